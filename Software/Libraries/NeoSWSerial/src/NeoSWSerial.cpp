@@ -54,6 +54,8 @@ static const uint8_t BITS_PER_TICK_38400_Q10 = 157;
   #else
     #define TCNTX TCNT2
     #define PCI_FLAG_REGISTER PCIFR
+    // Timer 2 compare A clocks out transmitted bits
+    #define NEOSWSERIAL_TX_ISR
   #endif
 #endif
 
@@ -77,6 +79,54 @@ static uint8_t rxTail;   // buffer pointer output
 static          uint8_t rxBitMask, txBitMask; // port bit masks
 static volatile uint8_t *txPort;  // port register
 
+#ifdef NEOSWSERIAL_TX_ISR
+
+  // Interrupt-driven transmission: write() queues characters and the
+  // timer 2 compare A ISR sets the TX line for each bit, advancing the
+  // compare register by one bit width.  Interrupts are only masked
+  // for the few microseconds of each ISR call.
+
+  static const uint8_t TX_BUFFER_SIZE = 16;  // power of 2 for optimal speed
+  static volatile uint8_t txBuffer[TX_BUFFER_SIZE];
+  static volatile uint8_t txHead;    // buffer pointer input
+  static volatile uint8_t txTail;    // buffer pointer output
+  static volatile uint8_t txBit;     // next bit: 0 start, 1-8 data, 9 stop
+  static volatile uint8_t txValue;   // remaining bits of character being sent
+  static volatile bool    txActive;  // compare ISR running
+
+  static const uint8_t TX_BIT_DONE = 10;  // stop bit has ended
+
+  static void txISR();
+
+#endif
+
+#ifdef NEOSWSERIAL_ICP
+
+  // Input capture receive mode.  Timer 1 runs free at F_CPU/8; the
+  // capture ISR queues each edge's time stamp (extended to 32 bits
+  // with a count of timer wraps) and the line level after the edge.
+  // Characters are decoded from the queue outside of the ISR.
+
+  struct capture_t { uint16_t lo; uint16_t hi; uint8_t level; };
+
+  static const uint8_t CAPTURE_QUEUE_SIZE = 32; // power of 2; ~3 chars of edges
+  static volatile capture_t captureQueue[CAPTURE_QUEUE_SIZE];
+  static volatile uint8_t   captureHead;  // queue input (ISR)
+  static volatile uint8_t   captureTail;  // queue output (decoder)
+  static volatile uint16_t  captureWraps; // timer 1 wraps (compare B ISR)
+  static          bool      captureMode;  // listener is receiving via ICP1
+
+  static uint16_t captureBitTicks; // bit width in timer 1 ticks
+  static uint8_t  captureBit;      // bits of frame received (start=0); 0xFF idle
+  static uint8_t  captureValue;    // character being built
+  static uint8_t  captureLevel;    // line level after last edge
+  static uint32_t captureLast;     // time of last edge
+
+  static const uint8_t CAPTURE_IDLE = 0xFF;
+  static const uint8_t CAPTURE_FRAME_BITS = 9; // start + 8 data bits
+
+#endif
+
 //#define DEBUG_NEOSWSERIAL
 #ifdef DEBUG_NEOSWSERIAL
 
@@ -132,6 +182,9 @@ void NeoSWSerial::begin(uint16_t baudRate)
 
 void NeoSWSerial::listen()
 {
+  // Finish any transmission on the current pins first
+  flush();
+
   if (listener)
     listener->ignore();
 
@@ -157,40 +210,67 @@ void NeoSWSerial::listen()
     #endif
   }
 
+  // Set up timings based on baud rate
+  
+  switch (_baudRate) {
+    case 9600:
+      txBitWidth      = TICKS_PER_BIT_9600          ;
+      bitsPerTick_Q10 = BITS_PER_TICK_38400_Q10 >> 2;
+      rxWindowWidth   = 10;
+      break;
+    case 31250:
+      if (F_CPU > 12000000L) {
+        txBitWidth = TICKS_PER_BIT_31250;
+        bitsPerTick_Q10 = BITS_PER_TICK_31250_Q10;
+        rxWindowWidth = 5;
+        break;
+      } // else use 19200
+    case 38400:
+      if (F_CPU > 12000000L) {
+        txBitWidth      = TICKS_PER_BIT_9600    >> 2;
+        bitsPerTick_Q10 = BITS_PER_TICK_38400_Q10   ;
+        rxWindowWidth   = 4;
+        break;
+      } // else use 19200
+    case 19200:
+      txBitWidth      = TICKS_PER_BIT_9600      >> 1;
+      bitsPerTick_Q10 = BITS_PER_TICK_38400_Q10 >> 1;
+      rxWindowWidth   = 6;
+      break;
+  }
+
+  #ifdef NEOSWSERIAL_ICP
+    if (isCapturePin()) {
+      rxState = WAITING_FOR_START_BIT;  // not used by this mode
+      rxHead  = rxTail = 0;             // no characters in buffer
+      captureBit      = CAPTURE_IDLE;
+      captureBitTicks = (F_CPU/8 + _baudRate/2) / _baudRate;
+
+      uint8_t prevSREG = SREG;
+      cli();
+      {
+        // Timer 1 free-running (normal mode) at F_CPU/8, with the
+        // noise canceler on and the falling edge (start bit) armed.
+        // The compare B match at TOP counts timer wraps: its flag
+        // is set on the same tick the counter wraps to zero.
+        TCCR1A = 0;
+        TCCR1B = _BV(ICNC1) | _BV(CS11);
+        OCR1B  = 0xFFFF;
+        captureHead = captureTail = 0;
+        TIFR1  = _BV(ICF1) | _BV(OCF1B);
+        TIMSK1 |= _BV(ICIE1) | _BV(OCIE1B);
+        captureMode = true;
+        listener = this;
+      }
+      SREG = prevSREG;
+      return;
+    }
+  #endif
+
   volatile uint8_t *pcmsk = digitalPinToPCMSK(rxPin);
   if (pcmsk) {
     rxState  = WAITING_FOR_START_BIT;
     rxHead   = rxTail = 0;    // no characters in buffer
-    flush();
-
-    // Set up timings based on baud rate
-    
-    switch (_baudRate) {
-      case 9600:
-        txBitWidth      = TICKS_PER_BIT_9600          ;
-        bitsPerTick_Q10 = BITS_PER_TICK_38400_Q10 >> 2;
-        rxWindowWidth   = 10;
-        break;
-      case 31250:
-        if (F_CPU > 12000000L) {
-          txBitWidth = TICKS_PER_BIT_31250;
-          bitsPerTick_Q10 = BITS_PER_TICK_31250_Q10;
-          rxWindowWidth = 5;
-          break;
-        } // else use 19200
-      case 38400:
-        if (F_CPU > 12000000L) {
-          txBitWidth      = TICKS_PER_BIT_9600    >> 2;
-          bitsPerTick_Q10 = BITS_PER_TICK_38400_Q10   ;
-          rxWindowWidth   = 4;
-          break;
-        } // else use 19200
-      case 19200:
-        txBitWidth      = TICKS_PER_BIT_9600      >> 1;
-        bitsPerTick_Q10 = BITS_PER_TICK_38400_Q10 >> 1;
-        rxWindowWidth   = 6;
-        break;
-    }
 
     // Enable the pin change interrupts
 
@@ -210,6 +290,21 @@ void NeoSWSerial::listen()
 
 void NeoSWSerial::ignore()
 {
+  #ifdef NEOSWSERIAL_ICP
+    if (listener && captureMode) {
+      uint8_t prevSREG = SREG;
+      cli();
+      {
+        // Leave timer 1 running for any other users
+        TIMSK1 &= ~(_BV(ICIE1) | _BV(OCIE1B));
+        captureMode = false;
+        listener = (NeoSWSerial *) NULL;
+      }
+      SREG = prevSREG;
+      return;
+    }
+  #endif
+
   if (listener) {
     volatile uint8_t *pcmsk = digitalPinToPCMSK(rxPin);
 
@@ -251,6 +346,13 @@ void NeoSWSerial::setBaudRate(uint16_t baudRate)
 
 int NeoSWSerial::available()
 {
+  #ifdef NEOSWSERIAL_ICP
+    if (captureMode) {
+      decodeCaptures();
+      return ((rxHead - rxTail + RX_BUFFER_SIZE) % RX_BUFFER_SIZE);
+    }
+  #endif
+
   uint8_t avail = ((rxHead - rxTail + RX_BUFFER_SIZE) % RX_BUFFER_SIZE);
   
   if (avail == 0) {
@@ -270,6 +372,11 @@ int NeoSWSerial::available()
 
 int NeoSWSerial::read()
 {
+  #ifdef NEOSWSERIAL_ICP
+    if (captureMode && (rxHead == rxTail))
+      decodeCaptures();
+  #endif
+
   if (rxHead == rxTail) return -1;
   uint8_t c = rxBuffer[rxTail];
   rxTail = (rxTail + 1) % RX_BUFFER_SIZE;
@@ -424,6 +531,142 @@ void NeoSWSerial::rxChar( uint8_t c )
 
 //----------------------------------------------------------------------------
 
+#ifdef NEOSWSERIAL_ICP
+
+bool NeoSWSerial::isCapturePin() const
+{
+  volatile uint8_t *pin = portInputRegister( digitalPinToPort( rxPin ) );
+  uint8_t mask = digitalPinToBitMask( rxPin );
+
+  #if defined(__AVR_AT90USB1286__) | \
+      defined(__AVR_ATmega32U4__)
+    return (pin == &PIND) && (mask == _BV(4));
+  #elif defined(__AVR_ATmega328P__)
+    return (pin == &PINB) && (mask == _BV(0));
+  #else
+    return false;
+  #endif
+
+} // isCapturePin
+
+//..........................................
+// Queue the captured edge.  Also called with interrupts disabled by
+// write() when the capture flag is found set.
+
+void NeoSWSerial::captureISR()
+{
+  uint16_t lo    = ICR1;
+  uint8_t  level = (TCCR1B & _BV(ICES1)) ? 1 : 0;
+
+  TCCR1B ^= _BV(ICES1);  // arm the opposite edge...
+  TIFR1   = _BV(ICF1);   // ...which can set the flag spuriously
+
+  // A wrap not yet counted (its ISR is pending) belongs to this
+  // edge if the capture is early in the timer cycle.
+  uint16_t hi = captureWraps;
+  if ((TIFR1 & _BV(OCF1B)) && (lo < 0x8000))
+    hi++;
+
+  uint8_t index = (captureHead + 1) % CAPTURE_QUEUE_SIZE;
+  if (index != captureTail) {
+    captureQueue[captureHead].lo    = lo;
+    captureQueue[captureHead].hi    = hi;
+    captureQueue[captureHead].level = level;
+    captureHead = index;
+  }
+  // else the edge is lost: the character will be garbled
+
+} // captureISR
+
+//..........................................
+// Add n bit periods at the given level to the frame
+
+static void captureBits( uint8_t level, uint32_t n )
+{
+  while ((n-- > 0) && (captureBit < CAPTURE_FRAME_BITS)) {
+    if (level && (captureBit > 0))
+      captureValue |= (1 << (captureBit-1));
+    captureBit++;
+  }
+
+} // captureBits
+
+//..........................................
+// Decode queued edges into characters.  A character ending in 1 bits
+// has no final edge, so it is completed once enough time has passed.
+
+void NeoSWSerial::decodeCaptures()
+{
+  // Current time, read before emptying the queue so any earlier
+  // edge is already there (unless its capture is still pending).
+  uint8_t prevSREG = SREG;
+  cli();
+    uint16_t lo      = TCNT1;
+    uint16_t hi      = captureWraps;
+    if ((TIFR1 & _BV(OCF1B)) && (lo < 0x8000))
+      hi++;
+    bool     pending = (TIFR1 & _BV(ICF1));
+  SREG = prevSREG;
+  uint32_t now = ((uint32_t) hi << 16) | lo;
+
+  while (captureTail != captureHead) {
+    volatile capture_t &c = captureQueue[captureTail];
+    uint32_t t     = ((uint32_t) c.hi << 16) | c.lo;
+    uint8_t  level = c.level;
+    captureTail = (captureTail + 1) % CAPTURE_QUEUE_SIZE;
+
+    if (captureBit == CAPTURE_IDLE) {
+      if (level == 0) {  // start bit
+        captureBit   = 0;
+        captureValue = 0;
+      }
+    } else {
+      // The previous level lasted since the last edge
+      captureBits( !level, (t - captureLast + captureBitTicks/2) / captureBitTicks );
+      if (captureBit >= CAPTURE_FRAME_BITS) {
+        rxChar( captureValue );
+        if (level == 0) {  // start bit of the next character
+          captureBit   = 0;
+          captureValue = 0;
+        } else {
+          captureBit   = CAPTURE_IDLE;
+        }
+      }
+    }
+    captureLevel = level;
+    captureLast  = t;
+  }
+
+  if ((captureBit != CAPTURE_IDLE) && (captureLevel == 1) && !pending) {
+    // Ended on a 1, see if the remaining data bits have passed
+    uint8_t bitsLeft = CAPTURE_FRAME_BITS - captureBit;
+    if (now - captureLast > (uint32_t) bitsLeft * captureBitTicks - captureBitTicks/2) {
+      captureBits( 1, bitsLeft );
+      rxChar( captureValue );
+      captureBit = CAPTURE_IDLE;
+    }
+  }
+
+} // decodeCaptures
+
+//..........................................
+
+extern "C" {
+ISR(TIMER1_CAPT_vect)
+{
+  NeoSWSerial::captureISR();
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+  captureWraps++;
+}
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+
 #ifdef NEOSWSERIAL_EXTERNAL_PCINT
 
   // Client code must call NeoSWSerial::rxISR(PINB) in PCINT handler
@@ -513,6 +756,104 @@ void NeoSWSerial::rxChar( uint8_t c )
 
 #endif
 
+#ifdef NEOSWSERIAL_TX_ISR
+
+//-----------------------------------------------------------------------------
+// Characters are queued and clocked out by the timer 2 compare A ISR,
+// so write() returns immediately unless the TX buffer is full.
+
+// Service a pending compare match when interrupts are disabled (the
+// ISR cannot run), so waiting on the ISR cannot deadlock.
+
+static void txPoll()
+{
+  if (!(SREG & _BV(SREG_I)) && (TIFR2 & _BV(OCF2A))) {
+    TIFR2 = _BV(OCF2A);
+    txISR();
+  }
+}
+
+//..........................................
+
+static void txISR()
+{
+  if (txBit == TX_BIT_DONE) {
+    if (txHead == txTail) {  // nothing more to send
+      TIMSK2  &= ~_BV(OCIE2A);
+      txActive = false;
+      return;
+    }
+    txBit = 0;
+  }
+
+  if (txBit == 0) {          // start bit is low
+    txValue = txBuffer[txTail];
+    txTail  = (txTail + 1) % TX_BUFFER_SIZE;
+    *txPort &= ~txBitMask;
+  } else if (txBit < 9) {    // data bits, lsb first
+    if (txValue & 0x01)
+      *txPort |= txBitMask;
+    else
+      *txPort &= ~txBitMask;
+    txValue = txValue >> 1;
+  } else {                   // stop bit is high
+    *txPort |= txBitMask;
+  }
+
+  txBit++;
+  OCR2A += txBitWidth;       // relative to the scheduled (not actual) time
+
+} // txISR
+
+//..........................................
+
+size_t NeoSWSerial::write(uint8_t txChar)
+{
+  if (!txPort)
+    return 0;
+
+  uint8_t index = (txHead + 1) % TX_BUFFER_SIZE;
+  while (index == txTail)    // buffer full: wait for the ISR
+    txPoll();
+
+  uint8_t prevSREG = SREG;
+  cli();
+    txBuffer[txHead] = txChar;
+    txHead = index;
+    if (!txActive) {
+      // Start bit on a following tick
+      txActive = true;
+      txBit    = TX_BIT_DONE;
+      OCR2A    = TCNTX + 2;
+      TIFR2    = _BV(OCF2A);
+      TIMSK2  |= _BV(OCIE2A);
+    }
+  SREG = prevSREG;
+
+  return 1;               // 1 character queued
+
+} // write
+
+//..........................................
+
+void NeoSWSerial::flush()
+{
+  while (txActive)
+    txPoll();
+
+} // flush
+
+//..........................................
+
+extern "C" {
+ISR(TIMER2_COMPA_vect)
+{
+  txISR();
+}
+}
+
+#else
+
 //-----------------------------------------------------------------------------
 // Instead of using a TX buffer and interrupt
 // service, the transmit function is a simple timer0 based delay loop.
@@ -558,6 +899,11 @@ size_t NeoSWSerial::write(uint8_t txChar)
 
       while ((uint8_t)(TCNTX - t0) < width) {
         // Receive interrupt pending?
+        #ifdef NEOSWSERIAL_ICP
+          if (TIFR1 & _BV(ICF1)) {
+            captureISR();  // edge captured; queue it
+          } else
+        #endif
         if (PCI_FLAG_REGISTER & PCIbit) {
           PCI_FLAG_REGISTER |= PCIbit;   // clear it because...
           rxISR( *rxPort );  // ... this handles it
@@ -582,3 +928,13 @@ size_t NeoSWSerial::write(uint8_t txChar)
   return 1;               // 1 character sent
 
 } // write
+
+//..........................................
+
+void NeoSWSerial::flush()
+{
+  // write() returns once the character is sent
+
+} // flush
+
+#endif
@@ -29,7 +29,10 @@
 // allowed by digitalPinToPCMSK in pins_arduino.h
 //
 // This code uses a pin change interrupt on the selected RX pin.
-// Transmission on the TX line is done in a loop with interrupts disabled.
+// Transmission on the TX line is done in a loop with interrupts disabled,
+// except on 8 MHz systems, where characters are queued and the bits are
+// clocked out by a timer 2 compare A interrupt (write() returns at once;
+// flush() waits for the queue to empty).
 // Both RX and TX read timer0 for determining elapsed time. Timer0 itself is
 // not reprogrammed; it is assumed to be running with a 4 microsecond step.
 //
@@ -39,6 +42,17 @@
 // In such case client code should call NeoSWSerial::rxISR(PINB) (assuming
 // that receivePin is on PORT B)
 //
+// Alternatively, if the RX pin is the input capture pin of timer 1 (ICP1:
+// PD4 on the AT90USB1286/ATmega32U4, PB0 on the ATmega328P) and the library
+// is built with #define NEOSWSERIAL_ICP, edge times are latched in hardware
+// by the timer's input capture unit.  The capture ISR only queues the edge
+// time stamps; characters are decoded from that queue by available() and
+// read().  Reception then tolerates interrupt latencies of up to about one
+// bit time (~100 us at 9600 baud) instead of a few microseconds.  Timer 1
+// is run free (normal mode, clock/8) and its capture and compare B
+// interrupts are used; compare channel A is left for the application, but
+// the timer cannot also be used by e.g. TimerOne.
+//
 // Supported baud rates are 9600 (default), 19200 and 38400.
 // The baud rate is selectable at run time.
 //
@@ -58,6 +72,9 @@
 // v2.2   Mar 2017 Dionorgua - Add option to disable pre-defined PCINT ISRs.
 // v2.3   Mar 2017 SlashDev  - Add GPL
 // v3.0.0 May 2017 SlashDev  - Convert to new Arduino IDE library
+//        2019 PODD          - Add input capture receive mode
+
+//#define NEOSWSERIAL_ICP // uncomment to receive via timer 1 input capture
 
 class NeoSWSerial : public Stream
 {
@@ -81,7 +98,7 @@ public:
   virtual size_t write(uint8_t txChar);
   using Stream::write; // make the base class overloads visible
   virtual int    peek() { return 0; };
-  virtual void   flush() {};
+  virtual void   flush();                         // wait for transmission to finish
           void   end() { ignore(); }
 
   typedef void (* isr_t)( uint8_t );
@@ -101,9 +118,17 @@ private:
 
   static void startChar();
 
+  #ifdef NEOSWSERIAL_ICP
+    bool isCapturePin() const;
+    static void decodeCaptures();
+  #endif
+
 public:
   // visible only so the ISRs can call it...
   static void rxISR( uint8_t port_input_register );
+  #ifdef NEOSWSERIAL_ICP
+    static void captureISR();
+  #endif
 
   //#define NEOSWSERIAL_EXTERNAL_PCINT // uncomment to use your own PCINT ISRs
 };
@@ -146,59 +146,46 @@ int year(time_t t) { // the year for the given time
 // leap year calulator expects year argument as years offset from 1970
 #define LEAP_YEAR(Y)     ( ((1970+Y)>0) && !((1970+Y)%4) && ( ((1970+Y)%100) || !((1970+Y)%400) ) )
 
-static  const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31}; // API starts months from 1, this array starts from 0
+static  const uint16_t monthStart[]={0,0,31,59,90,120,151,181,212,243,273,304,334}; // days before the first of each month, API starts months from 1
  
 void breakTime(time_t timeInput, tmElements_t &tm){
 // break the given time_t into time components
 // this is a more compact version of the C library localtime function
 // note that year is offset from 1970 !!!
+// the date is found directly from the day count (no stepping through the
+// years and months), using 16-bit arithmetic after the first division
 
-  uint8_t year;
-  uint8_t month, monthLength;
+  uint8_t month;
+  uint16_t days, cycle, year;
+  uint16_t secs;
   uint32_t time;
-  unsigned long days;
 
   time = (uint32_t)timeInput;
-  tm.Second = time % 60;
-  time /= 60; // now it is minutes
-  tm.Minute = time % 60;
-  time /= 60; // now it is hours
-  tm.Hour = time % 24;
-  time /= 24; // now it is days
-  tm.Wday = ((time + 4) % 7) + 1;  // Sunday is day 1 
-  
-  year = 0;  
-  days = 0;
-  while((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time) {
+  days = time / SECS_PER_DAY;
+  time -= days * SECS_PER_DAY; // now it is seconds in this day
+  tm.Hour = (uint16_t)(time >> 4) / 225;  // 3600 = 16*225, and fits 16 bits after the shift
+  secs = time - tm.Hour * SECS_PER_HOUR;
+  tm.Minute = secs / 60;
+  tm.Second = secs % 60;
+  tm.Wday = ((days + 4) % 7) + 1;  // Sunday is day 1 
+
+  // count days from 1 mar 1968, so that every leap day falls at the end of a
+  // four year cycle; 2100 is the only year in range that is not a leap year,
+  // so from 1 mar 2100 on skip the 29 feb it would have had
+  days += 671 + (days >= 47541);
+  cycle = days / 1461;
+  days -= cycle * 1461;   // now it is days in the cycle, 0-1460
+  year = (days - (days == 1460)) / 365;
+  days -= year * 365;     // now it is days since 1 mar, 0-365
+  month = (5 * days + 2) / 153;  // months since march, 0-11
+  tm.Day = days - (153 * month + 2) / 5 + 1;  // day of month
+  if (month < 10) {
+    tm.Month = month + 3;
+  } else {
+    tm.Month = month - 9;  // jan and feb are in the next year
     year++;
   }
-  tm.Year = year; // year is offset from 1970 
-  
-  days -= LEAP_YEAR(year) ? 366 : 365;
-  time  -= days; // now it is days in this year, starting at 0
-  
-  days=0;
-  month=0;
-  monthLength=0;
-  for (month=0; month<12; month++) {
-    if (month==1) { // february
-      if (LEAP_YEAR(year)) {
-        monthLength=29;
-      } else {
-        monthLength=28;
-      }
-    } else {
-      monthLength = monthDays[month];
-    }
-    
-    if (time >= monthLength) {
-      time -= monthLength;
-    } else {
-        break;
-    }
-  }
-  tm.Month = month + 1;  // jan is month 1  
-  tm.Day = time + 1;     // day of month
+  tm.Year = cycle * 4 + year - 2; // year is offset from 1970 
 }
 
 time_t makeTime(tmElements_t &tm){   
@@ -206,26 +193,22 @@ time_t makeTime(tmElements_t &tm){
 // note year argument is offset from 1970 (see macros in time.h to convert to other formats)
 // previous version used full four digit year (or digits since 2000),i.e. 2009 was 2009 or 9
   
-  int i;
+  uint16_t year = tm.Year;
+  uint32_t days;
   uint32_t seconds;
 
-  // seconds from 1970 till 1 jan 00:00:00 of the given year
-  seconds= tm.Year*(SECS_PER_DAY * 365);
-  for (i = 0; i < tm.Year; i++) {
-    if (LEAP_YEAR(i)) {
-      seconds +=  SECS_PER_DAY;   // add extra days for leap years
-    }
-  }
+  // days from 1970 till 1 jan of the given year, with one extra day for
+  // each leap year passed (every 4th year, except centuries not divisible
+  // by 400)
+  days = year * 365UL + (year + 1) / 4 - (year + 69) / 100 + (year + 369) / 400;
   
   // add days for this year, months start from 1
-  for (i = 1; i < tm.Month; i++) {
-    if ( (i == 2) && LEAP_YEAR(tm.Year)) { 
-      seconds += SECS_PER_DAY * 29;
-    } else {
-      seconds += SECS_PER_DAY * monthDays[i-1];  //monthDay array starts from 0
-    }
+  days += monthStart[tm.Month];
+  if ((tm.Month > 2) && LEAP_YEAR(tm.Year)) {
+    days++;
   }
-  seconds+= (tm.Day-1) * SECS_PER_DAY;
+  days += tm.Day - 1;
+  seconds= days * SECS_PER_DAY;
   seconds+= tm.Hour * SECS_PER_HOUR;
   seconds+= tm.Minute * SECS_PER_MIN;
   seconds+= tm.Second;
@@ -29,9 +29,11 @@
 
 AlarmClass::AlarmClass()
 {
-  Mode.isEnabled = Mode.isOneShot = 0;
+  Mode.isEnabled = Mode.isOneShot = Mode.isMillis = 0;
   Mode.alarmType = dtNotAllocated;
   value = nextTrigger = 0;
+  due = 0;
+  heapPos = dtNOT_SCHEDULED;
   onTickHandler = NULL;  // prevent a callback until this pointer is explicitly set
 }
 
@@ -73,7 +75,8 @@ void AlarmClass::updateNextTrigger()
     }
     if (Mode.alarmType == dtTimer) {
       // its a timer
-      nextTrigger = time + value;  // add the value to previous time (this ensures delay always at least Value seconds)
+      // (only for reference: timers are scheduled on millis(), see TimeAlarmsClass::serviceAlarms())
+      nextTrigger = time + (Mode.isMillis ? value / 1000 : value);  // add the value to previous time (this ensures delay always at least Value seconds)
     }
   }
 }
@@ -81,25 +84,43 @@ void AlarmClass::updateNextTrigger()
 //**************************************************************
 //* Time Alarms Public Methods
 
-TimeAlarmsClass::TimeAlarmsClass()
+// returns the interval of the given timer in milliseconds, or 0 if too long for millis()
+static uint32_t timerMillis(const AlarmClass &alarm)
 {
-  isServicing = false;
-  for(uint8_t id = 0; id < dtNBR_ALARMS; id++) {
-    free(id);   // ensure all Alarms are cleared and available for allocation
+  if (alarm.Mode.isMillis) {
+    return ((uint32_t)alarm.value <= dtMAX_TIMER_MILLIS) ? (uint32_t)alarm.value : 0;
   }
+  return (alarm.value > 0 && alarm.value <= (time_t)(dtMAX_TIMER_MILLIS / 1000)) ? (uint32_t)alarm.value * 1000UL : 0;
+}
+
+// the alarms and schedule are held by TimeAlarmsPool (and constructed after this)
+TimeAlarmsClass::TimeAlarmsClass(AlarmClass *alarms, uint8_t *heapStorage, uint8_t n)
+  : Alarm(alarms), heap(heapStorage), capacity(n), heapSize(0)
+{
+  isServicing = false;
+  servicedAlarmId = dtINVALID_ALARM_ID;
 }
 
 void TimeAlarmsClass::enable(AlarmID_t ID)
 {
   if (isAllocated(ID)) {
-    if (( !(dtUseAbsoluteValue(Alarm[ID].Mode.alarmType) && (Alarm[ID].value == 0)) ) && (Alarm[ID].onTickHandler != NULL)) {
+    if (( !(dtUseAbsoluteValue(Alarm[ID].Mode.alarmType) && (Alarm[ID].value == 0)) ) && (Alarm[ID].onTickHandler != NULL)
+        && !(Alarm[ID].Mode.alarmType == dtTimer && timerMillis(Alarm[ID]) == 0)) {
       // only enable if value is non zero and a tick handler has been set
       // (is not NULL, value is non zero ONLY for dtTimer & dtExplicitAlarm
       // (the rest can have 0 to account for midnight))
       Alarm[ID].Mode.isEnabled = true;
       Alarm[ID].updateNextTrigger(); // trigger is updated whenever  this is called, even if already enabled
+      if (Alarm[ID].Mode.alarmType == dtTimer) {
+        schedule(ID, millis() + timerMillis(Alarm[ID]));
+      } else if (Alarm[ID].Mode.isEnabled) {
+        schedule(ID, millis() + clockDelay(Alarm[ID].nextTrigger));
+      } else {
+        unschedule(ID);
+      }
     } else {
       Alarm[ID].Mode.isEnabled = false;
+      unschedule(ID);
     }
   }
 }
@@ -108,6 +129,15 @@ void TimeAlarmsClass::disable(AlarmID_t ID)
 {
   if (isAllocated(ID)) {
     Alarm[ID].Mode.isEnabled = false;
+    unschedule(ID);
+  }
+}
+
+// delay the next trigger of the given timer (later ones follow on from it)
+void TimeAlarmsClass::postpone(AlarmID_t ID, uint32_t ms)
+{
+  if (isAllocated(ID) && Alarm[ID].Mode.alarmType == dtTimer && Alarm[ID].heapPos != dtNOT_SCHEDULED) {
+    schedule(ID, Alarm[ID].due + ms);
   }
 }
 
@@ -144,6 +174,7 @@ dtAlarmPeriod_t TimeAlarmsClass::readType(AlarmID_t ID) const
 void TimeAlarmsClass::free(AlarmID_t ID)
 {
   if (isAllocated(ID)) {
+    unschedule(ID);
     Alarm[ID].Mode.isEnabled = false;
     Alarm[ID].Mode.alarmType = dtNotAllocated;
     Alarm[ID].onTickHandler = NULL;
@@ -156,7 +187,7 @@ void TimeAlarmsClass::free(AlarmID_t ID)
 uint8_t TimeAlarmsClass::count() const
 {
   uint8_t c = 0;
-  for(uint8_t id = 0; id < dtNBR_ALARMS; id++) {
+  for(uint8_t id = 0; id < capacity; id++) {
     if (isAllocated(id)) c++;
   }
   return c;
@@ -171,7 +202,7 @@ bool TimeAlarmsClass::isAlarm(AlarmID_t ID) const
 // returns true if this id is allocated
 bool TimeAlarmsClass::isAllocated(AlarmID_t ID) const
 {
-  return (ID < dtNBR_ALARMS && Alarm[ID].Mode.alarmType != dtNotAllocated);
+  return (ID < capacity && Alarm[ID].Mode.alarmType != dtNotAllocated);
 }
 
 // returns the currently triggered alarm id
@@ -195,6 +226,21 @@ void TimeAlarmsClass::delay(unsigned long ms)
   } while (millis() - start  <= ms);
 }
 
+void TimeAlarmsClass::service()
+{
+  serviceAlarms();
+}
+
+// for idling until there is something to do: the alarm due soonest is
+// the first in the schedule (this may be a time of day alarm being
+// checked against the clock, so can be early)
+uint32_t TimeAlarmsClass::millisToNextTrigger() const
+{
+  if (heapSize == 0) return 0xFFFFFFFFUL;
+  int32_t dt = (int32_t)(Alarm[heap[0]].due - millis());
+  return (dt > 0) ? (uint32_t)dt : 0;
+}
+
 void TimeAlarmsClass::waitForDigits( uint8_t Digits, dtUnits_t Units)
 {
   while (Digits != getDigitsNow(Units)) {
@@ -232,23 +278,121 @@ bool TimeAlarmsClass::getIsServicing() const
 
 void TimeAlarmsClass::serviceAlarms()
 {
-  if (!isServicing) {
-    isServicing = true;
-    for (servicedAlarmId = 0; servicedAlarmId < dtNBR_ALARMS; servicedAlarmId++) {
-      if (Alarm[servicedAlarmId].Mode.isEnabled && (now() >= Alarm[servicedAlarmId].nextTrigger)) {
-        OnTick_t TickHandler = Alarm[servicedAlarmId].onTickHandler;
-        if (Alarm[servicedAlarmId].Mode.isOneShot) {
-          free(servicedAlarmId);  // free the ID if mode is OnShot
-        } else {
-          Alarm[servicedAlarmId].updateNextTrigger();
-        }
-        if (TickHandler != NULL) {
-          (*TickHandler)();     // call the handler
-        }
+  // the usual case, nothing due, only needs a look at the first alarm
+  if (isServicing || heapSize == 0) return;
+  uint32_t ms = millis();
+  if ((int32_t)(ms - Alarm[heap[0]].due) < 0) return;
+
+  isServicing = true;
+  // alarms are rescheduled for after ms, so each triggers at most once here
+  while (heapSize > 0 && (int32_t)(ms - Alarm[heap[0]].due) >= 0) {
+    servicedAlarmId = heap[0];
+    AlarmClass &alarm = Alarm[servicedAlarmId];
+    if (dtIsAlarm(alarm.Mode.alarmType) && (now() < alarm.nextTrigger)) {
+      // time of day not reached yet: check again later
+      schedule(servicedAlarmId, ms + clockDelay(alarm.nextTrigger));
+      continue;
+    }
+    OnTick_t TickHandler = alarm.onTickHandler;
+    if (alarm.Mode.isOneShot) {
+      free(servicedAlarmId);  // free the ID if mode is OnShot
+    } else if (alarm.Mode.alarmType == dtTimer) {
+      // next interval follows on from this one, unless a whole interval behind
+      uint32_t interval = timerMillis(alarm);
+      uint32_t due = alarm.due + interval;
+      if ((int32_t)(ms - due) >= 0) due = ms + interval;
+      alarm.updateNextTrigger();
+      schedule(servicedAlarmId, due);
+    } else {
+      alarm.updateNextTrigger();
+      if (alarm.Mode.isEnabled) {
+        schedule(servicedAlarmId, ms + clockDelay(alarm.nextTrigger));
+      } else {
+        unschedule(servicedAlarmId);
       }
     }
-    isServicing = false;
+    if (TickHandler != NULL) {
+      (*TickHandler)();     // call the handler
+    }
+  }
+  isServicing = false;
+}
+
+// returns the approximate number of milliseconds until now() reaches the given time
+uint32_t TimeAlarmsClass::clockDelay(time_t trigger) const
+{
+  time_t time = now();
+  if (trigger <= time) return 0;
+  // look at the clock again at least once a minute (in case it is set), and
+  // every 20 ms through the last second, as now() only gives whole seconds
+  if (trigger - time > 60) return 60000UL;
+  return (trigger - time > 1) ? (uint32_t)(trigger - time - 1) * 1000UL : 20;
+}
+
+// adds the alarm to the schedule with the given due time, or moves it there
+void TimeAlarmsClass::schedule(AlarmID_t ID, uint32_t due)
+{
+  Alarm[ID].due = due;
+  if (Alarm[ID].heapPos == dtNOT_SCHEDULED) {
+    heapSet(heapSize++, ID);
+    siftUp(heapSize - 1);
+  } else {
+    siftUp(Alarm[ID].heapPos);
+    siftDown(Alarm[ID].heapPos);
+  }
+}
+
+// removes the alarm from the schedule
+void TimeAlarmsClass::unschedule(AlarmID_t ID)
+{
+  uint8_t pos = Alarm[ID].heapPos;
+  if (pos == dtNOT_SCHEDULED) return;
+  Alarm[ID].heapPos = dtNOT_SCHEDULED;
+  uint8_t last = heap[--heapSize];
+  if (pos < heapSize) {
+    // fill the gap with the last entry
+    heapSet(pos, last);
+    siftUp(pos);
+    siftDown(Alarm[last].heapPos);
+  }
+}
+
+// returns true if alarm a is due before alarm b (allowing for millis() wrapping)
+bool TimeAlarmsClass::before(uint8_t a, uint8_t b) const
+{
+  return (int32_t)(Alarm[a].due - Alarm[b].due) < 0;
+}
+
+void TimeAlarmsClass::heapSet(uint8_t pos, AlarmID_t ID)
+{
+  heap[pos] = ID;
+  Alarm[ID].heapPos = pos;
+}
+
+void TimeAlarmsClass::siftUp(uint8_t pos)
+{
+  AlarmID_t ID = heap[pos];
+  while (pos > 0) {
+    uint8_t parent = (pos - 1) / 2;
+    if (!before(ID, heap[parent])) break;
+    heapSet(pos, heap[parent]);
+    pos = parent;
+  }
+  heapSet(pos, ID);
+}
+
+void TimeAlarmsClass::siftDown(uint8_t pos)
+{
+  AlarmID_t ID = heap[pos];
+  for (;;) {
+    uint16_t child = 2 * (uint16_t)pos + 1;
+    if (child >= heapSize) break;
+    if (child + 1 < heapSize && before(heap[child + 1], heap[child])) child++;
+    if (!before(heap[child], ID)) break;
+    heapSet(pos, heap[child]);
+    pos = child;
   }
+  heapSet(pos, ID);
 }
 
 // returns the absolute time of the next scheduled alarm, or 0 if none
@@ -256,7 +400,7 @@ time_t TimeAlarmsClass::getNextTrigger() const
 {
   time_t nextTrigger = 0;
 
-  for (uint8_t id = 0; id < dtNBR_ALARMS; id++) {
+  for (uint8_t id = 0; id < capacity; id++) {
     if (isAllocated(id)) {
       if (nextTrigger == 0) {
         nextTrigger = Alarm[id].nextTrigger;
@@ -279,15 +423,16 @@ time_t TimeAlarmsClass::getNextTrigger(AlarmID_t ID) const
 }
 
 // attempt to create an alarm and return true if successful
-AlarmID_t TimeAlarmsClass::create(time_t value, OnTick_t onTickHandler, uint8_t isOneShot, dtAlarmPeriod_t alarmType)
+AlarmID_t TimeAlarmsClass::create(time_t value, OnTick_t onTickHandler, uint8_t isOneShot, dtAlarmPeriod_t alarmType, bool isMillis)
 {
   if ( ! ( (dtIsAlarm(alarmType) && now() < SECS_PER_YEAR) || (dtUseAbsoluteValue(alarmType) && (value == 0)) ) ) {
     // only create alarm ids if the time is at least Jan 1 1971
-    for (uint8_t id = 0; id < dtNBR_ALARMS; id++) {
+    for (uint8_t id = 0; id < capacity; id++) {
       if (Alarm[id].Mode.alarmType == dtNotAllocated) {
         // here if there is an Alarm id that is not allocated
         Alarm[id].onTickHandler = onTickHandler;
         Alarm[id].Mode.isOneShot = isOneShot;
+        Alarm[id].Mode.isMillis = isMillis;
         Alarm[id].Mode.alarmType = alarmType;
         Alarm[id].value = value;
         enable(id);
@@ -299,4 +444,4 @@ AlarmID_t TimeAlarmsClass::create(time_t value, OnTick_t onTickHandler, uint8_t
 }
 
 // make one instance for the user to use
-TimeAlarmsClass Alarm = TimeAlarmsClass() ;
+TimeAlarmsPool<dtNBR_ALARMS> Alarm;
@@ -6,11 +6,13 @@
 #include <Arduino.h>
 #include "TimeLib.h"
 
+// Capacity of the default Alarm instance.  Other capacities can be had by
+// declaring a TimeAlarmsPool<N> (see below).
 #if !defined(dtNBR_ALARMS )
 #if defined(__AVR__)
 //#define dtNBR_ALARMS 6   // max is 255
 // PODD modification: Need a larger number of timers.
-#define dtNBR_ALARMS 12  // max is 255
+#define dtNBR_ALARMS 16  // max is 254
 #elif defined(ESP8266)
 #define dtNBR_ALARMS 20  // for esp8266 chip - max is 255
 #else
@@ -35,6 +37,7 @@ typedef struct {
                                // or weekly alarm periods
   uint8_t isEnabled      :1 ;  // the timer is only actioned if isEnabled is true
   uint8_t isOneShot      :1 ;  // the timer will be de-allocated after trigger is processed
+  uint8_t isMillis       :1 ;  // timer value is in milliseconds rather than seconds
 } AlarmMode_t;
 
 // new time based alarms should be added just before dtLastAlarmType
@@ -56,6 +59,7 @@ typedef AlarmID_t AlarmId;  // Arduino friendly name
 
 #define dtINVALID_ALARM_ID 255
 #define dtINVALID_TIME     (time_t)(-1)
+#define dtMAX_TIMER_MILLIS 0x7FFFFFFFUL  // timers are scheduled on millis(), which wraps
 #define AlarmHMS(_hr_, _min_, _sec_) (_hr_ * SECS_PER_HOUR + _min_ * SECS_PER_MIN + _sec_)
 
 typedef void (*OnTick_t)();  // alarm callback function typedef
@@ -69,21 +73,44 @@ public:
   void updateNextTrigger();
   time_t value;
   time_t nextTrigger;
+  uint32_t due;        // millis() at which the alarm is next checked (scheduling key)
+  uint8_t heapPos;     // position in the schedule, or dtNOT_SCHEDULED
   AlarmMode_t Mode;
 };
 
+#define dtNOT_SCHEDULED 255
+
 // class containing the collection of alarms
+//
+// PODD modification: enabled alarms are kept in a binary min-heap ordered
+// by the millis() time at which each is next due, so serviceAlarms() only
+// has to look at the first entry when nothing is due, and scheduling an
+// alarm takes O(log n).  Timers run on millis() (and can be given in
+// milliseconds); time of day alarms are checked against now() when due.
+// The storage is supplied by TimeAlarmsPool<N>, which sets the capacity.
 class TimeAlarmsClass
 {
 private:
-  AlarmClass Alarm[dtNBR_ALARMS];
+  AlarmClass *Alarm;
+  uint8_t *heap;           // ids of the scheduled alarms, soonest first
+  uint8_t capacity;
+  uint8_t heapSize;
   void serviceAlarms();
   uint8_t isServicing;
   uint8_t servicedAlarmId; // the alarm currently being serviced
-  AlarmID_t create(time_t value, OnTick_t onTickHandler, uint8_t isOneShot, dtAlarmPeriod_t alarmType);
+  AlarmID_t create(time_t value, OnTick_t onTickHandler, uint8_t isOneShot, dtAlarmPeriod_t alarmType, bool isMillis = false);
+  void schedule(AlarmID_t ID, uint32_t due);
+  void unschedule(AlarmID_t ID);
+  bool before(uint8_t a, uint8_t b) const;
+  void heapSet(uint8_t pos, AlarmID_t ID);
+  void siftUp(uint8_t pos);
+  void siftDown(uint8_t pos);
+  uint32_t clockDelay(time_t trigger) const;
+
+protected:
+  TimeAlarmsClass(AlarmClass *alarms, uint8_t *heapStorage, uint8_t n);
 
 public:
-  TimeAlarmsClass();
   // functions to create alarms and timers
 
   // trigger once at the given time in the future
@@ -126,7 +153,7 @@ public:
 
   // trigger once after the given number of seconds
   AlarmID_t timerOnce(time_t value, OnTick_t onTickHandler) {
-    if (value <= 0) return dtINVALID_ALARM_ID;
+    if (value <= 0 || value > (time_t)(dtMAX_TIMER_MILLIS / 1000)) return dtINVALID_ALARM_ID;
     return create(value, onTickHandler, true, dtTimer);
   }
   AlarmID_t timerOnce(const int H, const int M, const int S, OnTick_t onTickHandler) {
@@ -135,14 +162,33 @@ public:
 
   // trigger at a regular interval
   AlarmID_t timerRepeat(time_t value, OnTick_t onTickHandler) {
-    if (value <= 0) return dtINVALID_ALARM_ID;
+    if (value <= 0 || value > (time_t)(dtMAX_TIMER_MILLIS / 1000)) return dtINVALID_ALARM_ID;
     return create(value, onTickHandler, false, dtTimer);
   }
   AlarmID_t timerRepeat(const int H,  const int M,  const int S, OnTick_t onTickHandler) {
     return timerRepeat(AlarmHMS(H,M,S), onTickHandler);
   }
+  // as above, with the triggers offset by the given phase (first trigger
+  // after the interval plus phaseMillis)
+  AlarmID_t timerRepeat(time_t value, OnTick_t onTickHandler, uint32_t phaseMillis) {
+    AlarmID_t ID = timerRepeat(value, onTickHandler);
+    postpone(ID, phaseMillis);
+    return ID;
+  }
+
+  // timers with the interval in milliseconds
+  AlarmID_t timerOnceMillis(uint32_t ms, OnTick_t onTickHandler) {
+    if (ms == 0 || ms > dtMAX_TIMER_MILLIS) return dtINVALID_ALARM_ID;
+    return create(ms, onTickHandler, true, dtTimer, true);
+  }
+  AlarmID_t timerRepeatMillis(uint32_t ms, OnTick_t onTickHandler) {
+    if (ms == 0 || ms > dtMAX_TIMER_MILLIS) return dtINVALID_ALARM_ID;
+    return create(ms, onTickHandler, false, dtTimer, true);
+  }
 
   void delay(unsigned long ms);
+  void service();                           // trigger any alarms that are due (without waiting)
+  uint32_t millisToNextTrigger() const;     // milliseconds until the next alarm is due (0 if now, 0xFFFFFFFF if none)
 
   // utility methods
   uint8_t getDigitsNow( dtUnits_t Units) const;         // returns the current digit value for the given time unit
@@ -152,6 +198,7 @@ public:
   // low level methods
   void enable(AlarmID_t ID);                // enable the alarm to trigger
   void disable(AlarmID_t ID);               // prevent the alarm from triggering
+  void postpone(AlarmID_t ID, uint32_t ms); // delay the next trigger of the timer by the given milliseconds
   AlarmID_t getTriggeredAlarmId() const;          // returns the currently triggered  alarm id
   bool getIsServicing() const;                    // returns isServicing
   void write(AlarmID_t ID, time_t value);   // write the value (and enable) the alarm with the given ID
@@ -159,6 +206,7 @@ public:
   dtAlarmPeriod_t readType(AlarmID_t ID) const;   // return the alarm type for the given alarm ID
 
   void free(AlarmID_t ID);                  // free the id to allow its reuse
+  uint8_t getCapacity() const {return capacity;}  // maximum number of alarms
 
 #ifndef USE_SPECIALIST_METHODS
 private:  // the following methods are for testing and are not documented as part of the standard library
@@ -170,7 +218,19 @@ private:  // the following methods are for testing and are not documented as par
   bool isAlarm(AlarmID_t ID) const;               // returns true if id is for a time based alarm, false if its a timer or not allocated
 };
 
-extern TimeAlarmsClass Alarm;  // make an instance for the user
+// collection of up to N alarms
+template <uint8_t N>
+class TimeAlarmsPool : public TimeAlarmsClass
+{
+private:
+  AlarmClass alarms[N];
+  uint8_t heapStorage[N];
+
+public:
+  TimeAlarmsPool() : TimeAlarmsClass(alarms, heapStorage, N) {}
+};
+
+extern TimeAlarmsPool<dtNBR_ALARMS> Alarm;  // make an instance for the user
 
 /*==============================================================================
  * MACROS
@@ -48,9 +48,6 @@ Timezone::Timezone(int address)
  *----------------------------------------------------------------------*/
 time_t Timezone::toLocal(time_t utc)
 {
-    // recalculate the time change points if needed
-    if (year(utc) != year(m_dstUTC)) calcTimeChanges(year(utc));
-
     if (utcIsDST(utc))
         return utc + m_dst.offset * SECS_PER_MIN;
     else
@@ -65,9 +62,6 @@ time_t Timezone::toLocal(time_t utc)
  *----------------------------------------------------------------------*/
 time_t Timezone::toLocal(time_t utc, TimeChangeRule **tcr)
 {
-    // recalculate the time change points if needed
-    if (year(utc) != year(m_dstUTC)) calcTimeChanges(year(utc));
-
     if (utcIsDST(utc)) {
         *tcr = &m_dst;
         return utc + m_dst.offset * SECS_PER_MIN;
@@ -105,9 +99,6 @@ time_t Timezone::toLocal(time_t utc, TimeChangeRule **tcr)
  *----------------------------------------------------------------------*/
 time_t Timezone::toUTC(time_t local)
 {
-    // recalculate the time change points if needed
-    if (year(local) != year(m_dstLoc)) calcTimeChanges(year(local));
-
     if (locIsDST(local))
         return local - m_dst.offset * SECS_PER_MIN;
     else
@@ -121,7 +112,7 @@ time_t Timezone::toUTC(time_t local)
 bool Timezone::utcIsDST(time_t utc)
 {
     // recalculate the time change points if needed
-    if (year(utc) != year(m_dstUTC)) calcTimeChanges(year(utc));
+    if (utc < m_yrStartUTC || utc >= m_yrEndUTC) calcTimeChanges(year(utc));
 
     if (m_stdUTC == m_dstUTC)       // daylight time not observed in this tz
         return false;
@@ -138,7 +129,7 @@ bool Timezone::utcIsDST(time_t utc)
 bool Timezone::locIsDST(time_t local)
 {
     // recalculate the time change points if needed
-    if (year(local) != year(m_dstLoc)) calcTimeChanges(year(local));
+    if (local < m_yrStartLoc || local >= m_yrEndLoc) calcTimeChanges(year(local));
 
     if (m_stdUTC == m_dstUTC)       // daylight time not observed in this tz
         return false;
@@ -148,6 +139,25 @@ bool Timezone::locIsDST(time_t local)
         return !(local >= m_stdLoc && local < m_dstLoc);
 }
 
+/*----------------------------------------------------------------------*
+ * Find the start of the year containing the given time, and of the     *
+ * following year.                                                      *
+ *----------------------------------------------------------------------*/
+static void yearBounds(time_t t, time_t &start, time_t &end)
+{
+    tmElements_t tm;
+    tm.Second = 0;
+    tm.Minute = 0;
+    tm.Hour = 0;
+    tm.Day = 1;
+    tm.Month = 1;
+    tm.Year = year(t) - 1970;
+    start = makeTime(tm);
+    tm.Year++;
+    end = makeTime(tm);
+    if (end < start) end = (time_t)0xFFFFFFFFUL;    // 2106: end of time_t range
+}
+
 /*----------------------------------------------------------------------*
  * Calculate the DST and standard time change points for the given      *
  * given year as local and UTC time_t values.                           *
@@ -158,6 +168,12 @@ void Timezone::calcTimeChanges(int yr)
     m_stdLoc = toTime_t(m_std, yr);
     m_dstUTC = m_dstLoc - m_std.offset * SECS_PER_MIN;
     m_stdUTC = m_stdLoc - m_dst.offset * SECS_PER_MIN;
+
+    // The change points are used for times in the same year as the DST
+    // start (usually the given year), so later conversions only need a
+    // range check rather than finding the year of the time
+    yearBounds(m_dstUTC, m_yrStartUTC, m_yrEndUTC);
+    yearBounds(m_dstLoc, m_yrStartLoc, m_yrEndLoc);
 }
 
 /*----------------------------------------------------------------------*
@@ -169,6 +185,10 @@ void Timezone::initTimeChanges()
     m_stdLoc = 0;
     m_dstUTC = 0;
     m_stdUTC = 0;
+    m_yrStartUTC = 0;   // empty ranges: calculate at the first conversion
+    m_yrEndUTC = 0;
+    m_yrStartLoc = 0;
+    m_yrEndLoc = 0;
 }
 
 /*----------------------------------------------------------------------*
@@ -57,5 +57,9 @@ class Timezone
         time_t m_stdUTC;        // std time start for given/current year, given in UTC
         time_t m_dstLoc;        // dst start for given/current year, given in local time
         time_t m_stdLoc;        // std time start for given/current year, given in local time
+        time_t m_yrStartUTC;    // start of the year of m_dstUTC (recalculate outside it)
+        time_t m_yrEndUTC;      // start of the following year
+        time_t m_yrStartLoc;    // start of the year of m_dstLoc
+        time_t m_yrEndLoc;      // start of the following year
 };
 #endif
@@ -42,6 +42,7 @@
 #include "pod_sensors.h"
 #include "pod_network.h"
 #include "pod_logging.h"
+#include "pod_power.h"
 
 //--------------------------------------------------------------------------------------------- [Default Configs and Variables]
 
@@ -53,6 +54,9 @@ void setup() {
   // Places string in flash memory rather than dynamic memory
   FType LINE = F("------------------------------------------------------------------------");
   
+  // Mark free RAM, to track how much is left (printMemoryStats())
+  paintFreeRAM();
+  
   // Time delay gives chance to connect a terminal after reset
   delay(5000);
   Serial.begin(9600);
@@ -211,6 +215,8 @@ void setup() {
     setupNetworkTimers();
   }
   
+  printMemoryStats();
+  
   // power optimizations
   // Sensor power handling is in setupSensorTimers()
   if(!getModeCoord()){
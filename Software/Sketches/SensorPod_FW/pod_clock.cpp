@@ -26,9 +26,11 @@
 ==============================================================================*/
 
 #include "pod_clock.h"
+#include "pod_config.h"
 #include "pod_eeprom.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <Time.h>
 #include <Timezone.h>
 #include <EEPROM.h>
@@ -43,6 +45,9 @@
 
 // SPI chip-select pin for RTC
 #define RTC_PIN_CS 17
+// RTC square-wave output (SQW/INT) pin: must be an external interrupt
+// pin (INT4).  The output is open-drain, so the internal pull-up is used.
+#define RTC_PIN_SQW PIN_E4
 // Minimum valid unix time (~ 2001-09-09)
 #define UTC_CUTOFF 1000000000ul
 
@@ -54,9 +59,23 @@ const uint16_t MONTH_DOLY[] = {0,31,60,91,121,152,182,213,244,274,305,335};
 // DS3234 RTC register addresses
 #define DS3234_TIME_ADDR 0x00
 #define DS3234_TIME_LEN 7
+#define DS3234_CONTROL_ADDR 0x0E
+#define DS3234_STATUS_ADDR 0x0F
+#define DS3234_AGING_ADDR 0x10
 #define DS3234_TEMP_ADDR 0x11
 #define DS3234_TEMP_LEN 2
 
+// DS3234 control register bits
+#define DS3234_CONTROL_INTCN 0x04  // 0: SQW/INT pin outputs square wave
+#define DS3234_CONTROL_RS 0x18     // square wave rate (00: 1 Hz)
+#define DS3234_CONTROL_CONV 0x20   // 1: start temperature conversion
+// DS3234 status register bits
+#define DS3234_STATUS_BSY 0x04     // 1: temperature conversion running
+
+// Maximum interval between square-wave ticks [ms].  If the square wave
+// stops (or is not connected), the time is read from the RTC instead.
+#define RTC_SQW_TIMEOUT 2500
+
 // SPI settings for RTC communication
 SPISettings rtcSPISettings(4000000, MSBFIRST, SPI_MODE3);
 
@@ -87,6 +106,71 @@ ClockConfig clockConfig {CLOCK_CONFIG_VERSION,"",""};
 Timezone timezone((TimeChangeRule){"PST",First,Sun,Nov,2,-480},
                   (TimeChangeRule){"PDT",Second,Sun,Mar,2,-420});
 
+// Current unix time, read from the RTC at startup (and whenever the time
+// is set) and then advanced by the RTC's 1 Hz square-wave interrupt, so
+// the time is available without SPI communication.  Only valid while
+// rtcSynced is set and ticks are arriving.
+volatile time_t rtcEpoch = 0;
+volatile bool rtcSynced = false;
+// Square-wave tick count and time [ms,us] of most recent tick.  The
+// tick time in microseconds gives the fraction of the current second.
+volatile uint8_t rtcTicks = 0;
+volatile unsigned long rtcTickMillis = 0;
+volatile unsigned long rtcTickMicros = 0;
+
+// Time to be set with sub-second precision (see setUTC(t,us)).  Writing
+// the RTC seconds register restarts its 1 Hz countdown, so the write is
+// made at a second boundary of the new time: serviceClock() waits out
+// the last CLOCK_SET_WINDOW [us] before that boundary, and otherwise
+// returns at once.
+#define CLOCK_SET_WINDOW 50000ul
+bool clockSetPending = false;
+time_t clockSetEpoch = 0;
+unsigned long clockSetMicros = 0;
+
+// RTC drift is estimated from the offsets found at each update from a
+// reference (syncUTC(): NTP server or coordinator broadcast).  A line
+// is fitted to the offsets the clock would have had without those
+// updates, taking a sample at most every CLOCK_DRIFT_SAMPLE_INTERVAL
+// [s].  Samples are only taken while the RTC square wave gives the
+// clock's milliseconds (see clockHasSubsecond()).  Once the samples
+// span CLOCK_DRIFT_MIN_SPAN [s] and the fitted drift has a standard
+// error under CLOCK_DRIFT_MAX_ERROR [ppb] (the offsets from clock
+// broadcasts jitter by ~10 ms, so this can take days), the DS3234
+// aging offset is adjusted to cancel the drift (CLOCK_AGING_PPB [ppb]
+// per step; higher values slow the oscillator) and the fit starts
+// over.  The aging offset register is battery-backed along with the
+// time.  The fit also starts over after CLOCK_DRIFT_MAX_SPAN [s], or
+// if the RTC temperature varies by more than CLOCK_DRIFT_TEMP_RANGE
+// [C], as the drift then mostly reflects the RTC's temperature
+// compensation rather than crystal aging.
+#define CLOCK_DRIFT_SAMPLE_INTERVAL 600
+#define CLOCK_DRIFT_MIN_SPAN 21600
+#define CLOCK_DRIFT_MAX_SPAN 604800
+#define CLOCK_DRIFT_TEMP_RANGE 5
+#define CLOCK_AGING_PPB 100
+#define CLOCK_DRIFT_MAX_ERROR 25
+struct ClockDrift {
+  bool started = false;
+  time_t start = 0;           // time of first sample
+  time_t last = 0;            // time of last sample
+  long corrected = 0;         // sum of offsets [ms] corrected since start
+  uint16_t n = 0;
+  float sx = 0, sy = 0;       // sums of sample times [h] and offsets [ms]
+  float sxx = 0, sxy = 0, syy = 0;
+  float tmin = 0, tmax = 0;   // RTC temperature range [C]
+} clockDrift;
+
+// Most recently formatted database date/time string, for the local time
+// dbDateTimeLocal.  Readings usually come in the same or the following
+// second, so the string is patched in place rather than rebuilt (see
+// formatDBDateTime()).  dbDateTimeDay is the local time at the start of
+// the day in the string.
+char dbDateTime[20] = "";
+time_t dbDateTimeLocal = 0;
+time_t dbDateTimeDay = 0;
+bool dbDateTimeValid = false;
+
 
 
 // General Time Functions ======================================================
@@ -96,9 +180,30 @@ Timezone timezone((TimeChangeRule){"PST",First,Sun,Nov,2,-480},
 void initRTC() {
   // Initialize communication with DS3234 RTC
   initDS3234();
+  #ifdef RTC_SQUARE_WAVE
+  // Start the 1 Hz square wave that keeps the cached time, and check
+  // that it arrives (the SQW jumper is fitted)
+  initDS3234SquareWave();
+  syncClock();
+  uint8_t ticks = rtcTicks;
+  unsigned long start = millis();
+  while ((rtcTicks == ticks) && (millis() - start < RTC_SQW_TIMEOUT)) {}
+  if (rtcTicks != ticks) {
+    Serial.println(F("  RTC square wave running."));
+  } else {
+    Serial.println(F("  Warning: No RTC square wave (check SQW jumper).  Time will be to the second."));
+  }
+  #else
+  syncClock();
+  #endif
   // Load local timezone from non-volatile memory if available
   // or set to default (Pacific).
   initTimezone();
+  // Time library (used by TimeAlarms) follows the same clock.  Syncing
+  // is cheap (no SPI) when the square wave is running, so resync every
+  // second to keep the two in step.
+  setSyncInterval(1);
+  setSyncProvider(getUTC);
 }
 
 
@@ -114,16 +219,271 @@ bool probeRTC() {
    at 00:00:00 UTC.  Backed by RTC.  As a safety measure, time will not be
    set if t < 1000000000 (~ 2001-09-09). */
 void setUTC(time_t t) {
+  clockSetPending = false;
+  resetClockDrift();
   setDS3234Time(t);
+  syncClock();
+}
+
+
+//------------------------------------------------------------------------------
+/* As above, but with sub-second precision: t is the unix time at the
+   moment micros() read us (which may have passed).  The RTC is written
+   at the next second boundary by serviceClock(), so this returns at
+   once; the time changes within a second. */
+void setUTC(time_t t, unsigned long us) {
+  if (t < UTC_CUTOFF) return;
+  clockSetEpoch = t;
+  clockSetMicros = us;
+  clockSetPending = true;
+}
+
+
+//------------------------------------------------------------------------------
+/* Offset [ms] of the given time from the clock: t is the unix time at
+   the moment micros() read us.  Limited to +/- 1000 s. */
+long getUTCOffset(time_t t, unsigned long us) {
+  uint16_t ms;
+  time_t t0 = getUTC(ms);
+  unsigned long elapsed = micros() - us;
+  long offset = (long)(t + elapsed / 1000000ul - t0);
+  if (offset <= -1000) return -1000000l;
+  if (offset >= 1000) return 1000000l;
+  return 1000 * offset + (long)(elapsed % 1000000ul / 1000) - ms;
+}
+
+
+//------------------------------------------------------------------------------
+/* Sets the time as setUTC(t,us) if it is off by at least minOffset
+   [ms], first recording the offset for drift estimation (see
+   updateClockDrift()).  Returns the offset [ms]. */
+long syncUTC(time_t t, unsigned long us, long minOffset) {
+  long offset = getUTCOffset(t, us);
+  // Offsets at the limit of getUTCOffset(), or without the clock's
+  // milliseconds, are not measurements
+  if (clockHasSubsecond() && (offset > -1000000l) && (offset < 1000000l)) {
+    updateClockDrift(t + (micros() - us) / 1000000ul, offset);
+  } else {
+    resetClockDrift();
+  }
+  if ((offset > -minOffset) && (offset < minOffset)) return offset;
+  setUTC(t, us);
+  clockDrift.corrected += offset;
+  return offset;
+}
+
+
+//------------------------------------------------------------------------------
+/* Discards the samples for drift estimation, as when the time is set
+   without measuring its offset. */
+void resetClockDrift() {
+  clockDrift.started = false;
+}
+
+
+//------------------------------------------------------------------------------
+/* Adds a sample to the drift fit: the clock is offset [ms] from the
+   reference at time t.  Adjusts the DS3234 aging offset once the
+   samples span long enough to give the drift. */
+void updateClockDrift(time_t t, long offset) {
+  ClockDrift &d = clockDrift;
+  if (d.started && (t - d.last < CLOCK_DRIFT_SAMPLE_INTERVAL)) return;
+  float temp = getDS3234Temperature();
+  if (d.started && ((t - d.start > CLOCK_DRIFT_MAX_SPAN)
+                    || (temp - d.tmin > CLOCK_DRIFT_TEMP_RANGE)
+                    || (d.tmax - temp > CLOCK_DRIFT_TEMP_RANGE))) {
+    d.started = false;
+  }
+  if (!d.started) {
+    d = ClockDrift();
+    d.started = true;
+    d.start = t;
+    d.tmin = temp;
+    d.tmax = temp;
+  }
+  
+  // Offset the clock would have without any corrections
+  float x = (t - d.start) / 3600.0;
+  float y = offset + d.corrected;
+  d.last = t;
+  d.n++;
+  d.sx += x;
+  d.sy += y;
+  d.sxx += x*x;
+  d.sxy += x*y;
+  d.syy += y*y;
+  if (temp < d.tmin) d.tmin = temp;
+  if (temp > d.tmax) d.tmax = temp;
+  if ((t - d.start < CLOCK_DRIFT_MIN_SPAN) || (d.n < 3)) return;
+  
+  // Least-squares slope [ms/h], as a rate [ppb] at which the clock
+  // falls behind the reference
+  float den = d.n * d.sxx - d.sx * d.sx;
+  if (den <= 0) return;
+  float slope = (d.n * d.sxy - d.sx * d.sy) / den;
+  float ppb = slope * (1e6 / 3600);
+  // Standard error of the slope, from the scatter about the line
+  float sse = (d.n * d.syy - d.sy * d.sy - slope * (d.n * d.sxy - d.sx * d.sy)) / d.n;
+  float error = (sse > 0) ? sqrt(sse / (d.n - 2) * d.n / den) * (1e6 / 3600) : 0;
+  Serial.print(F("RTC drift: "));
+  Serial.print(ppb / 1000, 3);
+  Serial.print(F(" +/- "));
+  Serial.print(error / 1000, 3);
+  Serial.print(F(" ppm slow over "));
+  Serial.print((t - d.start) / 3600.0, 1);
+  Serial.print(F(" h ("));
+  Serial.print(d.tmin, 2);
+  Serial.print(F(" - "));
+  Serial.print(d.tmax, 2);
+  Serial.println(F(" C)."));
+  if (error >= CLOCK_DRIFT_MAX_ERROR) return;
+  long steps = lround(ppb / CLOCK_AGING_PPB);
+  if (steps == 0) return;
+  
+  // A slow clock needs a lower aging offset
+  long aging = getDS3234Aging() - steps;
+  if (aging < -128) aging = -128;
+  if (aging > 127) aging = 127;
+  setDS3234Aging((int8_t)aging);
+  Serial.print(F("RTC aging offset set to "));
+  Serial.print(aging);
+  Serial.println(F("."));
+  resetClockDrift();
+}
+
+
+//------------------------------------------------------------------------------
+/* Time [ms] until serviceClock() must be called to carry out a pending
+   setUTC(t,us) (0 if due now, ULONG_MAX if none pending). */
+unsigned long getClockSetWait() {
+  if (!clockSetPending) return ULONG_MAX;
+  unsigned long remaining = 1000000ul - (micros() - clockSetMicros) % 1000000ul;
+  return (remaining > CLOCK_SET_WINDOW) ? (remaining - CLOCK_SET_WINDOW) / 1000 : 0;
+}
+
+
+//------------------------------------------------------------------------------
+/* Carries out a pending setUTC(t,us) once the next second boundary of
+   the new time is within CLOCK_SET_WINDOW [us].  Called regularly from
+   the main loop. */
+void serviceClock() {
+  if (!clockSetPending) return;
+  unsigned long elapsed = micros() - clockSetMicros;
+  unsigned long remaining = 1000000ul - elapsed % 1000000ul;
+  if (remaining > CLOCK_SET_WINDOW) return;
+  time_t t = clockSetEpoch + elapsed / 1000000ul + 1;
+  unsigned long target = micros() + remaining;
+  const bool ticking = clockHasSubsecond();
+  while ((long)(target - micros()) > 0) {}
+  setDS3234Time(t);
+  // The square wave restarts with the write: the next tick is a
+  // second away.  Without it, the time continues to be read from
+  // the RTC (see getUTC(ms)).
+  uint8_t oldSREG = SREG;
+  cli();
+  rtcEpoch = t;
+  if (ticking) {
+    rtcSynced = true;
+    rtcTickMillis = millis();
+    rtcTickMicros = micros();
+  }
+  SREG = oldSREG;
+  clockSetPending = false;
 }
 
 
 //------------------------------------------------------------------------------
 /* Get the current time as unix time: number of seconds since 1970-01-01
    at 00:00:00 UTC.  Backed by RTC.  Returns 0 if failed to extract time
-   from RTC. */
+   from RTC.  Normally returns the cached time advanced by the RTC's
+   square-wave interrupt; falls back to reading the RTC if the square
+   wave is not running. */
 time_t getUTC() {
-  return getDS3234Time();
+  uint16_t ms;
+  return getUTC(ms);
+}
+
+
+//------------------------------------------------------------------------------
+/* As above, but also provides the number of milliseconds into the current
+   second, from the time since the last square-wave tick (0 if the square
+   wave is not running).  No additional RTC communication is needed. */
+time_t getUTC(uint16_t &ms) {
+  // Disable interrupts for a consistent (multi-byte) read.
+  // Store previous interrupt state so we can restore it afterwards.
+  uint8_t oldSREG = SREG;
+  cli();
+  time_t t = rtcEpoch;
+  #ifdef RTC_SQUARE_WAVE
+  bool ticking = rtcSynced && (millis() - rtcTickMillis < RTC_SQW_TIMEOUT);
+  #else
+  bool ticking = false;
+  #endif
+  unsigned long dt = micros() - rtcTickMicros;
+  SREG = oldSREG;
+  if (ticking) {
+    // Clamp in case of a late tick (interrupts held off)
+    ms = (dt < 1000000ul) ? (uint16_t)(dt / 1000) : 999;
+    return t;
+  }
+  // Square wave not (yet) running: read RTC directly, resyncing the
+  // cached time in case the square wave resumes
+  ms = 0;
+  return syncClock();
+}
+
+
+//------------------------------------------------------------------------------
+/* Whether the square wave is running, so getUTC(ms) gives the fraction
+   of the current second. */
+bool clockHasSubsecond() {
+  uint8_t oldSREG = SREG;
+  cli();
+  #ifdef RTC_SQUARE_WAVE
+  bool ticking = rtcSynced && (millis() - rtcTickMillis < RTC_SQW_TIMEOUT);
+  #else
+  bool ticking = false;
+  #endif
+  SREG = oldSREG;
+  return ticking;
+}
+
+
+//------------------------------------------------------------------------------
+/* Sets the cached time from the RTC.  Returns the time read (0 if failed
+   to extract time from the RTC). */
+time_t syncClock() {
+  time_t t = 0;
+  // Retry if a square-wave tick arrives during the read, as the RTC
+  // registers may have been read before or after that tick's update
+  for (int k = 0; k < 3; k++) {
+    uint8_t ticks = rtcTicks;
+    t = getDS3234Time();
+    uint8_t oldSREG = SREG;
+    cli();
+    if (rtcTicks == ticks) {
+      rtcEpoch = t;
+      rtcSynced = (t != 0);
+      SREG = oldSREG;
+      return t;
+    }
+    SREG = oldSREG;
+  }
+  return t;
+}
+
+
+//------------------------------------------------------------------------------
+/* Square-wave ISR: advances the cached time at each second boundary. */
+void rtcSquareWaveISR() {
+  unsigned long ms = millis();
+  // After a gap in the square wave, the cached time has missed seconds:
+  // flag it for resync from the RTC
+  if (ms - rtcTickMillis >= RTC_SQW_TIMEOUT) rtcSynced = false;
+  rtcEpoch++;
+  rtcTicks++;
+  rtcTickMillis = ms;
+  rtcTickMicros = micros();
 }
 
 
@@ -359,6 +719,70 @@ String getDBTimeString(time_t t) {
 }
 
 
+//------------------------------------------------------------------------------
+/* Writes the given value (0-99) as two digits. */
+void formatTwoDigits(char *p, uint8_t v) {
+  p[0] = '0' + v / 10;
+  p[1] = '0' + v % 10;
+}
+
+
+//------------------------------------------------------------------------------
+/* Returns the given local time as a "YYYY-MM-DD hh:mm:ss" string, kept in
+   the dbDateTime buffer (valid until the next call).  The same time is
+   returned as is; a later time in the same day only has its time digits
+   updated (by carrying through the digits from the seconds for the next
+   second); the full string is only formatted for a new day. */
+const char* formatDBDateTime(time_t tloc) {
+  if (dbDateTimeValid && (tloc == dbDateTimeLocal)) return dbDateTime;
+  if (dbDateTimeValid && (tloc >= dbDateTimeDay) && (tloc - dbDateTimeDay < SECS_PER_DAY)) {
+    if (tloc == dbDateTimeLocal + 1) {
+      // Next second: increment, carrying into the minutes and hours.
+      // Cannot carry past 23:59:59 in the same day.
+      static const uint8_t pos[] = {18,17,15,14,12,11};
+      static const char last[] = {'9','5','9','5','9','2'};
+      for (uint8_t k = 0; k < sizeof(pos); k++) {
+        if (dbDateTime[pos[k]] < last[k]) {
+          dbDateTime[pos[k]]++;
+          break;
+        }
+        dbDateTime[pos[k]] = '0';
+      }
+    } else {
+      uint32_t secs = tloc - dbDateTimeDay;
+      uint8_t hour = secs / SECS_PER_HOUR;
+      uint16_t rem = secs - hour * SECS_PER_HOUR;
+      formatTwoDigits(dbDateTime + 11, hour);
+      formatTwoDigits(dbDateTime + 14, rem / 60);
+      formatTwoDigits(dbDateTime + 17, rem % 60);
+    }
+    dbDateTimeLocal = tloc;
+    return dbDateTime;
+  }
+  // New day: format everything
+  tmElements_t tm;
+  breakTime(tloc,tm);
+  uint16_t year = 1970 + tm.Year;
+  formatTwoDigits(dbDateTime, year / 100);
+  formatTwoDigits(dbDateTime + 2, year % 100);
+  dbDateTime[4] = '-';
+  formatTwoDigits(dbDateTime + 5, tm.Month);
+  dbDateTime[7] = '-';
+  formatTwoDigits(dbDateTime + 8, tm.Day);
+  dbDateTime[10] = ' ';
+  formatTwoDigits(dbDateTime + 11, tm.Hour);
+  dbDateTime[13] = ':';
+  formatTwoDigits(dbDateTime + 14, tm.Minute);
+  dbDateTime[16] = ':';
+  formatTwoDigits(dbDateTime + 17, tm.Second);
+  dbDateTime[19] = '\0';
+  dbDateTimeLocal = tloc;
+  dbDateTimeDay = tloc - ((tm.Hour * 60UL + tm.Minute) * 60 + tm.Second);
+  dbDateTimeValid = true;
+  return dbDateTime;
+}
+
+
 //------------------------------------------------------------------------------
 /* Converts the given unix time (in seconds since 1970-01-01 00:00:00 UTC) 
    to a date & time string intended for database uploads.  Current time will
@@ -370,7 +794,7 @@ String getDBDateTimeString(time_t t) {
   //return getDateString(t) + " " + getTimeString(t);
   // Use local time instead (if we also send the unix time)
   time_t tloc = (t != 0) ? timezone.toLocal(t) : 0;
-  return getDateString(tloc) + " " + getTimeString(tloc);
+  return formatDBDateTime(tloc);
   
   // ISO 8601 formats:
   //   YYYY-MM-DDThh:mm:ss
@@ -404,6 +828,23 @@ String getDBDateTimeString(time_t t) {
 }
 
 
+//------------------------------------------------------------------------------
+/* As above, with milliseconds appended as a decimal fraction of the
+   seconds ("YYYY-MM-DD hh:mm:ss.sss"), which MySQL also accepts. */
+String getDBDateTimeString(time_t t, uint16_t ms) {
+  if (t == 0) t = getUTC();
+  time_t tloc = (t != 0) ? timezone.toLocal(t) : 0;
+  char sbuffer[24];
+  memcpy(sbuffer,formatDBDateTime(tloc),19);
+  ms %= 1000;
+  sbuffer[19] = '.';
+  sbuffer[20] = '0' + ms / 100;
+  formatTwoDigits(sbuffer + 21, ms % 100);
+  sbuffer[23] = '\0';
+  return sbuffer;
+}
+
+
 
 // Testing Functions ===========================================================
 
@@ -540,6 +981,20 @@ void initDS3234() {
 }
 
 
+//------------------------------------------------------------------------------
+/* Configures the DS3234 SQW/INT pin to output a 1 Hz square wave and
+   attaches the ISR that keeps the cached time.  The RTC time registers
+   update on the falling edge. */
+void initDS3234SquareWave() {
+  uint8_t control;
+  readDS3234Byte(DS3234_CONTROL_ADDR, control);
+  control &= ~(DS3234_CONTROL_INTCN | DS3234_CONTROL_RS);
+  writeDS3234Byte(DS3234_CONTROL_ADDR, control);
+  pinMode(RTC_PIN_SQW, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(RTC_PIN_SQW), rtcSquareWaveISR, FALLING);
+}
+
+
 //------------------------------------------------------------------------------
 /* Test connection with DS3234 RTC. */
 bool probeDS3234() {
@@ -678,6 +1133,40 @@ void setDS3234Time(const time_t t) {
 }
 
 
+//------------------------------------------------------------------------------
+/* DS3234 RTC temperature [C], as last measured by the RTC for its
+   temperature compensation (0.25 C resolution). */
+float getDS3234Temperature() {
+  uint8_t v[DS3234_TEMP_LEN];
+  readDS3234Bytes(DS3234_TEMP_ADDR, v, DS3234_TEMP_LEN);
+  return (int8_t)v[0] + (v[1] >> 6) / 4.0;
+}
+
+
+//------------------------------------------------------------------------------
+/* DS3234 RTC aging offset: trims the oscillator frequency (two's
+   complement, ~0.1 ppm per step at 25 C; higher values slow it). */
+int8_t getDS3234Aging() {
+  uint8_t v;
+  readDS3234Byte(DS3234_AGING_ADDR, v);
+  return (int8_t)v;
+}
+
+
+//------------------------------------------------------------------------------
+/* Set the DS3234 RTC aging offset.  Takes effect at the RTC's next
+   temperature conversion, which is started here unless one is
+   already running. */
+void setDS3234Aging(const int8_t v) {
+  writeDS3234Byte(DS3234_AGING_ADDR, (uint8_t)v);
+  uint8_t status, control;
+  readDS3234Byte(DS3234_STATUS_ADDR, status);
+  if (status & DS3234_STATUS_BSY) return;
+  readDS3234Byte(DS3234_CONTROL_ADDR, control);
+  writeDS3234Byte(DS3234_CONTROL_ADDR, control | DS3234_CONTROL_CONV);
+}
+
+
 //------------------------------------------------------------------------------
 /* Read a single byte from the given register of the DS3234 RTC. */
 void readDS3234Byte(const uint8_t reg, uint8_t &v) {
@@ -59,8 +59,36 @@ bool probeRTC();
 // Set or get the time using unix time: number of seconds since 1970-01-01
 // at 00:00:00 UTC.  Backed by RTC.
 // As a safety measure, time will not be set if t < 1000000000.
+// With RTC_SQUARE_WAVE (pod_config.h), the time is cached and advanced
+// by the RTC's 1 Hz square wave, so getUTC() does not normally
+// communicate with the RTC.
 void setUTC(time_t t);
 time_t getUTC();
+// As above, also giving the milliseconds into the current second
+// (0 if the square wave is not running).
+time_t getUTC(uint16_t &ms);
+// Whether the square wave is running, so that getUTC(ms) gives the
+// sub-second phase.  Otherwise the time is only good to the second.
+bool clockHasSubsecond();
+
+// Sets the time to t at the moment micros() read us.  The RTC is
+// written at a second boundary (see serviceClock()), so its seconds
+// start in step with the given time rather than at the write.
+void setUTC(time_t t, unsigned long us);
+void serviceClock();
+// Time [ms] until serviceClock() is next needed (ULONG_MAX: not needed).
+unsigned long getClockSetWait();
+// Offset [ms] of the given time (as for setUTC(t,us)) from the clock.
+long getUTCOffset(time_t t, unsigned long us);
+// Sets the time as setUTC(t,us) if off by at least minOffset [ms],
+// recording the offset to estimate and trim the RTC drift.  Returns
+// the offset.
+long syncUTC(time_t t, unsigned long us, long minOffset);
+void resetClockDrift();
+void updateClockDrift(time_t t, long offset);
+
+// Reloads the cached time from the RTC, returning that time.
+time_t syncClock();
 
 // Number of seconds since 1970-01-01 at 00:00:00 in configured timezone.
 time_t getLocalTime();
@@ -108,6 +136,8 @@ String getUTCDateTimeString(time_t t=0);  // includes timezone label
 String getDBDateString(time_t t=0);
 String getDBTimeString(time_t t=0);
 String getDBDateTimeString(time_t t=0);
+// As above, with milliseconds ("YYYY-MM-DD hh:mm:ss.sss").
+String getDBDateTimeString(time_t t, uint16_t ms);
 
 // Clock testing routine.
 // Number of cycles (-1 for infinite) and interval between cycles.
@@ -117,9 +147,13 @@ void testClock(unsigned long cycles = -1, unsigned long interval = 1000);
 
 // DS3234 RTC module initialization, clock, and low-level communication.
 void initDS3234();
+void initDS3234SquareWave();
 bool probeDS3234();
 time_t getDS3234Time();
 void setDS3234Time(const time_t t);
+float getDS3234Temperature();
+int8_t getDS3234Aging();
+void setDS3234Aging(const int8_t v);
 void readDS3234Byte(const uint8_t reg, uint8_t &v);
 void readDS3234Bytes(const uint8_t reg, uint8_t *v, const uint8_t len);
 void writeDS3234Byte(const uint8_t reg, const uint8_t v);
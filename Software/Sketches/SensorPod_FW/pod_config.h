@@ -36,6 +36,20 @@
 #define update_default "1970-01-01 00:00:00"
 #define network_default "ABCD"
 
+// Receive data from the CO2 sensor with the input capture unit of
+// timer 1, which tolerates other ISRs delaying the serial receive
+// interrupt.  Requires the sensor's TX line on pin D4 (ICP1) and
+// NEOSWSERIAL_ICP defined in NeoSWSerial.h.  Timer 1 then runs free
+// and also paces the XBee reads (in place of TimerOne).
+//#define CO2_SERIAL_ICP
+
+// Keep the time from the RTC's 1 Hz square wave, which gives timestamps
+// and clock updates sub-second precision (see pod_clock.cpp).  PCB v1.2
+// does not connect the RTC's SQW output: add a jumper from the DeadOn
+// RTC header (P14 pin 5) to pin E4 (INT4).  Without it, the time is
+// read from the RTC when needed, to the whole second.
+//#define RTC_SQUARE_WAVE
+
 struct PodConfigStruct {
   char pod_version[5], server[61], devid[17], project [17], room[17], setupD[11], teardownD[11], lastUpdate[20], networkID[5];
   char coord; // 
@@ -17,13 +17,15 @@
 #include "pod_logging.h"
 #include "pod_config.h"
 #include "pod_network.h"
+#include "pod_power.h"
 #include "pod_sensors.h"
 
 #include <SD.h>
 
-// This library must be modified to increase the maximum number
-// of available alarms by changing dtNBR_ALARMS  (default is 6,
-// should allow for 10-12).
+// The included version of this library schedules its alarms in a
+// min-heap, with the number available set by dtNBR_ALARMS in
+// TimeAlarms.h (16; the original library allows only 6).  Timers
+// that cannot be created are reported by checkTimer().
 #include <TimeAlarms.h>
 
 // Frequencies at which to poll NTP server for current time
@@ -43,6 +45,10 @@
 // to update their destination if the coordinator node changes.
 #define ADDRESS_BROADCAST_INTERVAL 60
 
+// Interval between reports of the coordinator's per-drone
+// delivery counters on serial [s].
+#define NODE_STATS_INTERVAL 3600
+
 #define logint 01 // whenever seconds hit 01 (RTC)
 //SET START MONTH, DAY, HOUR, AND MINUTE.
 int startMonth = 0, startDay = 0, startHr = 0, startMinute = 0;
@@ -54,6 +60,14 @@ int startMonth = 0, startDay = 0, startHr = 0, startMinute = 0;
 #define SD_CHIP_SELECT 10
 File dataFile;
 File setFile;
+// Drone readings waiting for delivery to the coordinator (see
+// pod_network.cpp): one reading packet per line, with '#' lines
+// marking the position of the first undelivered reading.  The file
+// is emptied once everything has been delivered and it has grown
+// past the given size [bytes].
+#define OUTBOX_FILENAME "OUTBOX.TXT"
+#define OUTBOX_COMPACT_SIZE 16384
+File outboxFile;
 char timestamp[30];
 #ifdef DEBUG
 File logFile;
@@ -165,33 +179,182 @@ void writeSDConfig(String DID, String Location, String Coordinator, String Proje
   Serial.println(F("Settings file updated."));
 }
 
+
+/* Opens the outbox file of readings awaiting delivery, creating it
+   if necessary.  Returns the position of the first undelivered
+   reading left from before a restart (0 if none) and places the
+   number of such readings in pending, or returns -1 if the file
+   could not be opened. */
+long openOutboxSD(uint32_t &pending) {
+  pending = 0;
+  SdFile::dateTimeCallback(sdDateTime);
+  outboxFile = SD.open(OUTBOX_FILENAME, FILE_WRITE);
+  if (!outboxFile) {
+    Serial.print(F("\nError opening "));
+    Serial.print(OUTBOX_FILENAME);
+    Serial.println("!");
+    return -1;
+  }
+  // Do not wait at the end of the file for the rest of a line
+  outboxFile.setTimeout(0);
+  // Find the last delivery mark, then count the readings from the
+  // position it gives
+  uint32_t start = 0;
+  String line;
+  outboxFile.seek(0);
+  while (outboxFile.available()) {
+    line = outboxFile.readStringUntil('\n');
+    if (line.startsWith("#")) start = line.substring(1).toInt();
+  }
+  long pos = start;
+  while ((pos = readOutboxSD(pos, line)) >= 0) pending++;
+  return start;
+}
+
+
+/* Appends a reading to the outbox.  Returns the reading's position
+   in the file, or -1 if it could not be written. */
+long appendOutboxSD(const String line) {
+  if (!outboxFile) return -1;
+  uint32_t pos = outboxFile.size();
+  outboxFile.seek(pos);
+  if (outboxFile.println(line) == 0) return -1;
+  outboxFile.flush();
+  return pos;
+}
+
+
+/* Reads the next reading at or after the given outbox position into
+   line.  Returns the position following it, or -1 if there is none. */
+long readOutboxSD(const uint32_t pos, String &line) {
+  if (!outboxFile) return -1;
+  if (!outboxFile.seek(pos)) return -1;
+  while (outboxFile.available()) {
+    line = outboxFile.readStringUntil('\n');
+    if (line.endsWith("\r")) line.remove(line.length() - 1);
+    if ((line.length() > 0) && !line.startsWith("#")) return outboxFile.position();
+  }
+  return -1;
+}
+
+
+/* Records that the readings before the given outbox position have
+   been delivered.  If that is everything in the outbox and the file
+   has grown large, the file is emptied instead (outbox positions
+   restart at 0) and true is returned. */
+bool markOutboxSD(const uint32_t pos) {
+  if (!outboxFile) return false;
+  uint32_t size = outboxFile.size();
+  String line;
+  if ((size > OUTBOX_COMPACT_SIZE) && (readOutboxSD(pos, line) < 0)) {
+    outboxFile.close();
+    SD.remove(OUTBOX_FILENAME);
+    outboxFile = SD.open(OUTBOX_FILENAME, FILE_WRITE);
+    outboxFile.setTimeout(0);
+    return true;
+  }
+  outboxFile.seek(size);
+  outboxFile.print('#');
+  outboxFile.println(pos);
+  outboxFile.flush();
+  return false;
+}
+
+
 void handleLoopLogging() {
   // do any tasks required by the config in loop
   if(getModeCoord()) {
     Alarm.delay(0);
     processXBee();
+    serviceUploadQueue();
+    serviceNTP();
+    serviceClock();
   }
   else {
-    Alarm.delay(250); // Checks all alarm.timerRepeat events from setup()
+    // Checks all alarm.timerRepeat events from setup(), sleeping
+    // until something is due (or a pending clock update)
+    unsigned long wait = getClockSetWait();
+    idleDelay((wait < 250) ? wait : 250);
+    serviceClock();
     processXBee();
+    serviceXBeeOutbox();
+  }
+}
+
+/* Reports a timer that could not be created (alarm id is
+   dtINVALID_ALARM_ID), as happens when all alarms are in use. */
+void checkTimer(AlarmID_t id, const __FlashStringHelper *task) {
+  if (id != dtINVALID_ALARM_ID) return;
+  Serial.print(F("WARNING: Unable to schedule "));
+  Serial.print(task);
+  Serial.print(F(" (all "));
+  Serial.print(Alarm.getCapacity());
+  Serial.println(F(" timers in use)."));
+}
+
+// Periodic sensor tasks, collected by setupSensorTimers() so their
+// timers can be started with staggered phases (see startSensorTimers()).
+#define MAX_SENSOR_TIMERS 8
+struct SensorTimer {
+  int rate;  // [s]
+  OnTick_t handler;
+  const __FlashStringHelper *task;
+};
+SensorTimer sensorTimers[MAX_SENSOR_TIMERS];
+uint8_t sensorTimerCount = 0;
+
+/* Adds a periodic sensor task, to be started by startSensorTimers(). */
+void addSensorTimer(int rate, OnTick_t handler, const __FlashStringHelper *task) {
+  if (sensorTimerCount >= MAX_SENSOR_TIMERS) {
+    checkTimer(dtINVALID_ALARM_ID,task);
+    return;
+  }
+  sensorTimers[sensorTimerCount].rate = rate;
+  sensorTimers[sensorTimerCount].handler = handler;
+  sensorTimers[sensorTimerCount].task = task;
+  sensorTimerCount++;
+}
+
+/* Starts the timers of the periodic sensor tasks, each offset by a
+   different phase so that readings do not all come at once (each
+   reading blocks while it is logged and sent over the XBee network).
+   Tasks with rates r1, r2, ... repeat their relative timing with a
+   period of G = gcd(r1,r2,...): two tasks whose phases differ (modulo
+   G) never trigger together, so the phases are spread evenly over G.
+   With all rates at 60 s and six sensors, readings come every 10 s. */
+void startSensorTimers() {
+  if (sensorTimerCount == 0) return;
+  unsigned long g = sensorTimers[0].rate;
+  for (uint8_t k = 1; k < sensorTimerCount; k++) {
+    unsigned long a = sensorTimers[k].rate;
+    while (a != 0) {
+      unsigned long r = g % a;
+      g = a;
+      a = r;
+    }
+  }
+  for (uint8_t k = 0; k < sensorTimerCount; k++) {
+    uint32_t phase = (1000UL * g * k) / sensorTimerCount;
+    checkTimer(Alarm.timerRepeat(sensorTimers[k].rate,sensorTimers[k].handler,phase),sensorTimers[k].task);
+  }
+  if (getDebugMode()) {
+    Serial.print(F("DEBUG: Sensor readings staggered by "));
+    Serial.print((1000UL * g) / sensorTimerCount);
+    Serial.println(F(" ms."));
   }
 }
 
 void setupSensorTimers() {
   // set up timers for sensors.
-  // Add a delay for each to avoid pileups if using the same
-  // interval times (or multiples of each other).  Since TimeAlarms
-  // resolution is in seconds, make sure the delay is at least one
-  // second.
-  //const int init_delay = 1500;
-  // NOTE: Delay in XBee sensor reading upload routine prevents pileup.
-  const int init_delay = 0;
+  // The timers are started together at the end, each with a
+  // different phase to avoid pileups when using the same interval
+  // times (or multiples of each other).
+  sensorTimerCount = 0;
 
   // Illuminance
   if(getRateLight() > 0) {
     if (probeLightSensor()) {
-      Alarm.timerRepeat(getRateLight(),lightLog);
-      delay(init_delay);
+      addSensorTimer(getRateLight(),lightLog,F("light readings"));
     } else {
       Serial.println(F("WARNING: Failed to communicate with light sensor."));
       Serial.println(F("         No readings will be performed."));
@@ -201,8 +364,7 @@ void setupSensorTimers() {
   // Sound: turn off background sampling if not needed
   if(getRateSound() > 0) {
     startSoundSampling();
-    Alarm.timerRepeat(getRateSound(),soundLog);
-    delay(init_delay);
+    addSensorTimer(getRateSound(),soundLog,F("sound readings"));
   } else {
     stopSoundSampling();
   }
@@ -210,8 +372,7 @@ void setupSensorTimers() {
   // Humidity/temperature
   if(getRateRH() > 0) {
     if (probeTemperatureSensor()) {
-      Alarm.timerRepeat(getRateRH(),humidityLog);
-      delay(init_delay);
+      addSensorTimer(getRateRH(),humidityLog,F("humidity readings"));
     } else {
       Serial.println(F("WARNING: Failed to communicate with temperature/humidity sensor."));
       Serial.println(F("         No readings will be performed."));
@@ -220,8 +381,7 @@ void setupSensorTimers() {
 
   // Radiant temperature
   if(getRateGlobeTemp() > 0) {
-    Alarm.timerRepeat(getRateGlobeTemp(),tempLog);
-    delay(init_delay);
+    addSensorTimer(getRateGlobeTemp(),tempLog,F("globe temperature readings"));
   }
 
   // CO2 sensor
@@ -236,8 +396,7 @@ void setupSensorTimers() {
       if (b) break;
     }
     if (b) {
-      Alarm.timerRepeat(getRateCO2(),co2Log);
-      delay(init_delay);
+      addSensorTimer(getRateCO2(),co2Log,F("CO2 readings"));
     } else {
       Serial.println(F("WARNING: Failed to communicate with CO2 sensor."));
       Serial.println(F("         No readings will be performed."));
@@ -246,8 +405,7 @@ void setupSensorTimers() {
   
   // CO sensor
   if(getRateCO() > 0) {
-    Alarm.timerRepeat(getRateCO(),coLog);  
-    delay(init_delay);
+    addSensorTimer(getRateCO(),coLog,F("CO readings"));
   }
 
   // Particulate matter sensor: turn off if not using
@@ -271,18 +429,18 @@ void setupSensorTimers() {
   } else if(getRatePM() > 120) {
     stopPMSensor();
     powerOffPMSensor();
-    Alarm.timerRepeat(getRatePM(), particleWarmup);
-    delay(init_delay);
+    addSensorTimer(getRatePM(),particleWarmup,F("particulate matter readings"));
   } else if(getRatePM() > 0){
     powerOnPMSensor();
     delay(10);
     startPMSensor();
-    Alarm.timerRepeat(getRatePM(), particleLog);
-    delay(init_delay);
+    addSensorTimer(getRatePM(),particleLog,F("particulate matter readings"));
   } else {
     stopPMSensor();
     powerOffPMSensor();
   }
+
+  startSensorTimers();
 }
 
 /* Set up timers for network-related tasks, like updating the
@@ -290,9 +448,10 @@ void setupSensorTimers() {
    and broadcasting the coordinator's address. */
 void setupNetworkTimers() {
   if (getModeCoord()) {
-    Alarm.timerRepeat(NTP_POLL_INTERVAL,updateClockFromNTP);
-    Alarm.timerRepeat(CLOCK_BROADCAST_INTERVAL,broadcastClock);
-    Alarm.timerRepeat(ADDRESS_BROADCAST_INTERVAL,broadcastCoordinatorAddress);
+    checkTimer(Alarm.timerRepeat(NTP_POLL_INTERVAL,updateClockFromNTP),F("NTP updates"));
+    checkTimer(Alarm.timerRepeat(CLOCK_BROADCAST_INTERVAL,broadcastClock),F("clock broadcasts"));
+    checkTimer(Alarm.timerRepeat(ADDRESS_BROADCAST_INTERVAL,broadcastCoordinatorAddress),F("address broadcasts"));
+    checkTimer(Alarm.timerRepeat(NODE_STATS_INTERVAL,printXBeeNodeStats),F("node statistics"));
   }
 }
 
@@ -388,7 +547,7 @@ void particleWarmup() {
   // Sensor does not return data for ~ 5 seconds,
   // but takes 80-120 seconds for measurements to
   // settle down (initially very inaccurate).
-  Alarm.timerOnce(120,particleLog);
+  checkTimer(Alarm.timerOnce(120,particleLog),F("particulate matter reading"));
   Serial.println(F("Warming up particulate matter sensor."));
 }
 
@@ -21,6 +21,10 @@ void setupPodSD();
 void setupSDLogging();
 void logDataSD(String sensorData);
 void writeSDConfig(String DID, String Location, String Coordinator, String Project, String Rate, String Setup, String Teardown, String Datetime, String NetID);
+long openOutboxSD(uint32_t &pending);
+long appendOutboxSD(const String line);
+long readOutboxSD(const uint32_t pos, String &line);
+bool markOutboxSD(const uint32_t pos);
 void sdDateTime(uint16_t* date, uint16_t* time);
 void setupSensorTimers();
 void setupNetworkTimers();
@@ -18,7 +18,9 @@
 
 #include <EEPROM.h>
 #include <SPI.h>
+#ifndef CO2_SERIAL_ICP
 #include <TimerOne.h>
+#endif
 #include <Ethernet.h>
 #include <EthernetUdp.h>
 
@@ -33,21 +35,110 @@ volatile char xbeeBuffer[XBEE_BUFFER_SIZE];
 volatile size_t xbeeBufferHead = 0;
 volatile size_t xbeeBufferElements = 0;
 volatile size_t xbeeBufferOverrun = 0;
+// Largest buffer occupancy since the coordinator last set its credit
+// (see updateXBeeCredit())
+volatile size_t xbeeBufferPeak = 0;
 volatile bool xbeeBufferHold = false;
-
-// Use ASCII "start of text" and "end of text" control characters
-// to mark the start and end of packets.  The use of both allows
-// incomplete packets to be identified during buffer overruns.
-#define PACKET_START_TOKEN '\x02'
-#define PACKET_END_TOKEN '\x03'
-
-// In addition to the use of the above tokens, a two-digit
-// hexadecimal packet length (modulo 256) is prepended to a packet
-// when sent over the XBee network; incoming packets are dropped
-// if the length does not match.  That may occur if the serial
-// interface missed a character or the serial buffer overflowed,
-// which may happen if any firmware routines prevent background
-// ISRs from running.
+// Arrival times (micros()) of the most recent XBEE_FRAME_TIMES frames,
+// by the buffer position of their start delimiter.  A delimiter read
+// with bytes already queued behind it arrived that many serial byte
+// times (XBEE_BYTE_MICROS) earlier, so the time does not depend on
+// how soon the read ISR runs.  Gives the arrival time of the packet
+// last returned by getXBeeBufferPacket() (xbeePacketMicros; see
+// processClockPacket()).
+#define XBEE_FRAME_TIMES 8
+#define XBEE_BYTE_MICROS (10 * 1000000ul / 9600)
+volatile size_t xbeeFrameStart[XBEE_FRAME_TIMES];
+volatile unsigned long xbeeFrameMicros[XBEE_FRAME_TIMES];
+volatile uint8_t xbeeFrameNext = 0;
+bool xbeePacketTimed = false;
+unsigned long xbeePacketMicros = 0;
+
+// The XBee is operated in API mode with escaped characters (AP=2):
+// all data to and from the XBee is sent in frames of the form
+//   0x7E, length (2 bytes, MSB first), frame data, checksum
+// where the frame data starts with a frame type and the checksum is
+// 0xFF minus the (8-bit) sum of the frame data bytes.  Any 0x7E, 0x7D,
+// 0x11 or 0x13 following the start delimiter is sent as 0x7D followed
+// by that byte XOR 0x20, so an unescaped 0x7E always marks the start
+// of a frame.  Frames are dropped if the checksum does not match or
+// a new frame starts before the current one is complete.  That may
+// occur if the serial interface missed a character or the serial
+// buffer overflowed, which may happen if any firmware routines
+// prevent background ISRs from running.
+#define XBEE_FRAME_START   0x7E
+#define XBEE_FRAME_ESCAPE  0x7D
+#define XBEE_FRAME_XON     0x11
+#define XBEE_FRAME_XOFF    0x13
+// Frame types used here
+#define XBEE_AT_COMMAND    0x08
+#define XBEE_TX_REQUEST    0x10
+#define XBEE_AT_RESPONSE   0x88
+#define XBEE_TX_STATUS     0x8B
+#define XBEE_RX_PACKET     0x90
+// Largest frame (frame data bytes) accepted from the XBee.  PODD
+// packets are well under 128 characters; an RX packet frame adds
+// 12 bytes of addressing ahead of the packet.
+#define XBEE_MAX_FRAME_LENGTH 160
+// Maximum time to wait for an AT command response [ms]
+#define XBEE_AT_TIMEOUT 100
+
+// Drones deliver readings to the coordinator as sequenced packets:
+//   W,<session>,<sequence>,<device ID>,<sensor>,<value>,<timestamp>,<date/time>
+// with the session (chosen at startup) and sequence number as 4-digit
+// hex.  Readings are queued in an outbox on the SD card (see
+// pod_logging.cpp) and up to XBEE_WINDOW of them are sent ahead of
+// the coordinator's acknowledgement:
+//   A,<session>,<sequence>,<bitmap>
+// giving the next sequence number it expects (all readings before it
+// have been queued for upload to the server) and, as 8-digit hex,
+// which of the XBEE_NODE_WINDOW readings after that it has already
+// queued (bit k: reading <sequence>+1+k).  Every reading received is
+// answered this way, including duplicates, which are not queued
+// again.  The drone then removes acknowledged readings from its
+// outbox.  Note the upload queue is held in RAM (UPLOAD_QUEUE_SIZE):
+// readings acknowledged but not yet uploaded or spilled to the SD
+// card are lost if the coordinator resets.  If no acknowledgement
+// arrives within XBEE_ACK_TIMEOUT [ms], the drone resends the
+// unacknowledged readings not in the bitmap, keeping their numbers
+// (so readings whose acknowledgement was lost are dropped as
+// duplicates).  A session starts at reading 0 and is never 0 itself;
+// the coordinator answers a reading of any other session than the
+// one it has for the drone (having restarted or forgotten the drone,
+// or for the session it replaced) with
+//   N,<session>
+// and the drone then renumbers its unacknowledged readings in a new
+// session.  Drones also accept the older "A,<session>,<sequence>"
+// form without a bitmap.  The
+// coordinator still accepts the unsequenced "V" packets (which
+// drones fall back to without an SD card).
+#define XBEE_WINDOW 8
+#define XBEE_ACK_TIMEOUT 5000
+// Number of drones the coordinator tracks sequence numbers for; the
+// least recently heard drone is forgotten to make room for another.
+// Drones are looked up through a hash index with XBEE_NODE_SLOTS
+// slots (a power of 2, kept no more than 3/4 full).
+#define XBEE_MAX_NODES 20
+#define XBEE_NODE_SLOTS 32
+// Number of readings past the next one expected that the coordinator
+// keeps track of (bits in the acknowledgement bitmap)
+#define XBEE_NODE_WINDOW 32
+
+// Flow control: the coordinator appends a credit to its address and
+// clock broadcasts ("D<address>,<credit>", "C<timestamp>,<credit>[,<ms>]",
+// one hex digit) giving the number of readings (1 to XBEE_WINDOW)
+// each drone may have awaiting acknowledgement.  The credit is
+// reconsidered at most every XBEE_CREDIT_INTERVAL [ms]: it is halved
+// if the coordinator's XBee buffer or upload queue has been more than
+// half full (or overran or spilled to the SD card) in the meantime,
+// and raised by XBEE_CREDIT_STEP if both stayed under a quarter
+// full.  Drones below full credit also space out new readings by
+// XBEE_PACE_STEP [ms] per step below XBEE_WINDOW, and return to full
+// credit if no broadcast is heard within XBEE_CREDIT_TIMEOUT [ms].
+#define XBEE_CREDIT_INTERVAL 30000
+#define XBEE_CREDIT_STEP 2
+#define XBEE_PACE_STEP 250
+#define XBEE_CREDIT_TIMEOUT 180000
 
 // How frequently data is pulled from hardware serial buffer (microseconds)
 // through the use of a timer-driven interrupt service routine (ISR).
@@ -66,18 +157,29 @@ volatile bool xbeeBufferHold = false;
 // read ISR run time must be shorter than that so it does not interfere
 // with the Serial1 ISR timing.
 
+#ifdef CO2_SERIAL_ICP
+// Timer 1 runs free at F_CPU/8 for the CO2 sensor's input capture
+// receiver (see pod_config.h), so XBee reads are paced by its
+// compare A channel rather than by TimerOne.
+#define XBEE_READ_TICKS ((F_CPU/8/1000) * (XBEE_READ_INTERVAL/1000))
+ISR(TIMER1_COMPA_vect) {
+  OCR1A += XBEE_READ_TICKS;
+  readXBeeISR();
+}
+#endif
+
 // MOVED XBEE VALUES TO STRUCTURE BELOW.
 // The XBee's serial number.  To be extracted from XBee.
 //uint64_t xbeeSerialNumber = 0;
 // If not a coordinator, the destination is the serial number of the
 // coordinator.  Initially extracted from XBee, but will be updated from
-// network broadcast by coordinator.  Cached here instead of rereading
-// from XBee due to ~ 2 second command mode period for each read.
+// network broadcast by coordinator.
 //uint64_t xbeeDestination = 0;
 
 // Structure to store various XBee configuration settings.
-// Useful to retrieve/set in bulk as each switch into command mode
-// takes 2+ seconds.
+// Cached here so they do not need to be reread from the XBee.
+// The destination is sent with each transmit request, so the
+// XBee's own DH/DL settings only serve to retain it across resets.
 struct XBeeConfigStruct {
   // NI: node identifier.
   String identifier = "";
@@ -110,8 +212,62 @@ struct XBeeConfigStruct {
 // Corresponds to XBee preamble ID.
 uint8_t xbeeGroup = 0;
 
+// ID of the most recent API frame sent that expects a response
+// (1-255; frames with ID 0 receive no response).
+uint8_t xbeeFrameID = 0;
+
+// Source address of the most recent XBee packet received
+uint64_t xbeeSource = 0;
+
 String set1;
 String set2;
+// Sender of the settings packets above: the two halves must come
+// from the same PODD
+uint64_t setSource = 0;
+
+// Drone reading outbox.  Sequence numbers are counted from the
+// oldest undelivered reading at startup; outboxPos holds the outbox
+// file positions of the readings sent but not yet acknowledged.
+struct XBeeOutbox {
+  bool open = false;
+  uint16_t session = 0;
+  uint16_t acked = 0;     // next reading to be acknowledged
+  uint16_t sent = 0;      // next reading to send
+  uint16_t written = 0;   // next reading to be written
+  uint32_t sendPos = 0;   // file position of next reading to send
+  uint32_t sacked = 0;    // bit k: reading acked+1+k received by coordinator
+  uint32_t outboxPos[XBEE_WINDOW];
+  unsigned long ackTime = 0;  // last acknowledgement (or start of sending)
+  unsigned long sendTime = 0; // last new reading sent
+  unsigned long resent = 0;   // readings sent again
+} xbeeOutbox;
+
+// Flow control credit: advertised (coordinator) or last heard (drone)
+uint8_t xbeeCredit = XBEE_WINDOW;
+unsigned long xbeeCreditTime = 0;
+// Coordinator: XBee buffer overran since the credit was last set
+bool xbeeCreditOverrun = false;
+
+// Coordinator's record of the readings received from each drone,
+// with delivery counters
+struct NodeSequence {
+  uint64_t source = 0;    // XBee serial number
+  uint16_t session = 0;   // 0: none yet
+  uint16_t lastSession = 0;  // session replaced by the current one
+  uint16_t next = 0;      // next reading expected
+  uint32_t ahead = 0;     // bit k: reading next+1+k already queued
+  uint16_t highest = 0;   // one past the highest reading queued
+  unsigned long heard = 0;
+  uint32_t received = 0;
+  uint32_t duplicates = 0;
+  uint32_t missing = 0;
+  uint32_t reordered = 0;
+};
+NodeSequence nodeSequences[XBEE_MAX_NODES];
+int8_t nodeCount = 0;
+// Hash index into the above (-1: empty slot)
+int8_t nodeIndex[XBEE_NODE_SLOTS] = {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+                                     -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1};
 
 // Network configuration.
 // Contains a version number used for EEPROM storage checking,
@@ -167,11 +323,139 @@ unsigned long packetsUploaded = 0;
 // data logs).
 #define HTTP_POST_TIMEOUT 250
 
+// Readings to be uploaded (coordinator) are held in a queue of
+// UPLOAD_QUEUE_SIZE compact records in RAM, which serviceUploadQueue()
+// empties one upload at a time from the main loop.  XBee packets are
+// then taken off the buffer as they arrive rather than one per upload.
+// Readings that do not fit are spilled to the SD card outbox (see
+// pod_logging.cpp) and move into the queue as it empties.  A reading
+// stays in the queue until the server has responded to its post, and
+// is posted again if no response arrives within HTTP_POST_TIMEOUT.
+// After a failed post (no connection), posting resumes after
+// UPLOAD_RETRY_INTERVAL [ms].
+#define UPLOAD_QUEUE_SIZE 6
+#define UPLOAD_RETRY_INTERVAL 5000
+
+// Posts to the server are made over up to UPLOAD_SOCKETS connections
+// at a time.  postPage() can return as soon as a post has been sent,
+// leaving the server's response to be collected from the main loop
+// (serviceUploadSockets()), so a slow response does not hold up the
+// uploads behind it.  The W5100 has MAX_SOCK_NUM (4) sockets, shared
+// with the DNS query (see resolveHost()), the NTP requests (UDP, open
+// for the length of an update) and the ethernet library's DHCP lease
+// renewals.  Posts use one socket fewer while an NTP update is running
+// (see uploadSocketLimit()), so one socket is always left for DHCP.
+#define UPLOAD_SOCKETS 2
+struct UploadSocket {
+  EthernetClient client;
+  bool busy = false;          // awaiting server response
+  unsigned long sent = 0;     // time post was sent
+  int8_t reading = -1;        // upload queue slot of reading posted (-1: none)
+};
+UploadSocket uploadSockets[UPLOAD_SOCKETS];
+// State of a queued reading
+#define QUEUED_WAITING 0      // to be posted
+#define QUEUED_POSTED 1       // posted, awaiting server response
+#define QUEUED_UPLOADED 2     // server has responded
+struct QueuedReading {
+  char did[17];
+  char sensor[10];
+  char value[12];
+  uint32_t timestamp;
+  char datetime[24];
+  uint32_t spillPos;    // spill file position after it (0: not spilled)
+  uint8_t state;
+};
+QueuedReading uploadQueue[UPLOAD_QUEUE_SIZE];
+uint8_t uploadQueueHead = 0;
+uint8_t uploadQueueCount = 0;
+// Largest queue occupancy since the XBee credit was last set
+uint8_t uploadQueuePeak = 0;
+bool uploadRetry = false;
+unsigned long uploadRetryTime = 0;
+struct UploadSpill {
+  bool open = false;
+  uint32_t readPos = 0;   // file position of next reading not in queue
+  uint32_t pending = 0;   // readings in file not yet in queue
+} uploadSpill;
+
 // NTP settings
 #define NTP_SERVER "time.nist.gov"
 #define NTP_PORT 123
 #define NTP_PACKET_SIZE 48
 
+// NTP updates run in the background: updateClockFromNTP() starts a
+// burst of NTP_SAMPLES requests, sent NTP_SAMPLE_INTERVAL [ms] apart
+// (NIST servers refuse more frequent requests), and serviceNTP()
+// collects each response from the main loop or gives up on it after
+// NTP_TIMEOUT [ms].  The sample with the shortest round trip, the one
+// least delayed by network queues, sets the clock to the millisecond
+// (see setUTC(t,us)).  Offsets under NTP_MIN_OFFSET [ms] are left
+// alone.
+#define NTP_SAMPLES 4
+#define NTP_SAMPLE_INTERVAL 4000
+#define NTP_TIMEOUT 1000
+#define NTP_MIN_OFFSET 20
+
+// Clock broadcasts from a coordinator whose clock has milliseconds
+// (see clockHasSubsecond()) give them ("C<timestamp>,<credit>,<ms>"),
+// read just before sending.  The drone takes the broadcast's arrival
+// from the start of the receive frame (see xbeePacketMicros) and
+// allows for the serial transfer of the transmit frame to the
+// coordinator's XBee and for the radio hop, CLOCK_RADIO_DELAY [us].
+// The latter is an estimate for a single-hop broadcast; it can be
+// measured by comparing the two XBee serial lines on a scope.
+// Offsets under CLOCK_MIN_OFFSET [ms] are left alone.
+#define CLOCK_RADIO_DELAY 5000ul
+#define CLOCK_MIN_OFFSET 10
+struct NTPUpdate {
+  EthernetUDP udp;
+  bool active = false;        // burst in progress
+  bool waiting = false;       // request awaiting response
+  uint8_t sent = 0;           // requests sent in burst
+  unsigned long sentAt = 0;   // time [ms] of last request
+  unsigned long t1 = 0;       // micros() at last request
+  // Best sample so far: unix time and the micros() at which that
+  // second started, and the round trip [us]
+  bool found = false;
+  time_t utc = 0;
+  unsigned long second = 0;
+  unsigned long roundTrip = 0;
+} ntpUpdate;
+
+// Host names (upload server, NTP server) are looked up through a
+// small cache (resolveHost()), so uploads connect to the server by
+// address instead of each making its own DNS query.  An address is
+// kept for the TTL given with it (limited to DNS_MIN_TTL..DNS_MAX_TTL
+// [s]) and looked up again in the background once DNS_REFRESH_PERCENT
+// of that has passed.  If that lookup fails, the old address continues
+// to be used.  A name that could not be looked up at all is not tried
+// again for DNS_NEGATIVE_TTL [s], so a missing DNS server does not
+// hold up every upload.
+#define DNS_CACHE_SIZE 3
+#define DNS_PORT 53
+#define DNS_LOCAL_PORT 8889
+#define DNS_TIMEOUT 2000
+#define DNS_MIN_TTL 60
+#define DNS_MAX_TTL 86400
+#define DNS_NEGATIVE_TTL 30
+#define DNS_REFRESH_PERCENT 75
+#define DNS_PACKET_SIZE 192
+struct DNSCacheEntry {
+  uint32_t name = 0;          // hash of host name (0: unused)
+  uint32_t ip = 0;            // address (0: lookup failed)
+  unsigned long checked = 0;  // time of last lookup
+  uint32_t refresh = 0;       // time [s] after last lookup to look up again
+};
+DNSCacheEntry dnsCache[DNS_CACHE_SIZE];
+// Lookup awaiting a response from the DNS server (at most one)
+struct DNSQuery {
+  EthernetUDP udp;
+  int8_t entry = -1;          // cache entry being looked up (-1: none)
+  uint16_t id = 0;
+  unsigned long sent = 0;
+} dnsQuery;
+
 
 
 //--------------------------------------------------------------------------------------------- [XBee Management]
@@ -259,8 +543,10 @@ NetworkStatus ethStatus;
 
 //------------------------------------------------------------------------------
 
-/* Places the XBee in command mode.  Takes ~ 2 seconds.  XBee will remain 
-   in command mode for ~ 1 second or until explicitly ended. */
+/* Places the XBee in (transparent mode) command mode.  Takes ~ 2 seconds.
+   XBee will remain in command mode for ~ 1 second or until explicitly
+   ended.  Only used to switch an XBee into API mode (command mode is
+   not available in API mode). */
 bool startXBeeCommandMode() {
   // Clear incoming buffer
   while (xbee.available()) xbee.read();
@@ -324,97 +610,248 @@ bool submitXBeeCommand(const String cmd) {
 }
 
 
-/* Sends the given command to the XBee and returns the response.
-   Returns empty string if communication was unsuccessful.
-   XBee must already be in command mode.  Do not include trailing '\r'. */
-String getXBeeCommandResponse(const String cmd) {
-  // XBee responds with "OK\r" or "ERROR\n" after each sent command,
-  // except when data is returned.
-  // Clear incoming buffer
-  while (xbee.available()) xbee.read();
-  // Submit command
-  xbee.print(cmd + "\r");
-  const int BUF_LEN = 16;
-  size_t pos = 0;
-  char buf[BUF_LEN];
-  // Wait for response until '\r'
+/* Places the XBee in API mode with escaped characters (AP=2), if it
+   is not already.  An XBee still in transparent mode (the out-of-box
+   default) is switched through command mode, which takes a few
+   seconds but is only necessary once as the setting is saved.
+   Returns true if the XBee responds to API frames. */
+bool enableXBeeAPIMode() {
+  // Already in API mode: AP=1 (unescaped) frames are read the same
+  // way as long as no bytes require escaping, which holds for
+  // this query and its response.
+  uint8_t ap;
+  if (getXBeeATResponse("AP", &ap, 1) == 1) {
+    if (ap == 2) return true;
+    return setXBeeNumericParameter("AP", 2) && setXBeeATParameter("WR", NULL, 0);
+  }
+  // Transparent mode
+  if (!startXBeeCommandMode()) return false;
+  submitXBeeCommand(F("ATAP 2"));
+  stopXBeeCommandMode(true);
+  return (getXBeeATResponse("AP", &ap, 1) == 1) && (ap == 2);
+}
+
+
+/* Returns the ID to use for the next API frame that expects a
+   response.  Cycles through 1-255 (0 indicates no response). */
+uint8_t nextXBeeFrameID() {
+  if (++xbeeFrameID == 0) xbeeFrameID = 1;
+  return xbeeFrameID;
+}
+
+
+/* Writes a byte of an API frame to the XBee, escaping it if
+   necessary. */
+void writeXBeeEscaped(const uint8_t b) {
+  if ((b == XBEE_FRAME_START) || (b == XBEE_FRAME_ESCAPE)
+      || (b == XBEE_FRAME_XON) || (b == XBEE_FRAME_XOFF)) {
+    xbee.write(XBEE_FRAME_ESCAPE);
+    xbee.write(b ^ 0x20);
+  } else {
+    xbee.write(b);
+  }
+}
+
+
+/* Sends an API frame to the XBee.  The frame data is the given
+   header (starting with the frame type) followed by the given data,
+   which may be empty. */
+void sendXBeeFrame(const uint8_t *header, const size_t headerLen,
+                   const uint8_t *data, const size_t dataLen) {
+  const uint16_t len = headerLen + dataLen;
+  uint8_t checksum = 0;
+  xbee.write(XBEE_FRAME_START);
+  writeXBeeEscaped((len >> 8) & 0xFF);
+  writeXBeeEscaped((len >> 0) & 0xFF);
+  for (size_t k = 0; k < headerLen; k++) {
+    writeXBeeEscaped(header[k]);
+    checksum += header[k];
+  }
+  for (size_t k = 0; k < dataLen; k++) {
+    writeXBeeEscaped(data[k]);
+    checksum += data[k];
+  }
+  writeXBeeEscaped(0xFF - checksum);
+}
+
+
+/* Reads the next API frame directly from the XBee serial interface,
+   waiting up to the given time [ms].  Places the frame data in the
+   given buffer and returns its length, or 0 if no valid frame was
+   received.  Bypasses the XBee ring buffer, so should only be used
+   before startXBee(). */
+size_t readXBeeFrame(uint8_t *buf, const size_t bufLen, const unsigned long timeout) {
   unsigned long t0 = millis();
-  while (millis() - t0 < 100) {
-    if (xbee.available()) {
-      char c = xbee.read();
-      if (c == '\r') break;
-      if (c == '\n') break;
-      buf[pos++] = c;
-      if (pos >= BUF_LEN) break;
+  // Position within frame: -1 while waiting for the start delimiter,
+  // then the number of bytes received after the delimiter
+  int pos = -1;
+  bool escaped = false;
+  uint16_t len = 0;
+  uint8_t checksum = 0;
+  while (millis() - t0 < timeout) {
+    if (!xbee.available()) continue;
+    uint8_t b = xbee.read();
+    // Start of a (new) frame
+    if (b == XBEE_FRAME_START) {
+      pos = 0;
+      escaped = false;
+      len = 0;
+      checksum = 0;
+      continue;
     }
-    delay(5);
+    if (pos < 0) continue;
+    if (b == XBEE_FRAME_ESCAPE) {
+      escaped = true;
+      continue;
+    }
+    if (escaped) {
+      b ^= 0x20;
+      escaped = false;
+    }
+    if (pos < 2) {
+      len = (len << 8) | b;
+    } else if (pos < 2 + (int)len) {
+      if ((size_t)(pos - 2) < bufLen) buf[pos - 2] = b;
+      checksum += b;
+    } else {
+      // Checksum byte
+      if (((uint8_t)(checksum + b) == 0xFF) && (len <= bufLen)) return len;
+      pos = -1;
+      continue;
+    }
+    pos++;
   }
-  // Check for overflow
-  if (pos >= BUF_LEN) pos = BUF_LEN - 1;
-  buf[pos] = '\0';
-  // Clear remaining incoming buffer
+  return 0;
+}
+
+
+/* Sends the given AT command (two characters, e.g. "SH") to the XBee
+   as an API frame and waits for the response.  Places any returned
+   parameter value in the given buffer and returns its length, or -1
+   if the command failed or there was no response.  Should only be
+   used before startXBee() (see readXBeeFrame()). */
+int getXBeeATResponse(const char *cmd, uint8_t *value, const size_t valueLen) {
+  return getXBeeATResponse(cmd, NULL, 0, value, valueLen);
+}
+
+
+/* As above, but also passes the given parameter value with the
+   command (to change the corresponding setting). */
+int getXBeeATResponse(const char *cmd, const uint8_t *param, const size_t paramLen,
+                      uint8_t *value, const size_t valueLen) {
+  // Clear incoming buffer
   while (xbee.available()) xbee.read();
-  //Serial.print(F("XBee response: "));
-  //Serial.println(buf);
-  return String(buf);
+  const uint8_t id = nextXBeeFrameID();
+  const uint8_t header[] = {XBEE_AT_COMMAND, id, (uint8_t)cmd[0], (uint8_t)cmd[1]};
+  sendXBeeFrame(header, sizeof(header), param, paramLen);
+  // Response: frame type, frame ID, command (2 bytes), status, value
+  uint8_t buf[5 + 20];
+  unsigned long t0 = millis();
+  unsigned long elapsed;
+  while ((elapsed = millis() - t0) < XBEE_AT_TIMEOUT) {
+    size_t len = readXBeeFrame(buf, sizeof(buf), XBEE_AT_TIMEOUT - elapsed);
+    if (len < 5) continue;
+    if ((buf[0] != XBEE_AT_RESPONSE) || (buf[1] != id)) continue;
+    if (buf[4] != 0) return -1;
+    size_t n = (len - 5 < valueLen) ? len - 5 : valueLen;
+    for (size_t k = 0; k < n; k++) value[k] = buf[5 + k];
+    return n;
+  }
+  return -1;
+}
+
+
+/* Sets the XBee setting for the given AT command (two characters)
+   to the given value.  If wait is true, waits for the XBee to
+   respond and returns whether the setting was accepted (should only
+   be used before startXBee()).  Otherwise, the XBee is asked not to
+   respond, the command returns immediately and true is returned. */
+bool setXBeeATParameter(const char *cmd, const uint8_t *param, const size_t paramLen,
+                        const bool wait) {
+  if (wait) return (getXBeeATResponse(cmd, param, paramLen, NULL, 0) >= 0);
+  const uint8_t header[] = {XBEE_AT_COMMAND, 0, (uint8_t)cmd[0], (uint8_t)cmd[1]};
+  sendXBeeFrame(header, sizeof(header), param, paramLen);
+  return true;
+}
+
+
+/* Returns the string setting for the given AT command (e.g. "NI"),
+   or an empty string if it could not be obtained. */
+String getXBeeStringParameter(const char *cmd) {
+  uint8_t buf[21];
+  int n = getXBeeATResponse(cmd, buf, sizeof(buf) - 1);
+  if (n < 0) n = 0;
+  buf[n] = '\0';
+  return String((const char *)buf);
+}
+
+
+/* Sets the string setting for the given AT command.  See
+   setXBeeATParameter() for the wait argument. */
+bool setXBeeStringParameter(const char *cmd, const String value, const bool wait) {
+  return setXBeeATParameter(cmd, (const uint8_t *)value.c_str(), value.length(), wait);
 }
 
 
-/* Sends the given command to the XBee and returns the numeric response.
-   Returns 0 if communication was unsuccessful or response was not
-   hexadecimal.  XBee must already be in command mode.
-   Do not include trailing '\r'. */
-uint32_t getXBeeNumericResponse(const String cmd) {
-  String response = getXBeeCommandResponse(cmd);
+/* Returns the numeric setting for the given AT command, or 0 if it
+   could not be obtained.  Values are returned by the XBee in binary,
+   most significant byte first. */
+uint32_t getXBeeNumericParameter(const char *cmd) {
+  uint8_t buf[4];
+  int n = getXBeeATResponse(cmd, buf, sizeof(buf));
   uint32_t v = 0;
-  for (size_t k = 0; k < response.length(); k++) {
-    char c = response.charAt(k);
-    if ((c >= '0') && (c <= '9')) {
-      v = (v << 4) + (uint8_t)(c - '0');
-    } else if ((c >= 'A') && (c <= 'F')) {
-      v = (v << 4) + (uint8_t)(c - 'A' + 10);
-    } else if ((c >= 'a') && (c <= 'f')) {
-      v = (v << 4) + (uint8_t)(c - 'a' + 10);
-    } else {
-      return 0;
-    }
-  }
+  for (int k = 0; k < n; k++) v = (v << 8) | buf[k];
   return v;
 }
 
 
+/* Sets the numeric setting for the given AT command.  Sent in binary,
+   most significant byte first, without leading zero bytes.  See
+   setXBeeATParameter() for the wait argument. */
+bool setXBeeNumericParameter(const char *cmd, const uint32_t value, const bool wait) {
+  uint8_t buf[4];
+  size_t n = 0;
+  for (int k = 3; k >= 0; k--) {
+    uint8_t b = (value >> (8*k)) & 0xFF;
+    if ((n == 0) && (b == 0) && (k > 0)) continue;
+    buf[n++] = b;
+  }
+  return setXBeeATParameter(cmd, buf, n, wait);
+}
+
+
 /* Gets the XBee serial number as 64-bit number.  Returns 0 if 
-   could not obtain the serial number.  XBee must already be in
-   command mode. */
+   could not obtain the serial number. */
 uint64_t getXBeeSerialNumber() {
   // Get serial number as upper and lower 32-bits
-  uint32_t SH = getXBeeNumericResponse(F("ATSH"));  // For XBee S3B, this is 0x0013A2XX
-  uint32_t SL = getXBeeNumericResponse(F("ATSL"));
+  uint32_t SH = getXBeeNumericParameter("SH");  // For XBee S3B, this is 0x0013A2XX
+  uint32_t SL = getXBeeNumericParameter("SL");
   // Construct 64-bit number
   return ((uint64_t)SH << 32) | (uint64_t)SL;
 }
 
 
 /* Gets the XBee destination as 64-bit number.  Returns 0 if 
-   could not obtain the destination.  XBee must already be in
-   command mode. */
+   could not obtain the destination. */
 uint64_t getXBeeDestination() {
   // Get destination as upper and lower 32-bits
-  uint32_t DH = getXBeeNumericResponse(F("ATDH"));
-  uint32_t DL = getXBeeNumericResponse(F("ATDL"));
+  uint32_t DH = getXBeeNumericParameter("DH");
+  uint32_t DL = getXBeeNumericParameter("DL");
   // Construct 64-bit number
   return ((uint64_t)DH << 32) | (uint64_t)DL;
 }
 
 
-/* Sets the XBee destination as 64-bit number.  XBee must already 
-   be in command mode. */
-void setXBeeDestination(const uint64_t dest) {
+/* Sets the XBee destination as 64-bit number.  See
+   setXBeeATParameter() for the wait argument: without waiting, this
+   takes only the few milliseconds needed to send the frames, so can
+   be used at any time. */
+void setXBeeDestination(const uint64_t dest, const bool wait) {
   // Set destination as upper and lower 32-bits
   uint32_t DH = (dest >> 32) & 0xFFFFFFFF;
   uint32_t DL = (dest >>  0) & 0xFFFFFFFF;
-  submitXBeeCommand(F("ATDH ") + String(DH,HEX));
-  submitXBeeCommand(F("ATDL ") + String(DL,HEX));
+  setXBeeNumericParameter("DH", DH, wait);
+  setXBeeNumericParameter("DL", DL, wait);
 }
 
 
@@ -468,19 +905,22 @@ void initXBee() {
   xbeeBufferHold = true;
   resetXBeeBuffer();
 
+  // Communicate with the XBee through API frames.
+  if (!enableXBeeAPIMode()) {
+    Serial.println(F("Warning: XBee did not respond to API mode commands."));
+  }
+
   // Get various XBee configuration settings.
   // Not all these are currently being used in the firmware, but
   // these settings might be useful at some point.
-  startXBeeCommandMode();
   //xbeeSerialNumber = getXBeeSerialNumber();
   //xbeeDestination = getXBeeDestination();
-  xbeeConfig.identifier = getXBeeCommandResponse(F("ATNI"));
-  xbeeConfig.coordinator = (uint8_t)getXBeeNumericResponse(F("ATCE"));
+  xbeeConfig.identifier = getXBeeStringParameter("NI");
+  xbeeConfig.coordinator = (uint8_t)getXBeeNumericParameter("CE");
   xbeeConfig.serialNumber = getXBeeSerialNumber();
   xbeeConfig.destination = getXBeeDestination();
-  xbeeConfig.preamble = (uint8_t)getXBeeNumericResponse(F("ATHP"));
-  xbeeConfig.network = getXBeeNumericResponse(F("ATID"));
-  stopXBeeCommandMode(false);
+  xbeeConfig.preamble = (uint8_t)getXBeeNumericParameter("HP");
+  xbeeConfig.network = getXBeeNumericParameter("ID");
 
   // PODD group number is equivalent to preamble ID
   xbeeGroup = (xbeeConfig.preamble > 0) ? xbeeConfig.preamble : 0;
@@ -495,40 +935,31 @@ void initXBee() {
    XBee configuration.  Argument indicates if this PODD
    is the coordinator. */
 void configureXBee(const bool coord) {
-  // Takes ~ 2 seconds to enter command mode.
-  startXBeeCommandMode();
-
   // Update XBee identifier to device ID (if necessary)
   if (!xbeeConfig.identifier.equals(getDevID())) {
     xbeeConfig.identifier = getDevID();
-    submitXBeeCommand(F("ATNI ") + xbeeConfig.identifier);
+    setXBeeStringParameter("NI", xbeeConfig.identifier);
   }
 
   // Update XBee preamble ID to PODD XBee group number (if necessary)
   if ((xbeeConfig.preamble != xbeeGroup) && (xbeeGroup >= 1) && (xbeeGroup <= 7)) {
     xbeeConfig.preamble = xbeeGroup;
-    submitXBeeCommand(F("ATHP ") + String(xbeeConfig.preamble,HEX));
+    setXBeeNumericParameter("HP", xbeeConfig.preamble);
   }
   
   // Settings for coordinator
   if (coord) {
     // Set as coordinator
-    submitXBeeCommand(F("ATCE 1"));
+    setXBeeNumericParameter("CE", 1);
     // Set destination to broadcast address (0x000000000000FFFF).
-    // Note command string omits '0x'.
-    //submitXBeeCommand(F("ATDH 00000000"));
-    //submitXBeeCommand(F("ATDL 0000FFFF"));
     xbeeConfig.destination = 0xFFFF;
     setXBeeDestination(xbeeConfig.destination);
     
   // Settings for drone
   } else {
     // Set as non-coordinator
-    submitXBeeCommand(F("ATCE 0"));
+    setXBeeNumericParameter("CE", 0);
     // Set destination to coordinator address (0x0000000000000000).
-    // Note command string omits '0x'.
-    //submitXBeeCommand(F("ATDH 00000000"));
-    //submitXBeeCommand(F("ATDL 00000000"));
     //xbeeDestination = 0x0000;
     //setXBeeDestination(xbeeDestination);
     // NOTE: Unlike conventional XBee network topologies, Digimesh
@@ -549,21 +980,23 @@ void configureXBee(const bool coord) {
   }
   
   // Read settings
-  //Serial.println(F("ATCE: ") + getXBeeCommandResponse(F("ATCE")));
-  //Serial.println(F("ATDH: ") + getXBeeCommandResponse(F("ATDH")));
-  //Serial.println(F("ATDL: ") + getXBeeCommandResponse(F("ATDL")));
+  //Serial.println(F("CE: ") + String(getXBeeNumericParameter("CE")));
+  //Serial.println(F("DH: ") + String(getXBeeNumericParameter("DH"),HEX));
+  //Serial.println(F("DL: ") + String(getXBeeNumericParameter("DL"),HEX));
   
   //Serial.println(F("  XBee serial number: ") + getXBeeSerialNumberString());
   //Serial.println(F("  XBee destination:   ") + getXBeeDestinationString());
   
-  // Save new configuration and exit command mode (applies changes)
-  stopXBeeCommandMode(true);
+  // Save new configuration (changes made through API frames are
+  // applied immediately)
+  setXBeeATParameter("WR", NULL, 0);
 }
 
 
 /* Begin XBee processing.  Starts a timer-based ISR to grab data
    from the Arduino buffer into a ring buffer for more leisurely
-   processing. */
+   processing.  Drones also open their outbox of readings awaiting
+   delivery (SD card must already be set up). */
 void startXBee() {
   // Clear buffers and start fresh.
   // First disable interrupts to prevent ISRs from changing buffers.
@@ -578,8 +1011,27 @@ void startXBee() {
   // Use timer-based, interrupt-driven function calls to
   // ensure data is getting pulled from the Arduino buffer
   // before it can fill.
+#ifdef CO2_SERIAL_ICP
+  oldSREG = SREG;
+  cli();
+  // Same timer mode as the capture receiver sets (keep its
+  // capture settings if already running)
+  TCCR1A = 0;
+  TCCR1B = (TCCR1B & (_BV(ICNC1) | _BV(ICES1))) | _BV(CS11);
+  OCR1A = TCNT1 + XBEE_READ_TICKS;
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+  SREG = oldSREG;
+#else
   Timer1.initialize(XBEE_READ_INTERVAL);
   Timer1.attachInterrupt(readXBeeISR);
+#endif
+
+  if (getModeCoord()) {
+    openUploadSpill();
+  } else {
+    openXBeeOutbox();
+  }
 }
 
 
@@ -635,8 +1087,14 @@ void readXBee() {
     } else {
       xbeeBuffer[xbeeBufferHead] = xbee.read();
       //Serial.print(xbeeBuffer[xbeeBufferHead]);
+      if ((uint8_t)xbeeBuffer[xbeeBufferHead] == XBEE_FRAME_START) {
+        xbeeFrameStart[xbeeFrameNext] = xbeeBufferHead;
+        xbeeFrameMicros[xbeeFrameNext] = micros() - xbee.available() * XBEE_BYTE_MICROS;
+        xbeeFrameNext = (xbeeFrameNext + 1) % XBEE_FRAME_TIMES;
+      }
       xbeeBufferHead = (xbeeBufferHead + 1) % XBEE_BUFFER_SIZE;
       xbeeBufferElements++;
+      if (xbeeBufferElements > xbeeBufferPeak) xbeeBufferPeak = xbeeBufferElements;
     }
   }
 #if defined(XBEE_DEBUG)
@@ -645,9 +1103,11 @@ void readXBee() {
 }
 
 
-/* Send the given packet over the XBee network to the coordinator.
-   Adds start & stop tokens and 2-digit packet hex length prefix to
-   help coordinator with packet parsing. */
+/* Send the given packet over the XBee network to the coordinator
+   (or to all nodes, for the coordinator).  The packet is sent as an
+   API transmit request addressed to the current destination; the
+   XBee reports the delivery status in a transmit status frame,
+   which is checked when processing the XBee buffer. */
 void sendXBee(const String packet)
 {
   // Serial output should be flushed here as activity may
@@ -656,32 +1116,7 @@ void sendXBee(const String packet)
   Serial.println(packet);
   Serial.flush();
   
-  // Length of packet, in 2-digit hex (mod 256)
-  char lbuf[3];
-  sprintf(lbuf,"%02X",(uint8_t)(packet.length() % 256));
-  lbuf[2] = '\0';
-  
-  // Would probably work...
-  //xbee.write(PACKET_START_TOKEN);
-  //xbee.write(lbuf);
-  //xbee.write(packet);
-  //xbee.write(PACKET_END_TOKEN);
-
-  // Send payload to serial all at once in the hopes that the
-  // XBee will place it in a single network packet.
-  // By default, data in XBee input buffer is sent when packet
-  // is full or 3 UART character transmission times have passed
-  // without activity.
-  // Note we omit null-termination character.
-  //size_t bufLength = packet.length() + 2;
-  size_t bufLength = packet.length() + 4;
-  char buf[bufLength];
-  //strcpy(&buf[1], packet.c_str());
-  strcpy(&buf[1], lbuf);
-  strcpy(&buf[3], packet.c_str());
-  buf[0] = PACKET_START_TOKEN;
-  buf[bufLength - 1] = PACKET_END_TOKEN;
-  xbee.write(buf);
+  transmitXBee(xbeeConfig.destination, packet);
 
   // Hardware serial interface is operated through ISRs.
   // Give dedicated time here for those ISRs to run as any
@@ -689,17 +1124,38 @@ void sendXBee(const String packet)
   // garbage appearing in the data packets.  This is a
   // precaution and may not be necessary if the rest of the
   // code is well-behaved....
-  // Time: 1000*10/9600 ms per character @ 9600 baud, but add
-  // add extra time as there may be gaps between characters.
-  //delay(1000 * 15 * bufLength / 9600);
-  // Even better: flush() waits for Arduino serial output buffer
-  // to finish sending to the XBee.  Then add delay for XBee to
-  // upload data over network.
+  // flush() waits for Arduino serial output buffer to finish
+  // sending to the XBee.  Then add delay for XBee to upload data
+  // over network.
   xbee.flush();
   delay(100);
 }
 
 
+/* Passes the given packet to the XBee for transmission to the given
+   64-bit address (0xFFFF to broadcast), without waiting for it to
+   be sent.  Used directly for short replies. */
+void transmitXBee(const uint64_t dest, const String packet)
+{
+  // Transmit request: frame type, frame ID, 64-bit destination,
+  // 16-bit network address (0xFFFE: unknown), broadcast radius
+  // (0: maximum hops) and transmit options (0: XBee defaults),
+  // followed by the packet.
+  // Note we omit null-termination character.
+  uint8_t header[14];
+  header[0] = XBEE_TX_REQUEST;
+  header[1] = nextXBeeFrameID();
+  for (int k = 0; k < 8; k++) {
+    header[2+k] = (dest >> (8*(7-k))) & 0xFF;
+  }
+  header[10] = 0xFF;
+  header[11] = 0xFE;
+  header[12] = 0;
+  header[13] = 0;
+  sendXBeeFrame(header, sizeof(header), (const uint8_t *)packet.c_str(), packet.length());
+}
+
+
 /* Prevent the XBee buffer from being modified by ISR.
    Returns the prior hold state. */
 bool holdXBeeBuffer() {
@@ -738,10 +1194,21 @@ void resetXBeeBuffer() {
 }
 
 
-/* Removes buffer data before the first packet and or after the
-   last complete packet. The latter should be performed on a
-   buffer overrun as data beyond the last complete packet belongs
-   to a packet where data was thrown out. */
+/* Number of bytes in the XBee buffer (read without interference
+   from the ISR). */
+size_t getXBeeBufferCount() {
+  uint8_t oldSREG = SREG;  // Save interrupt status (among other things)
+  cli();  // Disable interrupts
+  size_t n = xbeeBufferElements;
+  SREG = oldSREG;  // Restore interrupt status
+  return n;
+}
+
+
+/* Removes buffer data before the first frame and or from the
+   start of the last frame onward. The latter should be performed on
+   a buffer overrun as the last frame is likely the one where data
+   was thrown out. */
 void cleanXBeeBuffer(const bool cleanStart, const bool cleanEnd) {
   // Prevent ISR from modifying buffer during this routine.
   // Will return to previous hold state.
@@ -753,117 +1220,154 @@ void cleanXBeeBuffer(const bool cleanStart, const bool cleanEnd) {
     if (!wasHeld) releaseXBeeBuffer();
     return;
   }
-  // Remove everything prior to first start token
+  // Remove everything prior to first start delimiter
   if (cleanStart) {
-    while ((xbeeBufferElements > 0) && (xbeeBuffer[(xbeeBufferHead - xbeeBufferElements) % XBEE_BUFFER_SIZE] != PACKET_START_TOKEN)) {
+    while ((xbeeBufferElements > 0) && ((uint8_t)xbeeBuffer[(xbeeBufferHead - xbeeBufferElements) % XBEE_BUFFER_SIZE] != XBEE_FRAME_START)) {
       xbeeBufferElements--;
     }
   }
-  // Remove everything after last end token
+  // Remove everything from last start delimiter onward
   if (cleanEnd) {
-    while ((xbeeBufferElements > 0) && (xbeeBuffer[(xbeeBufferHead - 1) % XBEE_BUFFER_SIZE] != PACKET_END_TOKEN)) {
+    while (xbeeBufferElements > 0) {
       xbeeBufferElements--;
       xbeeBufferHead = (xbeeBufferHead - 1) % XBEE_BUFFER_SIZE;
+      if ((uint8_t)xbeeBuffer[xbeeBufferHead] == XBEE_FRAME_START) break;
     }
   }
   if (!wasHeld) releaseXBeeBuffer();
 }
 
 
-/* Returns the next available XBee data packet from the XBee buffer,
-   or an empty string if no packet is available. */
-String getXBeeBufferPacket() {
-  const String EMPTY_STRING = "";
-
-  // Ensure buffer is not modified while in this routine.
-  // At return, we will return held state back to original state.
-  bool wasHeld = holdXBeeBuffer();
-
-  //noInterrupts();
-  //const bool hold = xbeeBufferHold;
-  //if (!hold) xBeeBufferHold = true;
-  //interrupts();
-
-  // Empty buffer
-  if (xbeeBufferElements == 0) {
-    if (!wasHeld) releaseXBeeBuffer();
-    return EMPTY_STRING;
-  }
-
-  // Loop over buffer until we find a valid packet
-  // or we reach the end.
+/* Reads the next complete API frame from the XBee buffer (which
+   must be held), removing it from the buffer.  Places the frame data
+   in the given buffer and returns its length.  Returns 0 if no
+   complete frame is available (a frame may still be arriving).
+   Invalid frames are dropped. */
+size_t getXBeeBufferFrame(uint8_t *frame, const size_t frameLen) {
   while (1) {
-    
-    // Remove everything prior to first start token
-    while ((xbeeBufferElements > 0) && (xbeeBuffer[(xbeeBufferHead - xbeeBufferElements) % XBEE_BUFFER_SIZE] != PACKET_START_TOKEN)) {
+    // Remove everything prior to first start delimiter
+    while ((xbeeBufferElements > 0) && ((uint8_t)xbeeBuffer[(xbeeBufferHead - xbeeBufferElements) % XBEE_BUFFER_SIZE] != XBEE_FRAME_START)) {
       xbeeBufferElements--;
     }
-    
-    // (Nearly) empty buffer: no valid packets
-    if (xbeeBufferElements < 2) break;
-    
-    // Look for end token
-    size_t endLoc = (xbeeBufferHead - xbeeBufferElements + 1) % XBEE_BUFFER_SIZE;
-    while ((endLoc != xbeeBufferHead) && (xbeeBuffer[endLoc] != PACKET_END_TOKEN)) {
-      endLoc = (endLoc + 1) % XBEE_BUFFER_SIZE;
-    }
-    if (endLoc == xbeeBufferHead) break;
-    
-    // Search backwards from end for start token, in case there are multiple
-    size_t startLoc = (endLoc - 1) % XBEE_BUFFER_SIZE;
-    while (xbeeBuffer[startLoc] != PACKET_START_TOKEN) {
-      startLoc = (startLoc - 1) % XBEE_BUFFER_SIZE;
-    }
-    if (startLoc != (xbeeBufferHead - xbeeBufferElements) % XBEE_BUFFER_SIZE) {
-      xbeeBufferElements = (xbeeBufferHead - startLoc) % XBEE_BUFFER_SIZE;
-      Serial.println(F("Warning: Invalid XBee data dropped (possible buffer overrun)."));
+    if (xbeeBufferElements == 0) return 0;
+
+    // Unescape the frame following the delimiter: length (2 bytes),
+    // frame data and checksum
+    const size_t startLoc = (xbeeBufferHead - xbeeBufferElements) % XBEE_BUFFER_SIZE;
+    size_t loc = (startLoc + 1) % XBEE_BUFFER_SIZE;
+    size_t pos = 0;
+    uint16_t len = 0;
+    uint8_t checksum = 0;
+    bool complete = false;
+    bool valid = false;
+    bool truncated = false;
+    while (loc != xbeeBufferHead) {
+      uint8_t b = xbeeBuffer[loc];
+      // Start of the next frame: current frame is incomplete
+      if (b == XBEE_FRAME_START) {
+        truncated = true;
+        break;
+      }
+      if (b == XBEE_FRAME_ESCAPE) {
+        loc = (loc + 1) % XBEE_BUFFER_SIZE;
+        if (loc == xbeeBufferHead) break;
+        b = xbeeBuffer[loc] ^ 0x20;
+      }
+      loc = (loc + 1) % XBEE_BUFFER_SIZE;
+      if (pos < 2) {
+        len = (len << 8) | b;
+        if ((pos == 1) && ((len == 0) || (len > frameLen))) {
+          truncated = true;
+          break;
+        }
+      } else if (pos < 2 + (size_t)len) {
+        frame[pos - 2] = b;
+        checksum += b;
+      } else {
+        complete = true;
+        valid = ((uint8_t)(checksum + b) == 0xFF);
+        break;
+      }
+      pos++;
     }
 
-    // At this point, startLoc should point to start token, endLoc points
-    // to end token, and everything in between should be a two-character
-    // hexadecimal packet length (mod 256) followed by the packet.
-    
-    // Ignore empty packets
-    if ((endLoc - startLoc) % XBEE_BUFFER_SIZE <= 2) {
-      xbeeBufferElements = (xbeeBufferHead - endLoc + 1) % XBEE_BUFFER_SIZE;
-      Serial.println(F("Warning: Dropped empty XBee packet."));
+    // Incomplete frame still arriving: leave in buffer
+    if (!complete && !truncated) return 0;
+
+    // Remove frame (or just its start delimiter, if it was cut
+    // short by the next frame) from the buffer
+    if (truncated) {
+      xbeeBufferElements--;
+      Serial.println(F("Warning: Dropped incomplete XBee frame (possible buffer overrun)."));
       continue;
     }
-    
-    // Ignore packets missing length prefix
-    if ((endLoc - startLoc) % XBEE_BUFFER_SIZE <= 4) {
-      xbeeBufferElements = (xbeeBufferHead - endLoc + 1) % XBEE_BUFFER_SIZE;
-      Serial.println(F("Warning: Dropped invalid XBee packet."));
+    xbeeBufferElements = (xbeeBufferHead - loc) % XBEE_BUFFER_SIZE;
+    if (!valid) {
+      Serial.println(F("Warning: Dropped invalid XBee frame (checksum mismatch)."));
       continue;
     }
-    
-    // Check packet length.  First two characters should be
-    // remaining packet length in hexadecimal (mod 256).
-    const size_t packetLen = ((endLoc - startLoc) % XBEE_BUFFER_SIZE) - 3;
-    char lbuf[3];
-    sprintf(lbuf,"%02X",(uint8_t)(packetLen % 256));
-    lbuf[2] = '\0';
-    if ((xbeeBuffer[(startLoc + 1) % XBEE_BUFFER_SIZE] != lbuf[0])
-        || (xbeeBuffer[(startLoc + 2) % XBEE_BUFFER_SIZE] != lbuf[1])) {
-      xbeeBufferElements = (xbeeBufferHead - endLoc + 1) % XBEE_BUFFER_SIZE;
-      Serial.println(F("Warning: Dropped invalid XBee packet (length mismatch)."));
-      continue;
+    // Arrival time, if still recorded (most recent first)
+    xbeePacketTimed = false;
+    for (uint8_t k = 1; k <= XBEE_FRAME_TIMES; k++) {
+      uint8_t j = (xbeeFrameNext + XBEE_FRAME_TIMES - k) % XBEE_FRAME_TIMES;
+      if (xbeeFrameStart[j] != startLoc) continue;
+      xbeePacketTimed = true;
+      xbeePacketMicros = xbeeFrameMicros[j];
+      break;
     }
-    
-    // We have found a valid packet: extract packet characters, excluding
-    // start & end tokens and two-character packet length prefix.
-    const size_t packetBufSize = ((endLoc - startLoc) % XBEE_BUFFER_SIZE) - 2;
-    char packetBuf[packetBufSize];
-    for (size_t pos = 0; pos < packetBufSize - 1; pos++) {
-      packetBuf[pos] = xbeeBuffer[(startLoc + 3 + pos) % XBEE_BUFFER_SIZE];
+    return len;
+  }
+}
+
+
+/* Returns the next available XBee data packet from the XBee buffer,
+   or an empty string if no packet is available.  The sender's
+   64-bit address is placed in source, if given.  Transmit status
+   frames in the buffer are checked (with a warning for any failed
+   deliveries) and other frames are ignored. */
+String getXBeeBufferPacket(uint64_t *source) {
+  const String EMPTY_STRING = "";
+
+  // Ensure buffer is not modified while in this routine.
+  // At return, we will return held state back to original state.
+  bool wasHeld = holdXBeeBuffer();
+
+  // Loop over buffer until we find a data packet
+  // or we reach the end.
+  uint8_t frame[XBEE_MAX_FRAME_LENGTH + 1];
+  size_t len;
+  while ((len = getXBeeBufferFrame(frame, XBEE_MAX_FRAME_LENGTH)) > 0) {
+    switch (frame[0]) {
+      // RX packet: frame type, 64-bit source, 16-bit network
+      // address, receive options, followed by the packet
+      case XBEE_RX_PACKET:
+        if (len <= 12) {
+          Serial.println(F("Warning: Dropped empty XBee packet."));
+          break;
+        }
+        if (source != NULL) {
+          *source = 0;
+          for (int k = 0; k < 8; k++) *source = (*source << 8) | frame[1+k];
+        }
+        frame[len] = '\0';
+        if (!wasHeld) releaseXBeeBuffer();
+        return String((const char *)&frame[12]);
+      // Transmit status: frame type, frame ID, 16-bit network
+      // address, retry count, delivery status, discovery status
+      case XBEE_TX_STATUS:
+        if ((len >= 6) && (frame[5] != 0)) {
+          Serial.print(F("Warning: XBee packet delivery failed (status 0x"));
+          Serial.print(frame[5],HEX);
+          Serial.println(F(")."));
+        }
+        break;
+      // Other frames (e.g. responses to AT commands): ignore
+      default:
+        break;
     }
-    packetBuf[packetBufSize - 1] = '\0';
-    xbeeBufferElements = (xbeeBufferHead - endLoc + 1) % XBEE_BUFFER_SIZE;
-    if (!wasHeld) releaseXBeeBuffer();
-    return packetBuf;
   }
   
-  // If we reach here, we did not find a valid packet
+  // If we reach here, we did not find a data packet
   if (!wasHeld) releaseXBeeBuffer();
   return EMPTY_STRING;
 }
@@ -890,6 +1394,7 @@ void processXBee() {
     Serial.flush();
     cleanXBeeBuffer(true, true);
     xbeeBufferOverrun = 0;
+    xbeeCreditOverrun = true;
   }
 
   // Timing note: The web upload routines can take a long time
@@ -901,15 +1406,34 @@ void processXBee() {
   // Cycle over packets until we find a valid one.
   String packet;
   size_t nuploaded = 0;
-  while ((packet = getXBeeBufferPacket()).length() > 0) {
-    Serial.print(F("XBee packet: "));
+  while ((packet = getXBeeBufferPacket(&xbeeSource)).length() > 0) {
+    Serial.print(F("XBee packet from "));
+    Serial.print(uint64ToHexString(xbeeSource));
+    Serial.print(F(": "));
     Serial.println(packet);
     Serial.flush();
+    // Settings are sent in two packets: discard a half from a
+    // different PODD
+    if (((packet.charAt(0) == 'S') || (packet.charAt(0) == 'T')) && (xbeeSource != setSource)) {
+      set1 = "";
+      set2 = "";
+      setSource = xbeeSource;
+    }
     switch (packet.charAt(0)) {
+      // Readings are only queued for upload (see serviceUploadQueue())
       case 'V':
         if (!getModeCoord()) break;
         xbeeReading(packet);
-        nuploaded++;
+        break;
+      case 'W':
+        if (!getModeCoord()) break;
+        processSequencedReading(packet, xbeeSource);
+        break;
+      case 'A':
+        if (!getModeCoord()) processAckPacket(packet);
+        break;
+      case 'N':
+        if (!getModeCoord()) processRenumberPacket(packet);
         break;
       case 'R':
         if (!getModeCoord()) break;
@@ -1009,7 +1533,7 @@ void xbeeSettings(String incoming, String incoming2) {
   updateConfig(did, location, coordinator, project, rate, build, teardown, datetime, netid);
 }
 
-void xbeeReading(String incoming) {
+bool xbeeReading(String incoming) {
   String did, sensor, val, timestamp, datetime;
   int one, two, three, four, five;
 
@@ -1030,7 +1554,7 @@ void xbeeReading(String incoming) {
   //Serial.println(sensor);
   //Serial.println(val);
   //Serial.println(datetime);
-  postReading(did, sensor, val, timestamp, datetime);
+  return postReading(did, sensor, val, timestamp, datetime);
 }
 
 
@@ -1046,8 +1570,8 @@ void broadcastCoordinatorAddress() {
   uint32_t SL = (xbeeConfig.serialNumber >>  0) & 0xFFFFFFFF;
   
   // Zero-padded hex string.
-  char buff[18];
-  sprintf(buff,"D%08lX%08lX",SH,SL);
+  char buff[20];
+  sprintf(buff,"D%08lX%08lX,%X",SH,SL,updateXBeeCredit());
   sendXBee(buff);
 }
 
@@ -1055,7 +1579,7 @@ void broadcastCoordinatorAddress() {
 /* Parses an XBee destination broadcast packet and updates destination 
    if packet is valid and provides a new address. */
 void processDestinationPacket(const String packet) {
-  if ((packet.length() != 17) || (packet.charAt(0) != 'D')) {
+  if (((packet.length() != 17) && (packet.length() != 19)) || (packet.charAt(0) != 'D')) {
     Serial.println(F("Warning: Received invalid coordinator address broadcast (ignoring)."));
     return;
   }
@@ -1075,12 +1599,23 @@ void processDestinationPacket(const String packet) {
     }
   }
   
-  // Update destination address only if it has changed
+  // The broadcast address should be the sender's own
+  if (v != xbeeSource) {
+    Serial.println(F("Warning: Received coordinator address broadcast from another address (ignoring)."));
+    return;
+  }
+  if (!processCreditField(packet, 17)) {
+    Serial.println(F("Warning: Received invalid coordinator address broadcast (ignoring)."));
+    return;
+  }
+
+  // Update destination address only if it has changed.
+  // The XBee is not waited on (responses would land in the XBee
+  // buffer), so this only takes a few milliseconds.
   if (v != xbeeConfig.destination) {
     xbeeConfig.destination = v;
-    startXBeeCommandMode();
-    setXBeeDestination(xbeeConfig.destination);
-    stopXBeeCommandMode(true);
+    setXBeeDestination(xbeeConfig.destination, false);
+    setXBeeATParameter("WR", NULL, 0, false);
     Serial.print(F("Coordinator (destination) address updated: "));
     uint32_t DH = (xbeeConfig.destination >> 32) & 0xFFFFFFFF;
     uint32_t DL = (xbeeConfig.destination >>  0) & 0xFFFFFFFF;
@@ -1091,80 +1626,505 @@ void processDestinationPacket(const String packet) {
 }
 
 
-//--------------------------------------------------------------------------------------------- [Upload Support]
+/* Sets the coordinator's flow control credit from the XBee buffer
+   and upload queue use since it was last set (at most every
+   XBEE_CREDIT_INTERVAL [ms], as both the address and clock
+   broadcasts carry it).  Returns the credit. */
+uint8_t updateXBeeCredit() {
+  if ((xbeeCreditTime != 0) && (millis() - xbeeCreditTime < XBEE_CREDIT_INTERVAL)) return xbeeCredit;
+  xbeeCreditTime = millis();
 
-/* Loads network configuration information from EEPROM if available, 
-   otherwise sets default values. */
-void loadNetworkConfig() {
-  // Check config version
-  uint16_t version = (((uint16_t)EEPROM.read(EEPROM_NETWORK_ADDR + 0)) << 0)
-                     + (((uint16_t)EEPROM.read(EEPROM_NETWORK_ADDR + 1)) << 8);
+  bool wasHeld = holdXBeeBuffer();
+  size_t peak = xbeeBufferPeak;
+  xbeeBufferPeak = xbeeBufferElements;
+  if (!wasHeld) releaseXBeeBuffer();
 
-  // Load data if valid
-  if (version == NETWORK_CONFIG_VERSION) {
-    for (size_t k = 0; k < sizeof(networkConfig); k++) {
-      *((char*)&networkConfig + k) = EEPROM.read(EEPROM_NETWORK_ADDR + k);
-    }
-  } else {
-    networkConfig.version = NETWORK_CONFIG_VERSION;
-    networkConfig.flags = 0x00;
-    networkConfig.staticIP = 0;
-    networkConfig.dnsIP = 0x08080808;  // Google DNS: 8.8.8.8
-    networkConfig.gatewayIP = 0;
-    networkConfig.subnet = 0;
-    //saveNetworkConfig();
+  uint8_t queuePeak = uploadQueuePeak;
+  uploadQueuePeak = uploadQueueCount;
+
+  uint8_t credit = xbeeCredit;
+  if (xbeeCreditOverrun || (peak > XBEE_BUFFER_SIZE/2)
+      || (queuePeak > UPLOAD_QUEUE_SIZE/2) || (uploadSpill.pending > 0)) {
+    credit = (credit > 1) ? credit/2 : 1;
+  } else if ((peak < XBEE_BUFFER_SIZE/4) && (queuePeak < UPLOAD_QUEUE_SIZE/4)) {
+    credit = (credit + XBEE_CREDIT_STEP < XBEE_WINDOW) ? credit + XBEE_CREDIT_STEP : XBEE_WINDOW;
   }
+  xbeeCreditOverrun = false;
+  if (credit != xbeeCredit) {
+    Serial.print(F("XBee flow control credit: "));
+    Serial.print(credit);
+    Serial.print(F(" (buffer peak "));
+    Serial.print(peak);
+    Serial.print(F(" bytes, upload queue peak "));
+    Serial.print(queuePeak);
+    Serial.println(F(")."));
+  }
+  xbeeCredit = credit;
+  return xbeeCredit;
 }
 
 
-/* Saves network configuration information to EEPROM. */
-void saveNetworkConfig() {
-  for (size_t k = 0; k < sizeof(networkConfig); k++) {
-    // Put only writes byte if different from current EEPROM value
-    // (reduces EEPROM wear).  If configuration hasn't changed,
-    // this will not actually write anything.
-    EEPROM.put(EEPROM_NETWORK_ADDR + k, *((char*)&networkConfig + k));
+/* Parses the optional flow control credit (",<credit>") at the
+   given position of a coordinator broadcast packet.  Broadcasts
+   without one leave the drone's credit unchanged.  Returns false
+   if the field is not valid. */
+bool processCreditField(const String &packet, const int pos) {
+  if ((int)packet.length() == pos) return true;
+  char c = packet.charAt(pos+1);
+  uint8_t credit;
+  if ((c >= '0') && (c <= '9')) {
+    credit = c - '0';
+  } else if ((c >= 'A') && (c <= 'F')) {
+    credit = c - 'A' + 10;
+  } else {
+    return false;
+  }
+  if (((int)packet.length() != pos+2) || (packet.charAt(pos) != ',')
+      || (credit < 1) || (credit > XBEE_WINDOW)) return false;
+  if (credit != xbeeCredit) {
+    Serial.print(F("XBee flow control credit: "));
+    Serial.println(credit);
   }
+  xbeeCredit = credit;
+  xbeeCreditTime = millis();
+  return true;
 }
 
 
-void setNetworkFlags(uint8_t flags) {
-  networkConfig.flags = flags;
-}
-uint8_t getNetworkFlags() {
-  return networkConfig.flags;
+/* Number of readings a drone may currently have awaiting
+   acknowledgement: the coordinator's credit, if heard recently. */
+uint8_t getXBeeWindow() {
+  if ((xbeeCreditTime == 0) || (millis() - xbeeCreditTime > XBEE_CREDIT_TIMEOUT)) return XBEE_WINDOW;
+  return xbeeCredit;
 }
 
-void setNetworkStaticIP(uint32_t ip) {
-  networkConfig.staticIP = ip;
-}
-uint32_t getNetworkStaticIP() {
-  return networkConfig.staticIP;
-}
 
-void setNetworkGatewayIP(uint32_t ip) {
-  networkConfig.gatewayIP = ip;
-}
-uint32_t getNetworkGatewayIP() {
-  return networkConfig.gatewayIP;
+/* Parses the 4-digit hexadecimal field starting at the given
+   position of a packet.  Returns false if it is not valid. */
+bool parseHexField(const String &packet, const int pos, uint16_t &v) {
+  if ((int)packet.length() < pos + 4) return false;
+  v = 0;
+  for (int k = pos; k < pos + 4; k++) {
+    char c = packet.charAt(k);
+    if ((c >= '0') && (c <= '9')) {
+      v = (v << 4) + (uint8_t)(c - '0');
+    } else if ((c >= 'A') && (c <= 'F')) {
+      v = (v << 4) + (uint8_t)(c - 'A' + 10);
+    } else if ((c >= 'a') && (c <= 'f')) {
+      v = (v << 4) + (uint8_t)(c - 'a' + 10);
+    } else {
+      return false;
+    }
+  }
+  return true;
 }
 
-void setNetworkSubnetMask(uint32_t ip) {
-  networkConfig.subnet = ip;
-}
-uint32_t getNetworkSubnetMask() {
-  return networkConfig.subnet;
-}
 
-void setNetworkDNSServerIP(uint32_t ip) {
-  networkConfig.dnsIP = ip;
+/* Opens the drone's outbox of readings awaiting delivery to the
+   coordinator.  Readings left undelivered before a restart are sent
+   again under a new session. */
+void openXBeeOutbox() {
+  uint32_t pending;
+  long pos = openOutboxSD(pending);
+  if (pos < 0) {
+    Serial.println(F("Warning: No reading outbox; readings will be sent without acknowledgement."));
+    return;
+  }
+  xbeeOutbox.open = true;
+  startXBeeOutboxSession(pending, pos);
+  if (pending > 0) {
+    Serial.print(F("Reading outbox: "));
+    Serial.print(pending);
+    Serial.println(F(" readings awaiting delivery."));
+  }
 }
-uint32_t getNetworkDNSServerIP() {
-  return networkConfig.dnsIP;
+
+
+/* Starts a new session of sequence numbers for the drone's outbox,
+   counting from the oldest of the given number of undelivered
+   readings, at the given outbox position.  The session differs from
+   the previous one (and between startups) so the coordinator does
+   not mistake renumbered readings for ones it has already seen, and
+   is never 0 (the coordinator's "no session"). */
+void startXBeeOutboxSession(const uint16_t pending, const uint32_t pos) {
+  uint16_t session = (uint16_t)(micros() ^ getUTC() ^ (getUTC() >> 16) ^ xbeeConfig.serialNumber);
+  while ((session == 0) || (session == xbeeOutbox.session)) session++;
+  xbeeOutbox.session = session;
+  xbeeOutbox.acked = 0;
+  xbeeOutbox.sent = 0;
+  xbeeOutbox.written = pending;
+  xbeeOutbox.sendPos = pos;
+  xbeeOutbox.sacked = 0;
+  xbeeOutbox.ackTime = millis();
 }
 
 
-/* Sets the ethernet MAC address using the XBee serial number. */
+/* Queues a reading packet (without the "W,<session>,<sequence>,"
+   prefix) for delivery to the coordinator and sends what the window
+   allows.  Returns false if the outbox is not available. */
+bool queueXBeeReading(const String packet) {
+  if (!xbeeOutbox.open) return false;
+  if (appendOutboxSD(packet) < 0) {
+    Serial.println(F("Warning: Unable to write to reading outbox."));
+    return false;
+  }
+  xbeeOutbox.written++;
+  serviceXBeeOutbox();
+  return true;
+}
+
+
+/* Sends queued readings to the coordinator as far as the window of
+   unacknowledged readings allows, first resending those that have
+   gone unacknowledged for too long.  Called regularly on drones. */
+void serviceXBeeOutbox() {
+  if (!xbeeOutbox.open) return;
+
+  // No acknowledgement in time: resend the unacknowledged readings
+  // the coordinator has not reported receiving, under the same
+  // numbers (the acknowledgement may be what was lost)
+  if ((xbeeOutbox.sent != xbeeOutbox.acked)
+      && (millis() - xbeeOutbox.ackTime > XBEE_ACK_TIMEOUT)) {
+    uint16_t n = 0;
+    for (uint16_t seq = xbeeOutbox.acked; seq != xbeeOutbox.sent; seq++) {
+      uint16_t d = seq - xbeeOutbox.acked;
+      if ((d > 0) && (xbeeOutbox.sacked & (1UL << (d-1)))) continue;
+      if (sendXBeeOutboxReading(seq, xbeeOutbox.outboxPos[seq % XBEE_WINDOW]) < 0) return;
+      n++;
+    }
+    Serial.print(F("Warning: Readings not acknowledged by coordinator; resent "));
+    Serial.print(n);
+    Serial.println(F("."));
+    xbeeOutbox.resent += n;
+    xbeeOutbox.ackTime = millis();
+  }
+
+  // New readings, as far as the coordinator's credit allows
+  uint8_t window = getXBeeWindow();
+  unsigned long spacing = (unsigned long)(XBEE_WINDOW - window) * XBEE_PACE_STEP;
+  while ((xbeeOutbox.sent != xbeeOutbox.written)
+         && ((uint16_t)(xbeeOutbox.sent - xbeeOutbox.acked) < window)
+         && (millis() - xbeeOutbox.sendTime >= spacing)) {
+    if (xbeeOutbox.sent == xbeeOutbox.acked) xbeeOutbox.ackTime = millis();
+    xbeeOutbox.outboxPos[xbeeOutbox.sent % XBEE_WINDOW] = xbeeOutbox.sendPos;
+    long next = sendXBeeOutboxReading(xbeeOutbox.sent, xbeeOutbox.sendPos);
+    if (next < 0) return;
+    xbeeOutbox.sent++;
+    xbeeOutbox.sendPos = next;
+    xbeeOutbox.sendTime = millis();
+  }
+}
+
+
+/* Sends the outbox reading at the given file position to the
+   coordinator with the given sequence number.  Returns the position
+   of the following reading, or -1 if the outbox could not be read. */
+long sendXBeeOutboxReading(const uint16_t seq, const uint32_t pos) {
+  String line;
+  long next = readOutboxSD(pos, line);
+  if (next < 0) {
+    Serial.println(F("Warning: Unable to read from reading outbox."));
+    return -1;
+  }
+  char prefix[13];
+  sprintf(prefix,"W,%04X,%04X,",xbeeOutbox.session,seq);
+  sendXBee(prefix + line);
+  return next;
+}
+
+
+/* Parses a coordinator's acknowledgement packet ("A,<session>,
+   <sequence>[,<bitmap>]") and releases the readings it covers from
+   the outbox.  Readings after those that the bitmap reports as
+   received are not resent. */
+void processAckPacket(const String packet) {
+  uint16_t session, next, hi = 0, lo = 0;
+  if (((packet.length() != 11) && (packet.length() != 20))
+      || (packet.charAt(1) != ',') || (packet.charAt(6) != ',')
+      || !parseHexField(packet, 2, session) || !parseHexField(packet, 7, next)
+      || ((packet.length() == 20) && ((packet.charAt(11) != ',')
+          || !parseHexField(packet, 12, hi) || !parseHexField(packet, 16, lo)))) {
+    Serial.println(F("Warning: Received invalid acknowledgement (ignoring)."));
+    return;
+  }
+  if (!xbeeOutbox.open || (session != xbeeOutbox.session)) return;
+  // Must not acknowledge readings not yet sent
+  uint16_t n = next - xbeeOutbox.acked;
+  if (n > (uint16_t)(xbeeOutbox.sent - xbeeOutbox.acked)) return;
+  xbeeOutbox.sacked = ((uint32_t)hi << 16) | lo;
+  if (n == 0) return;
+  xbeeOutbox.acked = next;
+  xbeeOutbox.ackTime = millis();
+  // Record delivery in the outbox (file position of the next
+  // undelivered reading)
+  uint32_t pos = (xbeeOutbox.acked == xbeeOutbox.sent)
+                 ? xbeeOutbox.sendPos : xbeeOutbox.outboxPos[xbeeOutbox.acked % XBEE_WINDOW];
+  if (markOutboxSD(pos)) xbeeOutbox.sendPos = 0;
+}
+
+
+/* Parses a coordinator's renumber request ("N,<session>"), sent when
+   it does not know the drone's session (it has restarted or forgotten
+   the drone), and renumbers the unacknowledged readings in a new
+   session starting from the oldest. */
+void processRenumberPacket(const String packet) {
+  uint16_t session;
+  if ((packet.length() != 6) || (packet.charAt(1) != ',') || !parseHexField(packet, 2, session)) {
+    Serial.println(F("Warning: Received invalid renumber request (ignoring)."));
+    return;
+  }
+  if (!xbeeOutbox.open || (session != xbeeOutbox.session)) return;
+  uint16_t n = xbeeOutbox.sent - xbeeOutbox.acked;
+  Serial.print(F("Warning: Coordinator does not know the reading session; renumbering "));
+  Serial.print(n);
+  Serial.println(F("."));
+  xbeeOutbox.resent += n;
+  uint32_t pos = (xbeeOutbox.acked == xbeeOutbox.sent)
+                 ? xbeeOutbox.sendPos : xbeeOutbox.outboxPos[xbeeOutbox.acked % XBEE_WINDOW];
+  startXBeeOutboxSession(xbeeOutbox.written - xbeeOutbox.acked, pos);
+}
+
+
+/* Slot of the node index to start looking for the given drone in. */
+uint8_t nodeSlot(const uint64_t source) {
+  uint32_t h = (uint32_t)source ^ (uint32_t)(source >> 32);
+  h ^= h >> 16;
+  h ^= h >> 8;
+  return h & (XBEE_NODE_SLOTS - 1);
+}
+
+
+/* Returns the coordinator's sequence record for the given drone,
+   replacing the least recently heard one if the drone is new and
+   the table is full.  Drones are found through a small open-addressed
+   hash index, so the lookup does not depend on the number of drones. */
+NodeSequence *getNodeSequence(const uint64_t source) {
+  uint8_t slot = nodeSlot(source);
+  while (nodeIndex[slot] >= 0) {
+    if (nodeSequences[nodeIndex[slot]].source == source) return &nodeSequences[nodeIndex[slot]];
+    slot = (slot + 1) & (XBEE_NODE_SLOTS - 1);
+  }
+
+  // New drone: use a free record, or forget the least recently heard
+  int8_t k;
+  if (nodeCount < XBEE_MAX_NODES) {
+    k = nodeCount++;
+  } else {
+    k = 0;
+    for (int8_t j = 1; j < XBEE_MAX_NODES; j++) {
+      if (millis() - nodeSequences[j].heard > millis() - nodeSequences[k].heard) k = j;
+    }
+    // Remove from index, moving any later entries of the same probe
+    // sequence back into the gap
+    uint8_t gap = nodeSlot(nodeSequences[k].source);
+    while (nodeIndex[gap] != k) gap = (gap + 1) & (XBEE_NODE_SLOTS - 1);
+    nodeIndex[gap] = -1;
+    uint8_t j = (gap + 1) & (XBEE_NODE_SLOTS - 1);
+    while (nodeIndex[j] >= 0) {
+      uint8_t home = nodeSlot(nodeSequences[nodeIndex[j]].source);
+      // Entry may move back if its home slot is not in (gap, j]
+      if (((j - home) & (XBEE_NODE_SLOTS - 1)) >= ((j - gap) & (XBEE_NODE_SLOTS - 1))) {
+        nodeIndex[gap] = nodeIndex[j];
+        nodeIndex[j] = -1;
+        gap = j;
+      }
+      j = (j + 1) & (XBEE_NODE_SLOTS - 1);
+    }
+    // Slot for the new drone may have changed
+    slot = nodeSlot(source);
+    while (nodeIndex[slot] >= 0) slot = (slot + 1) & (XBEE_NODE_SLOTS - 1);
+  }
+  nodeIndex[slot] = k;
+  NodeSequence *node = &nodeSequences[k];
+  *node = NodeSequence();
+  node->source = source;
+  node->heard = millis();
+  return node;
+}
+
+
+/* Handles a drone's sequenced reading packet on the coordinator.
+   Readings already queued for upload are dropped, and the rest are
+   queued whether or not they arrive in order: the record keeps the
+   next reading expected along with a bitmap of the readings after it
+   that have been queued.  Every packet within the window is
+   acknowledged with both (see top of file), so the drone only resends
+   what is missing.  A new session is only taken up from its reading 0:
+   otherwise (or for the session just replaced, whose late readings
+   would reset the record) the drone is asked to renumber.  Returns
+   true if the reading was queued. */
+bool processSequencedReading(const String packet, const uint64_t source) {
+  uint16_t session, seq;
+  if ((packet.length() < 13) || (packet.charAt(1) != ',') || (packet.charAt(6) != ',')
+      || (packet.charAt(11) != ',')
+      || !parseHexField(packet, 2, session) || !parseHexField(packet, 7, seq)) {
+    Serial.println(F("Warning: Received invalid reading packet (ignoring)."));
+    return false;
+  }
+  NodeSequence *node = getNodeSequence(source);
+  node->heard = millis();
+  // New session: readings are numbered from 0
+  if (session != node->session) {
+    if ((seq != 0) || (session == 0) || (session == node->lastSession)) {
+      char renumber[8];
+      sprintf(renumber,"N,%04X",session);
+      transmitXBee(source, renumber);
+      return false;
+    }
+    node->lastSession = node->session;
+    node->session = session;
+    node->next = 0;
+    node->ahead = 0;
+    node->highest = 0;
+  }
+
+  // Position relative to the next reading expected
+  uint16_t d = seq - node->next;
+  bool queued = false;
+  if ((d > XBEE_NODE_WINDOW) && (d < 0x8000)) {
+    // Too far ahead to track: drone will send it again
+    return false;
+  } else if ((d >= 0x8000) || ((d > 0) && (node->ahead & (1UL << (d-1))))) {
+    node->duplicates++;
+  } else {
+    if (xbeeReading("V," + packet.substring(12))) {
+      queued = true;
+      node->received++;
+      // Arrived after a later reading
+      if ((uint16_t)(seq - node->highest) >= 0x8000) {
+        node->reordered++;
+        if (node->missing > 0) node->missing--;
+      }
+      // Readings skipped over
+      if ((uint16_t)(seq - node->highest) < 0x8000) {
+        node->missing += (uint16_t)(seq - node->highest);
+        node->highest = seq + 1;
+      }
+      if (d == 0) {
+        // Advance past this and any readings already queued after it
+        bool have;
+        do {
+          node->next++;
+          have = node->ahead & 1;
+          node->ahead >>= 1;
+        } while (have);
+      } else {
+        node->ahead |= (1UL << (d-1));
+      }
+    }
+  }
+
+  // Acknowledge everything queued so far
+  char ack[22];
+  sprintf(ack,"A,%04X,%04X,%08lX",node->session,node->next,node->ahead);
+  transmitXBee(source, ack);
+  return queued;
+}
+
+
+/* Writes the coordinator's per-drone delivery counters to serial:
+   readings queued for upload, duplicates dropped, readings skipped over that
+   have not (yet) arrived, and readings that arrived out of order. */
+void printXBeeNodeStats() {
+  if (!getModeCoord()) return;
+  Serial.print(F("XBee drones: "));
+  Serial.println(nodeCount);
+  for (int8_t k = 0; k < nodeCount; k++) {
+    NodeSequence &node = nodeSequences[k];
+    Serial.print(F("  "));
+    Serial.print(uint64ToHexString(node.source));
+    Serial.print(F(": received "));
+    Serial.print(node.received);
+    Serial.print(F(", duplicates "));
+    Serial.print(node.duplicates);
+    Serial.print(F(", missing "));
+    Serial.print(node.missing);
+    Serial.print(F(", reordered "));
+    Serial.print(node.reordered);
+    if (node.received > 0) {
+      Serial.print(F(" (loss "));
+      Serial.print(100.0 * node.missing / (node.received + node.missing),1);
+      Serial.print(F("%)"));
+    }
+    Serial.println();
+  }
+}
+
+
+//--------------------------------------------------------------------------------------------- [Upload Support]
+
+/* Loads network configuration information from EEPROM if available, 
+   otherwise sets default values. */
+void loadNetworkConfig() {
+  // Check config version
+  uint16_t version = (((uint16_t)EEPROM.read(EEPROM_NETWORK_ADDR + 0)) << 0)
+                     + (((uint16_t)EEPROM.read(EEPROM_NETWORK_ADDR + 1)) << 8);
+
+  // Load data if valid
+  if (version == NETWORK_CONFIG_VERSION) {
+    for (size_t k = 0; k < sizeof(networkConfig); k++) {
+      *((char*)&networkConfig + k) = EEPROM.read(EEPROM_NETWORK_ADDR + k);
+    }
+  } else {
+    networkConfig.version = NETWORK_CONFIG_VERSION;
+    networkConfig.flags = 0x00;
+    networkConfig.staticIP = 0;
+    networkConfig.dnsIP = 0x08080808;  // Google DNS: 8.8.8.8
+    networkConfig.gatewayIP = 0;
+    networkConfig.subnet = 0;
+    //saveNetworkConfig();
+  }
+}
+
+
+/* Saves network configuration information to EEPROM. */
+void saveNetworkConfig() {
+  for (size_t k = 0; k < sizeof(networkConfig); k++) {
+    // Put only writes byte if different from current EEPROM value
+    // (reduces EEPROM wear).  If configuration hasn't changed,
+    // this will not actually write anything.
+    EEPROM.put(EEPROM_NETWORK_ADDR + k, *((char*)&networkConfig + k));
+  }
+}
+
+
+void setNetworkFlags(uint8_t flags) {
+  networkConfig.flags = flags;
+}
+uint8_t getNetworkFlags() {
+  return networkConfig.flags;
+}
+
+void setNetworkStaticIP(uint32_t ip) {
+  networkConfig.staticIP = ip;
+}
+uint32_t getNetworkStaticIP() {
+  return networkConfig.staticIP;
+}
+
+void setNetworkGatewayIP(uint32_t ip) {
+  networkConfig.gatewayIP = ip;
+}
+uint32_t getNetworkGatewayIP() {
+  return networkConfig.gatewayIP;
+}
+
+void setNetworkSubnetMask(uint32_t ip) {
+  networkConfig.subnet = ip;
+}
+uint32_t getNetworkSubnetMask() {
+  return networkConfig.subnet;
+}
+
+void setNetworkDNSServerIP(uint32_t ip) {
+  networkConfig.dnsIP = ip;
+}
+uint32_t getNetworkDNSServerIP() {
+  return networkConfig.dnsIP;
+}
+
+
+/* Sets the ethernet MAC address using the XBee serial number. */
 void initMACAddress() {
   // Use XBee's serial number for ethernet MAC address
   // (as it does not have its own). Serial number should
@@ -1295,6 +2255,12 @@ bool ethernetBegin(int attempts) {
   //digitalWrite(ETHERNET_EN,HIGH);
   //delay(10);
   
+  // Posts, DNS queries and NTP requests awaiting a response do not
+  // survive the reset
+  resetUploadSockets();
+  resetDNSQuery();
+  resetNTPUpdate();
+
   // Reset ethernet chip
   // WIZnet W5100 documentation says this needs to be pulled low for
   // as short as 2us to reinitialize all internal registers to their
@@ -1434,9 +2400,11 @@ void ethernetMaintain() {
 }
 
 void saveReading(String lstr, String rstr, String atstr, String gtstr, String sstr, String c2str, String p1str, String p2str, String cstr) {
-  time_t utc = getUTC();
+  // Whole-second unix timestamp, and local date/time to the millisecond
+  uint16_t ms;
+  time_t utc = getUTC(ms);
   String TS(utc);
-  String DT = getDBDateTimeString(utc);
+  String DT = getDBDateTimeString(utc, ms);
   // Use local time in log file, but also include unix timestamp
   String sensorData = (TS + ", " + DT + ", " + lstr + ", " + rstr + ", " + atstr + ", " + gtstr + ", " + sstr + ", " + c2str + ", " + p1str + ", " + p2str + ", " + cstr);
   logDataSD(sensorData);
@@ -1461,35 +2429,221 @@ void saveReading(String lstr, String rstr, String atstr, String gtstr, String ss
     postReading(getDevID(), "CO", cstr, TS, DT);
 }
 
-void postReading(String DID, String ST, String R, String TS, String DT)
+/* Uploads a reading to the server (coordinator) or sends it to the
+   coordinator (drones).  On the coordinator, the reading is only
+   placed in the upload queue (see serviceUploadQueue()).  Returns
+   false if the reading could not be queued or sent. */
+bool postReading(String DID, String ST, String R, String TS, String DT)
 {
   #ifdef DEBUG
   writeDebugLog(ST);
   #endif
   if (getModeCoord()) {
-    // String in temp string is data to be submitted to MySQL
-    String amp = "&";
-    String content = "DeviceID=" + DID + amp + "SensorType=" + ST + amp + "Reading=" + R + amp + "TimeStamp=" + TS + amp + "ReadTime=" + DT;
-    //char p[200];
-    //content.toCharArray(p, 200);
-    //if (!postPage(getServer(), SERVER_PORT, SERVER_PAGE_NAME, p)) {
-    if (!postPage(getServer(), SERVER_PORT, SERVER_PAGE_NAME, content.c_str())) {
-      Serial.print("[" + String(packetsUploaded) + "] ");
-      Serial.println(F("Failed to upload sensor reading to remote."));
-      #ifdef DEBUG
-      writeDebugLog(F("Failed to upload sensor reading to remote. \n"));
-      #endif
-    } else {
-      Serial.print("[" + String(packetsUploaded) + "] ");
-      Serial.println(F("Uploaded sensor reading (") + ST + F(" @ ") + DID + F(")."));
-    }
+    return queueReading(DID, ST, R, TS, DT);
   } else {
-    String message = "V," + DID + "," + ST + "," + R + "," + TS + "," + DT;
-    sendXBee(message);
+    // Sequenced delivery through the outbox, if available
+    String message = DID + "," + ST + "," + R + "," + TS + "," + DT;
+    if (queueXBeeReading(message)) return true;
+    sendXBee("V," + message);
     delay(1000);
   }
+  return true;
+}
+
+
+/* Uploads a reading to the server.  If wait is false, does not wait
+   for the server's response (see postPage()).  Returns false if the
+   upload failed. */
+bool uploadReading(String DID, String ST, String R, String TS, String DT, const bool wait)
+{
+  // String in temp string is data to be submitted to MySQL
+  String amp = "&";
+  String content = "DeviceID=" + DID + amp + "SensorType=" + ST + amp + "Reading=" + R + amp + "TimeStamp=" + TS + amp + "ReadTime=" + DT;
+  //char p[200];
+  //content.toCharArray(p, 200);
+  //if (!postPage(getServer(), SERVER_PORT, SERVER_PAGE_NAME, p)) {
+  if (!postPage(getServer(), SERVER_PORT, SERVER_PAGE_NAME, content.c_str(), wait)) {
+    Serial.print("[" + String(packetsUploaded) + "] ");
+    Serial.println(F("Failed to upload sensor reading to remote."));
+    #ifdef DEBUG
+    writeDebugLog(F("Failed to upload sensor reading to remote. \n"));
+    #endif
+    return false;
+  } else {
+    Serial.print("[" + String(packetsUploaded) + "] ");
+    Serial.println(F("Uploaded sensor reading (") + ST + F(" @ ") + DID + F(")."));
+  }
+  return true;
+}
+
+
+/* Copies a string into a fixed-size record field.  Returns false if
+   it does not fit. */
+bool copyReadingField(char *field, const size_t size, const String &s) {
+  if (s.length() >= size) return false;
+  strcpy(field, s.c_str());
+  return true;
+}
+
+
+/* Fills an upload queue record with the given reading.  Returns false
+   if the reading does not fit a record. */
+bool fillQueuedReading(QueuedReading &r, const String &DID, const String &ST,
+                       const String &R, const String &TS, const String &DT) {
+  if ((TS.length() == 0) || (TS.length() > 10)) return false;
+  uint32_t ts = 0;
+  for (size_t k = 0; k < TS.length(); k++) {
+    char c = TS.charAt(k);
+    if ((c < '0') || (c > '9')) return false;
+    ts = 10*ts + (c - '0');
+  }
+  // Must reproduce the timestamp exactly
+  if (String(ts) != TS) return false;
+  r.timestamp = ts;
+  r.spillPos = 0;
+  r.state = QUEUED_WAITING;
+  return copyReadingField(r.did, sizeof(r.did), DID)
+         && copyReadingField(r.sensor, sizeof(r.sensor), ST)
+         && copyReadingField(r.value, sizeof(r.value), R)
+         && copyReadingField(r.datetime, sizeof(r.datetime), DT);
+}
+
+
+/* Fills an upload queue record from a reading spilled to the SD card
+   ("<device ID>,<sensor>,<value>,<timestamp>,<date/time>").  Returns
+   false if the line is not a valid reading. */
+bool parseQueuedReading(QueuedReading &r, const String &line) {
+  int one = line.indexOf(',') + 1;
+  int two = line.indexOf(',', one) + 1;
+  int three = line.indexOf(',', two) + 1;
+  int four = line.indexOf(',', three) + 1;
+  if ((one == 0) || (two == 0) || (three == 0) || (four == 0)) return false;
+  return fillQueuedReading(r, line.substring(0, one - 1), line.substring(one, two - 1),
+                           line.substring(two, three - 1), line.substring(three, four - 1),
+                           line.substring(four));
+}
+
+
+/* Opens the SD card spill file for readings that do not fit in the
+   coordinator's upload queue.  Readings left in it from before a
+   restart are uploaded first. */
+void openUploadSpill() {
+  uint32_t pending;
+  long pos = openOutboxSD(pending);
+  if (pos < 0) {
+    Serial.println(F("Warning: No upload spill file; readings will be dropped when the upload queue is full."));
+    return;
+  }
+  uploadSpill.open = true;
+  uploadSpill.readPos = pos;
+  uploadSpill.pending = pending;
+  if (pending > 0) {
+    Serial.print(F("Upload spill: "));
+    Serial.print(pending);
+    Serial.println(F(" readings awaiting upload."));
+  }
+}
+
+
+/* Queues a reading for upload to the server by serviceUploadQueue().
+   Once the queue is full, readings are spilled to the SD card
+   (keeping their order); a reading too large for a queue record is
+   uploaded immediately instead.  Returns false if the reading could
+   be neither queued nor uploaded. */
+bool queueReading(String DID, String ST, String R, String TS, String DT)
+{
+  QueuedReading r;
+  if (!fillQueuedReading(r, DID, ST, R, TS, DT)) return uploadReading(DID, ST, R, TS, DT);
+  if ((uploadQueueCount < UPLOAD_QUEUE_SIZE) && (uploadSpill.pending == 0)) {
+    uploadQueue[(uploadQueueHead + uploadQueueCount) % UPLOAD_QUEUE_SIZE] = r;
+    uploadQueueCount++;
+    if (uploadQueueCount > uploadQueuePeak) uploadQueuePeak = uploadQueueCount;
+    return true;
+  }
+  if (uploadSpill.open) {
+    if (appendOutboxSD(DID + "," + ST + "," + R + "," + TS + "," + DT) >= 0) {
+      uploadSpill.pending++;
+      return true;
+    }
+    Serial.println(F("Warning: Unable to write to upload spill file."));
+  }
+  Serial.println(F("Warning: Upload queue full; reading dropped."));
+  return false;
+}
+
+
+/* Posts the oldest queued reading not yet posted, first dropping the
+   readings the server has responded to and moving readings spilled to
+   the SD card into the queue as space allows.  Only one reading is
+   posted per call, and only if an upload socket is free; the server's
+   response is collected by later calls.  XBee packets thus keep being
+   taken off the buffer between uploads.  A reading the server did not
+   respond to is posted again; after a failed post, posting resumes
+   after UPLOAD_RETRY_INTERVAL [ms].  Called regularly on the
+   coordinator. */
+void serviceUploadQueue() {
+  serviceUploadSockets();
+  checkDNSQuery();
+
+  // Readings leave the queue in order, so a spilled reading is only
+  // recorded as uploaded once all those before it have been
+  while ((uploadQueueCount > 0) && (uploadQueue[uploadQueueHead].state == QUEUED_UPLOADED)) {
+    QueuedReading &r = uploadQueue[uploadQueueHead];
+    // Record upload of a spilled reading (file position after it)
+    if ((r.spillPos != 0) && markOutboxSD(r.spillPos)) uploadSpill.readPos = 0;
+    uploadQueueHead = (uploadQueueHead + 1) % UPLOAD_QUEUE_SIZE;
+    uploadQueueCount--;
+  }
+
+  while ((uploadQueueCount < UPLOAD_QUEUE_SIZE) && (uploadSpill.pending > 0)) {
+    String line;
+    long next = readOutboxSD(uploadSpill.readPos, line);
+    if (next < 0) {
+      Serial.println(F("Warning: Unable to read from upload spill file."));
+      uploadSpill.pending = 0;
+      break;
+    }
+    uploadSpill.readPos = next;
+    uploadSpill.pending--;
+    QueuedReading &r = uploadQueue[(uploadQueueHead + uploadQueueCount) % UPLOAD_QUEUE_SIZE];
+    if (!parseQueuedReading(r, line)) {
+      Serial.println(F("Warning: Invalid reading in upload spill file (ignoring)."));
+      continue;
+    }
+    r.spillPos = next;
+    uploadQueueCount++;
+  }
+
+  if (uploadRetry && (millis() - uploadRetryTime < UPLOAD_RETRY_INTERVAL)) return;
+  int8_t k = getFreeUploadSocket();
+  if (k < 0) return;
+  uint8_t n = 0, slot = 0;
+  for (; n < uploadQueueCount; n++) {
+    slot = (uploadQueueHead + n) % UPLOAD_QUEUE_SIZE;
+    if (uploadQueue[slot].state == QUEUED_WAITING) break;
+  }
+  if (n == uploadQueueCount) return;
+  QueuedReading &r = uploadQueue[slot];
+  if (!uploadReading(r.did, r.sensor, r.value, String(r.timestamp), r.datetime, false)) {
+    uploadRetry = true;
+    uploadRetryTime = millis();
+    return;
+  }
+  uploadRetry = false;
+  // Posted on socket k (postPage() takes the first free one); the
+  // outcome is set once the response arrives (see finishPostPage())
+  r.state = QUEUED_POSTED;
+  uploadSockets[k].reading = slot;
+}
+
+
+/* Number of readings waiting in the upload queue (not counting
+   those spilled to the SD card). */
+uint8_t getUploadQueueCount() {
+  return uploadQueueCount;
 }
 
+
 void updateRate(String DID, String ST, String R, String DT)
 {
   if (getModeCoord()) {
@@ -1534,8 +2688,334 @@ void updateConfig(String DID, String Location, String Coordinator, String Projec
   }
 }
 
+/* Hash of a host name identifying it in the DNS cache (never 0). */
+uint32_t hashHostName(const char *host) {
+  // FNV-1a, ignoring case
+  uint32_t h = 2166136261ul;
+  for (; *host != '\0'; host++) {
+    char c = *host;
+    if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+    h = (h ^ (uint8_t)c) * 16777619ul;
+  }
+  return (h != 0) ? h : 1;
+}
+
+
+/* Parses a dotted-decimal address.  Returns false if the host is
+   not one (i.e. is a name to be looked up). */
+bool parseIPAddress(const char *host, IPAddress &ip) {
+  uint16_t part = 0;
+  uint8_t n = 0, digits = 0;
+  for (const char *c = host; ; c++) {
+    if ((*c >= '0') && (*c <= '9')) {
+      part = 10*part + (*c - '0');
+      if ((part > 255) || (++digits > 3)) return false;
+    } else if (((*c == '.') || (*c == '\0')) && (digits > 0) && (n < 4)) {
+      ip[n++] = part;
+      if (*c == '\0') return (n == 4);
+      part = 0;
+      digits = 0;
+    } else {
+      return false;
+    }
+  }
+}
+
+
+/* Sends a DNS query (A record) for the given host name to the DNS
+   server, to be filled into the given cache entry once the response
+   arrives (see checkDNSQuery()).  Returns false if the query could
+   not be sent, including when another query is awaiting a response. */
+bool startDNSQuery(const char *host, const int8_t k) {
+  if (dnsQuery.entry >= 0) return false;
+  if (!ethernetHasIPAddress()) return false;
+  if (!dnsQuery.udp.begin(DNS_LOCAL_PORT)) {
+    Serial.println(F("Warning: Failed to open port to receive DNS response."));
+    return false;
+  }
+  dnsQuery.id = (uint16_t)micros();
+  // Header: recursion desired, one question
+  uint8_t header[12] = {(uint8_t)(dnsQuery.id >> 8), (uint8_t)dnsQuery.id,
+                        0x01,0x00, 0x00,0x01, 0x00,0x00, 0x00,0x00, 0x00,0x00};
+  if (!dnsQuery.udp.beginPacket(Ethernet.dnsServerIP(), DNS_PORT)) {
+    Serial.println(F("Warning: Failed to send DNS query."));
+    dnsQuery.udp.stop();
+    return false;
+  }
+  dnsQuery.udp.write(header, sizeof(header));
+  // Name as length-prefixed labels
+  for (const char *c = host; *c != '\0'; ) {
+    const char *dot = strchr(c, '.');
+    size_t len = (dot != NULL) ? (size_t)(dot - c) : strlen(c);
+    if ((len == 0) || (len > 63)) {
+      Serial.println(F("Warning: Invalid host name."));
+      dnsQuery.udp.stop();
+      return false;
+    }
+    dnsQuery.udp.write((uint8_t)len);
+    dnsQuery.udp.write((const uint8_t*)c, len);
+    c += (dot != NULL) ? len + 1 : len;
+  }
+  // End of name, type A, class IN
+  const uint8_t footer[5] = {0x00, 0x00,0x01, 0x00,0x01};
+  dnsQuery.udp.write(footer, sizeof(footer));
+  if (!dnsQuery.udp.endPacket()) {
+    Serial.println(F("Warning: Failed to send DNS query."));
+    dnsQuery.udp.stop();
+    return false;
+  }
+  dnsQuery.entry = k;
+  dnsQuery.sent = millis();
+  return true;
+}
+
+
+/* Position in a DNS packet just past the (possibly compressed)
+   name starting at the given position. */
+int skipDNSName(const uint8_t *packet, const int len, int pos) {
+  while (pos < len) {
+    uint8_t n = packet[pos];
+    if ((n & 0xC0) == 0xC0) return pos + 2;
+    if (n == 0) return pos + 1;
+    pos += n + 1;
+  }
+  return len;
+}
+
+
+/* Parses a DNS response to the query awaiting one, extracting the
+   first address and its TTL [s].  Returns 1 if an address was found,
+   -1 if the response has none (e.g. no such name), or 0 if the packet
+   is not a response to the query. */
+int8_t parseDNSResponse(const uint8_t *packet, const int len, uint32_t &ip, uint32_t &ttl) {
+  if (len < 12) return 0;
+  if ((((uint16_t)packet[0] << 8) | packet[1]) != dnsQuery.id) return 0;
+  if (!(packet[2] & 0x80)) return 0;
+  // Server failure, no such name, etc.
+  if ((packet[3] & 0x0F) != 0) return -1;
+  uint16_t questions = ((uint16_t)packet[4] << 8) | packet[5];
+  uint16_t answers = ((uint16_t)packet[6] << 8) | packet[7];
+  int pos = 12;
+  for (; questions > 0; questions--) pos = skipDNSName(packet, len, pos) + 4;
+  // The address may follow aliases (CNAME records): the shortest TTL
+  // along the way applies.
+  ttl = DNS_MAX_TTL;
+  for (; answers > 0; answers--) {
+    pos = skipDNSName(packet, len, pos);
+    if (pos + 10 > len) break;
+    uint16_t type = ((uint16_t)packet[pos] << 8) | packet[pos+1];
+    uint16_t cls = ((uint16_t)packet[pos+2] << 8) | packet[pos+3];
+    uint32_t t = ((uint32_t)packet[pos+4] << 24) | ((uint32_t)packet[pos+5] << 16)
+               | ((uint32_t)packet[pos+6] << 8) | packet[pos+7];
+    uint16_t n = ((uint16_t)packet[pos+8] << 8) | packet[pos+9];
+    pos += 10;
+    if (pos + n > len) break;
+    if (t < ttl) ttl = t;
+    if ((type == 1) && (cls == 1) && (n == 4)) {
+      ip = IPAddress(packet[pos], packet[pos+1], packet[pos+2], packet[pos+3]);
+      return (ip != 0) ? 1 : -1;
+    }
+    pos += n;
+  }
+  return -1;
+}
+
+
+/* Checks for the response to the DNS query sent by startDNSQuery()
+   and updates its cache entry once the response has arrived or
+   DNS_TIMEOUT [ms] has passed.  Returns true if no query is awaiting
+   a response.  Called regularly on the coordinator, so background
+   lookups complete without holding up uploads. */
+bool checkDNSQuery() {
+  if (dnsQuery.entry < 0) return true;
+  uint32_t ip = 0, ttl = 0;
+  int8_t stat = 0;
+  int n = dnsQuery.udp.parsePacket();
+  if (n > 0) {
+    uint8_t packet[DNS_PACKET_SIZE];
+    n = dnsQuery.udp.read(packet, (n < DNS_PACKET_SIZE) ? n : DNS_PACKET_SIZE);
+    stat = parseDNSResponse(packet, n, ip, ttl);
+  }
+  if ((stat == 0) && (millis() - dnsQuery.sent < DNS_TIMEOUT)) return false;
+  
+  DNSCacheEntry &e = dnsCache[dnsQuery.entry];
+  dnsQuery.udp.stop();
+  dnsQuery.entry = -1;
+  e.checked = millis();
+  if (stat > 0) {
+    if (ttl < DNS_MIN_TTL) ttl = DNS_MIN_TTL;
+    if (ttl > DNS_MAX_TTL) ttl = DNS_MAX_TTL;
+    e.ip = ip;
+    e.refresh = ttl * DNS_REFRESH_PERCENT / 100;
+  } else {
+    // Any previous address is kept, but looked up again soon
+    e.refresh = DNS_NEGATIVE_TTL;
+    Serial.println((stat < 0) ? F("Warning: DNS lookup failed.")
+                              : F("Warning: DNS server did not respond before timeout."));
+  }
+  return true;
+}
+
+
+/* Drops any DNS query awaiting a response, as when the ethernet
+   chip is reset. */
+void resetDNSQuery() {
+  if (dnsQuery.entry < 0) return;
+  DNSCacheEntry &e = dnsCache[dnsQuery.entry];
+  e.checked = millis();
+  e.refresh = DNS_NEGATIVE_TTL;
+  dnsQuery.udp.stop();
+  dnsQuery.entry = -1;
+}
+
+
+/* Looks up the address of the given host (name or dotted-decimal
+   address) through the DNS cache, without waiting for the DNS server.
+   An address due to be refreshed continues to be used while it is
+   looked up in the background.  Returns 1 if an address is known, 0
+   if it is being looked up (call again later), or -1 if it could not
+   be looked up. */
+int8_t lookupHost(const char *host, IPAddress &ip) {
+  if (parseIPAddress(host, ip)) return 1;
+  const uint32_t name = hashHostName(host);
+  int8_t k = -1;
+  for (int8_t j = 0; j < DNS_CACHE_SIZE; j++) {
+    if (dnsCache[j].name == name) k = j;
+  }
+  
+  if (k >= 0) {
+    DNSCacheEntry &e = dnsCache[k];
+    if (e.ip != 0) {
+      const bool due = (millis() - e.checked >= 1000ul*e.refresh);
+      if (due && (dnsQuery.entry < 0)) startDNSQuery(host, k);
+      ip = IPAddress(e.ip);
+      return 1;
+    }
+    if (dnsQuery.entry == k) {
+      if (!checkDNSQuery()) return 0;
+      if (e.ip == 0) return -1;
+      ip = IPAddress(e.ip);
+      return 1;
+    }
+    // Lookup failed recently
+    if (millis() - e.checked < 1000ul*e.refresh) return -1;
+  }
+  
+  // Only one query at a time: any background lookup finishes first
+  if (!checkDNSQuery()) return 0;
+  if (k < 0) {
+    // Take an unused entry, otherwise the one looked up longest ago
+    k = 0;
+    for (int8_t j = 1; j < DNS_CACHE_SIZE; j++) {
+      if (dnsCache[k].name == 0) break;
+      if ((dnsCache[j].name == 0)
+          || (millis() - dnsCache[j].checked > millis() - dnsCache[k].checked)) k = j;
+    }
+    dnsCache[k].name = name;
+    dnsCache[k].ip = 0;
+  }
+  if (!startDNSQuery(host, k)) {
+    dnsCache[k].checked = millis();
+    dnsCache[k].refresh = DNS_NEGATIVE_TTL;
+    return -1;
+  }
+  return 0;
+}
+
+
+/* As above, but waits for the DNS server if the name has no cached
+   address.  Returns false if no address is known. */
+bool resolveHost(const char *host, IPAddress &ip) {
+  int8_t stat;
+  while ((stat = lookupHost(host, ip)) == 0) delay(1);
+  return (stat > 0);
+}
+
+
+/* Number of upload sockets posts may use: one fewer while an NTP
+   update holds a socket open (see UPLOAD_SOCKETS). */
+uint8_t uploadSocketLimit() {
+  return ntpUpdate.active ? UPLOAD_SOCKETS - 1 : UPLOAD_SOCKETS;
+}
+
+
+/* Index of an upload socket not in use, or -1 if all are in use. */
+int8_t getFreeUploadSocket() {
+  for (int8_t k = 0; k < uploadSocketLimit(); k++) {
+    if (!uploadSockets[k].busy) return k;
+  }
+  return -1;
+}
+
+
+/* Collects the server's response to the post sent on the given
+   upload socket and closes the connection, once the response has
+   arrived or HTTP_POST_TIMEOUT [ms] has passed since the post was
+   sent.  A reading posted from the upload queue is then marked as
+   uploaded, or to be posted again if there was no response.  If wait
+   is false, returns false rather than waiting when neither has
+   happened yet. */
+bool finishPostPage(const uint8_t k, const bool wait) {
+  UploadSocket &u = uploadSockets[k];
+  if (!u.busy) return true;
+  // Wait for server to respond before closing connection.
+  // Otherwise, server may have failed to receive the full POST.
+  while (!u.client.available() && (millis() - u.sent < HTTP_POST_TIMEOUT)) {
+    if (!wait) return false;
+    delay(1);
+  }
+  //Serial.print(F("Available: "));
+  //Serial.println(u.client.available());
+  const bool responded = u.client.available();
+  if (!responded) {
+    Serial.println(F("Warning: Server did not respond before timeout.  Data upload may have failed."));
+    // May not want to flag this: probably a server issue, not
+    // an ethernet connection issue.
+    //ethStatus.failed();
+  } else {
+    if (getDebugMode()) {
+      Serial.print(F("Server response time: "));
+      Serial.println(millis() - u.sent);
+    }
+    // Successfully connected to server:
+    // clear bad ethernet connection flags
+    ethStatus.succeeded();
+  }
+  u.client.stop();
+  u.busy = false;
+  if (u.reading >= 0) {
+    uploadQueue[u.reading].state = responded ? QUEUED_UPLOADED : QUEUED_WAITING;
+    u.reading = -1;
+  }
+  return true;
+}
+
+
+/* Closes the connections of any posts whose server response has
+   arrived (or timed out).  Called regularly on the coordinator. */
+void serviceUploadSockets() {
+  for (uint8_t k = 0; k < UPLOAD_SOCKETS; k++) finishPostPage(k, false);
+}
+
+
+/* Drops any posts awaiting a server response, as when the ethernet
+   chip is reset.  Readings from the upload queue are posted again. */
+void resetUploadSockets() {
+  for (uint8_t k = 0; k < UPLOAD_SOCKETS; k++) {
+    UploadSocket &u = uploadSockets[k];
+    if (!u.busy) continue;
+    u.client.stop();
+    u.busy = false;
+    if (u.reading >= 0) uploadQueue[u.reading].state = QUEUED_WAITING;
+    u.reading = -1;
+  }
+}
+
+
 // postPage is function that performs POST request and prints results.
-byte postPage(const char* domainBuffer, int thisPort, const char* page, const char* thisData)
+// If wait is false, returns once the request has been sent, leaving
+// the response to serviceUploadSockets().
+byte postPage(const char* domainBuffer, int thisPort, const char* page, const char* thisData, const bool wait)
 {
   // Keep track of POST attempts (successful or not)
   packetsUploaded++;
@@ -1552,15 +3032,35 @@ byte postPage(const char* domainBuffer, int thisPort, const char* page, const ch
     Serial.println(F("Remote server upload failed: no internet connection"));
     return 0;
   }
+
+  // All upload sockets in use: finish the oldest post
+  int8_t k = getFreeUploadSocket();
+  if (k < 0) {
+    k = 0;
+    for (int8_t j = 1; j < uploadSocketLimit(); j++) {
+      if (millis() - uploadSockets[j].sent > millis() - uploadSockets[k].sent) k = j;
+    }
+    finishPostPage(k, true);
+  }
+  
+  // Connect by address (see resolveHost()): the Ethernet library
+  // would otherwise query the DNS server for every post.
+  IPAddress serverIP;
+  if (!resolveHost(domainBuffer, serverIP)) {
+    // Flag bad ethernet connection
+    ethStatus.failed();
+    Serial.println(F("Remote server upload failed: unable to look up server address"));
+    return 0;
+  }
   
   //int inChar;
   char outBuf[200];
-  EthernetClient client;
+  EthernetClient &client = uploadSockets[k].client;
 
   //Serial.print(F("connecting...."));
 
   int stat;
-  if ((stat = client.connect(domainBuffer, thisPort)) == 1)
+  if ((stat = client.connect(serverIP, thisPort)) == 1)
   {
     // Debugging
     //Serial.print(F("HTTP server IP: "));
@@ -1587,30 +3087,9 @@ byte postPage(const char* domainBuffer, int thisPort, const char* page, const ch
     client.print(thisData);
     client.flush();
 
-    // Wait for server to respond before closing connection.
-    // Otherwise, server may have failed to receive the full POST.
-    unsigned long t0 = millis();
-    while (millis() - t0 < HTTP_POST_TIMEOUT) {
-      if (client.available()) break;
-      delay(1);
-    }
-    //Serial.print(F("Available: "));
-    //Serial.println(client.available());
-    if (!client.available()) {
-      Serial.println(F("Warning: Server did not respond before timeout.  Data upload may have failed."));
-      // May not want to flag this: probably a server issue, not
-      // an ethernet connection issue.
-      //ethStatus.failed();
-    } else {
-      if (getDebugMode()) {
-        Serial.print(F("Server response time: "));
-        Serial.println(millis() - t0);
-      }
-      // Successfully connected to server:
-      // clear bad ethernet connection flags
-      ethStatus.succeeded();
-    }
-    client.stop();
+    uploadSockets[k].busy = true;
+    uploadSockets[k].sent = millis();
+    if (wait) finishPostPage(k, true);
     
   } else {
     // Flag bad ethernet connection
@@ -1645,7 +3124,7 @@ byte postPage(const char* domainBuffer, int thisPort, const char* page, const ch
       case 0:
         Serial.println(F("Remote server upload failed"));
         break;
-      // Below are only for DNS lookup errors?
+      // Below are only for DNS lookup errors (not made here)?
       case -1:
         Serial.println(F("Remote server upload failed: timed out"));
         break;
@@ -1675,32 +3154,41 @@ byte postPage(const char* domainBuffer, int thisPort, const char* page, const ch
 
 //--------------------------------------------------------------------------------------------- [Upload Support]
 
-/* Attempt to update the RTC with the current time from an NTP server. */
+/* Starts updating the RTC with the current time from an NTP server.
+   The requests and responses are handled in the background by
+   serviceNTP(), so this returns at once. */
 void updateClockFromNTP() {
+  NTPUpdate &u = ntpUpdate;
+  if (u.active) return;
   Serial.println(F("Retrieving NTP data...."));
   
-  // Build NTP request packet
-  byte packet[NTP_PACKET_SIZE];
-  memset(packet,0,NTP_PACKET_SIZE);
-  packet[0]  = 0b11100011;  // LI, Version, Mode
-  packet[1]  = 0;           // Stratum, or type of clock
-  packet[2]  = 6;           // Polling Interval
-  packet[3]  = 0xEC;        // Peer Clock Precision
-  // 8 bytes of zero for Root Delay & Root Dispersion
-  packet[12] = 49;
-  packet[13] = 0x4E;
-  packet[14] = 49;
-  packet[15] = 52;
+  // Free the upload socket posts give up during the update
+  // (see uploadSocketLimit())
+  finishPostPage(UPLOAD_SOCKETS - 1, true);
   
-  // Open port to receive UDP response packet.
-  EthernetUDP Udp;
-  if (!Udp.begin(LOCAL_PORT)) {
+  // Open port to receive UDP response packets.
+  if (!u.udp.begin(LOCAL_PORT)) {
     // Flag bad ethernet connection
     ethStatus.failed();
     Serial.println(F("Warning: Failed to open port to receive NTP response."));
-    Udp.stop();
+    u.udp.stop();
     return;
   }
+  u.active = true;
+  u.waiting = false;
+  u.sent = 0;
+  u.found = false;
+  serviceNTP();
+}
+
+
+/* Sends the next NTP request of the burst.  The NTP server's address
+   is looked up without waiting for the DNS server (see lookupHost()),
+   so XBee packets keep being handled during a lookup.  Returns 1 if
+   the request was sent, 0 if the address is still being looked up
+   (call again later), or -1 if the request could not be sent. */
+int8_t sendNTPRequest() {
+  NTPUpdate &u = ntpUpdate;
   
   // If we do not have IP address, we will be unable to connect to
   // NTP server.  The ethernetMaintain() routine should eventually
@@ -1709,78 +3197,200 @@ void updateClockFromNTP() {
     // Flag bad ethernet connection
     ethStatus.failed();
     Serial.println(F("Warning: Failed to connect to NTP server (no internet connection)."));
-    Udp.stop();
-    return;
+    return -1;
+  }
+  IPAddress ntpIP;
+  int8_t found = lookupHost(NTP_SERVER, ntpIP);
+  if (found == 0) return 0;
+  if (found < 0) {
+    // Flag bad ethernet connection
+    ethStatus.failed();
+    Serial.println(F("Warning: Failed to look up NTP server address."));
+    return -1;
   }
   
+  // Build NTP request packet
+  byte packet[NTP_PACKET_SIZE];
+  memset(packet,0,NTP_PACKET_SIZE);
+  packet[0]  = 0b11100011;  // LI, Version, Mode
+  packet[1]  = 0;           // Stratum, or type of clock
+  packet[2]  = 6;           // Polling Interval
+  packet[3]  = 0xEC;        // Peer Clock Precision
+  // 8 bytes of zero for Root Delay & Root Dispersion
+  packet[12] = 49;
+  packet[13] = 0x4E;
+  packet[14] = 49;
+  packet[15] = 52;
+  // Transmit timestamp: returned by the server as the originate
+  // timestamp, so identifies the response to this request
+  u.t1 = micros();
+  packet[40] = u.t1 >> 24;
+  packet[41] = u.t1 >> 16;
+  packet[42] = u.t1 >> 8;
+  packet[43] = u.t1;
+  
   // Send request packet to NTP server.  Do nothing if cannot connect.
-  if (!Udp.beginPacket(NTP_SERVER,NTP_PORT)) {
+  if (!u.udp.beginPacket(ntpIP,NTP_PORT)) {
     // Flag bad ethernet connection
     ethStatus.failed();
     Serial.println(F("Warning: Failed to connect to NTP server."));
-    Udp.stop();
-    return;
+    return -1;
   }
-  Udp.write(packet,NTP_PACKET_SIZE);
-  if (!Udp.endPacket()) {
+  u.udp.write(packet,NTP_PACKET_SIZE);
+  if (!u.udp.endPacket()) {
     Serial.println(F("Warning: Failed to connect to NTP server."));
     // Flag bad ethernet connection
     ethStatus.failed();
-    return;
+    return -1;
   }
+  u.sent++;
+  u.sentAt = millis();
+  u.waiting = true;
+  return 1;
+}
+
+
+/* Big-endian 32-bit word from an NTP packet. */
+uint32_t getNTPWord(const byte *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+       | ((uint32_t)p[2] <<  8) | ((uint32_t)p[3] <<  0);
+}
+
+
+/* Checks an NTP response received at the given micros() time,
+   keeping it if it has the shortest round trip of the burst so far.
+   Returns false if the packet is not a response to the last
+   request. */
+bool processNTPResponse(const byte *packet, const unsigned long t4) {
+  NTPUpdate &u = ntpUpdate;
+  // Server mode, with our transmit timestamp as originate timestamp
+  if (((packet[0] & 0x07) != 4) || (getNTPWord(packet + 24) != u.t1)) return false;
   
-  // Wait for reply.
-  unsigned long t0 = millis();
-  do {
-    delay(50);
-  } while ((millis() - t0 < 1000) && (Udp.parsePacket() == 0));
-  if (Udp.available() != NTP_PACKET_SIZE) {
-    Serial.println(F("Warning: Failed to retrieve NTP data."));
-    Udp.stop();
-    return;
+  // Unsynchronized server (leap indicator 3) or "kiss-of-death"
+  // (stratum 0) response
+  if (((packet[0] >> 6) == 3) || (packet[1] == 0)) {
+    Serial.println(F("Warning: Invalid NTP data (ignoring)."));
+    return true;
   }
   
-  // Successfully connected to NTP server:
-  // clear bad ethernet connection flags
-  ethStatus.succeeded();
-  
-  // Get returned packet contents and release incoming port.
-  Udp.read(packet,NTP_PACKET_SIZE);
-  Udp.stop();
-  
-  // Extract timestamp from packet bytes 40-43.
-  unsigned long tntp = (((unsigned long)packet[40]) << 24)
-                     | (((unsigned long)packet[41]) << 16)
-                     | (((unsigned long)packet[42]) <<  8)
-                     | (((unsigned long)packet[43]) <<  0);
+  // Server receive (T2) and transmit (T3) timestamps: seconds and
+  // fraction of a second (converted to microseconds)
+  uint32_t s2 = getNTPWord(packet + 32);
+  unsigned long us2 = ((uint64_t)getNTPWord(packet + 36) * 1000000ul) >> 32;
+  uint32_t s3 = getNTPWord(packet + 40);
+  unsigned long us3 = ((uint64_t)getNTPWord(packet + 44) * 1000000ul) >> 32;
 
   // NTP time is seconds since 1900-01-01 00:00:00 UTC.
   // Unix time is seconds since 1970-01-01 00:00:00 UTC.
   const time_t NTP1970 = 2208988800ul;
-  time_t utc = tntp - NTP1970;
-  Serial.print(F("  Retrieved NTP timestamp:  "));
-  Serial.println(tntp);
-  //Serial.print(F("  Unix timestamp: "));
-  //Serial.println(utc);
+  time_t utc = s3 - NTP1970;
   
   // Update RTC only if time is recent (otherwise, ntp
   // data must be invalid).
   //const time_t UTC2000 = 946684800ul;
   const time_t UTC2019 = 1546300800ul;
-  if (utc < UTC2019) {
+  if ((utc < UTC2019) || (s3 < s2) || (s3 - s2 > 1)) {
     Serial.println(F("Warning: Invalid NTP data (ignoring)."));
+    return true;
+  }
+  
+  // Successfully connected to NTP server:
+  // clear bad ethernet connection flags
+  ethStatus.succeeded();
+  
+  // Round trip (T4 - T1), less the time spent at the server (T3 - T2)
+  unsigned long held = (s3 - s2) * 1000000ul + us3 - us2;
+  unsigned long elapsed = t4 - u.t1;
+  unsigned long roundTrip = (held < elapsed) ? elapsed - held : 0;
+  if (getDebugMode()) {
+    Serial.print(F("  NTP round trip [ms]: "));
+    Serial.println(roundTrip / 1000);
+  }
+  if (u.found && (roundTrip >= u.roundTrip)) return true;
+  
+  // Server time at T4: T3 plus half the round trip
+  unsigned long us = us3 + roundTrip / 2;
+  u.found = true;
+  u.utc = utc + us / 1000000ul;
+  u.second = t4 - us % 1000000ul;
+  u.roundTrip = roundTrip;
+  return true;
+}
+
+
+/* Ends the NTP update, setting the clock from the sample with the
+   shortest round trip.  Without the RTC square wave, the clock is
+   only known to the second (see clockHasSubsecond()), so it is only
+   set if its second differs from the server's. */
+void finishNTPUpdate() {
+  NTPUpdate &u = ntpUpdate;
+  resetNTPUpdate();
+  if (!u.found) {
+    Serial.println(F("Warning: Failed to retrieve NTP data."));
     return;
   }
-  setUTC(utc);
+  Serial.print(F("  NTP round trip [ms]: "));
+  Serial.println(u.roundTrip / 1000);
+  time_t utc = u.utc + (micros() - u.second) / 1000000ul;
+  
+  const bool subsecond = clockHasSubsecond();
+  if (subsecond) {
+    // Offset of the server time from the clock (also used to
+    // estimate the RTC drift)
+    long offset = syncUTC(u.utc, u.second, NTP_MIN_OFFSET);
+    Serial.print(F("  Clock offset [ms]:   "));
+    Serial.println(offset);
+    if ((offset > -NTP_MIN_OFFSET) && (offset < NTP_MIN_OFFSET)) return;
+  } else {
+    if (getUTC() == utc) return;
+    setUTC(utc);
+  }
 
-  time_t utc0 = getUTC();
-  Serial.println(F("RTC updated.  New time:"));
+  Serial.println(subsecond ? F("RTC updated at next second.  New time:")
+                           : F("RTC updated.  New time:"));
   Serial.print(F("  Universal time: "));
-  Serial.println(getUTCDateTimeString(utc0));
+  Serial.println(getUTCDateTimeString(utc));
   Serial.print(F("  Local time:     "));
-  Serial.println(getLocalDateTimeString(utc0));
+  Serial.println(getLocalDateTimeString(utc));
   Serial.print(F("  Unix timestamp: "));
-  Serial.println(utc0);
+  Serial.println(utc);
+}
+
+
+/* Handles the NTP update started by updateClockFromNTP(): collects
+   the response to each request and sends the next, ending the update
+   once the burst is done.  Called regularly on the coordinator. */
+void serviceNTP() {
+  NTPUpdate &u = ntpUpdate;
+  if (!u.active) return;
+  if (u.waiting) {
+    if (u.udp.parsePacket() == NTP_PACKET_SIZE) {
+      unsigned long t4 = micros();
+      byte packet[NTP_PACKET_SIZE];
+      u.udp.read(packet,NTP_PACKET_SIZE);
+      if (processNTPResponse(packet, t4)) u.waiting = false;
+    }
+    if (u.waiting) {
+      if (millis() - u.sentAt < NTP_TIMEOUT) return;
+      Serial.println(F("Warning: NTP server did not respond before timeout."));
+      u.waiting = false;
+    }
+  }
+  if (u.sent >= NTP_SAMPLES) {
+    finishNTPUpdate();
+    return;
+  }
+  if ((u.sent > 0) && (millis() - u.sentAt < NTP_SAMPLE_INTERVAL)) return;
+  if (sendNTPRequest() < 0) finishNTPUpdate();
+}
+
+
+/* Drops any NTP update in progress, as when the ethernet chip is
+   reset. */
+void resetNTPUpdate() {
+  ntpUpdate.udp.stop();
+  ntpUpdate.active = false;
+  ntpUpdate.waiting = false;
 }
 
 
@@ -1804,20 +3414,53 @@ void broadcastClock() {
     return;
   }
   
-  // Zero-padded timestamp.
-  char buff[16];
-  sprintf(buff,"C%010ld",utc);
-  sendXBee(buff);
+  // Zero-padded timestamp and credit, followed by the milliseconds
+  // into the second only if this clock has them (see
+  // clockHasSubsecond()).  The time is taken just before the frame
+  // goes out, once any frame still being sent is done (so the packet
+  // is sent directly, not through sendXBee() and its serial output).
+  uint8_t credit = updateXBeeCredit();
+  xbee.flush();
+  char buff[20];
+  if (clockHasSubsecond()) {
+    uint16_t ms;
+    utc = getUTC(ms);
+    sprintf(buff,"C%010ld,%X,%03u",utc,credit,ms);
+  } else {
+    utc = getUTC();
+    sprintf(buff,"C%010ld,%X",utc,credit);
+  }
+  transmitXBee(xbeeConfig.destination, buff);
+  Serial.print(F("XBee send: "));
+  Serial.println(buff);
+  xbee.flush();
 }
 
 
 /* Parses an XBee clock broadcast packet and updates clock if
-   packet is valid. */
+   packet is valid.  Broadcasts giving the milliseconds into the
+   second set the clock to the millisecond, allowing for the time
+   taken to get here (see CLOCK_RADIO_DELAY), if the RTC square wave
+   gives this clock's own milliseconds (see clockHasSubsecond());
+   otherwise only whole seconds are corrected. */
 void processClockPacket(const String packet) {
-  if ((packet.length() != 11) || (packet.charAt(0) != 'C')) {
+  const unsigned int len = packet.length();
+  if (((len != 11) && (len != 13) && (len != 17)) || (packet.charAt(0) != 'C')
+      || !processCreditField((len == 17) ? packet.substring(0,13) : packet, 11)) {
     Serial.println(F("Warning: Received invalid clock broadcast (ignoring)."));
     return;
   }
+  unsigned long ms = 0;
+  if (len == 17) {
+    for (int k = 14; k < 17; k++) {
+      char c = packet.charAt(k);
+      if ((packet.charAt(13) != ',') || (c < '0') || (c > '9')) {
+        Serial.println(F("Warning: Received invalid clock broadcast (ignoring)."));
+        return;
+      }
+      ms = 10*ms + (c - '0');
+    }
+  }
   
   time_t utc = 0;
   for (int k = 1; k < 11; k++) {
@@ -1837,6 +3480,24 @@ void processClockPacket(const String packet) {
     Serial.println(F("Warning: Received invalid clock broadcast (ignoring)."));
     return;
   }
+  
+  if ((len == 17) && xbeePacketTimed && clockHasSubsecond()) {
+    // Time from the coordinator reading its clock to the broadcast
+    // arriving here: the transmit frame (packet plus 18 bytes) going
+    // to the coordinator's XBee, then the radio hop
+    unsigned long us = 1000*ms + (len + 18) * XBEE_BYTE_MICROS + CLOCK_RADIO_DELAY;
+    utc += us / 1000000ul;
+    unsigned long second = xbeePacketMicros - us % 1000000ul;
+    long offset = syncUTC(utc, second, CLOCK_MIN_OFFSET);
+    Serial.print(F("Clock offset from coordinator [ms]: "));
+    Serial.println(offset);
+    if ((offset > -CLOCK_MIN_OFFSET) && (offset < CLOCK_MIN_OFFSET)) return;
+    Serial.println(F("RTC updated at next second."));
+    return;
+  }
+  
+  // Whole seconds only: keep the clock's own phase if it agrees
+  if (getUTC() == utc) return;
   setUTC(utc);
 
   time_t utc0 = getUTC();
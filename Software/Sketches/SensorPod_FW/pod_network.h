@@ -14,15 +14,30 @@
 //--------------------------------------------------------------------------------------------- [XBee Management]
 
 // XBee command mode routines:
-// used by higher-level XBee routines below
+// only used to switch the XBee from transparent to API mode
 bool startXBeeCommandMode();
 void stopXBeeCommandMode(const bool write=true);
 bool submitXBeeCommand(const String cmd);
-String getXBeeCommandResponse(const String cmd);
-uint32_t getXBeeNumericResponse(const String cmd);
+
+// XBee API frame routines:
+// used by higher-level XBee routines below
+bool enableXBeeAPIMode();
+uint8_t nextXBeeFrameID();
+void sendXBeeFrame(const uint8_t *header, const size_t headerLen,
+                   const uint8_t *data=NULL, const size_t dataLen=0);
+size_t readXBeeFrame(uint8_t *buf, const size_t bufLen, const unsigned long timeout);
+int getXBeeATResponse(const char *cmd, uint8_t *value, const size_t valueLen);
+int getXBeeATResponse(const char *cmd, const uint8_t *param, const size_t paramLen,
+                      uint8_t *value, const size_t valueLen);
+bool setXBeeATParameter(const char *cmd, const uint8_t *param, const size_t paramLen,
+                        const bool wait=true);
+String getXBeeStringParameter(const char *cmd);
+bool setXBeeStringParameter(const char *cmd, const String value, const bool wait=true);
+uint32_t getXBeeNumericParameter(const char *cmd);
+bool setXBeeNumericParameter(const char *cmd, const uint32_t value, const bool wait=true);
 uint64_t getXBeeSerialNumber();
 uint64_t getXBeeDestination();
-void setXBeeDestination(const uint64_t dest);
+void setXBeeDestination(const uint64_t dest, const bool wait=true);
 
 String getXBeeSerialNumberString();
 String getXBeeDestinationString();
@@ -36,22 +51,39 @@ void startXBee();
 void readXBeeISR();
 void readXBee();
 void sendXBee(const String packet);
+void transmitXBee(const uint64_t dest, const String packet);
 void broadcastXBee(const String packet);
 bool holdXBeeBuffer();
 void releaseXBeeBuffer();
 void resetXBeeBuffer();
+size_t getXBeeBufferCount();
 void cleanXBeeBuffer(const bool cleanStart=true, const bool cleanEnd=true);
-String getXBeeBufferPacket();
+String getXBeeBufferPacket(uint64_t *source=NULL);
 void processXBee();
-bool submitXBeeCommand(const String cmd);
 
 void xbeeRate(String incoming);
 void xbeeSettings(String incoming, String incoming2);
-void xbeeReading(String incoming);
+bool xbeeReading(String incoming);
 
 void broadcastCoordinatorAddress();
 void processDestinationPacket(const String packet);
 
+// Flow control (coordinator credit advertised to drones)
+uint8_t updateXBeeCredit();
+bool processCreditField(const String &packet, const int pos);
+uint8_t getXBeeWindow();
+
+// Sequenced reading delivery (drone to coordinator)
+void openXBeeOutbox();
+void startXBeeOutboxSession(const uint16_t pending, const uint32_t pos);
+bool queueXBeeReading(const String packet);
+void serviceXBeeOutbox();
+long sendXBeeOutboxReading(const uint16_t seq, const uint32_t pos);
+void processAckPacket(const String packet);
+void processRenumberPacket(const String packet);
+bool processSequencedReading(const String packet, const uint64_t source);
+void printXBeeNodeStats();
+
 
 //--------------------------------------------------------------------------------------------- [Upload Support]
 
@@ -81,14 +113,31 @@ void ethernetMaintain();
 //String formatTime();
 //String formatDate();
 void saveReading(String lstr, String rstr, String atstr, String gtstr, String sstr, String c2str, String p1str, String p2str, String cstr);
-void postReading(String DID, String ST, String R, String TS, String DT);
+bool postReading(String DID, String ST, String R, String TS, String DT);
+bool uploadReading(String DID, String ST, String R, String TS, String DT, const bool wait=true);
+void openUploadSpill();
+bool queueReading(String DID, String ST, String R, String TS, String DT);
+void serviceUploadQueue();
+uint8_t getUploadQueueCount();
 void updateRate(String DID, String ST, String R, String DT);
 void updateConfig(String DID, String Location, String Coordinator, String Project, String Rate, String Setup, String Teardown, String Datetime, String NetID);
-byte postPage(const char* domainBuffer, int thisPort, const char* page, const char* thisData);
+bool checkDNSQuery();
+void resetDNSQuery();
+byte postPage(const char* domainBuffer, int thisPort, const char* page, const char* thisData, const bool wait=true);
+uint8_t uploadSocketLimit();
+int8_t getFreeUploadSocket();
+bool finishPostPage(const uint8_t k, const bool wait);
+void serviceUploadSockets();
+void resetUploadSockets();
 
 //void getTimeFromWeb();
 //void sendNTPpacket(const char* address);
 void updateClockFromNTP();
+int8_t sendNTPRequest();
+bool processNTPResponse(const byte *packet, const unsigned long t4);
+void finishNTPUpdate();
+void serviceNTP();
+void resetNTPUpdate();
 void broadcastClock();
 void processClockPacket(const String packet);
 
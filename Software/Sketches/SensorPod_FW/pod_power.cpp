@@ -0,0 +1,151 @@
+/*==============================================================================
+  Power management: idling in a sleep mode between scheduled tasks.
+
+  Readings are taken by timers (TimeAlarms), so a drone has nothing to do
+  between the next alarm and the arrival of XBee data.  Rather than
+  polling in Alarm.delay(), idleDelay() puts the CPU into the AVR idle
+  sleep mode, from which it is woken by any interrupt: the core's
+  millis() timer, the XBee read and sound sampling timers, the RTC
+  square wave and the serial ports.  Those clocks and peripherals must
+  keep running, so the deeper sleep modes (which stop the I/O clock and
+  with it millis() and the UARTs) are not used; when sound sampling is
+  off, the ADC is also powered down while sleeping.
+
+  Time spent asleep is measured and reported as a duty cycle for each
+  hour.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#include "pod_power.h"
+#include "pod_logging.h"
+#include "pod_network.h"
+#include "pod_sensors.h"
+#include "pod_util.h"
+
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <TimeAlarms.h>
+
+
+
+// Constants/global variables ==================================================
+
+// Interval over which sleep time is accounted [ms]
+#define POWER_STATS_INTERVAL 3600000UL
+
+// Minimum expected idle time [ms] for powering down the ADC
+#define POWER_ADC_OFF_MIN 10
+
+// Start of the current accounting interval [ms] and time asleep
+// within it [us]
+unsigned long powerIntervalStart = 0;
+unsigned long powerSleepMicros = 0;
+// Sleep fraction for the most recent complete interval (-1: none yet)
+float powerSleepFraction = -1;
+
+
+
+// Functions ===================================================================
+
+//------------------------------------------------------------------------------
+/* Sleeps (idle mode) until the next interrupt, accumulating the time
+   spent asleep.  If adcOff is set, the ADC is powered down while
+   asleep (must not be sampling). */
+void sleepUntilInterrupt(bool adcOff) {
+  uint8_t adcsra = ADCSRA;
+  if (adcOff) {
+    ADCSRA = adcsra & ~(1 << ADEN);
+    power_adc_disable();
+  }
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  unsigned long t0 = micros();
+  // An interrupt is not serviced until after the instruction that
+  // follows sei(), so one arriving here still wakes the CPU.
+  cli();
+  sleep_enable();
+  sei();
+  sleep_cpu();
+  sleep_disable();
+  powerSleepMicros += micros() - t0;
+  if (adcOff) {
+    power_adc_enable();
+    ADCSRA = adcsra;
+  }
+}
+
+
+//------------------------------------------------------------------------------
+/* Closes the accounting interval if an hour has passed. */
+void updatePowerStats() {
+  unsigned long elapsed = millis() - powerIntervalStart;
+  if (elapsed < POWER_STATS_INTERVAL) return;
+  powerSleepFraction = powerSleepMicros / (1000.0 * elapsed);
+  powerIntervalStart += elapsed;
+  powerSleepMicros = 0;
+  printPowerStats();
+  printMemoryStats();
+  #ifdef DEBUG
+  writeDebugLog(String(F("Idle: asleep ")) + String(100 * powerSleepFraction,1) + String(F("% of last hour")));
+  #endif
+}
+
+
+//------------------------------------------------------------------------------
+/* Waits up to the given number of milliseconds, triggering alarms as
+   they come due and sleeping in between (see file description).
+   Returns early when new XBee data arrives. */
+void idleDelay(unsigned long ms) {
+  unsigned long start = millis();
+  size_t xbeeCount = getXBeeBufferCount();
+  for (;;) {
+    Alarm.service();
+    unsigned long elapsed = millis() - start;
+    if (elapsed >= ms) break;
+    if (getXBeeBufferCount() != xbeeCount) break;
+    // Time until something is scheduled
+    unsigned long wait = ms - elapsed;
+    uint32_t next = Alarm.millisToNextTrigger();
+    if (next < wait) wait = next;
+    if (wait == 0) continue;
+    // Woken by (at least) the millis() timer within a couple of ms
+    sleepUntilInterrupt(!isSoundSampling() && (wait >= POWER_ADC_OFF_MIN));
+  }
+  updatePowerStats();
+}
+
+
+//------------------------------------------------------------------------------
+/* Writes the sleep/active duty cycle of the most recent hour to serial. */
+void printPowerStats() {
+  if (powerSleepFraction < 0) {
+    Serial.println(F("Idle: no complete hour measured yet."));
+    return;
+  }
+  Serial.print(F("Idle: asleep "));
+  Serial.print(100 * powerSleepFraction,1);
+  Serial.print(F("%, active "));
+  Serial.print(100 * (1 - powerSleepFraction),1);
+  Serial.println(F("% of last hour."));
+}
+
+
+//==============================================================================
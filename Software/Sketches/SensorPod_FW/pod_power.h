@@ -0,0 +1,50 @@
+/*==============================================================================
+  Power management: idling in a sleep mode between scheduled tasks.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+// Standard libraries
+// Contributed libraries
+#include <Arduino.h>
+// Local headers
+
+
+// Constants/global variables ==================================================
+
+
+// Functions ===================================================================
+
+// Waits up to the given number of milliseconds, triggering alarms as
+// they come due and sleeping (CPU idle) in between.  Returns early if
+// new XBee data arrives, so it can be processed.  Replaces Alarm.delay()
+// on drones.
+void idleDelay(unsigned long ms);
+
+// Writes the sleep/active duty cycle of the most recent accounting
+// interval (an hour) to serial output.  Also written as each interval
+// completes.
+void printPowerStats();
+
+
+//==============================================================================
@@ -99,10 +99,20 @@ volatile bool soundSampling = false;
 // CO2 [CozIR-A]
 // Note Rx/Tx labeled for Teensy side of serial
 // (reverse of Rx/Tx label on CO2 sensor)
+#ifdef CO2_SERIAL_ICP
+// Timer 1 input capture pin (see CO2_SERIAL_ICP in pod_config.h)
+#define CO2_PIN_RX PIN_D4
+#ifndef NEOSWSERIAL_ICP
+#error "CO2_SERIAL_ICP requires NEOSWSERIAL_ICP to be defined in NeoSWSerial.h"
+#endif
+#else
 #define CO2_PIN_RX PIN_B6
+#endif
 #define CO2_PIN_TX PIN_B5
 // Flag to indicate if CO2 sensor is present.
 bool CO2_present = false;
+
+// Software serial.
 // WARNING: Software serial implementations can interfere with
 // other serial interfaces as processing routines prevent
 // necessary interrupts from occurring in a timely manner.
@@ -111,8 +121,20 @@ bool CO2_present = false;
 // SoftwareSerial, but they have their own issues: AltSoftSerial
 // requires specific Rx/Tx pins and NeoSWSerial uses one of the
 // hardware timers (hopefully nothing else is trying to use it...).
+// (The Teensy++ 2.0 has a single hardware UART, used by the XBee.)
 //SoftwareSerial CO2_serial(CO2_PIN_RX,CO2_PIN_TX);
 NeoSWSerial CO2_serial(CO2_PIN_RX, CO2_PIN_TX);
+// Bit-timed reception fails if interrupts are delayed, so background
+// tasks are limited while the sensor is in use (see
+// limitSensorBackgroundTasks()).  If receiving with the timer input
+// capture unit, edge times are latched in hardware and reception is no
+// longer sensitive to other ISRs (transmission is done with interrupts
+// disabled).
+#ifdef CO2_SERIAL_ICP
+const bool CO2_BIT_TIMED = false;
+#else
+const bool CO2_BIT_TIMED = true;
+#endif
 
 // CO
 //#define numCoRead 4
@@ -993,7 +1015,8 @@ void sampleSoundISR() {
   // a much higher rate with the two-step sound sample
   // accumulation process implemented here.  A flag is used
   // to stop sample accumulation during use of the software
-  // serial.
+  // serial (not needed if the CO2 sensor is received by input
+  // capture; see CO2_SERIAL_ICP).
   
   if (!soundSampling) return;
 
@@ -1426,7 +1449,8 @@ float getGlobeTemperature() {
 // The result is that some communications fail or garbled results
 // are received (one bit or one byte missing/bad?).  The effect is
 // more pronounced when the sound sampling rate is increased for
-// testing.
+// testing.  The input capture receiver (CO2_SERIAL_ICP) avoids the
+// issue.
 
 
 /* Initializes the CO2 sensor. */
@@ -1560,21 +1584,16 @@ void setCO2(int ppm_reading, int ppm_actual) {
 
 /* Enable serial interface with CO2 sensor. */
 void enableCO2Serial() {
-  // SoftwareSerial must restart interface and listen,
   // NeoSWSerial need only listen.
-  //CO2_serial.begin(9600);
   CO2_serial.listen();
-  // Clear buffer
-  //while (CO2_serial.available()) CO2_serial.read();
 }
 
 
 /* Disable serial interface with CO2 sensor. */
 void disableCO2Serial() {
-  // NeoSWSerial can toggle serial interface with just listen/ignore:
+  // NeoSWSerial can toggle serial interface with just listen/ignore
+  // (SoftwareSerial would need to restart with begin/end).
   CO2_serial.ignore();
-  // SoftwareSerial has no ignore and must be turned off...
-  //CO2_serial.end();
 }
 
 
@@ -1604,60 +1623,81 @@ String cozirCommandString(char c, int v, int v2) {
 }
 
 
+// Response received from the CozIR CO2 sensor after the command
+// character, truncated to fit.  The buffer need only hold the first
+// returned number: it is not large enough for commands that return
+// multiple data fields.
+#define COZIR_RESPONSE_LEN 12
+char cozirResponse[COZIR_RESPONSE_LEN];
+size_t cozirResponseLength = 0;
+
+
 /* Sends single character command and, optionally, up to two 
    integer  values to the CozIR CO2 sensor over the serial
    interface.  If integer is negative, it and following values
    will be omitted.  Returns true if communication was successful
    (sensor returned command character).  This routine waits for
-   all serial data to finish arriving even if response is invalid.
-   The serial buffer will be left with whatever the sensor sends
-   after the command character. */
+   the full response to arrive even if response is invalid.
+   Whatever the sensor sends after the command character is left
+   in cozirResponse (truncated). */
 bool cozirSendCommand(char c, int v, int v2) {
-  // Make sure ISRs will not interfere with the
-  // sensitive software serial interface.
+  // Make sure ISRs will not interfere with a sensitive
+  // software serial interface.
   // Must release this before returning!
-  limitSensorBackgroundTasks(true);
+  if (CO2_BIT_TIMED) limitSensorBackgroundTasks(true);
   //cozirSendCommand(cozirCommandString(c,v));
   // Clear incoming serial buffer first
   while(CO2_serial.available()) CO2_serial.read();
+  cozirResponseLength = 0;
+  cozirResponse[0] = '\0';
   // Send command
   String s = cozirCommandString(c,v,v2);
   //Serial.println("DEBUG: cozir command -> '" + s + "'");
   CO2_serial.print(s);
   CO2_serial.print("\r\n");
+  // Transmission may be interrupt-driven: time the response from
+  // when the command has been sent
+  CO2_serial.flush();
   // Wait a limited time for response
   //const int TIMEOUT_MS = 20;
-  const int TIMEOUT_MS = 15;
-  for (int k = 0; k < TIMEOUT_MS; k++) {
-    while (CO2_serial.available()) {
-      // First non-space character should be same as command
-      // character sent.
-      char c0 = CO2_serial.read();
-      //Serial.println("DEBUG: cozir receive -> '" + String(c0) + "'");
-      if (c0 == ' ') continue;
-      // Wait for all serial data to finish arriving, which
-      // we take to be the case when no new serial input is
-      // available for 2ms.  Incoming data is left in the
-      // serial buffer.
-      // NOTE: If we do not do this, incoming serial data
-      // may appear in any quickly-following calls to this
-      // routine, contaminating that interaction.
-      int n = CO2_serial.available();
-      delay(2);
-      while (CO2_serial.available() != n) {
-        n = CO2_serial.available();
-        delay(2);
+  const unsigned long TIMEOUT_MS = 15;
+  // Response is complete at the end of the line or, failing
+  // that, when no new serial input arrives for 2ms (a character
+  // takes ~1ms at 9600 baud).  Upper limit in case the sensor is
+  // streaming.
+  const unsigned long GAP_MS = 2;
+  const unsigned long RESPONSE_MS = 100;
+  bool success = false;
+  unsigned long t0 = millis();
+  while (millis() - t0 <= TIMEOUT_MS) {
+    if (!CO2_serial.available()) continue;
+    // First non-space character should be same as command
+    // character sent.
+    char c0 = CO2_serial.read();
+    //Serial.println("DEBUG: cozir receive -> '" + String(c0) + "'");
+    if (c0 == ' ') continue;
+    // Read the rest of the response, rather than waiting for the
+    // serial input to go quiet: returns as soon as the sensor is
+    // done.
+    // NOTE: If we do not wait for all of the response, incoming
+    // serial data may appear in any quickly-following calls to
+    // this routine, contaminating that interaction.
+    unsigned long tlast = millis();
+    while ((millis() - tlast <= GAP_MS) && (millis() - t0 <= RESPONSE_MS)) {
+      if (!CO2_serial.available()) continue;
+      char c1 = CO2_serial.read();
+      tlast = millis();
+      if (c1 == '\n') break;
+      if (cozirResponseLength < COZIR_RESPONSE_LEN-1) {
+        cozirResponse[cozirResponseLength++] = c1;
       }
-      limitSensorBackgroundTasks(false);
-      return (c0 == c);
-      // Note post-command-character data received from sensor
-      // remains in the serial buffer.
     }
-    delay(1);
+    cozirResponse[cozirResponseLength] = '\0';
+    success = (c0 == c);
+    break;
   }
-  // Timed out
-  limitSensorBackgroundTasks(false);
-  return false;
+  if (CO2_BIT_TIMED) limitSensorBackgroundTasks(false);
+  return success;
 }
 
 
@@ -1672,33 +1712,9 @@ int cozirGetValue(char c, int v) {
   
   // Retrieve response
   // Note cozirSendCommand already stripped off command character
-  // from serial response.
-  // This buffer is not large enough for commands that return
-  // multiple data fields.
-  const size_t BUFF_LEN = 12;
-  size_t n = 0;
-  char buff[BUFF_LEN];
-  // Continue reading until no new input available for 2ms
-  // (in case serial data still arriving).
-  // Double while loops here are not redundant...
-  // MOVE TO COZIRSENDCOMMAND FUNCTION
-  //delay(2);
-  //while (CO2_serial.available()) {
-  //  while (CO2_serial.available()) {
-  //    if (n < BUFF_LEN-1) {
-  //      buff[n] = CO2_serial.read();
-  //      n++;
-  //    }
-  //  }
-  //  delay(2);
-  //}
-  // CozirSendCommand waited for all data to arrive, so we
-  // do not need to wait here.
-  while (CO2_serial.available() && (n < BUFF_LEN-1)) {
-    buff[n] = CO2_serial.read();
-    n++;
-  }
-  buff[n] = '\0';
+  // from serial response and waited for all data to arrive.
+  const char *buff = cozirResponse;
+  const size_t n = cozirResponseLength;
 
   // CozIR response string is command character, a space, and
   // one or more (space separated) non-negative integers, possibly
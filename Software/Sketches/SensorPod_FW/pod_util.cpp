@@ -36,6 +36,15 @@
 
 // Constants/global variables ==================================================
 
+// Byte written by paintFreeRAM() over the free RAM between the heap and
+// the stack.  The stack and heap overwrite it as they grow, so the paint
+// left shows the least free RAM there has been since.
+#define FREE_RAM_PAINT 0xA5
+// Bytes left unpainted below the stack pointer (for interrupts)
+#define FREE_RAM_PAINT_MARGIN 32
+// Least free RAM [bytes] before printMemoryStats() warns
+#define FREE_RAM_WARNING 256
+
 
 // Functions ===================================================================
 
@@ -62,6 +71,50 @@ size_t freeRAM() {
 }
 
 
+//------------------------------------------------------------------------------
+// Fills the free RAM between the heap and the stack with FREE_RAM_PAINT,
+// so minFreeRAM() can later tell how close they have come.  Called at the
+// start of setup().
+void paintFreeRAM() {
+  extern int __heap_start;
+  extern int *__brkval;
+  uint8_t *p = (uint8_t *)(__brkval == 0 ? &__heap_start : __brkval);
+  uint8_t *end = (uint8_t *)&p - FREE_RAM_PAINT_MARGIN;
+  while (p < end) *p++ = FREE_RAM_PAINT;
+}
+
+
+//------------------------------------------------------------------------------
+// The least free RAM since paintFreeRAM(): the paint left above the end
+// of the heap, which the stack has not reached.  Heap that has grown
+// and shrunk again also counts as used, so this errs low.
+size_t minFreeRAM() {
+  extern int __heap_start;
+  extern int *__brkval;
+  const uint8_t *p = (const uint8_t *)(__brkval == 0 ? &__heap_start : __brkval);
+  const uint8_t *sp = (const uint8_t *)&p;
+  size_t n = 0;
+  while ((p < sp) && (*p++ == FREE_RAM_PAINT)) n++;
+  return n;
+}
+
+
+//------------------------------------------------------------------------------
+// Writes to serial the free RAM now and the least since startup,
+// warning if the latter is below FREE_RAM_WARNING.
+void printMemoryStats() {
+  size_t least = minFreeRAM();
+  Serial.print(F("Free RAM: "));
+  Serial.print(freeRAM());
+  Serial.print(F(" bytes (least since startup: "));
+  Serial.print(least);
+  Serial.println(F(")."));
+  if (least < FREE_RAM_WARNING) {
+    Serial.println(F("Warning: Little free RAM left for the stack and heap."));
+  }
+}
+
+
 //------------------------------------------------------------------------------
 // Writes to serial the status of the given pin, with optional
 // label to include in output.  Note this gives digital states:
@@ -67,6 +67,12 @@ typedef const __FlashStringHelper * FType;
 
 // Returns the amount of RAM available to the stack and/or heap.
 size_t freeRAM();
+// Marks the free RAM at startup, and returns the least there has been
+// since (see pod_util.cpp).
+void paintFreeRAM();
+size_t minFreeRAM();
+// Writes the free RAM (now and least since startup) to serial.
+void printMemoryStats();
 
 // Writes to serial the status of the given pin, with optional
 // label to include in output.
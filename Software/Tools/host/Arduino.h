@@ -0,0 +1,290 @@
+/*==============================================================================
+  Host (PC) stand-in for the subset of the Arduino core used by the PODD
+  firmware modules compiled into the host test harness.  Timing functions
+  run on the harness's simulated clock (see host_sim.h), so delays and
+  timeouts in firmware routines take no real time.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+// Standard libraries
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+#include <type_traits>
+#include <utility>
+
+
+// Types and constants =========================================================
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HEX 16
+#define DEC 10
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define PROGMEM
+
+// Flash strings are ordinary strings on the host
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define PSTR(s) (s)
+
+// Interrupt control.  Simulated ISRs only run while the simulated clock
+// advances (delays and blocking I/O), so these only need to compile.
+extern volatile uint8_t SREG;
+inline void cli() {SREG &= 0x7F;}
+inline void sei() {SREG |= 0x80;}
+inline void noInterrupts() {cli();}
+inline void interrupts() {sei();}
+
+
+// Timing (simulated clock) ====================================================
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+inline void yield() {}
+
+
+// Pins (no-ops) ===============================================================
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) {return LOW;}
+
+
+
+// String ======================================================================
+
+/* Arduino String, backed by std::string. */
+class String {
+public:
+  String() {}
+  String(const char *s) : _s(s != nullptr ? s : "") {}
+  String(const __FlashStringHelper *s) : String(reinterpret_cast<const char *>(s)) {}
+  String(const std::string &s) : _s(s) {}
+  explicit String(char c) : _s(1, c) {}
+  explicit String(unsigned char v, unsigned char base = DEC) : String((unsigned long)v, base) {}
+  explicit String(int v, unsigned char base = DEC) : String((long)v, base) {}
+  explicit String(unsigned int v, unsigned char base = DEC) : String((unsigned long)v, base) {}
+  explicit String(long v, unsigned char base = DEC) {
+    if ((v < 0) && (base == DEC)) _s = "-" + format((unsigned long)(-v), base);
+    else _s = format((unsigned long)v, base);
+  }
+  explicit String(unsigned long v, unsigned char base = DEC) : _s(format(v, base)) {}
+  explicit String(double v, unsigned char decimals = 2) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+    _s = buf;
+  }
+  explicit String(float v, unsigned char decimals = 2) : String((double)v, decimals) {}
+
+  unsigned int length() const {return (unsigned int)_s.size();}
+  const char *c_str() const {return _s.c_str();}
+  char charAt(unsigned int k) const {return (k < _s.size()) ? _s[k] : '\0';}
+  char operator[](unsigned int k) const {return charAt(k);}
+  void setCharAt(unsigned int k, char c) {if (k < _s.size()) _s[k] = c;}
+
+  int indexOf(char c, unsigned int from = 0) const {return pos(_s.find(c, from));}
+  int indexOf(const String &s, unsigned int from = 0) const {return pos(_s.find(s._s, from));}
+  int lastIndexOf(char c) const {return pos(_s.rfind(c));}
+  String substring(unsigned int a) const {return (a < _s.size()) ? String(_s.substr(a)) : String();}
+  String substring(unsigned int a, unsigned int b) const {
+    if (a > b) std::swap(a, b);
+    if (a >= _s.size()) return String();
+    return String(_s.substr(a, b - a));
+  }
+
+  bool equals(const String &s) const {return _s == s._s;}
+  bool equals(const char *s) const {return _s == s;}
+  bool equalsIgnoreCase(const String &s) const {return strcasecmp(c_str(), s.c_str()) == 0;}
+  bool startsWith(const String &s) const {return _s.compare(0, s._s.size(), s._s) == 0;}
+  bool endsWith(const String &s) const {
+    return (_s.size() >= s._s.size()) && (_s.compare(_s.size() - s._s.size(), s._s.size(), s._s) == 0);
+  }
+  bool operator==(const String &s) const {return _s == s._s;}
+  bool operator==(const char *s) const {return _s == s;}
+  bool operator!=(const String &s) const {return _s != s._s;}
+  bool operator!=(const char *s) const {return _s != s;}
+
+  long toInt() const {return atol(c_str());}
+  float toFloat() const {return (float)atof(c_str());}
+  void trim() {
+    size_t a = _s.find_first_not_of(" \t\r\n");
+    size_t b = _s.find_last_not_of(" \t\r\n");
+    _s = (a == std::string::npos) ? "" : _s.substr(a, b - a + 1);
+  }
+  void toUpperCase() {for (char &c : _s) c = (char)toupper(c);}
+  void toLowerCase() {for (char &c : _s) c = (char)tolower(c);}
+  void toCharArray(char *buf, unsigned int n) const {
+    if (n == 0) return;
+    size_t len = std::min((size_t)n - 1, _s.size());
+    memcpy(buf, _s.data(), len);
+    buf[len] = '\0';
+  }
+
+  bool concat(const String &s) {_s += s._s; return true;}
+  String &operator+=(const String &s) {_s += s._s; return *this;}
+  String &operator+=(const char *s) {_s += s; return *this;}
+  String &operator+=(char c) {_s += c; return *this;}
+
+  const std::string &str() const {return _s;}
+
+private:
+  std::string _s;
+
+  static int pos(size_t p) {return (p == std::string::npos) ? -1 : (int)p;}
+  static std::string format(unsigned long v, unsigned char base) {
+    char buf[72];
+    if (base == HEX) snprintf(buf, sizeof(buf), "%lX", v);
+    else if (base == 8) snprintf(buf, sizeof(buf), "%lo", v);
+    else snprintf(buf, sizeof(buf), "%lu", v);
+    return buf;
+  }
+};
+
+inline String operator+(const String &a, const String &b) {return String(a.str() + b.str());}
+inline String operator+(const String &a, const char *b) {return String(a.str() + b);}
+inline String operator+(const char *a, const String &b) {return String(a + b.str());}
+inline String operator+(const String &a, char b) {return String(a.str() + b);}
+inline String operator+(const String &a, const __FlashStringHelper *b) {return a + String(b);}
+inline String operator+(const __FlashStringHelper *a, const String &b) {return String(a) + b;}
+template <class T, class = typename std::enable_if<std::is_arithmetic<T>::value
+                                                   && !std::is_same<T,char>::value>::type>
+inline String operator+(const String &a, T v) {return a + String(v);}
+
+
+
+// Print/Stream ================================================================
+
+class Print;
+
+/* Objects that can print themselves (e.g. IPAddress). */
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print &p) const = 0;
+};
+
+
+/* Formatted output onto a byte sink, as in the Arduino core. */
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t n) {
+    for (size_t k = 0; k < n; k++) write(buf[k]);
+    return n;
+  }
+  size_t write(const char *s) {return write((const uint8_t *)s, strlen(s));}
+  size_t write(const char *s, size_t n) {return write((const uint8_t *)s, n);}
+  virtual void flush() {}
+
+  size_t print(const char *s) {return write(s);}
+  size_t print(const String &s) {return write(s.c_str(), s.length());}
+  size_t print(const __FlashStringHelper *s) {return write(reinterpret_cast<const char *>(s));}
+  size_t print(char c) {return write((uint8_t)c);}
+  size_t print(unsigned char v, int base = DEC) {return print((unsigned long)v, base);}
+  size_t print(int v, int base = DEC) {return print((long)v, base);}
+  size_t print(unsigned int v, int base = DEC) {return print((unsigned long)v, base);}
+  size_t print(long v, int base = DEC) {return print(String(v, (unsigned char)base));}
+  size_t print(unsigned long v, int base = DEC) {return print(String(v, (unsigned char)base));}
+  size_t print(long long v, int base = DEC) {return print((long)v, base);}
+  size_t print(unsigned long long v, int base = DEC) {return print((unsigned long)v, base);}
+  size_t print(double v, int decimals = 2) {return print(String(v, (unsigned char)decimals));}
+  size_t print(const Printable &p) {return p.printTo(*this);}
+
+  size_t println() {return write("\r\n");}
+  template <class T> size_t println(const T &v) {size_t n = print(v); return n + println();}
+  template <class T> size_t println(const T &v, int fmt) {size_t n = print(v, fmt); return n + println();}
+};
+
+
+/* Readable byte source, as in the Arduino core. */
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+
+/* Hardware (or USB) serial port.  Output is handed to an optional sink;
+   input comes from a simulated receive buffer filled by the harness. */
+class HardwareSerial : public Stream {
+public:
+  explicit HardwareSerial(size_t rxCapacity) : _rxCapacity(rxCapacity) {}
+
+  void begin(unsigned long) {}
+  void end() {}
+  operator bool() const {return true;}
+
+  int available() override {return (int)_rxCount;}
+  int read() override;
+  int peek() override;
+  // Teensy extension: discards all buffered input
+  void clear();
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  // Harness interface --------------------------------------------------------
+  // Places a received byte in the buffer; returns false (byte lost) if
+  // the buffer is full
+  bool receive(uint8_t c);
+  // Destination for output (nullptr discards it)
+  void setOutput(FILE *f) {_out = f;}
+  // Optional hook called with each byte written
+  void setWriteHook(void (*hook)(uint8_t)) {_hook = hook;}
+  // Bytes discarded by clear() since the last reset of this counter
+  size_t cleared = 0;
+  size_t capacity() const {return _rxCapacity;}
+
+private:
+  size_t _rxCapacity;
+  uint8_t _rx[1024];
+  size_t _rxHead = 0;
+  size_t _rxCount = 0;
+  FILE *_out = nullptr;
+  void (*_hook)(uint8_t) = nullptr;
+};
+
+// USB serial console
+extern HardwareSerial Serial;
+// Hardware UART (XBee)
+extern HardwareSerial Serial1;
+
+
+//==============================================================================
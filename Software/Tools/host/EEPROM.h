@@ -0,0 +1,51 @@
+/*==============================================================================
+  Host stand-in for the Arduino EEPROM library: a RAM-backed array.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+#include "Arduino.h"
+
+class EEPROMClass {
+public:
+  static const size_t SIZE = 4096;
+  uint8_t read(int addr) const {return ((addr >= 0) && ((size_t)addr < SIZE)) ? _data[addr] : 0xFF;}
+  void write(int addr, uint8_t v) {if ((addr >= 0) && ((size_t)addr < SIZE)) _data[addr] = v;}
+  void update(int addr, uint8_t v) {write(addr, v);}
+  template <class T> T &get(int addr, T &v) const {
+    for (size_t k = 0; k < sizeof(T); k++) ((uint8_t *)&v)[k] = read(addr + (int)k);
+    return v;
+  }
+  template <class T> const T &put(int addr, const T &v) {
+    for (size_t k = 0; k < sizeof(T); k++) write(addr + (int)k, ((const uint8_t *)&v)[k]);
+    return v;
+  }
+  size_t length() const {return SIZE;}
+private:
+  uint8_t _data[SIZE] = {0};
+};
+
+extern EEPROMClass EEPROM;
+
+
+//==============================================================================
@@ -0,0 +1,106 @@
+/*==============================================================================
+  Host stand-in for the Arduino Ethernet library (W5100).  Connections
+  made through EthernetClient are handed to the harness's network model
+  (see host_sim.h), which decides how long they take and how the server
+  responds.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+#include <string>
+#include "Arduino.h"
+
+#define MAX_SOCK_NUM 4
+
+
+/* IPv4 address, stored in network order as on the Arduino. */
+class IPAddress : public Printable {
+public:
+  IPAddress() {}
+  IPAddress(uint32_t v) {memcpy(_b, &v, 4);}
+  IPAddress(unsigned long v) : IPAddress((uint32_t)v) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {_b[0] = a; _b[1] = b; _b[2] = c; _b[3] = d;}
+  operator uint32_t() const {uint32_t v; memcpy(&v, _b, 4); return v;}
+  uint8_t operator[](int k) const {return _b[k];}
+  uint8_t &operator[](int k) {return _b[k];}
+  bool operator==(const IPAddress &o) const {return memcmp(_b, o._b, 4) == 0;}
+  bool operator!=(const IPAddress &o) const {return !(*this == o);}
+  size_t printTo(Print &p) const override {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _b[0], _b[1], _b[2], _b[3]);
+    return p.print(buf);
+  }
+private:
+  uint8_t _b[4] = {0, 0, 0, 0};
+};
+
+
+class EthernetClass {
+public:
+  void init(uint8_t) {}
+  int begin(uint8_t *mac, unsigned long timeout = 60000, unsigned long responseTimeout = 4000);
+  void begin(uint8_t *mac, IPAddress ip, IPAddress dns, IPAddress gateway, IPAddress subnet);
+  int maintain() {return 0;}
+  IPAddress localIP() const {return _ip;}
+  IPAddress dnsServerIP() const {return _dns;}
+  void setLocalIP(IPAddress ip) {_ip = ip;}
+private:
+  IPAddress _ip;
+  IPAddress _dns;
+};
+
+extern EthernetClass Ethernet;
+
+
+/* TCP client.  Requests are buffered until flush(), then passed to the
+   network model as a whole.  As on the W5100, at most MAX_SOCK_NUM
+   clients can be connected at once; further connections fail. */
+class EthernetClient : public Stream {
+public:
+  int connect(const char *host, uint16_t port);
+  int connect(IPAddress ip, uint16_t port);
+  uint8_t connected() {return _open ? 1 : 0;}
+  operator bool() {return _open;}
+  size_t write(uint8_t c) override {_request += (char)c; return 1;}
+  size_t write(const uint8_t *buf, size_t n) override {_request.append((const char *)buf, n); return n;}
+  using Print::write;
+  void flush() override;
+  int available() override;
+  int read() override;
+  int peek() override;
+  void stop();
+  uint8_t getSocketNumber() const {return _sock;}
+  IPAddress remoteIP() const {return IPAddress();}
+  uint16_t remotePort() const {return _port;}
+private:
+  bool _open = false;
+  uint8_t _sock = MAX_SOCK_NUM;
+  uint16_t _port = 0;
+  std::string _request;
+  std::string _response;
+  size_t _responsePos = 0;
+  unsigned long long _responseAt = 0;
+};
+
+
+//==============================================================================
@@ -0,0 +1,58 @@
+/*==============================================================================
+  Host stand-in for the Arduino EthernetUDP class.  Queries sent to a
+  DNS server (port 53) are answered by the network model (see
+  sim::Network::lookup()); any other sends fail.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+#include "Ethernet.h"
+
+class EthernetUDP : public Stream {
+public:
+  uint8_t begin(uint16_t) {return 1;}
+  void stop();
+  int beginPacket(const char *, uint16_t) {return 0;}
+  int beginPacket(IPAddress, uint16_t port);
+  int endPacket();
+  size_t write(uint8_t c) override {_tx += (char)c; return 1;}
+  size_t write(const uint8_t *buf, size_t n) override {_tx.append((const char *)buf, n); return n;}
+  using Print::write;
+  int parsePacket();
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t n);
+  int peek() override;
+  IPAddress remoteIP() const {return IPAddress();}
+  uint16_t remotePort() const {return 0;}
+private:
+  uint16_t _txPort = 0;
+  std::string _tx;
+  std::string _rx;          // response not yet parsed
+  std::string _packet;      // packet being read
+  size_t _packetPos = 0;
+  unsigned long long _rxAt = 0;
+};
+
+
+//==============================================================================
@@ -0,0 +1,46 @@
+/*==============================================================================
+  Host stand-in for the TimerOne library: the attached ISR is run
+  periodically on the simulated clock (see host_sim.h).
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+#include "Arduino.h"
+
+class TimerOne {
+public:
+  void initialize(unsigned long microseconds = 1000000);
+  void setPeriod(unsigned long microseconds);
+  void attachInterrupt(void (*isr)(), unsigned long microseconds = 0);
+  void detachInterrupt();
+  void start() {}
+  void stop() {}
+  void resume() {}
+private:
+  unsigned long _period = 1000000;
+};
+
+extern TimerOne Timer1;
+
+
+//==============================================================================
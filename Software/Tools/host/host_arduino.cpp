@@ -0,0 +1,293 @@
+/*==============================================================================
+  Host implementations of the Arduino core and library stand-ins used by
+  the PODD host harness (Arduino.h, EEPROM.h, SPI.h, TimerOne.h,
+  Ethernet.h, EthernetUdp.h).
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Local headers
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Ethernet.h"
+#include "EthernetUdp.h"
+#include "SPI.h"
+#include "TimerOne.h"
+#include "host_sim.h"
+
+
+// Core ========================================================================
+
+volatile uint8_t SREG = 0x80;
+
+unsigned long millis() {return (unsigned long)(sim::now() / 1000);}
+unsigned long micros() {return (unsigned long)sim::now();}
+void delay(unsigned long ms) {sim::advance(1000ULL * ms);}
+void delayMicroseconds(unsigned int us) {sim::advance(us);}
+
+
+// Serial ======================================================================
+
+// Teensy++ 2.0 serial receive buffer is 64 bytes (Arduino 1.8.5)
+HardwareSerial Serial(64);
+HardwareSerial Serial1(64);
+
+
+int HardwareSerial::read() {
+  if (_rxCount == 0) return -1;
+  uint8_t c = _rx[_rxHead];
+  _rxHead = (_rxHead + 1) % _rxCapacity;
+  _rxCount--;
+  return c;
+}
+
+
+int HardwareSerial::peek() {
+  return (_rxCount == 0) ? -1 : _rx[_rxHead];
+}
+
+
+void HardwareSerial::clear() {
+  cleared += _rxCount;
+  _rxHead = 0;
+  _rxCount = 0;
+}
+
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (_out != nullptr) fputc(c, _out);
+  if (_hook != nullptr) _hook(c);
+  return 1;
+}
+
+
+bool HardwareSerial::receive(uint8_t c) {
+  if (_rxCount >= _rxCapacity) return false;
+  _rx[(_rxHead + _rxCount) % _rxCapacity] = c;
+  _rxCount++;
+  return true;
+}
+
+
+// Libraries ===================================================================
+
+EEPROMClass EEPROM;
+SPIClass SPI;
+TimerOne Timer1;
+EthernetClass Ethernet;
+
+
+void TimerOne::initialize(unsigned long microseconds) {
+  _period = microseconds;
+}
+
+
+void TimerOne::setPeriod(unsigned long microseconds) {
+  _period = microseconds;
+}
+
+
+void TimerOne::attachInterrupt(void (*isr)(), unsigned long microseconds) {
+  if (microseconds > 0) _period = microseconds;
+  sim::setPeriodic(1, _period, isr);
+}
+
+
+void TimerOne::detachInterrupt() {
+  sim::setPeriodic(1, 0, nullptr);
+}
+
+
+// The harness network is always reachable: DHCP succeeds immediately
+int EthernetClass::begin(uint8_t *, unsigned long, unsigned long) {
+  _ip = IPAddress(10, 0, 0, 2);
+  _dns = IPAddress(10, 0, 0, 1);
+  return 1;
+}
+
+
+void EthernetClass::begin(uint8_t *, IPAddress ip, IPAddress dns, IPAddress, IPAddress) {
+  _ip = ip;
+  _dns = dns;
+}
+
+
+// W5100 sockets in use by connected clients
+static bool socketUsed[MAX_SOCK_NUM] = {};
+
+
+int EthernetClient::connect(const char *host, uint16_t port) {
+  stop();
+  uint8_t sock = 0;
+  while ((sock < MAX_SOCK_NUM) && socketUsed[sock]) sock++;
+  if (sock == MAX_SOCK_NUM) return 0;
+  sim::Network *net = sim::network();
+  int stat = (net != nullptr) ? net->connect(host, port) : 0;
+  _open = (stat == 1);
+  _port = port;
+  if (_open) {
+    _sock = sock;
+    socketUsed[sock] = true;
+  }
+  return stat;
+}
+
+
+int EthernetClient::connect(IPAddress ip, uint16_t port) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return connect(buf, port);
+}
+
+
+void EthernetClient::flush() {
+  if (!_open || _request.empty()) return;
+  sim::Network *net = sim::network();
+  _response.clear();
+  _responsePos = 0;
+  _responseAt = (net != nullptr) ? net->request(_request, _response) : UINT64_MAX;
+  _request.clear();
+}
+
+
+int EthernetClient::available() {
+  if (!_open || (sim::now() < _responseAt)) return 0;
+  return (int)(_response.size() - _responsePos);
+}
+
+
+int EthernetClient::read() {
+  if (available() <= 0) return -1;
+  return (uint8_t)_response[_responsePos++];
+}
+
+
+int EthernetClient::peek() {
+  if (available() <= 0) return -1;
+  return (uint8_t)_response[_responsePos];
+}
+
+
+void EthernetClient::stop() {
+  if (_sock < MAX_SOCK_NUM) socketUsed[_sock] = false;
+  _sock = MAX_SOCK_NUM;
+  _open = false;
+  _request.clear();
+  _response.clear();
+  _responsePos = 0;
+  _responseAt = UINT64_MAX;
+}
+
+
+
+// Only DNS queries are answered, after DNS_DELAY [us]
+#define DNS_DELAY 2000
+
+int EthernetUDP::beginPacket(IPAddress, uint16_t port) {
+  if (port != 53) return 0;
+  _txPort = port;
+  _tx.clear();
+  return 1;
+}
+
+
+int EthernetUDP::endPacket() {
+  if (_txPort != 53) return 0;
+  _txPort = 0;
+  // Query: header, one question (length-prefixed labels, type, class)
+  const std::string q = _tx;
+  _tx.clear();
+  if (q.size() < 17) return 1;
+  std::string host;
+  size_t pos = 12;
+  while ((pos < q.size()) && (q[pos] != 0)) {
+    size_t n = (uint8_t)q[pos];
+    if (!host.empty()) host += '.';
+    host += q.substr(pos + 1, n);
+    pos += n + 1;
+  }
+  pos += 5;
+  if (pos > q.size()) return 1;
+  sim::Network *net = sim::network();
+  if (net == nullptr) return 1;
+  uint8_t ip[4];
+  uint32_t ttl = 0;
+  bool found = net->lookup(host, ip, ttl);
+  // Response: query header and question, plus any answer
+  _rx = q.substr(0, pos);
+  _rx[2] = (char)0x81;
+  _rx[3] = (char)(found ? 0x80 : 0x83);
+  _rx[7] = (char)(found ? 1 : 0);
+  if (found) {
+    const uint8_t answer[16] = {0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+                                (uint8_t)(ttl >> 24), (uint8_t)(ttl >> 16),
+                                (uint8_t)(ttl >> 8), (uint8_t)ttl,
+                                0x00, 0x04, ip[0], ip[1], ip[2], ip[3]};
+    _rx.append((const char *)answer, sizeof(answer));
+  }
+  _rxAt = sim::now() + DNS_DELAY;
+  return 1;
+}
+
+
+int EthernetUDP::parsePacket() {
+  _packet.clear();
+  _packetPos = 0;
+  if (_rx.empty() || (sim::now() < _rxAt)) return 0;
+  _packet.swap(_rx);
+  return (int)_packet.size();
+}
+
+
+int EthernetUDP::available() {
+  return (int)(_packet.size() - _packetPos);
+}
+
+
+int EthernetUDP::read() {
+  if (available() <= 0) return -1;
+  return (uint8_t)_packet[_packetPos++];
+}
+
+
+int EthernetUDP::read(uint8_t *buf, size_t n) {
+  size_t k = 0;
+  while ((k < n) && (available() > 0)) buf[k++] = (uint8_t)_packet[_packetPos++];
+  return (int)k;
+}
+
+
+int EthernetUDP::peek() {
+  if (available() <= 0) return -1;
+  return (uint8_t)_packet[_packetPos];
+}
+
+
+void EthernetUDP::stop() {
+  _txPort = 0;
+  _tx.clear();
+  _rx.clear();
+  _packet.clear();
+  _packetPos = 0;
+}
+
+
+//==============================================================================
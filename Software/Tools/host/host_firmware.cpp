@@ -0,0 +1,143 @@
+/*==============================================================================
+  Host stand-ins for the PODD firmware routines that the harness does not
+  compile from the firmware sources.  See host_firmware.h.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#include "host_firmware.h"
+
+// Local headers
+#include "Arduino.h"
+#include "host_sim.h"
+#include "pod_clock.h"
+#include "pod_config.h"
+#include "pod_logging.h"
+#include "../podd_csv.h"
+
+namespace hostfw {
+
+namespace {
+Settings current;
+uint64_t logged = 0;
+// Adjustment applied by setUTC()
+int64_t utcOffset = 0;
+}
+
+Settings &settings() {return current;}
+uint64_t sdLines() {return logged;}
+
+}  // namespace hostfw
+
+using hostfw::settings;
+
+
+// pod_config ==================================================================
+
+// Returned buffers persist until the next call (as the firmware's do
+// for the life of the configuration)
+char *getServer() {
+  static std::string s;
+  s = settings().server;
+  return &s[0];
+}
+
+char *getDevID() {
+  static std::string s;
+  s = settings().deviceID;
+  return &s[0];
+}
+
+bool getModeCoord() {return settings().coordinator;}
+bool getDebugMode() {return settings().debug;}
+
+
+// pod_clock ===================================================================
+// The RTC runs from the simulated clock.  Local time is taken to be UTC.
+
+time_t getUTC() {
+  return (time_t)(settings().utcStart + hostfw::utcOffset + (int64_t)(sim::now() / 1000000));
+}
+
+void setUTC(time_t t) {
+  hostfw::utcOffset += (int64_t)t - (int64_t)getUTC();
+}
+
+void setUTC(time_t t, unsigned long us) {
+  setUTC(t + (time_t)((micros() - us) / 1000000ul));
+}
+
+time_t getUTC(uint16_t &ms) {
+  ms = (uint16_t)((sim::now() / 1000) % 1000);
+  return getUTC();
+}
+
+// The simulated RTC always has its square wave
+bool clockHasSubsecond() {return true;}
+
+long getUTCOffset(time_t t, unsigned long us) {
+  uint16_t ms;
+  time_t t0 = getUTC(ms);
+  unsigned long elapsed = micros() - us;
+  long offset = (long)(t + elapsed / 1000000ul - t0);
+  if (offset <= -1000) return -1000000l;
+  if (offset >= 1000) return 1000000l;
+  return 1000 * offset + (long)(elapsed % 1000000ul / 1000) - ms;
+}
+
+// No drift estimation: the simulated RTC keeps perfect time
+long syncUTC(time_t t, unsigned long us, long minOffset) {
+  long offset = getUTCOffset(t, us);
+  if ((offset <= -minOffset) || (offset >= minOffset)) setUTC(t, us);
+  return offset;
+}
+
+time_t getLocalTime() {return getUTC();}
+
+String getDBDateTimeString(time_t t) {
+  char buf[20];
+  podd::formatDateTime((t == 0) ? getUTC() : t, buf);
+  return buf;
+}
+
+String getDBDateTimeString(time_t t, uint16_t ms) {
+  char buf[8];
+  snprintf(buf, sizeof(buf), ".%03u", (unsigned)(ms % 1000));
+  return getDBDateTimeString(t) + buf;
+}
+
+String getUTCDateTimeString(time_t t) {return getDBDateTimeString(t) + " UTC";}
+String getLocalDateTimeString(time_t t) {return getDBDateTimeString(t) + " UTC";}
+
+
+// pod_logging =================================================================
+
+void logDataSD(String) {hostfw::logged++;}
+void writeDebugLog(String) {}
+
+// No drone reading outbox (no SD card)
+long openOutboxSD(uint32_t &pending) {pending = 0; return -1;}
+long appendOutboxSD(const String) {return -1;}
+long readOutboxSD(const uint32_t, String &) {return -1;}
+bool markOutboxSD(const uint32_t) {return false;}
+
+
+//==============================================================================
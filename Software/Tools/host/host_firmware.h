@@ -0,0 +1,53 @@
+/*==============================================================================
+  Host stand-ins for the PODD firmware routines that the harness does not
+  compile from the firmware sources (clock, configuration and SD logging),
+  along with the settings that control them.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+// Standard libraries
+#include <cstdint>
+#include <string>
+
+namespace hostfw {
+
+/* Settings returned by the pod_config/pod_clock stand-ins. */
+struct Settings {
+  bool coordinator = true;
+  std::string deviceID = "HostPod";
+  std::string server = "podd.example.com";
+  bool debug = false;
+  // RTC time (unix) at simulated time zero
+  int64_t utcStart = 1568000000;
+};
+
+Settings &settings();
+
+// Number of lines written by logDataSD()
+uint64_t sdLines();
+
+}  // namespace hostfw
+
+
+//==============================================================================
@@ -0,0 +1,129 @@
+/*==============================================================================
+  Discrete-event simulation core for the PODD host harness.
+  See host_sim.h.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#include "host_sim.h"
+
+// Standard libraries
+#include <map>
+#include <queue>
+#include <vector>
+// Local headers
+#include "Arduino.h"
+
+namespace sim {
+
+
+namespace {
+
+struct Event {
+  uint64_t t;
+  uint64_t seq;
+  std::function<void()> fn;
+  bool operator>(const Event &o) const {return (t != o.t) ? (t > o.t) : (seq > o.seq);}
+};
+
+uint64_t clock = 0;
+uint64_t sequence = 0;
+std::priority_queue<Event,std::vector<Event>,std::greater<Event>> events;
+
+// Periodic ISRs, by id: a generation count invalidates the pending tick
+// of a replaced or stopped ISR
+struct Periodic {
+  uint64_t period = 0;
+  void (*isr)() = nullptr;
+  uint64_t generation = 0;
+};
+std::map<int,Periodic> periodics;
+
+Network *net = nullptr;
+
+
+void tick(int id, uint64_t generation) {
+  Periodic &p = periodics[id];
+  if ((p.generation != generation) || (p.period == 0)) return;
+  schedule(clock + p.period, [id, generation]() {tick(id, generation);});
+  // ISRs do not run while interrupts are disabled; on the AVR the
+  // interrupt would be serviced once they are re-enabled, but firmware
+  // code never waits with interrupts disabled, so this does not arise
+  if ((SREG & 0x80) && (p.isr != nullptr)) p.isr();
+}
+
+}  // namespace
+
+
+uint64_t now() {return clock;}
+
+
+void advanceTo(uint64_t t) {
+  while (!events.empty() && (events.top().t <= t)) {
+    Event e = events.top();
+    events.pop();
+    if (e.t > clock) clock = e.t;
+    e.fn();
+  }
+  if (t > clock) clock = t;
+}
+
+
+void advance(uint64_t us) {advanceTo(clock + us);}
+
+
+void schedule(uint64_t t, std::function<void()> fn) {
+  events.push({t, sequence++, std::move(fn)});
+}
+
+
+uint64_t nextEvent() {
+  return events.empty() ? UINT64_MAX : events.top().t;
+}
+
+
+void setPeriodic(int id, uint64_t period, void (*isr)()) {
+  Periodic &p = periodics[id];
+  p.generation++;
+  p.period = period;
+  p.isr = isr;
+  if (period == 0) return;
+  uint64_t generation = p.generation;
+  schedule(clock + period, [id, generation]() {tick(id, generation);});
+}
+
+
+void reset() {
+  clock = 0;
+  sequence = 0;
+  events = decltype(events)();
+  periodics.clear();
+}
+
+
+void setNetwork(Network *n) {net = n;}
+Network *network() {return net;}
+
+
+}  // namespace sim
+
+
+//==============================================================================
@@ -0,0 +1,106 @@
+/*==============================================================================
+  Discrete-event simulation core for the PODD host harness.
+
+  Firmware code compiled for the host runs on a simulated clock: time
+  only passes when the firmware waits (delay(), blocking network calls)
+  or when the harness explicitly charges time for work done.  While time
+  passes, any events falling due are run in order: timer ISRs (Timer1),
+  bytes arriving on serial lines, server responses, and so on.  Runs are
+  therefore deterministic and independent of the speed of the host.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+// Standard libraries
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace sim {
+
+
+// Clock =======================================================================
+
+// Current simulated time (microseconds since start)
+uint64_t now();
+
+// Advances the clock by the given amount, running any events that fall
+// due along the way
+void advance(uint64_t us);
+
+// Advances the clock to the given time (no-op if already past it)
+void advanceTo(uint64_t t);
+
+// Schedules a function to run at the given simulated time.  Events at
+// the same time run in the order scheduled.
+void schedule(uint64_t t, std::function<void()> fn);
+
+// Time of the next scheduled event (UINT64_MAX if none)
+uint64_t nextEvent();
+
+// Runs the given ISR every period microseconds (replacing any earlier
+// periodic ISR with the same id).  A period of 0 stops it.
+void setPeriodic(int id, uint64_t period, void (*isr)());
+
+// Clears the clock and all pending events
+void reset();
+
+
+// Network =====================================================================
+
+/* Network model for EthernetClient connections and DNS queries,
+   supplied by the harness. */
+class Network {
+public:
+  virtual ~Network() {}
+
+  // Called for a connection attempt.  Blocking connects take time, so
+  // the model should advance the clock as appropriate.  Returns 1 on
+  // success, or one of the Ethernet library's (non-positive) error codes.
+  virtual int connect(const std::string &host, uint16_t port) = 0;
+
+  // Called when a request has been sent over an open connection.  Sets
+  // the server's response and returns the simulated time at which it
+  // arrives (UINT64_MAX: never).
+  virtual uint64_t request(const std::string &req, std::string &response) = 0;
+
+  // Called for a DNS query (A record) made over EthernetUDP.  Sets the
+  // address and its TTL [s] and returns true, or returns false if the
+  // name is unknown.  By default all names are the harness server.
+  virtual bool lookup(const std::string &host, uint8_t ip[4], uint32_t &ttl) {
+    (void)host;
+    ip[0] = 10; ip[1] = 0; ip[2] = 0; ip[3] = 80;
+    ttl = 3600;
+    return true;
+  }
+};
+
+// Sets the network model (nullptr: all connections fail)
+void setNetwork(Network *net);
+Network *network();
+
+
+}  // namespace sim
+
+
+//==============================================================================
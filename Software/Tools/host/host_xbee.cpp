@@ -0,0 +1,136 @@
+/*==============================================================================
+  Model of the coordinator's XBee radio for the host test harness.
+  See host_xbee.h.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#include "host_xbee.h"
+
+// Standard libraries
+#include <cmath>
+// Local headers
+#include "host_sim.h"
+
+namespace sim {
+
+
+XBeeLink::XBeeLink(HardwareSerial &port, size_t bufferSize, unsigned baud)
+  : _port(port), _bufferSize(bufferSize),
+    _byteTime((uint64_t)std::llround(10e6 / baud)) {}
+
+
+bool XBeeLink::receive(const std::string &frame) {
+  if (_out.size() + frame.size() > _bufferSize) {
+    droppedFrames++;
+    return false;
+  }
+  _out.insert(_out.end(), frame.begin(), frame.end());
+  if (!_pumping) {
+    _pumping = true;
+    schedule(now() + _byteTime, [this]() {pump();});
+  }
+  return true;
+}
+
+
+void XBeeLink::pump() {
+  if (_out.empty()) {
+    _pumping = false;
+    return;
+  }
+  if (!_port.receive(_out.front())) lostBytes++;
+  _out.pop_front();
+  if (_hook != nullptr) _hook();
+  schedule(now() + _byteTime, [this]() {pump();});
+}
+
+
+std::string rxPacketFrame(uint64_t source, const std::string &data) {
+  // Frame type, source address, 16-bit address (unknown), options
+  std::string body(1, '\x90');
+  for (int k = 7; k >= 0; k--) body += (char)((source >> (8*k)) & 0xFF);
+  body += "\xFF\xFE";
+  body += '\x00';
+  body += data;
+  uint8_t checksum = 0;
+  for (char c : body) checksum += (uint8_t)c;
+  std::string raw;
+  raw += (char)((body.size() >> 8) & 0xFF);
+  raw += (char)(body.size() & 0xFF);
+  raw += body;
+  raw += (char)(0xFF - checksum);
+  std::string frame(1, '\x7E');
+  for (char c : raw) {
+    uint8_t b = (uint8_t)c;
+    if ((b == 0x7E) || (b == 0x7D) || (b == 0x11) || (b == 0x13)) {
+      frame += '\x7D';
+      frame += (char)(b ^ 0x20);
+    } else {
+      frame += c;
+    }
+  }
+  return frame;
+}
+
+
+void TxFrameReader::put(uint8_t c) {
+  if (c == 0x7E) {
+    _started = true;
+    _escaped = false;
+    _frame.clear();
+    _length = 0;
+    _header = 0;
+    return;
+  }
+  if (!_started) return;
+  if (c == 0x7D) {
+    _escaped = true;
+    return;
+  }
+  if (_escaped) {
+    c ^= 0x20;
+    _escaped = false;
+  }
+  if (_header < 2) {
+    _length = (_length << 8) | c;
+    _header++;
+    return;
+  }
+  if (_frame.size() < _length) {
+    _frame += (char)c;
+    return;
+  }
+  // Checksum: the frame is complete
+  _started = false;
+  uint8_t sum = c;
+  for (char b : _frame) sum += (uint8_t)b;
+  if ((sum != 0xFF) || (_frame.size() < 14) || ((uint8_t)_frame[0] != 0x10)) return;
+  uint64_t dest = 0;
+  for (int k = 0; k < 8; k++) dest = (dest << 8) | (uint8_t)_frame[2+k];
+  _handler(dest, _frame.substr(14));
+}
+
+
+}  // namespace sim
+
+
+//==============================================================================
@@ -0,0 +1,104 @@
+/*==============================================================================
+  Model of the coordinator's XBee radio for the host test harness:
+  frames received over the air wait in the XBee's serial output buffer
+  and are passed on a byte at a time, at the serial rate, into the
+  Teensy's receive buffer (Serial1).
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+// Standard libraries
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+// Local headers
+#include "Arduino.h"
+
+namespace sim {
+
+
+/* Coordinator XBee.  The XBee drops frames that do not fit in its
+   output buffer, and there is no flow control on the serial line, so
+   bytes arriving to a full receive buffer are lost. */
+class XBeeLink {
+public:
+  XBeeLink(HardwareSerial &port, size_t bufferSize = 1024, unsigned baud = 9600);
+
+  // Called when a frame arrives over the air.  Returns false if it was
+  // dropped.
+  bool receive(const std::string &frame);
+
+  // Nothing waiting to be passed on
+  bool idle() const {return _out.empty();}
+  // Serial transmission time of one byte [us]
+  uint64_t byteTime() const {return _byteTime;}
+
+  // Optional hook called after each byte is passed to the port
+  void setByteHook(void (*hook)()) {_hook = hook;}
+
+  uint64_t droppedFrames = 0;
+  uint64_t lostBytes = 0;
+
+private:
+  HardwareSerial &_port;
+  size_t _bufferSize;
+  uint64_t _byteTime;
+  std::deque<uint8_t> _out;
+  bool _pumping = false;
+  void (*_hook)() = nullptr;
+
+  void pump();
+};
+
+
+/* Returns the API receive packet frame (escaped, as with AP=2) the
+   coordinator's XBee passes on for data received over the air from
+   the given 64-bit source address. */
+std::string rxPacketFrame(uint64_t source, const std::string &data);
+
+
+/* Decodes the API frames the firmware writes to its XBee, one byte at
+   a time, and passes the data of each transmit request frame on with
+   its 64-bit destination address.  Other frames are skipped. */
+class TxFrameReader {
+public:
+  typedef std::function<void(uint64_t dest, const std::string &data)> Handler;
+  explicit TxFrameReader(Handler handler) : _handler(handler) {}
+
+  void put(uint8_t c);
+
+private:
+  Handler _handler;
+  std::string _frame;
+  bool _started = false;
+  bool _escaped = false;
+  size_t _length = 0;    // frame data length (once known)
+  size_t _header = 0;    // length bytes received
+};
+
+
+}  // namespace sim
+
+
+//==============================================================================
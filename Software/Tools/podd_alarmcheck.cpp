@@ -0,0 +1,705 @@
+/*==============================================================================
+  Test of the TimeAlarms scheduler used for the firmware's sensor and
+  network tasks, compiled for the host.  The enabled alarms are kept in
+  a min-heap ordered by the millis() time each is next due; random
+  sequences of timer calls are checked against a brute-force model that
+  searches every alarm at each step, and fixed cases check one-shot
+  timers, handlers acting on their own alarm, catch-up after a stall,
+  millis() wrapping and time of day alarms.
+
+  Usage:
+    podd_alarmcheck [options]
+
+  Exits with status 1 if the scheduler differs from the model or a case
+  fails.  See README.md in this directory.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Standard libraries
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+// Local headers
+#include "host/Arduino.h"
+// Libraries
+#include <TimeLib.h>
+
+
+// Clock stand-ins =============================================================
+// millis() is a 32-bit count on the pods, wrapping every 49.7 days, so
+// it is kept as one here (the host's unsigned long is 64 bits).  now()
+// advances with it from a fixed date.
+
+uint32_t clockMillis = 0;        // millis()
+uint64_t clockElapsed = 0;       // [ms] since the clock was last set
+time_t clockStart = 1577836800;  // now() when the clock was set (2020-01-01)
+
+unsigned long millis() {return clockMillis;}
+time_t now() {return clockStart + (time_t)(clockElapsed / 1000);}
+
+/* Sets millis() and now(). */
+void setClock(uint32_t ms, time_t t) {
+  clockMillis = ms;
+  clockElapsed = 0;
+  clockStart = t;
+}
+
+/* Advances the clock by the given number of milliseconds. */
+void advance(uint32_t ms) {
+  clockMillis += ms;
+  clockElapsed += ms;
+}
+
+// The library itself, with its private members opened up so the
+// schedule can be checked
+#define private public
+#include "TimeAlarms.cpp"
+#undef private
+
+
+// Options =====================================================================
+
+struct Options {
+  unsigned runs = 200;           // random sequences
+  unsigned ops = 2000;           // calls per sequence
+  uint64_t seed = 1;
+  bool verbose = false;          // print each difference
+};
+
+
+//------------------------------------------------------------------------------
+/* Prints usage information. */
+void usage(const char *prog) {
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "Options:\n"
+    "  --runs N      random call sequences (default: 200)\n"
+    "  --ops N       calls per sequence (default: 2000)\n"
+    "  --seed N      random seed (default: 1)\n"
+    "  --verbose     print every difference, not just the first\n",
+    prog);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses the command line into opts.  Returns false on invalid usage. */
+bool parseArgs(int argc, char **argv, Options &opts) {
+  for (int k = 1; k < argc; k++) {
+    std::string a = argv[k];
+    bool more = (k + 1 < argc);
+    if ((a == "--runs") && more) {
+      opts.runs = (unsigned)strtoul(argv[++k], nullptr, 10);
+    } else if ((a == "--ops") && more) {
+      opts.ops = (unsigned)strtoul(argv[++k], nullptr, 10);
+      if (opts.ops == 0) return false;
+    } else if ((a == "--seed") && more) {
+      opts.seed = (uint64_t)atoll(argv[++k]);
+    } else if (a == "--verbose") {
+      opts.verbose = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+
+// Handlers ====================================================================
+// A single handler serves every alarm.  It records the alarm that
+// triggered and may act on that alarm, as firmware handlers do (e.g. a
+// sensor routine rescheduling or freeing its own timer).
+
+enum Action {ACT_NONE, ACT_FREE, ACT_REARM, ACT_DISABLE, ACT_POSTPONE, ACT_WRITE};
+
+struct HandlerState {
+  TimeAlarmsClass *alarms = nullptr;
+  uint8_t action[256];
+  uint32_t arg[256];
+  std::vector<AlarmID_t> fired;  // alarms triggered, in order
+  std::vector<time_t> firedAt;   // now() at each trigger
+} handler;
+
+
+//------------------------------------------------------------------------------
+/* Applies the given action to an alarm, through the library. */
+void applyAction(TimeAlarmsClass &a, AlarmID_t ID, uint8_t action, uint32_t arg) {
+  switch (action) {
+    case ACT_FREE:     a.free(ID); break;
+    case ACT_REARM:    a.enable(ID); break;
+    case ACT_DISABLE:  a.disable(ID); break;
+    case ACT_POSTPONE: a.postpone(ID, arg); break;
+    case ACT_WRITE:    a.write(ID, arg); break;
+    default: break;
+  }
+}
+
+
+//------------------------------------------------------------------------------
+/* Alarm handler: records the alarm and carries out its action. */
+void onAlarm() {
+  TimeAlarmsClass &a = *handler.alarms;
+  AlarmID_t ID = a.getTriggeredAlarmId();
+  handler.fired.push_back(ID);
+  handler.firedAt.push_back(now());
+  if (ID != dtINVALID_ALARM_ID) applyAction(a, ID, handler.action[ID], handler.arg[ID]);
+}
+
+
+//------------------------------------------------------------------------------
+/* Clears the handler's record, for the given alarms. */
+void resetHandler(TimeAlarmsClass &a) {
+  handler.alarms = &a;
+  std::fill(handler.action, handler.action + 256, (uint8_t)ACT_NONE);
+  std::fill(handler.arg, handler.arg + 256, 0);
+  handler.fired.clear();
+  handler.firedAt.clear();
+}
+
+
+
+// Model =======================================================================
+
+/* A timer as the brute-force model keeps it. */
+struct RefTimer {
+  bool allocated = false;
+  bool enabled = false;
+  bool oneShot = false;
+  bool isMillis = false;
+  uint32_t value = 0;            // interval [s, or ms if isMillis]
+  uint32_t due = 0;              // millis() at which next due
+};
+
+
+/* Brute-force model of the scheduler for timers: every timer is
+   searched at each step for the one most overdue, as the library did
+   before the schedule was kept as a heap. */
+struct RefSchedule {
+  std::vector<RefTimer> t;
+  explicit RefSchedule(uint8_t n) : t(n) {}
+
+  // Interval [ms], or 0 if not valid (as timerMillis())
+  uint32_t interval(const RefTimer &r) const {
+    if (r.isMillis) return (r.value <= dtMAX_TIMER_MILLIS) ? r.value : 0;
+    return ((r.value > 0) && (r.value <= dtMAX_TIMER_MILLIS / 1000)) ? r.value * 1000 : 0;
+  }
+
+  AlarmID_t create(uint32_t value, bool oneShot, bool isMillis) {
+    for (uint8_t ID = 0; ID < t.size(); ID++) {
+      if (t[ID].allocated) continue;
+      t[ID] = RefTimer();
+      t[ID].allocated = true;
+      t[ID].oneShot = oneShot;
+      t[ID].isMillis = isMillis;
+      t[ID].value = value;
+      enable(ID);
+      return ID;
+    }
+    return dtINVALID_ALARM_ID;
+  }
+
+  void enable(AlarmID_t ID) {
+    if ((ID >= t.size()) || !t[ID].allocated) return;
+    uint32_t ms = interval(t[ID]);
+    t[ID].enabled = (ms > 0);
+    if (t[ID].enabled) t[ID].due = clockMillis + ms;
+  }
+
+  void disable(AlarmID_t ID) {
+    if ((ID < t.size()) && t[ID].allocated) t[ID].enabled = false;
+  }
+
+  void free(AlarmID_t ID) {
+    if (ID < t.size()) t[ID] = RefTimer();
+  }
+
+  void write(AlarmID_t ID, uint32_t value) {
+    if ((ID >= t.size()) || !t[ID].allocated) return;
+    t[ID].value = value;
+    enable(ID);
+  }
+
+  void postpone(AlarmID_t ID, uint32_t ms) {
+    if ((ID < t.size()) && t[ID].allocated && t[ID].enabled) t[ID].due += ms;
+  }
+
+  void apply(AlarmID_t ID, uint8_t action, uint32_t arg) {
+    switch (action) {
+      case ACT_FREE:     free(ID); break;
+      case ACT_REARM:    enable(ID); break;
+      case ACT_DISABLE:  disable(ID); break;
+      case ACT_POSTPONE: postpone(ID, arg); break;
+      case ACT_WRITE:    write(ID, arg); break;
+      default: break;
+    }
+  }
+
+  // Triggers the timers due, most overdue first, recording each with
+  // the time it was due.  A repeating timer's next interval follows on
+  // from the last unless a whole interval behind.
+  void service(std::vector<AlarmID_t> &fired, std::vector<uint32_t> &firedDue) {
+    const uint32_t ms = clockMillis;
+    for (;;) {
+      int best = -1;
+      for (uint8_t ID = 0; ID < t.size(); ID++) {
+        if (!t[ID].enabled || ((int32_t)(ms - t[ID].due) < 0)) continue;
+        if ((best < 0) || ((int32_t)(t[ID].due - t[best].due) < 0)) best = ID;
+      }
+      if (best < 0) return;
+      RefTimer &r = t[best];
+      fired.push_back(best);
+      firedDue.push_back(r.due);
+      if (r.oneShot) {
+        free(best);
+      } else {
+        uint32_t due = r.due + interval(r);
+        if ((int32_t)(ms - due) >= 0) due = ms + interval(r);
+        r.due = due;
+      }
+      apply(best, handler.action[best], handler.arg[best]);
+    }
+  }
+
+  // As millisToNextTrigger()
+  uint32_t millisToNext() const {
+    bool any = false;
+    int32_t dt = 0;
+    for (const RefTimer &r : t) {
+      if (!r.enabled) continue;
+      int32_t d = (int32_t)(r.due - clockMillis);
+      if (!any || (d < dt)) dt = d;
+      any = true;
+    }
+    if (!any) return 0xFFFFFFFFUL;
+    return (dt > 0) ? (uint32_t)dt : 0;
+  }
+};
+
+
+
+// Checks ======================================================================
+
+struct Counters {
+  uint64_t calls = 0;
+  uint64_t services = 0;
+  uint64_t triggers = 0;
+  uint64_t wraps = 0;            // sequences crossing the millis() wrap
+  uint64_t differences = 0;
+  uint64_t cases = 0;
+  uint64_t casesFailed = 0;
+  std::string first;             // first difference found
+};
+
+Counters counters;
+bool verbose = false;
+
+
+//------------------------------------------------------------------------------
+/* Records a difference from the model (or a failed case). */
+void differ(const std::string &what) {
+  if (counters.first.empty()) counters.first = what;
+  if (verbose) printf("  %s\n", what.c_str());
+}
+
+
+//------------------------------------------------------------------------------
+/* Checks the schedule is a valid heap of the enabled alarms, each
+   knowing its position.  Returns a description of the first fault, or
+   an empty string. */
+std::string checkHeap(const TimeAlarmsClass &a) {
+  uint8_t enabled = 0;
+  for (uint8_t ID = 0; ID < a.capacity; ID++) {
+    const AlarmClass &alarm = a.Alarm[ID];
+    bool scheduled = (alarm.heapPos != dtNOT_SCHEDULED);
+    if (scheduled != (a.isAllocated(ID) && alarm.Mode.isEnabled)) {
+      return "alarm " + std::to_string(ID) + (scheduled ? " scheduled but not enabled"
+                                                         : " enabled but not scheduled");
+    }
+    if (scheduled && ((alarm.heapPos >= a.heapSize) || (a.heap[alarm.heapPos] != ID))) {
+      return "alarm " + std::to_string(ID) + " at wrong schedule position";
+    }
+    if (scheduled) enabled++;
+  }
+  if (enabled != a.heapSize) return "schedule size " + std::to_string(a.heapSize)
+                                    + ", " + std::to_string(enabled) + " enabled";
+  for (uint8_t pos = 1; pos < a.heapSize; pos++) {
+    if (a.before(a.heap[pos], a.heap[(pos - 1) / 2])) {
+      return "schedule out of order at position " + std::to_string(pos);
+    }
+  }
+  return "";
+}
+
+
+//------------------------------------------------------------------------------
+/* Compares the library's alarms with the model.  Returns a description
+   of the first difference, or an empty string. */
+std::string compare(const TimeAlarmsClass &a, const RefSchedule &ref) {
+  std::string heap = checkHeap(a);
+  if (!heap.empty()) return heap;
+  for (uint8_t ID = 0; ID < a.capacity; ID++) {
+    const RefTimer &r = ref.t[ID];
+    const AlarmClass &alarm = a.Alarm[ID];
+    std::string id = "alarm " + std::to_string(ID);
+    if (a.isAllocated(ID) != r.allocated) return id + (r.allocated ? " not allocated" : " allocated");
+    if (!r.allocated) continue;
+    if ((bool)alarm.Mode.isEnabled != r.enabled) return id + (r.enabled ? " not enabled" : " enabled");
+    if (r.enabled && (alarm.due != r.due)) {
+      return id + " due at " + std::to_string(alarm.due) + ", expected " + std::to_string(r.due);
+    }
+  }
+  if (a.millisToNextTrigger() != ref.millisToNext()) {
+    return "millisToNextTrigger() " + std::to_string(a.millisToNextTrigger())
+           + ", expected " + std::to_string(ref.millisToNext());
+  }
+  return "";
+}
+
+
+//------------------------------------------------------------------------------
+/* Runs one random sequence of calls on the given alarms, comparing them
+   with the model after each.  Returns false on the first difference. */
+bool randomRun(TimeAlarmsClass &a, unsigned ops, std::mt19937_64 &rng) {
+  resetHandler(a);
+  RefSchedule ref(a.getCapacity());
+  auto uniform = [&](uint32_t lo, uint32_t hi) {
+    return std::uniform_int_distribution<uint32_t>(lo, hi)(rng);
+  };
+  auto anyID = [&]() {return (AlarmID_t)uniform(0, a.getCapacity());};  // may be unallocated
+
+  // Start near the millis() wrap in most runs
+  uint32_t start = (uniform(0, 3) > 0) ? 0xFFFFFFFFUL - uniform(0, 600000) : uniform(0, 0xFFFFFFFFUL);
+  setClock(start, 1577836800 + uniform(0, 86400));
+  bool wrapped = false;
+
+  for (unsigned step = 0; step < ops; step++) {
+    uint32_t pick = uniform(0, 99);
+    std::string call;
+    if (pick < 30) {
+      // Time passes, occasionally in a stall of several intervals
+      uint32_t ms = (uniform(0, 49) == 0) ? uniform(0, 120000) : uniform(0, 1500);
+      uint32_t before = clockMillis;
+      advance(ms);
+      if (clockMillis < before) wrapped = true;
+      handler.fired.clear();
+      std::vector<AlarmID_t> fired;
+      std::vector<uint32_t> firedDue;
+      a.service();
+      ref.service(fired, firedDue);
+      counters.services++;
+      counters.triggers += handler.fired.size();
+      // The same alarms trigger, most overdue first (alarms due at the
+      // same time may trigger in either order)
+      std::vector<AlarmID_t> got = handler.fired, want = fired;
+      std::sort(got.begin(), got.end());
+      std::sort(want.begin(), want.end());
+      call = "service() at " + std::to_string(clockMillis);
+      if (got != want) {
+        differ(call + ": " + std::to_string(handler.fired.size()) + " triggered, expected "
+               + std::to_string(fired.size()));
+        return false;
+      }
+      for (size_t k = 1; k < handler.fired.size(); k++) {
+        uint32_t prev = firedDue[std::find(fired.begin(), fired.end(), handler.fired[k-1]) - fired.begin()];
+        uint32_t next = firedDue[std::find(fired.begin(), fired.end(), handler.fired[k]) - fired.begin()];
+        if ((int32_t)(next - prev) < 0) {
+          differ(call + ": alarm " + std::to_string(handler.fired[k]) + " triggered after one due later");
+          return false;
+        }
+      }
+    } else if (pick < 50) {
+      // New timer, in seconds or milliseconds, perhaps acting on itself
+      // when triggered
+      bool oneShot = (uniform(0, 2) == 0);
+      bool isMillis = (uniform(0, 1) == 0);
+      uint32_t value = isMillis ? uniform(1, 5000) : uniform(1, 30);
+      AlarmID_t ID;
+      if (isMillis) {
+        ID = oneShot ? a.timerOnceMillis(value, onAlarm) : a.timerRepeatMillis(value, onAlarm);
+      } else {
+        ID = oneShot ? a.timerOnce(value, onAlarm) : a.timerRepeat(value, onAlarm);
+      }
+      AlarmID_t want = ref.create(value, oneShot, isMillis);
+      call = "create " + std::to_string(value) + (isMillis ? " ms" : " s");
+      if (ID != want) {
+        differ(call + ": id " + std::to_string(ID) + ", expected " + std::to_string(want));
+        return false;
+      }
+      if (ID != dtINVALID_ALARM_ID) {
+        handler.action[ID] = (uniform(0, 3) == 0) ? uniform(ACT_FREE, ACT_WRITE) : (uint32_t)ACT_NONE;
+        handler.arg[ID] = uniform(0, isMillis ? 5000 : 30);
+      }
+    } else if (pick < 60) {
+      AlarmID_t ID = anyID();
+      a.enable(ID);
+      ref.enable(ID);
+      call = "enable(" + std::to_string(ID) + ")";
+    } else if (pick < 70) {
+      AlarmID_t ID = anyID();
+      a.disable(ID);
+      ref.disable(ID);
+      call = "disable(" + std::to_string(ID) + ")";
+    } else if (pick < 78) {
+      AlarmID_t ID = anyID();
+      a.free(ID);
+      ref.free(ID);
+      call = "free(" + std::to_string(ID) + ")";
+    } else if (pick < 88) {
+      // Values of 0 and beyond the range of millis() disable the timer
+      AlarmID_t ID = anyID();
+      uint32_t r = uniform(0, 19);
+      uint32_t value = (r == 0) ? 0 : (r == 1) ? dtMAX_TIMER_MILLIS + 1 : uniform(1, 5000);
+      a.write(ID, value);
+      ref.write(ID, value);
+      call = "write(" + std::to_string(ID) + ", " + std::to_string(value) + ")";
+    } else {
+      AlarmID_t ID = anyID();
+      uint32_t ms = uniform(0, 10000);
+      a.postpone(ID, ms);
+      ref.postpone(ID, ms);
+      call = "postpone(" + std::to_string(ID) + ", " + std::to_string(ms) + ")";
+    }
+    counters.calls++;
+    std::string d = compare(a, ref);
+    if (!d.empty()) {
+      differ("after " + call + ": " + d);
+      return false;
+    }
+  }
+  if (wrapped) counters.wraps++;
+  return true;
+}
+
+
+
+// Cases =======================================================================
+
+//------------------------------------------------------------------------------
+/* Checks a condition of a fixed case. */
+void expect(bool ok, const std::string &what) {
+  counters.cases++;
+  if (ok) return;
+  counters.casesFailed++;
+  differ("case: " + what);
+}
+
+
+//------------------------------------------------------------------------------
+/* Advances the clock in the given steps [ms], servicing the alarms
+   after each, until the given time has passed.  Returns the alarms
+   triggered. */
+std::vector<AlarmID_t> runFor(TimeAlarmsClass &a, uint32_t ms, uint32_t step = 1) {
+  handler.fired.clear();
+  handler.firedAt.clear();
+  for (uint32_t t = 0; t < ms; t += step) {
+    advance(step);
+    a.service();
+  }
+  return handler.fired;
+}
+
+
+//------------------------------------------------------------------------------
+/* One-shot timers trigger once, when due, and free their alarm. */
+void oneShotCases() {
+  TimeAlarmsPool<4> a;
+  resetHandler(a);
+  setClock(1000, 1577836800);
+  AlarmID_t s = a.timerOnce(2, onAlarm);
+  AlarmID_t m = a.timerOnceMillis(250, onAlarm);
+  expect(a.millisToNextTrigger() == 250, "one-shot: next trigger in 250 ms");
+  expect(runFor(a, 249).empty(), "one-shot: nothing before 250 ms");
+  expect(runFor(a, 1) == std::vector<AlarmID_t>{m}, "one-shot: ms timer at 250 ms");
+  expect(!a.isAllocated(m), "one-shot: ms timer freed");
+  expect(runFor(a, 1749).empty(), "one-shot: nothing before 2 s");
+  expect(runFor(a, 1) == std::vector<AlarmID_t>{s}, "one-shot: timer at 2 s");
+  expect(!a.isAllocated(s) && (a.heapSize == 0), "one-shot: timer freed");
+  expect(a.millisToNextTrigger() == 0xFFFFFFFFUL, "one-shot: nothing left to trigger");
+  expect(runFor(a, 10000, 10).empty(), "one-shot: no second trigger");
+}
+
+
+//------------------------------------------------------------------------------
+/* Handlers freeing, re-arming or disabling their own alarm, with other
+   alarms due in the same call. */
+void handlerCases() {
+  TimeAlarmsPool<4> a;
+  resetHandler(a);
+  setClock(0, 1577836800);
+  AlarmID_t f = a.timerRepeatMillis(100, onAlarm);
+  AlarmID_t r = a.timerRepeatMillis(100, onAlarm);
+  AlarmID_t d = a.timerRepeatMillis(100, onAlarm);
+  AlarmID_t o = a.timerRepeatMillis(100, onAlarm);
+  handler.action[f] = ACT_FREE;
+  handler.action[r] = ACT_REARM;
+  handler.action[d] = ACT_DISABLE;
+  // All four due in one call: each triggers once
+  advance(150);
+  handler.fired.clear();
+  a.service();
+  std::vector<AlarmID_t> got = handler.fired;
+  std::sort(got.begin(), got.end());
+  expect(got == (std::vector<AlarmID_t>{f, r, d, o}), "handlers: all due alarms trigger once");
+  expect(!a.isAllocated(f), "handlers: freed own alarm");
+  expect(a.isAllocated(d) && !a.Alarm[d].Mode.isEnabled, "handlers: disabled own alarm");
+  // Re-armed from the handler: a full interval from the trigger,
+  // rather than following on from the time it was due
+  expect(a.Alarm[r].due == 250, "handlers: re-armed alarm due an interval after trigger");
+  expect(a.Alarm[o].due == 200, "handlers: other alarm keeps its phase");
+  expect(checkHeap(a).empty(), "handlers: schedule valid");
+  expect(runFor(a, 49).size() == 0, "handlers: nothing before 200 ms");
+  expect(runFor(a, 1) == std::vector<AlarmID_t>{o}, "handlers: other alarm at 200 ms");
+  expect(runFor(a, 50) == std::vector<AlarmID_t>{r}, "handlers: re-armed alarm at 250 ms");
+  // A freed id is reused by the next alarm created
+  expect(a.timerOnceMillis(10, onAlarm) == f, "handlers: freed id reused");
+}
+
+
+//------------------------------------------------------------------------------
+/* A repeating timer held up for longer than its interval triggers once,
+   then starts a new interval; held up for less, it keeps its phase. */
+void catchUpCases() {
+  TimeAlarmsPool<4> a;
+  resetHandler(a);
+  setClock(5000, 1577836800);
+  AlarmID_t t = a.timerRepeat(1, onAlarm);
+  advance(3500);
+  handler.fired.clear();
+  a.service();
+  expect(handler.fired.size() == 1, "catch-up: one trigger after a 3.5 s stall");
+  expect(a.Alarm[t].due == 5000 + 3500 + 1000, "catch-up: next a full interval after the stall");
+  expect(runFor(a, 999).empty(), "catch-up: nothing before the next interval");
+  expect(runFor(a, 1).size() == 1, "catch-up: trigger after the next interval");
+  // Late by less than an interval: the next one follows on
+  advance(1700);
+  handler.fired.clear();
+  a.service();
+  expect(handler.fired.size() == 1, "catch-up: trigger 0.7 s late");
+  expect(a.Alarm[t].due == 5000 + 3500 + 3000, "catch-up: phase kept when under an interval late");
+  // A phase offset (as for the sensor timers) delays the first trigger
+  AlarmID_t p = a.timerRepeat(2, onAlarm, 300);
+  expect(a.Alarm[p].due == clockMillis + 2300, "catch-up: phase offset of first trigger");
+}
+
+
+//------------------------------------------------------------------------------
+/* Timers due on either side of the millis() wrap trigger in order. */
+void wrapCases() {
+  TimeAlarmsPool<4> a;
+  resetHandler(a);
+  setClock(0xFFFFFFFFUL - 499, 1577836800);
+  AlarmID_t late = a.timerOnceMillis(800, onAlarm);
+  AlarmID_t early = a.timerRepeatMillis(300, onAlarm);
+  expect(a.millisToNextTrigger() == 300, "wrap: next trigger in 300 ms");
+  expect(runFor(a, 299).empty(), "wrap: nothing before 300 ms");
+  expect(runFor(a, 1) == std::vector<AlarmID_t>{early}, "wrap: timer due before the wrap");
+  expect(a.millisToNextTrigger() == 300, "wrap: next trigger in 300 ms across the wrap");
+  expect(runFor(a, 300) == std::vector<AlarmID_t>{early}, "wrap: timer due after the wrap");
+  expect(runFor(a, 199).empty(), "wrap: nothing before 800 ms");
+  expect(runFor(a, 1) == std::vector<AlarmID_t>{late}, "wrap: one-shot due after the wrap");
+  // Both overdue across the wrap: the earlier triggers first
+  setClock(0xFFFFFFFFUL - 99, 1577836800);
+  AlarmID_t b = a.timerOnceMillis(50, onAlarm);
+  AlarmID_t c = a.timerOnceMillis(150, onAlarm);
+  a.free(early);
+  advance(1000);
+  handler.fired.clear();
+  a.service();
+  expect(handler.fired == (std::vector<AlarmID_t>{b, c}), "wrap: overdue timers in order across the wrap");
+  expect(checkHeap(a).empty() && (a.heapSize == 0), "wrap: schedule empty");
+}
+
+
+//------------------------------------------------------------------------------
+/* Time of day alarms trigger once a day, in the second given, while
+   the schedule only looks at the clock as each nears. */
+void timeOfDayCases() {
+  TimeAlarmsPool<4> a;
+  resetHandler(a);
+  setClock(0xFFFFFFFFUL - 40000000, 1577836800 - 600);
+  AlarmID_t d = a.alarmRepeat(0, 0, 30, onAlarm);
+  AlarmID_t w = a.timerRepeatMillis(700, onAlarm);
+  runFor(a, 3 * 86400000u, 5);
+  std::vector<time_t> at;
+  for (size_t k = 0; k < handler.fired.size(); k++) {
+    if (handler.fired[k] == d) at.push_back(handler.firedAt[k]);
+  }
+  expect(at.size() == 3, "time of day: triggered daily");
+  for (size_t k = 0; k < at.size(); k++) {
+    expect(at[k] == 1577836800 + (time_t)(86400 * k) + 30, "time of day: triggered in its second");
+  }
+  expect(a.isAllocated(w) && a.Alarm[w].Mode.isEnabled, "time of day: timer alongside");
+}
+
+
+
+// Main ========================================================================
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseArgs(argc, argv, opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  std::mt19937_64 rng(opts.seed);
+  verbose = opts.verbose;
+
+  // Random sequences on small and full-size (dtNBR_ALARMS on the pods)
+  // alarm pools
+  unsigned failedRuns = 0;
+  for (unsigned run = 0; run < opts.runs; run++) {
+    bool ok;
+    if (run % 2 == 0) {
+      TimeAlarmsPool<4> a;
+      ok = randomRun(a, opts.ops, rng);
+    } else {
+      TimeAlarmsPool<16> a;
+      ok = randomRun(a, opts.ops, rng);
+    }
+    if (!ok) {
+      counters.differences++;
+      failedRuns++;
+    }
+  }
+
+  oneShotCases();
+  handlerCases();
+  catchUpCases();
+  wrapCases();
+  timeOfDayCases();
+
+  printf("random sequences: %u (%llu across the millis() wrap)  calls: %llu\n",
+         opts.runs, (unsigned long long)counters.wraps, (unsigned long long)counters.calls);
+  printf("services: %llu  triggers: %llu  sequences differing from model: %u\n",
+         (unsigned long long)counters.services, (unsigned long long)counters.triggers, failedRuns);
+  printf("cases: %llu checked  %llu failed\n",
+         (unsigned long long)counters.cases, (unsigned long long)counters.casesFailed);
+  bool ok = (failedRuns == 0) && (counters.casesFailed == 0);
+  if (!ok) printf("first difference: %s\n", counters.first.c_str());
+  printf(ok ? "All checks passed.\n" : "Scheduler DIFFERS from model.\n");
+  return ok ? 0 : 1;
+}
+
+
+//==============================================================================
@@ -0,0 +1,598 @@
+/*==============================================================================
+  Coordinator throughput benchmark.  Drives the coordinator firmware's
+  XBee receive and upload path (processXBee(), getXBeeBufferPacket(),
+  xbeeReading(), serviceUploadQueue() and postPage() in pod_network.cpp,
+  compiled for the host against the stand-ins in host/) with synthetic
+  reading packets from an increasing number of pods, uploading to a
+  stand-in HTTP server on the local machine.
+
+  Usage:
+    podd_coordbench [options]
+
+  For each pod count, reports the sustained upload rate, the latency
+  from a packet reaching the coordinator to its upload, the peak fill of
+  the firmware's XBee buffer and the bytes lost to buffer overruns.
+  Results can be saved as a baseline and later runs checked against it
+  (exit status 1 on a regression).  See README.md in this directory.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Standard libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+// POSIX sockets
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// Local headers
+#include "podd_csv.h"
+#include "host/Arduino.h"
+#include "host/host_firmware.h"
+#include "host/host_sim.h"
+#include "host/host_xbee.h"
+// Firmware headers
+#include "pod_network.h"
+
+// Firmware XBee buffer state (pod_network.cpp)
+extern volatile size_t xbeeBufferElements;
+
+
+// Options =====================================================================
+
+struct Options {
+  std::vector<unsigned> pods = {5, 10, 15, 20, 30, 50};
+  double duration = 120.0;       // [s] simulated time per pod count
+  double pace = 1.1;             // [s] drone time between packets
+  double jitter = 0.2;           // [s] maximum random delay of each packet
+  size_t xbeeBuffer = 1024;      // [bytes] coordinator XBee output buffer
+  unsigned baud = 9600;
+  double loop = 0.0002;          // [s] coordinator main loop overhead
+  double serverDelay = 0.0;      // [s] stand-in server response delay
+  double latency = 0.0;          // [s] simulated server response latency
+  double tolerance = 0.05;       // allowed fractional regression
+  std::string baseline;          // baseline to check against
+  std::string save;              // file to save results to
+  uint64_t seed = 1;
+};
+
+
+//------------------------------------------------------------------------------
+/* Prints usage information. */
+void usage(const char *prog) {
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "Options:\n"
+    "  --pods LIST         comma-separated pod counts (default: 5,10,15,20,30,50)\n"
+    "  --duration SEC      simulated time per pod count (default: 120)\n"
+    "  --pace SEC          drone time per packet (default: 1.1)\n"
+    "  --jitter SEC        maximum random delay of each packet (default: 0.2)\n"
+    "  --xbee-buffer N     coordinator XBee output buffer bytes (default: 1024)\n"
+    "  --baud N            XBee serial rate (default: 9600)\n"
+    "  --loop SEC          coordinator main loop overhead (default: 0.0002)\n"
+    "  --server-delay SEC  stand-in server response delay (default: 0)\n"
+    "  --latency SEC       simulated server response latency (default: 0)\n"
+    "  --baseline FILE     check results against a saved baseline\n"
+    "  --tolerance F       allowed fractional regression (default: 0.05)\n"
+    "  --save FILE         save results as a baseline\n"
+    "  --seed N            random seed (default: 1)\n",
+    prog);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses the command line into opts.  Returns false on invalid usage. */
+bool parseArgs(int argc, char **argv, Options &opts) {
+  for (int k = 1; k < argc; k++) {
+    std::string a = argv[k];
+    bool more = (k + 1 < argc);
+    if ((a == "--pods") && more) {
+      opts.pods.clear();
+      std::string list = argv[++k];
+      for (size_t p = 0; p < list.size(); ) {
+        size_t q = list.find(',', p);
+        if (q == std::string::npos) q = list.size();
+        unsigned n = (unsigned)atoi(list.substr(p, q - p).c_str());
+        if (n == 0) return false;
+        opts.pods.push_back(n);
+        p = q + 1;
+      }
+    } else if ((a == "--duration") && more) {
+      opts.duration = atof(argv[++k]);
+      if (opts.duration <= 0) return false;
+    } else if ((a == "--pace") && more) {
+      opts.pace = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--jitter") && more) {
+      opts.jitter = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--xbee-buffer") && more) {
+      opts.xbeeBuffer = (size_t)atoll(argv[++k]);
+    } else if ((a == "--baud") && more) {
+      opts.baud = (unsigned)atoi(argv[++k]);
+      if (opts.baud == 0) return false;
+    } else if ((a == "--loop") && more) {
+      opts.loop = std::max(1e-6, atof(argv[++k]));
+    } else if ((a == "--server-delay") && more) {
+      opts.serverDelay = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--latency") && more) {
+      opts.latency = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--baseline") && more) {
+      opts.baseline = argv[++k];
+    } else if ((a == "--tolerance") && more) {
+      opts.tolerance = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--save") && more) {
+      opts.save = argv[++k];
+    } else if ((a == "--seed") && more) {
+      opts.seed = (uint64_t)atoll(argv[++k]);
+    } else {
+      return false;
+    }
+  }
+  return !opts.pods.empty();
+}
+
+
+// Simulated time from seconds
+inline uint64_t us(double sec) {return (uint64_t)std::llround(1e6 * sec);}
+
+// Elapsed real time [us]
+inline uint64_t elapsed(std::chrono::steady_clock::time_point t0) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - t0).count();
+}
+
+
+
+// Stand-in server =============================================================
+
+/* Minimal HTTP server on the loopback interface, run in its own thread:
+   reads each request (headers and body) and answers 200 OK. */
+class LocalServer {
+public:
+  bool start(double delay) {
+    _delay = delay;
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd < 0) return false;
+    int one = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if ((bind(_fd, (sockaddr *)&addr, sizeof(addr)) != 0) || (listen(_fd, 16) != 0)
+        || (getsockname(_fd, (sockaddr *)&addr, &len) != 0)) {
+      close(_fd);
+      return false;
+    }
+    _port = ntohs(addr.sin_port);
+    _thread = std::thread([this]() {run();});
+    return true;
+  }
+
+  void stop() {
+    _stop = true;
+    shutdown(_fd, SHUT_RDWR);
+    if (_thread.joinable()) _thread.join();
+    close(_fd);
+  }
+
+  uint16_t port() const {return _port;}
+  uint64_t requests() const {return _requests;}
+
+private:
+  int _fd = -1;
+  uint16_t _port = 0;
+  double _delay = 0;
+  std::thread _thread;
+  std::atomic<bool> _stop{false};
+  std::atomic<uint64_t> _requests{0};
+
+  void run() {
+    while (!_stop) {
+      int c = accept(_fd, nullptr, nullptr);
+      if (c < 0) continue;
+      serve(c);
+      close(c);
+    }
+  }
+
+  void serve(int c) {
+    std::string req;
+    char buf[1024];
+    size_t need = std::string::npos;
+    while ((need == std::string::npos) || (req.size() < need)) {
+      ssize_t n = recv(c, buf, sizeof(buf), 0);
+      if (n <= 0) return;
+      req.append(buf, (size_t)n);
+      size_t hdr = req.find("\r\n\r\n");
+      if ((need == std::string::npos) && (hdr != std::string::npos)) {
+        size_t cl = req.find("Content-Length:");
+        size_t body = (cl != std::string::npos) ? (size_t)atol(req.c_str() + cl + 15) : 0;
+        need = hdr + 4 + body;
+      }
+    }
+    _requests++;
+    if (_delay > 0) std::this_thread::sleep_for(std::chrono::duration<double>(_delay));
+    const char resp[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nOK";
+    send(c, resp, sizeof(resp) - 1, 0);
+  }
+};
+
+
+
+// Benchmark ===================================================================
+
+/* A packet: when it reached the coordinator and was uploaded. */
+struct Packet {
+  uint64_t arrived = UINT64_MAX;
+  uint64_t uploaded = UINT64_MAX;
+};
+
+
+/* Results for one pod count. */
+struct Result {
+  unsigned pods = 0;
+  double offered = 0;     // packets/s sent by the pods
+  double rate = 0;        // readings/s uploaded (sustained)
+  double p50 = NAN;       // [ms] arrival to upload
+  double p99 = NAN;
+  uint64_t peak = 0;      // peak xbeeBufferElements [bytes]
+  uint64_t overrun = 0;   // xbeeBufferOverrun, total [bytes]
+  uint64_t lost = 0;      // packets sent but never uploaded
+};
+
+
+/* State of the current run. */
+struct Bench {
+  Options opts;
+  std::vector<Packet> packets;
+  std::unordered_map<std::string,uint32_t> ids;  // by "DeviceID&Reading"
+  std::mt19937_64 rng;
+  sim::XBeeLink *xbee = nullptr;
+  uint64_t endSend = 0;
+  size_t inFlight = 0;
+  size_t peak = 0;
+  uint64_t unmatched = 0;
+
+  double uniform(double max) {
+    return std::uniform_real_distribution<double>(0.0, max)(rng);
+  }
+};
+
+Bench bench;
+
+const char *SENSOR_TYPES[] = {"Light", "Humidity", "AirTemp", "GlobeTemp", "Sound",
+                              "CO2", "PM_2.5", "PM_10", "CO"};
+
+
+//------------------------------------------------------------------------------
+/* Samples the firmware's buffer fill level. */
+inline void sampleBuffer() {
+  size_t n = xbeeBufferElements;
+  if (n > bench.peak) bench.peak = n;
+}
+
+
+//------------------------------------------------------------------------------
+/* Sends a pod's next synthetic reading, and schedules the one after.
+   Each reading value is unique to the pod, identifying the packet when
+   it is uploaded. */
+void sendReading(unsigned pod, uint32_t seq) {
+  Bench &b = bench;
+  char did[16], value[24], dt[24];
+  snprintf(did, sizeof(did), "bench%03u", pod);
+  snprintf(value, sizeof(value), "%u.%02u", seq / 100, seq % 100);
+  int64_t ts = hostfw::settings().utcStart + (int64_t)(sim::now() / 1000000);
+  podd::formatDateTime(ts, dt);
+  std::string payload = std::string("V,") + did + "," + SENSOR_TYPES[seq % 9] + ","
+                        + value + "," + std::to_string(ts) + "," + dt;
+  std::string frame = sim::rxPacketFrame(0x0013A20040000000ull + pod, payload);
+
+  uint32_t id = (uint32_t)b.packets.size();
+  b.packets.emplace_back();
+  b.ids[std::string(did) + "&" + value] = id;
+
+  uint64_t tx = frame.size() * b.xbee->byteTime();
+  b.inFlight++;
+  sim::schedule(sim::now() + tx, [frame, id]() {
+    bench.inFlight--;
+    if (bench.xbee->receive(frame)) bench.packets[id].arrived = sim::now();
+  });
+
+  uint64_t next = sim::now() + tx + us(b.opts.pace + b.uniform(b.opts.jitter));
+  if (next < b.endSend) sim::schedule(next, [pod, seq]() {sendReading(pod, seq + 1);});
+}
+
+
+//------------------------------------------------------------------------------
+/* Connects to the stand-in server over real sockets.  The real time
+   taken by each connection and request is added to the simulated clock,
+   and the response arrives after a further --latency of simulated time. */
+class SocketNetwork : public sim::Network {
+public:
+  explicit SocketNetwork(uint16_t port) : _port(port) {}
+
+  int connect(const std::string &, uint16_t) override {
+    auto t0 = std::chrono::steady_clock::now();
+    closeSocket();
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd < 0) return 0;
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(_port);
+    int stat = (::connect(_fd, (sockaddr *)&addr, sizeof(addr)) == 0) ? 1 : 0;
+    if (stat != 1) closeSocket();
+    sim::advance(elapsed(t0));
+    return stat;
+  }
+
+  uint64_t request(const std::string &req, std::string &response) override {
+    auto t0 = std::chrono::steady_clock::now();
+    if (_fd < 0) return UINT64_MAX;
+    bool ok = (send(_fd, req.data(), req.size(), 0) == (ssize_t)req.size());
+    char buf[512];
+    ssize_t n;
+    while (ok && ((n = recv(_fd, buf, sizeof(buf), 0)) > 0)) response.append(buf, (size_t)n);
+    closeSocket();
+    if (response.empty()) return UINT64_MAX;
+    uint64_t arrival = sim::now() + elapsed(t0) + us(bench.opts.latency);
+
+    // Match the post to its packet
+    size_t body = req.find("\r\n\r\n");
+    std::string content = (body == std::string::npos) ? "" : req.substr(body + 4);
+    auto it = bench.ids.find(field(content, "DeviceID") + "&" + field(content, "Reading"));
+    if (it != bench.ids.end()) {
+      bench.packets[it->second].uploaded = arrival;
+      bench.ids.erase(it);
+    } else {
+      bench.unmatched++;
+    }
+    return arrival;
+  }
+
+private:
+  uint16_t _port;
+  int _fd = -1;
+
+  void closeSocket() {
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+  }
+
+  static std::string field(const std::string &content, const char *name) {
+    std::string prefix = std::string(name) + "=";
+    size_t a = 0;
+    while (a < content.size()) {
+      size_t b = content.find('&', a);
+      if (b == std::string::npos) b = content.size();
+      if (content.compare(a, prefix.size(), prefix) == 0) {
+        return content.substr(a + prefix.size(), b - a - prefix.size());
+      }
+      a = b + 1;
+    }
+    return "";
+  }
+};
+
+
+//------------------------------------------------------------------------------
+/* Runs the coordinator with the given number of pods. */
+Result run(unsigned pods) {
+  Bench &b = bench;
+  const Options &opts = b.opts;
+  Result r;
+  r.pods = pods;
+
+  // Fresh simulation and firmware buffers
+  sim::reset();
+  b.packets.clear();
+  b.ids.clear();
+  b.rng.seed(opts.seed);
+  b.inFlight = 0;
+  b.peak = 0;
+  sim::XBeeLink xbee(Serial1, opts.xbeeBuffer, opts.baud);
+  xbee.setByteHook(sampleBuffer);
+  b.xbee = &xbee;
+  sim::advance(us(1.0));
+  startXBee();
+  Serial1.cleared = 0;
+
+  // Pods start at random times within their first packet interval
+  uint64_t start = sim::now();
+  b.endSend = start + us(opts.duration);
+  for (unsigned k = 0; k < pods; k++) {
+    sim::schedule(start + us(b.uniform(opts.pace)), [k]() {sendReading(k, 0);});
+  }
+
+  // Coordinator main loop, until the pods have stopped and everything
+  // received has been processed (or a minute later, if stuck)
+  const uint64_t loopTime = us(opts.loop);
+  while (true) {
+    ethernetMaintain();
+    sampleBuffer();
+    processXBee();
+    serviceUploadQueue();
+    sim::advance(loopTime);
+    if (sim::now() < b.endSend) continue;
+    bool idle = (b.inFlight == 0) && xbee.idle() && (Serial1.available() == 0)
+                && (xbeeBufferElements == 0) && (getUploadQueueCount() == 0);
+    if (idle || (sim::now() > b.endSend + us(60.0))) break;
+  }
+
+  // Sustained rate: uploads after the first tenth of the run (start-up)
+  // up to the end of sending
+  uint64_t warm = start + us(0.1 * opts.duration);
+  uint64_t uploads = 0;
+  std::vector<double> latency;
+  for (const Packet &p : b.packets) {
+    if (p.uploaded == UINT64_MAX) {
+      r.lost++;
+      continue;
+    }
+    if ((p.uploaded >= warm) && (p.uploaded < b.endSend)) uploads++;
+    latency.push_back(1e-3 * (p.uploaded - p.arrived));
+  }
+  std::sort(latency.begin(), latency.end());
+  double window = 1e-6 * (b.endSend - warm);
+  r.offered = b.packets.size() / opts.duration;
+  r.rate = uploads / window;
+  if (!latency.empty()) {
+    r.p50 = latency[(size_t)std::llround(0.50 * (latency.size() - 1))];
+    r.p99 = latency[(size_t)std::llround(0.99 * (latency.size() - 1))];
+  }
+  r.peak = b.peak;
+  r.overrun = Serial1.cleared;
+  b.xbee = nullptr;
+  return r;
+}
+
+
+
+// Baseline ====================================================================
+// Text file, one line per pod count:
+//   pods offered rate p50 p99 peak overrun lost
+
+bool saveBaseline(const std::string &path, const std::vector<Result> &results) {
+  FILE *f = fopen(path.c_str(), "w");
+  if (f == nullptr) return false;
+  fprintf(f, "# podd_coordbench baseline\n");
+  fprintf(f, "# pods offered/s readings/s p50_ms p99_ms peak_buffer overrun lost\n");
+  for (const Result &r : results) {
+    fprintf(f, "%u %.3f %.3f %.3f %.3f %llu %llu %llu\n", r.pods, r.offered, r.rate,
+            r.p50, r.p99, (unsigned long long)r.peak, (unsigned long long)r.overrun,
+            (unsigned long long)r.lost);
+  }
+  return fclose(f) == 0;
+}
+
+
+bool loadBaseline(const std::string &path, std::map<unsigned,Result> &results) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (f == nullptr) return false;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    if (line[0] == '#') continue;
+    Result r;
+    unsigned long long peak, overrun, lost;
+    if (sscanf(line, "%u %lf %lf %lf %lf %llu %llu %llu", &r.pods, &r.offered, &r.rate,
+               &r.p50, &r.p99, &peak, &overrun, &lost) != 8) continue;
+    r.peak = peak;
+    r.overrun = overrun;
+    r.lost = lost;
+    results[r.pods] = r;
+  }
+  fclose(f);
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+/* Compares a result with its baseline, printing any regressions.
+   Latencies are allowed an extra millisecond (they include real
+   loopback round trips) and counts a few bytes or packets. */
+bool check(const Result &r, const Result &base, double tol) {
+  bool ok = true;
+  auto fail = [&](const char *what, double v, double b) {
+    printf("REGRESSION (%u pods): %s %.3f vs baseline %.3f\n", r.pods, what, v, b);
+    ok = false;
+  };
+  if (r.rate < base.rate * (1 - tol)) fail("readings/s", r.rate, base.rate);
+  if (r.p50 > base.p50 * (1 + tol) + 1.0) fail("p50 latency", r.p50, base.p50);
+  if (r.p99 > base.p99 * (1 + tol) + 1.0) fail("p99 latency", r.p99, base.p99);
+  if (r.peak > base.peak * (1 + tol) + 8) fail("peak buffer", r.peak, base.peak);
+  if (r.overrun > base.overrun * (1 + tol) + 8) fail("overrun", r.overrun, base.overrun);
+  if (r.lost > base.lost * (1 + tol) + 2) fail("lost packets", r.lost, base.lost);
+  return ok;
+}
+
+
+
+// Main ========================================================================
+
+int main(int argc, char **argv) {
+  Bench &b = bench;
+  if (!parseArgs(argc, argv, b.opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  const Options &opts = b.opts;
+
+  std::map<unsigned,Result> baseline;
+  if (!opts.baseline.empty() && !loadBaseline(opts.baseline, baseline)) {
+    fprintf(stderr, "Unable to read baseline %s.\n", opts.baseline.c_str());
+    return 1;
+  }
+
+  LocalServer server;
+  if (!server.start(opts.serverDelay)) {
+    fprintf(stderr, "Unable to start local server.\n");
+    return 1;
+  }
+  SocketNetwork network(server.port());
+  sim::setNetwork(&network);
+  hostfw::settings().coordinator = true;
+  Serial.setOutput(nullptr);
+  ethernetSetup();
+
+  printf("%5s %10s %11s %8s %8s %8s %8s %6s\n",
+         "pods", "offered/s", "readings/s", "p50 ms", "p99 ms", "peak buf", "overrun", "lost");
+  std::vector<Result> results;
+  bool ok = true;
+  unsigned capacity = 0;
+  for (unsigned pods : opts.pods) {
+    Result r = run(pods);
+    results.push_back(r);
+    printf("%5u %10.2f %11.2f %8.1f %8.1f %8llu %8llu %6llu\n", r.pods, r.offered, r.rate,
+           r.p50, r.p99, (unsigned long long)r.peak, (unsigned long long)r.overrun,
+           (unsigned long long)r.lost);
+    if ((r.lost == 0) && (r.overrun == 0) && (pods > capacity)) capacity = pods;
+    auto it = baseline.find(pods);
+    if (it != baseline.end()) ok = check(r, it->second, opts.tolerance) && ok;
+  }
+  server.stop();
+  printf("capacity: %u pods without loss (%llu uploads, %llu unmatched)\n", capacity,
+         (unsigned long long)server.requests(), (unsigned long long)b.unmatched);
+
+  if (!opts.save.empty() && !saveBaseline(opts.save, results)) {
+    fprintf(stderr, "Unable to write %s.\n", opts.save.c_str());
+    return 1;
+  }
+  if (!opts.baseline.empty()) {
+    printf(ok ? "Baseline check passed.\n" : "Baseline check FAILED.\n");
+  }
+  return ok ? 0 : 1;
+}
+
+
+//==============================================================================
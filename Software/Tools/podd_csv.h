@@ -0,0 +1,444 @@
+/*==============================================================================
+  Shared routines for the host-side PODD data tools: memory-mapped file
+  access and a zero-copy tokenizer for the CSV data logs written to the
+  PODD SD card.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+// Standard libraries
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// PODD data logs come in a few flavors, depending on the firmware
+// version that wrote them.  All have two time columns followed by one
+// column per sensor quantity, with at most a few sensor columns filled
+// on any given row:
+//
+//   Date, Time, Light, RH, ...               (2017 firmware)
+//   17-9-21, 9:54:19, , , , , 50.30, , , ,
+//   11/20/2017, 16:53:40, , , , ,37.7, , , ,
+//
+//   Timestamp, Date/Time, Light, RH, ...     (current firmware)
+//   1568000000, 2019-09-08 20:33:20, , 45.20, ...
+//
+// The older formats record local time only.  The current format records
+// the unix (UTC) timestamp along with the local date/time.
+
+namespace podd {
+
+
+// Calendar ====================================================================
+
+//------------------------------------------------------------------------------
+/* Number of days since 1970-01-01 for the given proleptic Gregorian date
+   (month 1-12, day 1-31).  Constant time; see:
+     http://howardhinnant.github.io/date_algorithms.html */
+inline int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= (m <= 2);
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+
+//------------------------------------------------------------------------------
+/* Inverse of above: date for the given number of days since 1970-01-01. */
+inline void civilFromDays(int64_t z, int &y, unsigned &m, unsigned &d) {
+  z += 719468;
+  const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  const unsigned doy = doe - (365*yoe + yoe/4 - yoe/100);
+  const unsigned mp = (5*doy + 2) / 153;
+  d = doy - (153*mp + 2)/5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = (int)((int64_t)yoe + era * 400 + (m <= 2));
+}
+
+
+//------------------------------------------------------------------------------
+/* Formats the given (unix-like) time as "YYYY-MM-DD HH:MM:SS" into the
+   buffer, which must hold at least 20 characters. */
+inline void formatDateTime(int64_t t, char *buf) {
+  int64_t days = (t >= 0) ? t / 86400 : -((-t + 86399) / 86400);
+  unsigned secs = (unsigned)(t - days * 86400);
+  int y; unsigned m, d;
+  civilFromDays(days, y, m, d);
+  const unsigned v[6] = {(unsigned)y % 10000, m, d, secs / 3600, secs / 60 % 60, secs % 60};
+  char *p = buf;
+  *p++ = (char)('0' + v[0] / 1000);
+  *p++ = (char)('0' + v[0] / 100 % 10);
+  for (int k = 0; k < 6; k++) {
+    *p++ = (char)('0' + v[k] / 10 % 10);
+    *p++ = (char)('0' + v[k] % 10);
+    *p++ = "-- :: "[k];
+  }
+  p[-1] = '\0';
+}
+
+
+
+// Memory-mapped files =========================================================
+
+/* Read-only view of a whole file.  The file is memory-mapped when
+   possible, so parsing touches the page cache directly without copying
+   the data into a user-space buffer first. */
+class MappedFile {
+public:
+  MappedFile() {}
+  ~MappedFile() {close();}
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Maps the given file.  Returns false if the file could not be opened.
+  bool open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    _size = (size_t)st.st_size;
+    _mtime = (int64_t)st.st_mtime;
+    if (_size > 0) {
+      void *p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        return false;
+      }
+      // Data is consumed front to back exactly once
+      madvise(p, _size, MADV_SEQUENTIAL);
+      _data = (const char *)p;
+    }
+    ::close(fd);
+    return true;
+  }
+
+  void close() {
+    if (_data != nullptr) munmap((void *)_data, _size);
+    _data = nullptr;
+    _size = 0;
+  }
+
+  const char *data() const {return _data;}
+  const char *end() const {return _data + _size;}
+  size_t size() const {return _size;}
+  int64_t mtime() const {return _mtime;}
+
+private:
+  const char *_data = nullptr;
+  size_t _size = 0;
+  int64_t _mtime = 0;
+};
+
+
+
+// Tokenizer ===================================================================
+
+// Which of the two time columns to use for files in the current format.
+// Older formats only have local time, so this setting is ignored there.
+enum TimeSource {UTC_TIME, LOCAL_TIME};
+
+// Columns in the data logs that precede the sensor columns
+const int TIME_COLUMNS = 2;
+
+
+//------------------------------------------------------------------------------
+/* Skips spaces (and tabs) starting at p, without passing end. */
+inline const char *skipSpaces(const char *p, const char *end) {
+  while ((p < end) && ((*p == ' ') || (*p == '\t'))) p++;
+  return p;
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses an unsigned decimal integer at p, advancing p.  Returns -1 if
+   no digits were found. */
+inline int64_t parseUnsigned(const char *&p, const char *end) {
+  if ((p >= end) || (unsigned)(*p - '0') > 9) return -1;
+  int64_t v = 0;
+  while ((p < end) && (unsigned)(*p - '0') <= 9) {
+    v = 10*v + (*p - '0');
+    p++;
+  }
+  return v;
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses a decimal number of the form written by the firmware
+   ("-12.34", "1003.23", "30") in [p,end).  Falls back to strtod for
+   anything more exotic.  Returns NAN if the field is not numeric. */
+inline double parseValue(const char *p, const char *end) {
+  static const double POW10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,
+                                 1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17};
+  const char *p0 = p;
+  bool neg = false;
+  if ((p < end) && ((*p == '-') || (*p == '+'))) {
+    neg = (*p == '-');
+    p++;
+  }
+  uint64_t mant = 0;
+  int digits = 0, frac = 0;
+  while ((p < end) && (unsigned)(*p - '0') <= 9) {
+    mant = 10*mant + (uint64_t)(*p - '0');
+    p++;
+    digits++;
+  }
+  if ((p < end) && (*p == '.')) {
+    p++;
+    while ((p < end) && (unsigned)(*p - '0') <= 9) {
+      mant = 10*mant + (uint64_t)(*p - '0');
+      p++;
+      digits++;
+      frac++;
+    }
+  }
+  p = skipSpaces(p, end);
+  if ((digits > 0) && (digits <= 18) && (p == end)) {
+    double v = (double)mant / POW10[frac];
+    return neg ? -v : v;
+  }
+  // Something unusual ("nan", exponents, long mantissas, garbage)
+  if (digits == 0 && p0 == end) return NAN;
+  std::string s(p0, end);
+  char *e;
+  double v = strtod(s.c_str(), &e);
+  if (e == s.c_str()) return NAN;
+  e = (char *)skipSpaces(e, s.c_str() + s.size());
+  return (*e == '\0') ? v : NAN;
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses a date field in any of the forms written by the firmware
+   ("17-9-21", "2019-09-08", "11/20/2017"), returning days since
+   1970-01-01, or INT64_MIN if the field is not a valid date. */
+inline int64_t parseDate(const char *&p, const char *end) {
+  int64_t a = parseUnsigned(p, end);
+  if ((a < 0) || (p >= end)) return INT64_MIN;
+  char sep = *p++;
+  if ((sep != '-') && (sep != '/')) return INT64_MIN;
+  int64_t b = parseUnsigned(p, end);
+  if ((b < 0) || (p >= end) || (*p++ != sep)) return INT64_MIN;
+  int64_t c = parseUnsigned(p, end);
+  if (c < 0) return INT64_MIN;
+  int64_t y, m, d;
+  if (sep == '/') {
+    // M/D/YYYY
+    m = a; d = b; y = c;
+  } else {
+    // Y-M-D, with two-digit years in 2017 firmware
+    y = a; m = b; d = c;
+  }
+  if (y < 100) y += 2000;
+  if ((m < 1) || (m > 12) || (d < 1) || (d > 31)) return INT64_MIN;
+  return daysFromCivil(y, (unsigned)m, (unsigned)d);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses a time of day field ("9:54:19"), returning seconds since
+   midnight, or -1 if the field is invalid.  Any fraction of a second
+   ("20:33:20.125", current firmware) is left unparsed. */
+inline int64_t parseTimeOfDay(const char *&p, const char *end) {
+  int64_t h = parseUnsigned(p, end);
+  if ((h < 0) || (p >= end) || (*p++ != ':')) return -1;
+  int64_t m = parseUnsigned(p, end);
+  if ((m < 0) || (p >= end) || (*p++ != ':')) return -1;
+  int64_t s = parseUnsigned(p, end);
+  if ((s < 0) || (h > 23) || (m > 59) || (s > 60)) return -1;
+  return 3600*h + 60*m + s;
+}
+
+
+//------------------------------------------------------------------------------
+/* Returns the end of the field starting at p: the next comma, or the end
+   of the line (trailing '\r' excluded).  Fields are short, so a plain
+   loop beats memchr here. */
+inline const char *fieldEnd(const char *p, const char *end) {
+  while ((p < end) && (*p != ',') && (*p != '\r')) p++;
+  return p;
+}
+
+
+//------------------------------------------------------------------------------
+/* Sensor column names from the header line of a data log, with the two
+   leading time columns removed.  Returns the position just past the
+   header line through hdrEnd. */
+inline std::vector<std::string> parseHeader(const char *p, const char *end,
+                                            const char *&hdrEnd) {
+  std::vector<std::string> cols;
+  const char *eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+  if (eol == nullptr) eol = end;
+  hdrEnd = (eol < end) ? eol + 1 : end;
+  int k = 0;
+  while (p <= eol) {
+    const char *q = fieldEnd(p, eol);
+    const char *s = skipSpaces(p, q);
+    if (k >= TIME_COLUMNS) cols.push_back(std::string(s, q));
+    k++;
+    if (q >= eol) break;
+    p = q + 1;
+  }
+  return cols;
+}
+
+
+/* Date field of the previous row and its parsed value.  Consecutive
+   rows nearly always share a date, so the date is only parsed when the
+   field text changes. */
+struct DateCache {
+  const char *text = nullptr;
+  size_t len = 0;
+  int64_t days = 0;
+
+  inline int64_t parse(const char *p, const char *end) {
+    size_t n = (size_t)(end - p);
+    if ((n == len) && (text != nullptr) && (memcmp(p, text, n) == 0)) return days;
+    const char *q = p;
+    int64_t v = parseDate(q, end);
+    if ((v == INT64_MIN) || (skipSpaces(q, end) != end)) return INT64_MIN;
+    text = p;
+    len = n;
+    days = v;
+    return v;
+  }
+};
+
+
+//------------------------------------------------------------------------------
+/* Parses the time columns of a data row into seconds since 1970-01-01
+   (UTC for the current format when src is UTC_TIME, local otherwise).
+   On success, returns true and advances p to the first sensor column. */
+inline bool parseRowTime(const char *&p, const char *eol, TimeSource src,
+                         DateCache &cache, int64_t &t) {
+  const char *f0 = skipSpaces(p, eol);
+  const char *e0 = fieldEnd(f0, eol);
+  if (e0 >= eol) return false;
+  const char *f1 = skipSpaces(e0 + 1, eol);
+  const char *e1 = fieldEnd(f1, eol);
+  const char *q = f0;
+  int64_t v = parseUnsigned(q, e0);
+  if ((v >= 0) && (q < e0) && ((*q == '-') || (*q == '/'))) {
+    // Older formats: local date and time of day in separate columns
+    int64_t days = cache.parse(f0, e0);
+    if (days == INT64_MIN) return false;
+    q = f1;
+    int64_t tod = parseTimeOfDay(q, e1);
+    if (tod < 0) return false;
+    t = 86400*days + tod;
+  } else if (v >= 0) {
+    // Current format: unix timestamp, then "YYYY-MM-DD HH:MM:SS"
+    if (src == UTC_TIME) {
+      t = v;
+    } else {
+      const char *de = f1;
+      while ((de < e1) && (*de != ' ')) de++;
+      int64_t days = cache.parse(f1, de);
+      if (days == INT64_MIN) return false;
+      q = skipSpaces(de, e1);
+      int64_t tod = parseTimeOfDay(q, e1);
+      if (tod < 0) return false;
+      t = 86400*days + tod;
+    }
+  } else {
+    return false;
+  }
+  p = (e1 < eol) ? e1 + 1 : eol;
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+/* Walks every non-empty sensor value in the data rows of [p,end),
+   invoking fn(time, column, value) for each, where column indexes the
+   sensor columns (0 = first column after the time columns).  Rows with
+   unparsable times are skipped.  Returns the number of rows seen. */
+template <class F>
+size_t forEachValue(const char *p, const char *end, TimeSource src, F &&fn) {
+  size_t rows = 0;
+  DateCache cache;
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+    if (eol == nullptr) eol = end;
+    int64_t t;
+    const char *q = p;
+    if (parseRowTime(q, eol, src, cache, t)) {
+      rows++;
+      int col = 0;
+      // Rows are sparse: most fields are empty (", ")
+      while (q < eol) {
+        char c = *q;
+        if (c == ' ') {
+          q++;
+        } else if (c == ',') {
+          col++;
+          q++;
+        } else if (c == '\r') {
+          break;
+        } else {
+          const char *fe = fieldEnd(q, eol);
+          double v = parseValue(q, fe);
+          if (!std::isnan(v)) fn(t, col, v);
+          q = fe;
+        }
+      }
+    }
+    p = eol + 1;
+  }
+  return rows;
+}
+
+
+//------------------------------------------------------------------------------
+/* Pod name for a data log path: the file name without directory or
+   extension (e.g. "Sample Data/podd1_5La.CSV" -> "podd1_5La"). */
+inline std::string podNameFromPath(const std::string &path) {
+  size_t a = path.find_last_of('/');
+  a = (a == std::string::npos) ? 0 : a + 1;
+  size_t b = path.find_last_of('.');
+  if ((b == std::string::npos) || (b < a)) b = path.size();
+  return path.substr(a, b - a);
+}
+
+
+}  // namespace podd
+
+
+//==============================================================================
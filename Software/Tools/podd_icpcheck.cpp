@@ -0,0 +1,351 @@
+/*==============================================================================
+  Test of the NeoSWSerial input capture receiver (NEOSWSERIAL_ICP), used
+  for the CO2 sensor with CO2_SERIAL_ICP.  The library is compiled for
+  the host against a model of timer 1 (free-running at F_CPU/8, with the
+  input capture and compare B flags) and of the interrupt latency left
+  by other ISRs and by code that runs with interrupts disabled.  Random
+  characters are sent to the RX pin and compared with those read back.
+
+  Usage:
+    podd_icpcheck [options]
+
+  Exits with status 1 if any character is lost or garbled.  See README.md
+  in this directory.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Standard libraries
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+// Local headers
+#include "host/Arduino.h"
+
+
+// AVR stand-ins ===============================================================
+// Registers and macros used by NeoSWSerial, for a Teensy++ 2.0
+// (AT90USB1286 at 16 MHz).  Timer 1 counts from the model's clock.
+
+#define F_CPU 16000000L
+#define __AVR_AT90USB1286__
+#define NEOSWSERIAL_ICP
+#define NEOSWSERIAL_EXTERNAL_PCINT
+
+#define _BV(b) (1 << (b))
+#define bit(b) (1UL << (b))
+#define ISR(vec) void vec()
+
+// Teensy++ 2.0 pin numbers
+#define PIN_D4 4
+#define PIN_B5 25
+
+// Register bits
+#define SREG_I 7
+#define CS11 1
+#define ICES1 6
+#define ICNC1 7
+#define OCF1B 2
+#define ICF1 5
+#define OCIE1B 2
+#define ICIE1 5
+
+// Timer 1 ticks since the model started (2 per microsecond)
+uint64_t ticks = 0;
+
+/* TCNT1: low 16 bits of the model's clock. */
+struct Timer1Count {
+  operator uint16_t() const {return (uint16_t)ticks;}
+};
+
+/* Interrupt flag register: flags are cleared by writing 1 to them. */
+struct FlagRegister {
+  uint8_t flags = 0;
+  FlagRegister &operator=(uint8_t m) {flags &= ~m; return *this;}
+  operator uint8_t() const {return flags;}
+};
+
+Timer1Count TCNT1;
+FlagRegister TIFR1;
+uint16_t ICR1, OCR1B;
+uint8_t TCCR1A, TCCR1B, TIMSK1;
+uint8_t TCNT0, TCCR2A, TCCR2B, PCIFR, PCICR, PCMSK0;
+volatile uint8_t PINB, PIND, PORTB, PORTD;
+
+inline uint8_t digitalPinToPort(uint8_t pin) {return (pin < 8) ? 'D' : 'B';}
+inline uint8_t digitalPinToBitMask(uint8_t pin) {return _BV(pin % 8);}
+inline volatile uint8_t *portInputRegister(uint8_t port) {return (port == 'D') ? &PIND : &PINB;}
+inline volatile uint8_t *portOutputRegister(uint8_t port) {return (port == 'D') ? &PORTD : &PORTB;}
+inline uint8_t *digitalPinToPCMSK(uint8_t pin) {return (pin < 8) ? nullptr : &PCMSK0;}
+inline uint8_t *digitalPinToPCICR(uint8_t) {return &PCICR;}
+inline uint8_t digitalPinToPCMSKbit(uint8_t pin) {return pin % 8;}
+inline uint8_t digitalPinToPCICRbit(uint8_t) {return 0;}
+
+// The library itself
+#include "NeoSWSerial.cpp"
+
+
+// Options =====================================================================
+
+struct Options {
+  unsigned long chars = 20000;   // characters sent per run
+  double latency = 100;          // maximum interrupt latency [us]
+  double isr = 5;                // time taken by each capture/wrap ISR [us]
+  double poll = 1000;            // maximum time between reads [us]
+  double skew = 0.005;           // maximum sender baud rate error
+  uint16_t baud = 9600;
+  bool sweep = false;            // run over a range of latencies
+  uint64_t seed = 1;
+};
+
+
+//------------------------------------------------------------------------------
+/* Prints usage information. */
+void usage(const char *prog) {
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "Options:\n"
+    "  --chars N       characters sent (default: 20000)\n"
+    "  --latency US    maximum interrupt latency (default: 100)\n"
+    "  --isr US        time taken by each ISR (default: 5)\n"
+    "  --poll US       maximum time between reads (default: 1000)\n"
+    "  --skew X        maximum sender baud rate error (default: 0.005)\n"
+    "  --baud N        serial rate: 9600, 19200 or 38400 (default: 9600)\n"
+    "  --sweep         report errors over a range of latencies\n"
+    "  --seed N        random seed (default: 1)\n",
+    prog);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses the command line into opts.  Returns false on invalid usage. */
+bool parseArgs(int argc, char **argv, Options &opts) {
+  for (int k = 1; k < argc; k++) {
+    std::string a = argv[k];
+    bool more = (k + 1 < argc);
+    if ((a == "--chars") && more) {
+      opts.chars = strtoul(argv[++k], nullptr, 10);
+      if (opts.chars == 0) return false;
+    } else if ((a == "--latency") && more) {
+      opts.latency = atof(argv[++k]);
+      if (opts.latency < 0) return false;
+    } else if ((a == "--isr") && more) {
+      opts.isr = atof(argv[++k]);
+      if (opts.isr < 0) return false;
+    } else if ((a == "--poll") && more) {
+      opts.poll = atof(argv[++k]);
+      if (opts.poll <= 0) return false;
+    } else if ((a == "--skew") && more) {
+      opts.skew = atof(argv[++k]);
+      if ((opts.skew < 0) || (opts.skew > 0.05)) return false;
+    } else if ((a == "--baud") && more) {
+      opts.baud = (uint16_t)atoi(argv[++k]);
+      if ((opts.baud != 9600) && (opts.baud != 19200) && (opts.baud != 38400)) return false;
+    } else if (a == "--sweep") {
+      opts.sweep = true;
+    } else if ((a == "--seed") && more) {
+      opts.seed = (uint64_t)atoll(argv[++k]);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+
+// Model =======================================================================
+
+/* Line level change at the RX pin. */
+struct Edge {
+  uint64_t t;     // [ticks]
+  uint8_t level;  // level after the edge
+};
+
+/* Results of one run. */
+struct Result {
+  unsigned long sent = 0;
+  unsigned long received = 0;
+  unsigned long differ = 0;    // characters that differ from those sent
+  long firstError = -1;        // position of the first difference
+  unsigned long wraps = 0;     // timer 1 wraps during the run
+  unsigned peakQueue = 0;      // peak fill of the capture queue
+};
+
+
+//------------------------------------------------------------------------------
+/* Random characters as sent on the line: a start bit, 8 data bits (lsb
+   first) and a stop bit, at a baud rate off by up to opts.skew, and
+   with an idle gap of up to three bits after half of them.  Returns the
+   edges, starting at time t0 [ticks]. */
+std::vector<Edge> makeLine(const Options &opts, std::mt19937_64 &rng,
+                           uint64_t t0, std::vector<uint8_t> &chars) {
+  std::uniform_real_distribution<double> unit(0, 1);
+  double bitTicks = (F_CPU / 8.0) / opts.baud / (1 + opts.skew * (2 * unit(rng) - 1));
+  std::vector<Edge> edges;
+  uint8_t level = 1;
+  double t = (double)t0;
+  auto hold = [&](uint8_t v, double bits) {
+    if (v != level) edges.push_back({(uint64_t)(t + 0.5), v});
+    level = v;
+    t += bits * bitTicks;
+  };
+  for (unsigned long k = 0; k < opts.chars; k++) {
+    uint8_t c = (uint8_t)rng();
+    chars.push_back(c);
+    hold(0, 1);
+    for (int b = 0; b < 8; b++) hold((c >> b) & 1, 1);
+    hold(1, 1);
+    if (unit(rng) < 0.5) hold(1, 3 * unit(rng));
+  }
+  return edges;
+}
+
+
+//------------------------------------------------------------------------------
+/* Sends random characters to a listening NeoSWSerial port, one timer
+   tick at a time.  When an interrupt flag is raised with no ISR running,
+   ISRs are held off for a random time of up to opts.latency (another
+   ISR, or code with interrupts disabled); pending ISRs then run in
+   priority order (capture, then compare B), each taking opts.isr.  The
+   main loop reads the port at random intervals of up to opts.poll. */
+Result run(const Options &opts, std::mt19937_64 &rng) {
+  std::uniform_real_distribution<double> unit(0, 1);
+  const double TICKS_PER_US = F_CPU / 8.0 / 1000000;
+  Result r;
+
+  // Start at a random timer phase, so wraps fall anywhere in a character
+  ticks = rng() % 0x10000;
+  TIFR1.flags = 0;
+  NeoSWSerial port(PIN_D4, PIN_B5);
+  PIND = 0xFF;
+  port.begin(opts.baud);
+
+  std::vector<uint8_t> sent, received;
+  std::vector<Edge> edges = makeLine(opts, rng, ticks + 1000, sent);
+  uint64_t end = edges.back().t + (uint64_t)(20 * (F_CPU / 8.0) / opts.baud + opts.poll * TICKS_PER_US);
+  size_t next = 0;
+  uint64_t busyUntil = 0;
+  uint64_t nextPoll = ticks;
+
+  for (; ticks < end; ticks++) {
+    uint8_t raised = 0;
+    // Compare B matches at TOP; the flag is set as the counter wraps
+    if ((uint16_t)ticks == 0) {
+      TIFR1.flags |= _BV(OCF1B);
+      raised |= _BV(OCF1B);
+      r.wraps++;
+    }
+    // Edge at the RX pin, captured if it is the armed one
+    if ((next < edges.size()) && (edges[next].t == ticks)) {
+      uint8_t level = edges[next++].level;
+      PIND = level ? (PIND | _BV(4)) : (PIND & ~_BV(4));
+      if (level == ((TCCR1B & _BV(ICES1)) ? 1 : 0)) {
+        ICR1 = (uint16_t)ticks;
+        TIFR1.flags |= _BV(ICF1);
+        raised |= _BV(ICF1);
+      }
+    }
+    if (ticks < busyUntil) continue;
+    if (raised != 0) {
+      busyUntil = ticks + (uint64_t)(opts.latency * TICKS_PER_US * unit(rng));
+      if (ticks < busyUntil) continue;
+    }
+
+    // Pending ISRs (the hardware clears the flag on entry)
+    if ((TIMSK1 & _BV(ICIE1)) && (TIFR1.flags & _BV(ICF1))) {
+      TIFR1.flags &= ~_BV(ICF1);
+      TIMER1_CAPT_vect();
+      busyUntil = ticks + (uint64_t)(opts.isr * TICKS_PER_US);
+      continue;
+    }
+    if ((TIMSK1 & _BV(OCIE1B)) && (TIFR1.flags & _BV(OCF1B))) {
+      TIFR1.flags &= ~_BV(OCF1B);
+      TIMER1_COMPB_vect();
+      busyUntil = ticks + (uint64_t)(opts.isr * TICKS_PER_US);
+      continue;
+    }
+
+    // Main loop
+    if (ticks >= nextPoll) {
+      unsigned fill = (uint8_t)(captureHead - captureTail) % CAPTURE_QUEUE_SIZE;
+      if (fill > r.peakQueue) r.peakQueue = fill;
+      while (port.available() > 0) received.push_back((uint8_t)port.read());
+      nextPoll = ticks + (uint64_t)(opts.poll * TICKS_PER_US * unit(rng));
+    }
+  }
+  port.ignore();
+
+  r.sent = sent.size();
+  r.received = received.size();
+  for (size_t k = 0; k < std::max(sent.size(), received.size()); k++) {
+    if ((k < sent.size()) && (k < received.size()) && (received[k] == sent[k])) continue;
+    if (r.firstError < 0) r.firstError = (long)k;
+    r.differ++;
+  }
+  return r;
+}
+
+
+//------------------------------------------------------------------------------
+/* Whether every character was received correctly. */
+bool passed(const Result &r) {
+  return r.firstError < 0;
+}
+
+
+
+// Main ========================================================================
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseArgs(argc, argv, opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  std::mt19937_64 rng(opts.seed);
+
+  if (opts.sweep) {
+    printf("latency us    sent  received  first error  peak queue\n");
+    for (double latency = 0; latency <= 300; latency += 25) {
+      Options o = opts;
+      o.latency = latency;
+      Result r = run(o, rng);
+      printf("%10.0f %7lu %9lu %12ld %11u\n", latency, r.sent, r.received, r.firstError, r.peakQueue);
+    }
+    return 0;
+  }
+
+  Result r = run(opts, rng);
+  printf("baud %u, latency up to %.0f us, reads every %.0f us or less\n",
+         opts.baud, opts.latency, opts.poll);
+  printf("characters: sent %lu  received %lu  differing %lu (first at %ld)\n",
+         r.sent, r.received, r.differ, r.firstError);
+  printf("timer wraps: %lu  peak capture queue: %u of %u\n",
+         r.wraps, r.peakQueue, (unsigned)CAPTURE_QUEUE_SIZE - 1);
+  printf(passed(r) ? "All characters received correctly.\n"
+                   : "Characters LOST or GARBLED.\n");
+  return passed(r) ? 0 : 1;
+}
+
+
+//==============================================================================
@@ -0,0 +1,475 @@
+/*==============================================================================
+  Host-side ingester for PODD data logs.  Merges the CSV logs of any
+  number of pods, resamples them onto a common time grid, and writes the
+  result as a dense table (columnar binary or CSV).
+
+  Usage:
+    podd_ingest [options] FILE...
+
+  Each FILE is a PODD data log (SD card or exported); the pod name is
+  taken from the file name unless given explicitly as NAME=FILE.  See
+  README.md in this directory for the options and output format.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Standard libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+// Local headers
+#include "podd_csv.h"
+
+
+// Files are split into chunks of about this size (at line boundaries)
+// so that large logs are parsed by several threads at once.
+const size_t CHUNK_SIZE = 4 << 20;
+
+
+// Options =====================================================================
+
+struct Options {
+  std::vector<std::pair<std::string,std::string>> inputs;  // (pod, path)
+  std::string output = "-";
+  int64_t step = 60;
+  bool ffill = false;
+  bool csv = false;
+  bool bench = false;
+  int repeat = 5;
+  unsigned threads = 0;
+  podd::TimeSource source = podd::UTC_TIME;
+};
+
+
+//------------------------------------------------------------------------------
+/* Prints usage information. */
+void usage(const char *prog) {
+  fprintf(stderr,
+    "Usage: %s [options] [POD=]FILE...\n"
+    "Options:\n"
+    "  -o FILE       output file (default: stdout)\n"
+    "  --step SEC    resampling interval in seconds (default: 60)\n"
+    "  --ffill       carry the last value forward into empty intervals\n"
+    "  --csv         write CSV instead of the columnar binary format\n"
+    "  --local       use the local date/time column of current-format logs\n"
+    "  --threads N   number of parser threads (default: all cores)\n"
+    "  --bench       parse only, reporting throughput\n"
+    "  --repeat N    benchmark passes (default: 5)\n",
+    prog);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses the command line into opts.  Returns false on invalid usage. */
+bool parseArgs(int argc, char **argv, Options &opts) {
+  for (int k = 1; k < argc; k++) {
+    std::string a = argv[k];
+    bool more = (k + 1 < argc);
+    if ((a == "-o") && more) {
+      opts.output = argv[++k];
+    } else if ((a == "--step") && more) {
+      opts.step = atoll(argv[++k]);
+      if (opts.step <= 0) return false;
+    } else if (a == "--ffill") {
+      opts.ffill = true;
+    } else if (a == "--csv") {
+      opts.csv = true;
+    } else if (a == "--local") {
+      opts.source = podd::LOCAL_TIME;
+    } else if ((a == "--threads") && more) {
+      opts.threads = (unsigned)atoi(argv[++k]);
+    } else if (a == "--bench") {
+      opts.bench = true;
+    } else if ((a == "--repeat") && more) {
+      opts.repeat = std::max(1, atoi(argv[++k]));
+    } else if ((a.size() > 1) && (a[0] == '-')) {
+      return false;
+    } else {
+      // POD=FILE or FILE
+      size_t eq = a.find('=');
+      if ((eq != std::string::npos) && (eq > 0) && (a.find('/') > eq)) {
+        opts.inputs.emplace_back(a.substr(0, eq), a.substr(eq + 1));
+      } else {
+        opts.inputs.emplace_back(podd::podNameFromPath(a), a);
+      }
+    }
+  }
+  if (opts.threads == 0) opts.threads = std::max(1u, std::thread::hardware_concurrency());
+  return !opts.inputs.empty();
+}
+
+
+
+// Resampling ==================================================================
+
+/* Per-interval sums and counts for each sensor column of one pod.
+   Intervals are indexed relative to the first interval seen; the
+   range grows in either direction as needed, which is cheap as logs
+   are (mostly) chronological. */
+struct Bins {
+  int ncols = 0;
+  int64_t first = 0;   // interval index of row 0
+  size_t nbins = 0;
+  std::vector<double> sum;
+  std::vector<uint32_t> count;
+
+  void init(int n) {
+    ncols = n;
+    first = 0;
+    nbins = 0;
+    sum.clear();
+    count.clear();
+  }
+
+  // Ensures interval b is in range, growing the arrays as necessary
+  inline size_t slot(int64_t b) {
+    if (nbins == 0) {
+      first = b;
+      grow(0, 1);
+    } else if (b < first) {
+      grow((size_t)(first - b), 0);
+      first = b;
+    } else if (b >= first + (int64_t)nbins) {
+      size_t need = (size_t)(b - first) + 1 - nbins;
+      grow(0, std::max(need, nbins / 2));
+    }
+    return (size_t)(b - first);
+  }
+
+  inline void add(int64_t b, int col, double v) {
+    size_t i = slot(b) * ncols + col;
+    sum[i] += v;
+    count[i]++;
+  }
+
+  // Adds the intervals of another set of bins (same columns) to these
+  void merge(const Bins &o) {
+    if (o.nbins == 0) return;
+    slot(o.first);
+    slot(o.first + (int64_t)o.nbins - 1);
+    size_t off = (size_t)(o.first - first) * ncols;
+    for (size_t i = 0; i < o.nbins * ncols; i++) {
+      sum[off + i] += o.sum[i];
+      count[off + i] += o.count[i];
+    }
+  }
+
+  int64_t last() const {return first + (int64_t)nbins - 1;}
+
+private:
+  void grow(size_t front, size_t back) {
+    size_t n = (nbins + front + back) * ncols;
+    std::vector<double> s(n, 0.0);
+    std::vector<uint32_t> c(n, 0);
+    std::copy(sum.begin(), sum.end(), s.begin() + front * ncols);
+    std::copy(count.begin(), count.end(), c.begin() + front * ncols);
+    sum.swap(s);
+    count.swap(c);
+    nbins += front + back;
+  }
+};
+
+
+/* One input file, mapped into memory, along with its accumulated
+   intervals. */
+struct Input {
+  std::string pod;
+  std::string path;
+  podd::MappedFile file;
+  std::vector<std::string> columns;
+  const char *body = nullptr;   // first data row
+  Bins bins;
+  size_t rows = 0;
+};
+
+
+/* Range of data rows within one input to be parsed by a single thread. */
+struct Chunk {
+  Input *input;
+  const char *begin;
+  const char *end;
+  bool whole;   // chunk covers the entire input
+};
+
+
+//------------------------------------------------------------------------------
+/* Floor division, for intervals preceding 1970. */
+inline int64_t floorDiv(int64_t a, int64_t b) {
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+
+//------------------------------------------------------------------------------
+/* Splits the data rows of the input into chunks at line boundaries. */
+void splitChunks(Input &in, std::vector<Chunk> &chunks) {
+  const char *p = in.body;
+  const char *end = in.file.end();
+  size_t first = chunks.size();
+  while (p < end) {
+    const char *q = p + std::min(CHUNK_SIZE, (size_t)(end - p));
+    if (q < end) {
+      const char *nl = (const char *)memchr(q, '\n', (size_t)(end - q));
+      q = (nl == nullptr) ? end : nl + 1;
+    }
+    chunks.push_back({&in, p, q, false});
+    p = q;
+  }
+  if (chunks.size() == first + 1) chunks.back().whole = true;
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses all inputs, accumulating their values into per-input bins,
+   using the given number of threads. */
+void parseInputs(std::vector<Input> &inputs, const Options &opts) {
+  std::vector<Chunk> chunks;
+  for (Input &in : inputs) {
+    in.bins.init((int)in.columns.size());
+    in.rows = 0;
+    splitChunks(in, chunks);
+  }
+  std::atomic<size_t> next(0);
+  std::mutex lock;
+  auto worker = [&]() {
+    Bins local;
+    for (size_t k; (k = next++) < chunks.size(); ) {
+      const Chunk &c = chunks[k];
+      Input &in = *c.input;
+      const int ncols = in.bins.ncols;
+      const int64_t step = opts.step;
+      // Small inputs are accumulated directly; chunks of larger inputs
+      // are accumulated separately and merged
+      Bins &bins = c.whole ? in.bins : local;
+      if (!c.whole) local.init(ncols);
+      size_t rows = podd::forEachValue(c.begin, c.end, opts.source,
+        [&](int64_t t, int col, double v) {
+          if (col < ncols) bins.add(floorDiv(t, step), col, v);
+        });
+      if (c.whole) {
+        in.rows = rows;
+        continue;
+      }
+      std::lock_guard<std::mutex> guard(lock);
+      in.bins.merge(local);
+      in.rows += rows;
+    }
+  };
+  unsigned n = std::min<size_t>(opts.threads, std::max<size_t>(1, chunks.size()));
+  std::vector<std::thread> pool;
+  for (unsigned k = 1; k < n; k++) pool.emplace_back(worker);
+  worker();
+  for (std::thread &t : pool) t.join();
+}
+
+
+/* Dense resampled table: a column of values for each (pod, sensor)
+   pair with any data, one row per interval. */
+struct Table {
+  int64_t start = 0;   // time of first row
+  int64_t step = 0;
+  size_t nrows = 0;
+  std::vector<std::string> names;
+  std::vector<std::vector<float>> columns;
+};
+
+
+//------------------------------------------------------------------------------
+/* Builds the resampled table from the parsed inputs.  Interval values
+   are the mean of all samples in the interval; empty intervals are NAN,
+   or the previous value if forward-filling.  Inputs for the same pod
+   are merged. */
+Table buildTable(std::vector<Input> &inputs, const Options &opts) {
+  Table table;
+  table.step = opts.step;
+  // Merge inputs by pod and sensor name, preserving first-seen order
+  std::map<std::string,size_t> index;
+  std::vector<std::pair<std::string,Bins>> merged;
+  int64_t lo = INT64_MAX, hi = INT64_MIN;
+  for (Input &in : inputs) {
+    const Bins &b = in.bins;
+    if (b.nbins == 0) continue;
+    lo = std::min(lo, b.first);
+    hi = std::max(hi, b.last());
+    for (int col = 0; col < b.ncols; col++) {
+      std::string name = in.pod + ":" + in.columns[col];
+      auto it = index.find(name);
+      size_t k;
+      if (it == index.end()) {
+        k = merged.size();
+        index[name] = k;
+        merged.emplace_back(name, Bins());
+        merged.back().second.init(1);
+      } else {
+        k = it->second;
+      }
+      Bins one;
+      one.init(1);
+      one.first = b.first;
+      one.nbins = b.nbins;
+      one.sum.resize(b.nbins);
+      one.count.resize(b.nbins);
+      for (size_t i = 0; i < b.nbins; i++) {
+        one.sum[i] = b.sum[i*b.ncols + col];
+        one.count[i] = b.count[i*b.ncols + col];
+      }
+      merged[k].second.merge(one);
+    }
+  }
+  if (lo > hi) return table;
+  table.start = lo * opts.step;
+  table.nrows = (size_t)(hi - lo + 1);
+  for (auto &m : merged) {
+    const Bins &b = m.second;
+    size_t off = (size_t)(b.first - lo);
+    std::vector<float> col(table.nrows, NAN);
+    bool any = false;
+    for (size_t i = 0; i < b.nbins; i++) {
+      if (b.count[i] == 0) continue;
+      col[off + i] = (float)(b.sum[i] / b.count[i]);
+      any = true;
+    }
+    if (!any) continue;
+    if (opts.ffill) {
+      float last = NAN;
+      for (float &v : col) {
+        if (std::isnan(v)) v = last;
+        else last = v;
+      }
+    }
+    table.names.push_back(m.first);
+    table.columns.push_back(std::move(col));
+  }
+  return table;
+}
+
+
+
+// Output ======================================================================
+
+//------------------------------------------------------------------------------
+/* Writes the table in the columnar binary format: a short text header
+   describing the grid and column names, terminated by an empty line,
+   followed by each column in turn as little-endian 32-bit floats.  The
+   row times are implicit (start + row*step). */
+bool writeColumnar(FILE *f, const Table &table) {
+  fprintf(f, "PODDCOL1\nstart %lld\nstep %lld\nrows %zu\ncolumns %zu\n",
+          (long long)table.start, (long long)table.step,
+          table.nrows, table.names.size());
+  for (const std::string &name : table.names) fprintf(f, "%s\n", name.c_str());
+  fputc('\n', f);
+  for (const std::vector<float> &col : table.columns) {
+    if (fwrite(col.data(), sizeof(float), col.size(), f) != col.size()) return false;
+  }
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+/* Writes the table as CSV, in the same two-time-column layout as the
+   PODD data logs.  Empty intervals are left blank. */
+bool writeCSV(FILE *f, const Table &table) {
+  fprintf(f, "Timestamp, Date/Time");
+  for (const std::string &name : table.names) fprintf(f, ", %s", name.c_str());
+  fprintf(f, "\r\n");
+  char dt[20];
+  for (size_t r = 0; r < table.nrows; r++) {
+    int64_t t = table.start + (int64_t)r * table.step;
+    podd::formatDateTime(t, dt);
+    fprintf(f, "%lld, %s", (long long)t, dt);
+    for (const std::vector<float> &col : table.columns) {
+      if (std::isnan(col[r])) fprintf(f, ", ");
+      else fprintf(f, ", %.2f", col[r]);
+    }
+    fprintf(f, "\r\n");
+  }
+  return !ferror(f);
+}
+
+
+
+// Main ========================================================================
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseArgs(argc, argv, opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<Input> inputs(opts.inputs.size());
+  size_t bytes = 0;
+  for (size_t k = 0; k < inputs.size(); k++) {
+    Input &in = inputs[k];
+    in.pod = opts.inputs[k].first;
+    in.path = opts.inputs[k].second;
+    if (!in.file.open(in.path)) {
+      fprintf(stderr, "Unable to open %s.\n", in.path.c_str());
+      return 1;
+    }
+    in.columns = podd::parseHeader(in.file.data(), in.file.end(), in.body);
+    bytes += in.file.size();
+  }
+
+  if (opts.bench) {
+    // Best of several passes, so that the first (cold cache) pass
+    // does not dominate
+    double best = 1e30;
+    size_t rows = 0;
+    for (int k = 0; k < opts.repeat; k++) {
+      auto t0 = std::chrono::steady_clock::now();
+      parseInputs(inputs, opts);
+      auto t1 = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+      rows = 0;
+      for (const Input &in : inputs) rows += in.rows;
+    }
+    printf("files: %zu  bytes: %zu  rows: %zu  threads: %u\n",
+           inputs.size(), bytes, rows, opts.threads);
+    printf("parse: %.3f ms  %.1f MB/s  %.2f Mrows/s\n",
+           1e3*best, bytes / best / 1e6, rows / best / 1e6);
+    return 0;
+  }
+
+  parseInputs(inputs, opts);
+  Table table = buildTable(inputs, opts);
+
+  FILE *f = (opts.output == "-") ? stdout : fopen(opts.output.c_str(), "wb");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to open %s for writing.\n", opts.output.c_str());
+    return 1;
+  }
+  bool ok = opts.csv ? writeCSV(f, table) : writeColumnar(f, table);
+  if (f != stdout) ok = (fclose(f) == 0) && ok;
+  if (!ok) {
+    fprintf(stderr, "Error writing %s.\n", opts.output.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+
+//==============================================================================
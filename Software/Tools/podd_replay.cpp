@@ -0,0 +1,560 @@
+/*==============================================================================
+  Coordinator load test for PODD networks.  Replays recorded data logs
+  as the XBee "V" reading packets a set of drone pods would send, and
+  feeds them through the coordinator firmware's XBee receive and upload
+  path (readXBee() -> processXBee() -> serviceUploadQueue() ->
+  postPage()), compiled for the host against the stand-ins in host/.
+
+  Usage:
+    podd_replay [options] [POD=]FILE...
+
+  Each FILE is a PODD data log; its readings are sent by one simulated
+  pod (or several, with --pods).  Everything runs on a simulated clock,
+  so runs are repeatable and much faster than real time.  See README.md
+  in this directory for the options and the model.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Standard libraries
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+// Local headers
+#include "podd_csv.h"
+#include "host/Arduino.h"
+#include "host/host_firmware.h"
+#include "host/host_sim.h"
+#include "host/host_xbee.h"
+// Firmware headers
+#include "pod_network.h"
+
+// Firmware XBee buffer state (pod_network.cpp)
+extern volatile size_t xbeeBufferElements;
+
+
+// Options =====================================================================
+
+struct Options {
+  std::vector<std::pair<std::string,std::string>> inputs;  // (pod, path)
+  unsigned pods = 0;             // number of pods (0: one per input)
+  double speed = 1.0;            // log time compression
+  double duration = 600.0;       // [s] of (compressed) log time to replay
+  double phase = 60.0;           // [s] maximum pod start offset
+  double jitter = 0.2;           // [s] maximum delay of each reading
+  double pace = 1.1;             // [s] drone time between packets
+  double rf = 0.02;              // [s] radio transit time
+  size_t xbeeBuffer = 1024;      // [bytes] coordinator XBee output buffer
+  unsigned baud = 9600;
+  double loop = 0.0002;          // [s] coordinator main loop overhead
+  double connect = 0.005;        // [s] server connect time
+  double server = 0.04;          // [s] server response time
+  double serverJitter = 0.02;    // [s] maximum additional response time
+  double fail = 0.0;             // connect failure probability
+  uint64_t seed = 1;
+  bool verbose = false;
+};
+
+
+//------------------------------------------------------------------------------
+/* Prints usage information. */
+void usage(const char *prog) {
+  fprintf(stderr,
+    "Usage: %s [options] [POD=]FILE...\n"
+    "Options:\n"
+    "  --pods N          number of simulated pods (default: one per file)\n"
+    "  --speed X         replay logs X times faster than recorded (default: 1)\n"
+    "  --duration SEC    replay this much (replayed) time (default: 600)\n"
+    "  --phase SEC       maximum random pod start offset (default: 60)\n"
+    "  --jitter SEC      maximum random delay of each reading (default: 0.2)\n"
+    "  --pace SEC        drone time per packet sent (default: 1.1)\n"
+    "  --rf SEC          radio transit time (default: 0.02)\n"
+    "  --xbee-buffer N   coordinator XBee output buffer bytes (default: 1024)\n"
+    "  --baud N          XBee serial rate (default: 9600)\n"
+    "  --loop SEC        coordinator main loop overhead (default: 0.0002)\n"
+    "  --connect SEC     server connect time (default: 0.005)\n"
+    "  --server SEC      server response time (default: 0.04)\n"
+    "  --server-jitter SEC  maximum additional response time (default: 0.02)\n"
+    "  --fail P          server connect failure probability (default: 0)\n"
+    "  --seed N          random seed (default: 1)\n"
+    "  --verbose         show the firmware's serial console output\n",
+    prog);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses the command line into opts.  Returns false on invalid usage. */
+bool parseArgs(int argc, char **argv, Options &opts) {
+  for (int k = 1; k < argc; k++) {
+    std::string a = argv[k];
+    bool more = (k + 1 < argc);
+    if ((a == "--pods") && more) {
+      opts.pods = (unsigned)atoi(argv[++k]);
+    } else if ((a == "--speed") && more) {
+      opts.speed = atof(argv[++k]);
+      if (opts.speed <= 0) return false;
+    } else if ((a == "--duration") && more) {
+      opts.duration = atof(argv[++k]);
+    } else if ((a == "--phase") && more) {
+      opts.phase = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--jitter") && more) {
+      opts.jitter = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--pace") && more) {
+      opts.pace = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--rf") && more) {
+      opts.rf = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--xbee-buffer") && more) {
+      opts.xbeeBuffer = (size_t)atoll(argv[++k]);
+    } else if ((a == "--baud") && more) {
+      opts.baud = (unsigned)atoi(argv[++k]);
+      if (opts.baud == 0) return false;
+    } else if ((a == "--loop") && more) {
+      opts.loop = std::max(1e-6, atof(argv[++k]));
+    } else if ((a == "--connect") && more) {
+      opts.connect = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--server") && more) {
+      opts.server = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--server-jitter") && more) {
+      opts.serverJitter = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--fail") && more) {
+      opts.fail = atof(argv[++k]);
+    } else if ((a == "--seed") && more) {
+      opts.seed = (uint64_t)atoll(argv[++k]);
+    } else if (a == "--verbose") {
+      opts.verbose = true;
+    } else if ((a.size() > 1) && (a[0] == '-')) {
+      return false;
+    } else {
+      // POD=FILE or FILE
+      size_t eq = a.find('=');
+      if ((eq != std::string::npos) && (eq > 0) && (a.find('/') > eq)) {
+        opts.inputs.emplace_back(a.substr(0, eq), a.substr(eq + 1));
+      } else {
+        opts.inputs.emplace_back(podd::podNameFromPath(a), a);
+      }
+    }
+  }
+  if (opts.pods == 0) opts.pods = (unsigned)opts.inputs.size();
+  return !opts.inputs.empty();
+}
+
+
+// Simulated time from seconds
+inline uint64_t us(double sec) {return (uint64_t)std::llround(1e6 * sec);}
+
+
+
+// Readings ====================================================================
+
+/* A reading as sent by a drone: time offset within its log, and the
+   packet text. */
+struct Reading {
+  int64_t t;
+  int sensor;
+  std::string value;
+};
+
+/* The readings of one data log, in log order. */
+struct Log {
+  std::string pod;
+  std::vector<Reading> readings;
+};
+
+
+//------------------------------------------------------------------------------
+/* Returns the sensor type name the firmware uses in XBee packets for the
+   given log column header, or an empty string for unknown columns. */
+std::string sensorType(const std::string &header) {
+  auto starts = [&](const char *s) {return header.compare(0, strlen(s), s) == 0;};
+  if (starts("Light")) return "Light";
+  if (starts("RH") || starts("Humidity")) return "Humidity";
+  if (starts("Air")) return "AirTemp";
+  if (starts("Globe")) return "GlobeTemp";
+  if (starts("Sound")) return "Sound";
+  if (starts("CO2")) return "CO2";
+  if (starts("PM 2.5") || starts("PM2.5")) return "PM_2.5";
+  if (starts("PM 10") || starts("PM10")) return "PM_10";
+  if (starts("CO")) return "CO";
+  return "";
+}
+
+
+//------------------------------------------------------------------------------
+/* Loads the readings of a data log, with times relative to the first
+   row.  Returns false if the file cannot be read. */
+bool loadLog(const std::string &path, Log &log, std::vector<std::string> &types) {
+  podd::MappedFile file;
+  if (!file.open(path)) return false;
+  const char *body;
+  std::vector<std::string> columns = podd::parseHeader(file.data(), file.end(), body);
+  std::vector<int> sensor(columns.size(), -1);
+  for (size_t k = 0; k < columns.size(); k++) {
+    std::string type = sensorType(columns[k]);
+    if (type.empty()) continue;
+    auto it = std::find(types.begin(), types.end(), type);
+    sensor[k] = (int)(it - types.begin());
+    if (it == types.end()) types.push_back(type);
+  }
+  int64_t t0 = INT64_MIN;
+  char buf[32];
+  podd::forEachValue(body, file.end(), podd::UTC_TIME,
+    [&](int64_t t, int col, double v) {
+      if ((col >= (int)sensor.size()) || (sensor[col] < 0)) return;
+      if (t0 == INT64_MIN) t0 = t;
+      snprintf(buf, sizeof(buf), "%.2f", v);
+      log.readings.push_back({t - t0, sensor[col], buf});
+    });
+  // Logs are (mostly) chronological; readings are sent in time order
+  std::stable_sort(log.readings.begin(), log.readings.end(),
+                   [](const Reading &a, const Reading &b) {return a.t < b.t;});
+  return true;
+}
+
+
+
+// Model =======================================================================
+
+/* A packet sent by a drone, and when it was sent and uploaded. */
+struct Packet {
+  uint64_t due;       // when the reading was ready to send
+  uint64_t sent;      // when the drone began sending it
+  uint64_t uploaded;  // when the coordinator posted it (UINT64_MAX: never)
+};
+
+
+/* A drone pod replaying one log. */
+struct Pod {
+  std::string name;
+  const Log *log;
+  int64_t base;       // log time of the first reading
+  uint64_t offset;    // start offset
+  size_t next = 0;    // next reading to send
+  uint64_t freeAt = 0;
+};
+
+
+struct Counters {
+  uint64_t sent = 0;
+  uint64_t connectFailed = 0;
+  uint64_t serverLate = 0;        // responses after the post timeout
+  uint64_t unmatched = 0;         // posts not matching a sent packet
+  size_t peakBuffer = 0;          // firmware XBee ring buffer
+};
+
+
+/* Shared state of the simulation. */
+struct Simulation {
+  Options opts;
+  std::vector<std::string> types;
+  std::vector<Pod> pods;
+  std::vector<Packet> packets;
+  // Packets awaiting upload, by post content
+  std::unordered_map<std::string,std::deque<uint32_t>> pending;
+  Counters counters;
+  std::mt19937_64 rng;
+  uint64_t endSend = 0;
+  size_t activePods = 0;
+  size_t inFlight = 0;            // frames on the air
+  sim::XBeeLink *xbee = nullptr;  // coordinator XBee
+
+  double uniform(double max) {
+    return std::uniform_real_distribution<double>(0.0, max)(rng);
+  }
+};
+
+Simulation simulation;
+
+
+//------------------------------------------------------------------------------
+/* Samples the firmware's buffer fill level. */
+inline void sampleBuffer() {
+  size_t n = xbeeBufferElements;
+  if (n > simulation.counters.peakBuffer) simulation.counters.peakBuffer = n;
+}
+
+
+//------------------------------------------------------------------------------
+/* A frame arrives over the air at the coordinator's XBee. */
+void receiveFrame(const std::string &frame) {
+  simulation.inFlight--;
+  simulation.xbee->receive(frame);
+}
+
+
+//------------------------------------------------------------------------------
+/* Key matching a reading to the coordinator's post of it. */
+std::string postKey(const std::string &did, const std::string &type,
+                    const std::string &value, const std::string &ts) {
+  return did + '&' + type + '&' + value + '&' + ts;
+}
+
+
+//------------------------------------------------------------------------------
+/* Sends a pod's next reading (as sendXBee() does) and schedules the one
+   after. */
+void sendReading(size_t podIndex) {
+  Simulation &s = simulation;
+  Pod &pod = s.pods[podIndex];
+  const Reading &r = pod.log->readings[pod.next];
+  uint64_t due = pod.offset + us(r.t / s.opts.speed);
+
+  char dt[24];
+  int64_t ts = pod.base + r.t;
+  podd::formatDateTime(ts, dt);
+  std::string type = s.types[(size_t)r.sensor];
+  std::string payload = "V," + pod.name + "," + type + "," + r.value + ","
+                        + std::to_string(ts) + "," + dt;
+  // Each pod's XBee has its own serial number
+  std::string frame = sim::rxPacketFrame(0x0013A20040000000ull + podIndex, payload);
+
+  uint32_t id = (uint32_t)s.packets.size();
+  s.packets.push_back({due, sim::now(), UINT64_MAX});
+  s.pending[postKey(pod.name, type, r.value, std::to_string(ts))].push_back(id);
+  s.counters.sent++;
+
+  // The drone sends at the serial rate; its XBee transmits once the
+  // frame is complete
+  uint64_t tx = frame.size() * s.xbee->byteTime();
+  uint64_t arrival = sim::now() + tx + us(s.opts.rf);
+  s.inFlight++;
+  sim::schedule(arrival, [frame]() {receiveFrame(frame);});
+  pod.freeAt = sim::now() + tx + us(s.opts.pace);
+
+  // Next reading
+  pod.next++;
+  if (pod.next >= pod.log->readings.size()) {
+    s.activePods--;
+    return;
+  }
+  const Reading &nr = pod.log->readings[pod.next];
+  uint64_t ndue = pod.offset + us(nr.t / s.opts.speed);
+  if (ndue > s.endSend) {
+    s.activePods--;
+    return;
+  }
+  uint64_t t = std::max(ndue + us(s.uniform(s.opts.jitter)), pod.freeAt);
+  sim::schedule(t, [podIndex]() {sendReading(podIndex);});
+}
+
+
+
+// Server ======================================================================
+
+/* Server model: connections and posts take fixed times (plus jitter),
+   and posted readings are matched to the packets sent by the drones. */
+class ReplayNetwork : public sim::Network {
+public:
+  int connect(const std::string &, uint16_t) override {
+    Simulation &s = simulation;
+    sim::advance(us(s.opts.connect));
+    if ((s.opts.fail > 0) && (s.uniform(1.0) < s.opts.fail)) {
+      s.counters.connectFailed++;
+      return 0;
+    }
+    return 1;
+  }
+
+  uint64_t request(const std::string &req, std::string &response) override {
+    Simulation &s = simulation;
+    size_t body = req.find("\r\n\r\n");
+    std::string content = (body == std::string::npos) ? "" : req.substr(body + 4);
+    std::string key = postKey(field(content, "DeviceID"), field(content, "SensorType"),
+                              field(content, "Reading"), field(content, "TimeStamp"));
+    auto it = s.pending.find(key);
+    if ((it != s.pending.end()) && !it->second.empty()) {
+      s.packets[it->second.front()].uploaded = sim::now();
+      it->second.pop_front();
+    } else {
+      s.counters.unmatched++;
+    }
+    response = "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n";
+    uint64_t delay = us(s.opts.server + s.uniform(s.opts.serverJitter));
+    // HTTP_POST_TIMEOUT in pod_network.cpp
+    if (delay >= 250000) s.counters.serverLate++;
+    return sim::now() + delay;
+  }
+
+private:
+  static std::string field(const std::string &content, const char *name) {
+    std::string prefix = std::string(name) + "=";
+    size_t a = 0;
+    while (a < content.size()) {
+      size_t b = content.find('&', a);
+      if (b == std::string::npos) b = content.size();
+      if (content.compare(a, prefix.size(), prefix) == 0) {
+        return content.substr(a + prefix.size(), b - a - prefix.size());
+      }
+      a = b + 1;
+    }
+    return "";
+  }
+};
+
+
+
+// Report ======================================================================
+
+/* Quantile of sorted values. */
+double quantile(const std::vector<double> &v, double q) {
+  if (v.empty()) return NAN;
+  return v[(size_t)std::llround(q * (v.size() - 1))];
+}
+
+
+//------------------------------------------------------------------------------
+/* Prints the results of the run. */
+void report(double realTime) {
+  const Simulation &s = simulation;
+  const Counters &c = s.counters;
+  std::vector<double> wait, transit;
+  uint64_t first = UINT64_MAX, last = 0;
+  for (const Packet &p : s.packets) {
+    first = std::min(first, p.sent);
+    if (p.uploaded == UINT64_MAX) continue;
+    last = std::max(last, p.uploaded);
+    transit.push_back(1e-3 * (p.uploaded - p.sent));
+    wait.push_back(1e-3 * (p.uploaded - p.due));
+  }
+  std::sort(wait.begin(), wait.end());
+  std::sort(transit.begin(), transit.end());
+  double span = (last > first) ? 1e-6 * (last - first) : 0.0;
+  uint64_t uploaded = transit.size();
+
+  printf("pods: %zu  simulated: %.1f s  (%.1fx real time)\n",
+         s.pods.size(), 1e-6 * sim::now(), 1e-6 * sim::now() / std::max(realTime, 1e-9));
+  printf("packets: sent %llu  uploaded %llu  lost %llu (%.2f%%)\n",
+         (unsigned long long)c.sent, (unsigned long long)uploaded,
+         (unsigned long long)(c.sent - uploaded),
+         (c.sent > 0) ? 100.0 * (c.sent - uploaded) / c.sent : 0.0);
+  printf("throughput: offered %.2f packets/s  uploaded %.2f packets/s\n",
+         (span > 0) ? c.sent / span : 0.0, (span > 0) ? uploaded / span : 0.0);
+  printf("drops: xbee buffer %llu frames  serial overflow %llu bytes  "
+         "ring buffer overrun %llu bytes\n",
+         (unsigned long long)s.xbee->droppedFrames, (unsigned long long)s.xbee->lostBytes,
+         (unsigned long long)Serial1.cleared);
+  printf("server: connect failures %llu  late responses %llu  unmatched posts %llu\n",
+         (unsigned long long)c.connectFailed, (unsigned long long)c.serverLate,
+         (unsigned long long)c.unmatched);
+  printf("peak ring buffer: %zu bytes\n", c.peakBuffer);
+  printf("latency, send to upload [ms]:   p50 %.1f  p99 %.1f  max %.1f\n",
+         quantile(transit, 0.5), quantile(transit, 0.99),
+         transit.empty() ? NAN : transit.back());
+  printf("latency, reading to upload [ms]: p50 %.1f  p99 %.1f  max %.1f\n",
+         quantile(wait, 0.5), quantile(wait, 0.99),
+         wait.empty() ? NAN : wait.back());
+}
+
+
+
+// Main ========================================================================
+
+int main(int argc, char **argv) {
+  Simulation &s = simulation;
+  if (!parseArgs(argc, argv, s.opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  const Options &opts = s.opts;
+
+  std::vector<Log> logs(opts.inputs.size());
+  for (size_t k = 0; k < logs.size(); k++) {
+    logs[k].pod = opts.inputs[k].first;
+    if (!loadLog(opts.inputs[k].second, logs[k], s.types)) {
+      fprintf(stderr, "Unable to open %s.\n", opts.inputs[k].second.c_str());
+      return 1;
+    }
+  }
+
+  // Pods cycle through the logs; replicas are named pod#2, pod#3, ...
+  s.rng.seed(opts.seed);
+  static sim::XBeeLink xbee(Serial1, opts.xbeeBuffer, opts.baud);
+  xbee.setByteHook(sampleBuffer);
+  s.xbee = &xbee;
+  s.endSend = us(opts.duration);
+  for (unsigned k = 0; k < opts.pods; k++) {
+    const Log &log = logs[k % logs.size()];
+    if (log.readings.empty()) continue;
+    Pod pod;
+    pod.name = log.pod;
+    if (k >= logs.size()) pod.name += "#" + std::to_string(k / logs.size() + 1);
+    pod.log = &log;
+    pod.base = hostfw::settings().utcStart;
+    pod.offset = us(s.uniform(opts.phase));
+    s.pods.push_back(pod);
+  }
+  if (s.pods.empty()) {
+    fprintf(stderr, "No readings found.\n");
+    return 1;
+  }
+
+  // Coordinator start-up, as in setup()
+  hostfw::settings().coordinator = true;
+  Serial.setOutput(opts.verbose ? stderr : nullptr);
+  static ReplayNetwork network;
+  sim::setNetwork(&network);
+  // Start away from time zero: the firmware treats a zero millis()
+  // timestamp as "never"
+  sim::advance(us(1.0));
+  startXBee();
+  ethernetSetup();
+  Serial1.cleared = 0;
+
+  uint64_t start = sim::now();
+  for (size_t k = 0; k < s.pods.size(); k++) {
+    Pod &pod = s.pods[k];
+    pod.offset += start;
+    s.activePods++;
+    sim::schedule(pod.offset, [k]() {sendReading(k);});
+  }
+  s.endSend += start;
+
+  // Coordinator main loop, until everything sent has been processed (or
+  // a minute after the last send, for packets lost along the way)
+  auto t0 = std::chrono::steady_clock::now();
+  const uint64_t loopTime = us(opts.loop);
+  uint64_t idleSince = UINT64_MAX;
+  while (true) {
+    ethernetMaintain();
+    sampleBuffer();
+    processXBee();
+    serviceUploadQueue();
+    sim::advance(loopTime);
+    bool idle = (s.activePods == 0) && (s.inFlight == 0) && s.xbee->idle()
+                && (Serial1.available() == 0)
+                && (getUploadQueueCount() == 0);
+    if (idle && (xbeeBufferElements == 0)) break;
+    if (!idle) idleSince = UINT64_MAX;
+    else if (idleSince == UINT64_MAX) idleSince = sim::now();
+    else if (sim::now() - idleSince > us(60.0)) break;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  report(std::chrono::duration<double>(t1 - t0).count());
+  return 0;
+}
+
+
+//==============================================================================
@@ -0,0 +1,855 @@
+/*==============================================================================
+  Protocol test for the sequenced readings ("W" packets) that drones
+  deliver to the coordinator.  A set of simulated drones follows the
+  drone side of the protocol (window of unacknowledged readings, resends
+  on timeout, renumbering in a new session when the coordinator asks)
+  against the coordinator
+  firmware's receive, acknowledgement and upload code (processXBee() ->
+  processSequencedReading() -> serviceUploadQueue() -> postPage()),
+  compiled for the host against the stand-ins in host/.  Frames are lost,
+  duplicated and delayed at random over the air, and the coordinator can
+  be restarted during the run.
+
+  Usage:
+    podd_seqcheck [options]
+
+  Exits with status 1 if a reading the coordinator acknowledged is never
+  uploaded (other than through a coordinator restart), a reading is never
+  acknowledged, an acknowledgement covers readings not yet sent, or (with
+  no coordinator restarts, lost posts or delayed frames) a reading is
+  uploaded more than once.  With
+  --cases, it instead checks the coordinator's replies to given packets,
+  including from more drones than it keeps records for.  See README.md in
+  this directory.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Standard libraries
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+// Local headers
+#include "podd_csv.h"
+#include "host/Arduino.h"
+#include "host/host_firmware.h"
+#include "host/host_sim.h"
+#include "host/host_xbee.h"
+// Firmware headers
+#include "pod_network.h"
+
+// Coordinator state cleared by a restart (pod_network.cpp)
+extern int8_t nodeCount;
+extern int8_t nodeIndex[];
+extern uint8_t uploadQueueHead;
+extern uint8_t uploadQueueCount;
+extern bool uploadRetry;
+
+// Protocol and coordinator limits, as in pod_network.cpp
+#define XBEE_WINDOW 8
+#define XBEE_ACK_TIMEOUT 5000
+#define XBEE_NODE_WINDOW 32
+#define XBEE_MAX_NODES 20
+#define XBEE_NODE_SLOTS 32
+// Longest idle delay of a drone's main loop (pod_logging.cpp)
+#define DRONE_LOOP_INTERVAL 250
+
+
+// Options =====================================================================
+
+struct Options {
+  unsigned pods = 20;            // number of drones
+  double interval = 4.0;         // [s] time between each drone's readings
+  double duration = 600.0;       // [s] time over which readings are taken
+  double loss = 0.02;            // probability a frame is lost
+  double ackLoss = 0.0;          // further probability a coordinator frame is lost
+  double dup = 0.01;             // probability a frame arrives twice
+  double reorder = 0.01;         // probability a frame is delayed
+  double delay = 2.0;            // [s] maximum delay of a delayed frame
+  std::vector<double> restarts;  // [s] times of coordinator restarts
+  double rf = 0.02;              // [s] radio transit time
+  unsigned baud = 9600;
+  double loop = 0.0002;          // [s] coordinator main loop overhead
+  double server = 0.04;          // [s] server response time
+  double postLoss = 0.0;         // probability a post never reaches the server
+  uint64_t seed = 1;
+  bool verbose = false;
+  bool cases = false;            // run the coordinator cases instead
+};
+
+
+//------------------------------------------------------------------------------
+/* Prints usage information. */
+void usage(const char *prog) {
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "Options:\n"
+    "  --pods N          number of simulated drones (default: 20)\n"
+    "  --interval SEC    time between each drone's readings (default: 4)\n"
+    "  --duration SEC    time over which readings are taken (default: 600)\n"
+    "  --loss P          probability a frame is lost (default: 0.02)\n"
+    "  --ack-loss P      further probability a frame from the coordinator is\n"
+    "                    lost (default: 0)\n"
+    "  --dup P           probability a frame arrives twice (default: 0.01)\n"
+    "  --reorder P       probability a frame is delayed (default: 0.01)\n"
+    "  --delay SEC       maximum delay of a delayed frame (default: 2)\n"
+    "  --restart SEC     restart the coordinator at this time (repeatable)\n"
+    "  --rf SEC          radio transit time (default: 0.02)\n"
+    "  --baud N          XBee serial rate (default: 9600)\n"
+    "  --loop SEC        coordinator main loop overhead (default: 0.0002)\n"
+    "  --server SEC      server response time (default: 0.04)\n"
+    "  --post-loss P     probability a post never reaches the server (default: 0)\n"
+    "  --seed N          random seed (default: 1)\n"
+    "  --verbose         show the firmware's serial console output\n"
+    "  --cases           check the coordinator's replies to given packets\n",
+    prog);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses the command line into opts.  Returns false on invalid usage. */
+bool parseArgs(int argc, char **argv, Options &opts) {
+  auto probability = [](const char *s, double &p) {
+    p = atof(s);
+    return (p >= 0) && (p <= 1);
+  };
+  for (int k = 1; k < argc; k++) {
+    std::string a = argv[k];
+    bool more = (k + 1 < argc);
+    if ((a == "--pods") && more) {
+      opts.pods = (unsigned)atoi(argv[++k]);
+      if (opts.pods == 0) return false;
+    } else if ((a == "--interval") && more) {
+      opts.interval = atof(argv[++k]);
+      if (opts.interval <= 0) return false;
+    } else if ((a == "--duration") && more) {
+      opts.duration = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--loss") && more) {
+      if (!probability(argv[++k], opts.loss)) return false;
+    } else if ((a == "--ack-loss") && more) {
+      if (!probability(argv[++k], opts.ackLoss)) return false;
+    } else if ((a == "--dup") && more) {
+      if (!probability(argv[++k], opts.dup)) return false;
+    } else if ((a == "--reorder") && more) {
+      if (!probability(argv[++k], opts.reorder)) return false;
+    } else if ((a == "--delay") && more) {
+      opts.delay = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--restart") && more) {
+      opts.restarts.push_back(std::max(0.0, atof(argv[++k])));
+    } else if ((a == "--rf") && more) {
+      opts.rf = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--baud") && more) {
+      opts.baud = (unsigned)atoi(argv[++k]);
+      if (opts.baud == 0) return false;
+    } else if ((a == "--loop") && more) {
+      opts.loop = std::max(1e-6, atof(argv[++k]));
+    } else if ((a == "--server") && more) {
+      opts.server = std::max(0.0, atof(argv[++k]));
+    } else if ((a == "--post-loss") && more) {
+      if (!probability(argv[++k], opts.postLoss)) return false;
+    } else if ((a == "--seed") && more) {
+      opts.seed = (uint64_t)atoll(argv[++k]);
+    } else if (a == "--verbose") {
+      opts.verbose = true;
+    } else if (a == "--cases") {
+      opts.cases = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Simulated time from seconds
+inline uint64_t us(double sec) {return (uint64_t)std::llround(1e6 * sec);}
+
+
+
+// Model =======================================================================
+
+/* A reading taken by a drone, and when it was acknowledged (removed
+   from the drone's outbox) and uploaded. */
+struct Reading {
+  uint64_t taken;
+  uint64_t acked = UINT64_MAX;
+  uint64_t uploaded = UINT64_MAX;
+  unsigned uploads = 0;
+};
+
+
+/* A drone.  Its outbox holds its readings from the oldest not yet
+   acknowledged; sequence number k of the current session is reading
+   base+k. */
+struct Drone {
+  std::string name;
+  uint64_t address;
+  std::vector<uint32_t> readings;   // all readings taken, in order
+  size_t delivered = 0;             // readings removed from the outbox
+  size_t base = 0;
+  uint16_t session = 0;
+  uint16_t acked = 0;               // next reading to be acknowledged
+  uint16_t sent = 0;                // next reading to send
+  uint32_t sacked = 0;              // bit k: reading acked+1+k received
+  uint64_t ackTime = 0;
+  uint64_t txFreeAt = 0;            // drone's serial line free
+};
+
+
+struct Counters {
+  uint64_t framesLost = 0;
+  uint64_t framesDuplicated = 0;
+  uint64_t framesDelayed = 0;
+  uint64_t resent = 0;              // readings sent again
+  uint64_t sessions = 0;            // renumberings asked for by the coordinator
+  uint64_t staleAcks = 0;           // for an earlier session or position
+  uint64_t badAcks = 0;             // acknowledging readings not sent
+  uint64_t unmatched = 0;           // posts not matching a reading
+  uint64_t posts = 0;
+  uint64_t postsLost = 0;
+};
+
+
+/* Shared state of the simulation. */
+struct Simulation {
+  Options opts;
+  std::vector<Drone> drones;
+  std::vector<Reading> readings;
+  std::unordered_map<uint64_t,size_t> byAddress;
+  std::vector<uint64_t> restarts;   // times the coordinator restarted
+  Counters counters;
+  std::mt19937_64 rng;
+  uint64_t endReadings = 0;
+  bool restartPending = false;
+  std::string lastAck;              // coordinator's last packet (--cases)
+  sim::XBeeLink *xbee = nullptr;    // coordinator XBee
+
+  double uniform(double max) {
+    return std::uniform_real_distribution<double>(0.0, max)(rng);
+  }
+  bool chance(double p) {
+    return (p > 0) && (uniform(1.0) < p);
+  }
+};
+
+Simulation simulation;
+
+
+//------------------------------------------------------------------------------
+/* Carries a frame over the air, arriving at time t unless lost; it may
+   be delayed (arriving after frames sent later) or arrive twice. */
+void overAir(uint64_t t, std::function<void()> arrive) {
+  Simulation &s = simulation;
+  if (s.chance(s.opts.loss)) {
+    s.counters.framesLost++;
+    return;
+  }
+  if (s.chance(s.opts.reorder)) {
+    s.counters.framesDelayed++;
+    t += us(s.uniform(s.opts.delay));
+  }
+  sim::schedule(t, arrive);
+  if (s.chance(s.opts.dup)) {
+    s.counters.framesDuplicated++;
+    sim::schedule(t + us(s.uniform(s.opts.delay)), arrive);
+  }
+}
+
+
+//------------------------------------------------------------------------------
+/* Starts a new session of sequence numbers, counting from the oldest
+   reading in the outbox (as startXBeeOutboxSession()). */
+void startSession(Drone &d) {
+  Simulation &s = simulation;
+  uint16_t session = (uint16_t)s.rng();
+  while ((session == 0) || (session == d.session)) session++;
+  d.session = session;
+  d.base = d.delivered;
+  d.acked = 0;
+  d.sent = 0;
+  d.sacked = 0;
+  d.ackTime = sim::now();
+}
+
+
+//------------------------------------------------------------------------------
+/* Sends the drone's reading with the given sequence number to the
+   coordinator, after anything the drone is still sending. */
+void sendSequenced(Drone &d, uint16_t seq) {
+  Simulation &s = simulation;
+  uint32_t id = d.readings[d.base + seq];
+  uint32_t ts = (uint32_t)(hostfw::settings().utcStart + s.readings[id].taken / 1000000);
+  char dt[24];
+  podd::formatDateTime(ts, dt);
+  char prefix[13];
+  snprintf(prefix, sizeof(prefix), "W,%04X,%04X,", d.session, seq);
+  // The reading's ID is its value, to match it to the coordinator's post
+  std::string packet = prefix + d.name + ",Light," + std::to_string(id) + ","
+                       + std::to_string(ts) + "," + dt;
+  std::string frame = sim::rxPacketFrame(d.address, packet);
+  d.txFreeAt = std::max(d.txFreeAt, sim::now()) + frame.size() * s.xbee->byteTime();
+  overAir(d.txFreeAt + us(s.opts.rf), [frame]() {simulation.xbee->receive(frame);});
+}
+
+
+//------------------------------------------------------------------------------
+/* Resends unacknowledged readings after a timeout, and sends new
+   readings as far as the window allows (as serviceXBeeOutbox()). */
+void serviceDrone(Drone &d) {
+  Simulation &s = simulation;
+  if ((d.sent != d.acked) && (sim::now() - d.ackTime > 1000ull * XBEE_ACK_TIMEOUT)) {
+    for (uint16_t seq = d.acked; seq != d.sent; seq++) {
+      uint16_t k = seq - d.acked;
+      if ((k > 0) && (d.sacked & (1UL << (k-1)))) continue;
+      sendSequenced(d, seq);
+      s.counters.resent++;
+    }
+    d.ackTime = sim::now();
+  }
+
+  uint16_t written = (uint16_t)(d.readings.size() - d.base);
+  while ((d.sent != written) && ((uint16_t)(d.sent - d.acked) < XBEE_WINDOW)) {
+    if (d.sent == d.acked) d.ackTime = sim::now();
+    sendSequenced(d, d.sent);
+    d.sent++;
+  }
+}
+
+
+//------------------------------------------------------------------------------
+/* Handles an acknowledgement arriving at a drone (as processAckPacket()),
+   removing the readings it covers from the outbox. */
+void receiveAck(Drone &d, const std::string &packet) {
+  Simulation &s = simulation;
+  unsigned session, next;
+  unsigned long bitmap = 0;
+  if ((packet.size() != 20)
+      || (sscanf(packet.c_str(), "A,%4x,%4x,%8lx", &session, &next, &bitmap) != 3)) {
+    fprintf(stderr, "Invalid acknowledgement: %s\n", packet.c_str());
+    s.counters.badAcks++;
+    return;
+  }
+  if (session != d.session) {
+    s.counters.staleAcks++;
+    return;
+  }
+  uint16_t n = (uint16_t)(next - d.acked);
+  if (n > (uint16_t)(d.sent - d.acked)) {
+    // Behind the acknowledgements already seen (a delayed frame), or
+    // covering readings the drone has not sent
+    if (n >= 0x8000) s.counters.staleAcks++;
+    else s.counters.badAcks++;
+    return;
+  }
+  d.sacked = (uint32_t)bitmap;
+  if (n == 0) return;
+  for (uint16_t seq = d.acked; seq != (uint16_t)next; seq++) {
+    Reading &r = s.readings[d.readings[d.base + seq]];
+    if (r.acked == UINT64_MAX) r.acked = sim::now();
+  }
+  d.acked = (uint16_t)next;
+  d.delivered = d.base + d.acked;
+  d.ackTime = sim::now();
+  serviceDrone(d);
+}
+
+
+//------------------------------------------------------------------------------
+/* Handles a renumber request arriving at a drone (as
+   processRenumberPacket()), starting a new session from the oldest
+   unacknowledged reading. */
+void receiveRenumber(Drone &d, const std::string &packet) {
+  Simulation &s = simulation;
+  unsigned session;
+  if ((packet.size() != 6) || (sscanf(packet.c_str(), "N,%4x", &session) != 1)) {
+    fprintf(stderr, "Invalid renumber request: %s\n", packet.c_str());
+    s.counters.badAcks++;
+    return;
+  }
+  if (session != d.session) {
+    s.counters.staleAcks++;
+    return;
+  }
+  s.counters.resent += (uint16_t)(d.sent - d.acked);
+  s.counters.sessions++;
+  startSession(d);
+  serviceDrone(d);
+}
+
+
+//------------------------------------------------------------------------------
+/* Takes a drone's next reading and schedules the one after. */
+void takeReading(size_t k) {
+  Simulation &s = simulation;
+  Drone &d = s.drones[k];
+  d.readings.push_back((uint32_t)s.readings.size());
+  s.readings.push_back(Reading{sim::now()});
+  serviceDrone(d);
+  uint64_t t = sim::now() + us(s.opts.interval * (0.9 + s.uniform(0.2)));
+  if (t < s.endReadings) sim::schedule(t, [k]() {takeReading(k);});
+}
+
+
+//------------------------------------------------------------------------------
+/* Drone main loop, which checks for acknowledgement timeouts. */
+void droneLoop(size_t k) {
+  serviceDrone(simulation.drones[k]);
+  sim::schedule(sim::now() + 1000ull * DRONE_LOOP_INTERVAL, [k]() {droneLoop(k);});
+}
+
+
+//------------------------------------------------------------------------------
+/* Passes a packet the coordinator transmits to the drone it is
+   addressed to. */
+void coordinatorTransmit(uint64_t dest, const std::string &packet) {
+  Simulation &s = simulation;
+  s.lastAck = packet;
+  auto it = s.byAddress.find(dest);
+  if (it == s.byAddress.end()) return;
+  size_t k = it->second;
+  bool ack = (packet.compare(0, 2, "A,") == 0);
+  if (!ack && (packet.compare(0, 2, "N,") != 0)) return;
+  if (s.chance(s.opts.ackLoss)) {
+    s.counters.framesLost++;
+    return;
+  }
+  // Frame of about 18 bytes plus the packet, at the serial rate
+  uint64_t t = sim::now() + (packet.size() + 18) * s.xbee->byteTime() + us(s.opts.rf);
+  if (ack) overAir(t, [k, packet]() {receiveAck(simulation.drones[k], packet);});
+  else overAir(t, [k, packet]() {receiveRenumber(simulation.drones[k], packet);});
+}
+
+sim::TxFrameReader txReader(coordinatorTransmit);
+
+void coordinatorWrite(uint8_t c) {txReader.put(c);}
+
+
+//------------------------------------------------------------------------------
+/* Restarts the coordinator: its drone records, upload queue and XBee
+   buffer are lost, as is anything it was posting.  Called from the main
+   loop, not from a scheduled event, which may run while the firmware is
+   part way through a function (in delay()). */
+void restartCoordinator() {
+  Simulation &s = simulation;
+  s.restarts.push_back(sim::now());
+  nodeCount = 0;
+  for (int k = 0; k < XBEE_NODE_SLOTS; k++) nodeIndex[k] = -1;
+  uploadQueueHead = 0;
+  uploadQueueCount = 0;
+  uploadRetry = false;
+  Serial1.clear();
+  resetXBeeBuffer();
+  ethernetBegin();
+}
+
+
+
+// Server ======================================================================
+
+/* Server model: posts take a fixed time, and posted readings are
+   matched to the readings taken by the drones.  A post may be lost,
+   with no response. */
+class SeqNetwork : public sim::Network {
+public:
+  int connect(const std::string &, uint16_t) override {return 1;}
+
+  uint64_t request(const std::string &req, std::string &response) override {
+    Simulation &s = simulation;
+    s.counters.posts++;
+    if (s.chance(s.opts.postLoss)) {
+      s.counters.postsLost++;
+      return UINT64_MAX;
+    }
+    size_t a = req.find("Reading=");
+    uint32_t id = (a == std::string::npos) ? UINT32_MAX : (uint32_t)atol(req.c_str() + a + 8);
+    if (id < s.readings.size()) {
+      Reading &r = s.readings[id];
+      if (r.uploads++ == 0) r.uploaded = sim::now();
+    } else {
+      s.counters.unmatched++;
+    }
+    response = "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n";
+    return sim::now() + us(s.opts.server);
+  }
+};
+
+
+
+// Report ======================================================================
+
+/* Quantile of sorted values. */
+double quantile(const std::vector<double> &v, double q) {
+  if (v.empty()) return NAN;
+  return v[(size_t)std::llround(q * (v.size() - 1))];
+}
+
+
+//------------------------------------------------------------------------------
+/* Prints the results of the run.  Returns true if the checks passed. */
+bool report() {
+  const Simulation &s = simulation;
+  const Counters &c = s.counters;
+  uint64_t acked = 0, uploaded = 0, twice = 0, undelivered = 0;
+  uint64_t lostRestart = 0, lost = 0;
+  std::vector<double> wait;
+  for (const Reading &r : s.readings) {
+    if (r.uploads > 0) uploaded++;
+    if (r.uploads > 1) twice += r.uploads - 1;
+    if (r.acked == UINT64_MAX) {
+      if (r.uploads == 0) undelivered++;
+      continue;
+    }
+    acked++;
+    wait.push_back(1e-3 * (r.acked - r.taken));
+    if (r.uploads > 0) continue;
+    // Acknowledged but not uploaded: only allowed if the coordinator
+    // restarted (with the reading in its upload queue) after the reading
+    // was taken.  The acknowledgement may still have been on its way to
+    // the drone at the restart.
+    bool restarted = std::any_of(s.restarts.begin(), s.restarts.end(),
+                                 [&](uint64_t t) {return t >= r.taken;});
+    if (restarted) lostRestart++;
+    else lost++;
+  }
+  std::sort(wait.begin(), wait.end());
+
+  printf("drones: %zu  readings: %zu  simulated: %.1f s\n",
+         s.drones.size(), s.readings.size(), 1e-6 * sim::now());
+  printf("faults: frames lost %llu  duplicated %llu  delayed %llu  posts lost %llu"
+         "  coordinator restarts %zu\n",
+         (unsigned long long)c.framesLost, (unsigned long long)c.framesDuplicated,
+         (unsigned long long)c.framesDelayed, (unsigned long long)c.postsLost,
+         s.restarts.size());
+  printf("readings: acknowledged %llu  uploaded %llu  uploaded again %llu  undelivered %llu\n",
+         (unsigned long long)acked, (unsigned long long)uploaded,
+         (unsigned long long)twice, (unsigned long long)undelivered);
+  printf("acknowledged, not uploaded: at coordinator restart %llu  otherwise %llu\n",
+         (unsigned long long)lostRestart, (unsigned long long)lost);
+  printf("drones: resent %llu  renumbered %llu  stale acks %llu  invalid acks %llu\n",
+         (unsigned long long)c.resent, (unsigned long long)c.sessions,
+         (unsigned long long)c.staleAcks, (unsigned long long)c.badAcks);
+  printf("latency, reading to acknowledgement [ms]: p50 %.1f  p99 %.1f  max %.1f\n",
+         quantile(wait, 0.5), quantile(wait, 0.99), wait.empty() ? NAN : wait.back());
+  if (c.unmatched > 0) printf("unmatched posts: %llu\n", (unsigned long long)c.unmatched);
+
+  // Lost acknowledgements and duplicated frames alone must not lead to
+  // a reading being uploaded twice
+  bool repeats = s.restarts.empty() && (s.opts.postLoss == 0) && (s.opts.reorder == 0)
+                 && (s.drones.size() <= XBEE_MAX_NODES);
+  if (repeats && (twice > 0)) printf("readings uploaded again without a restart or lost post\n");
+  bool ok = (lost == 0) && (undelivered == 0) && (c.badAcks == 0) && (c.unmatched == 0)
+            && !(repeats && (twice > 0));
+  printf(ok ? "All readings delivered.\n" : "Readings LOST or REPEATED, or acknowledgements INVALID.\n");
+  return ok;
+}
+
+
+
+// Cases =======================================================================
+
+/* Passes a reading packet from the given drone straight to the
+   coordinator's processSequencedReading() and lets the upload finish.
+   Returns the coordinator's reply ("": none). */
+std::string deliver(uint64_t source, uint16_t session, uint16_t seq) {
+  Simulation &s = simulation;
+  char packet[80];
+  snprintf(packet, sizeof(packet), "W,%04X,%04X,case,Light,%u,1568000000,2019-09-09 03:33:20",
+           session, seq, seq);
+  s.lastAck.clear();
+  processSequencedReading(packet, source);
+  for (int k = 0; k < 250; k++) {
+    ethernetMaintain();
+    serviceUploadQueue();
+    sim::advance(us(0.0002));
+  }
+  return s.lastAck;
+}
+
+
+//------------------------------------------------------------------------------
+/* The acknowledgement the coordinator should send. */
+std::string ackPacket(uint16_t session, uint16_t next, uint32_t ahead) {
+  char ack[24];
+  snprintf(ack, sizeof(ack), "A,%04X,%04X,%08X", session, next, ahead);
+  return ack;
+}
+
+
+/* The coordinator's request to renumber the given session. */
+std::string renumberPacket(uint16_t session) {
+  char renumber[8];
+  snprintf(renumber, sizeof(renumber), "N,%04X", session);
+  return renumber;
+}
+
+
+//------------------------------------------------------------------------------
+/* Delivery counter from the coordinator's printXBeeNodeStats() for its
+   first drone ("received", "duplicates", "missing" or "reordered"). */
+long nodeCounter(const char *name) {
+  char *text = nullptr;
+  size_t size = 0;
+  FILE *f = open_memstream(&text, &size);
+  Serial.setOutput(f);
+  printXBeeNodeStats();
+  Serial.setOutput(simulation.opts.verbose ? stderr : nullptr);
+  fclose(f);
+  std::string stats(text, size);
+  free(text);
+  size_t a = stats.find(std::string(name) + " ");
+  return (a == std::string::npos) ? -1 : atol(stats.c_str() + a + strlen(name) + 1);
+}
+
+
+//------------------------------------------------------------------------------
+/* Checks the node index: each record in use appears in exactly one slot. */
+bool nodeIndexValid() {
+  std::vector<int> found(XBEE_NODE_SLOTS, 0);
+  int used = 0;
+  for (int k = 0; k < XBEE_NODE_SLOTS; k++) {
+    if (nodeIndex[k] < 0) continue;
+    if (nodeIndex[k] >= nodeCount) return false;
+    found[nodeIndex[k]]++;
+    used++;
+  }
+  return (used == nodeCount)
+         && std::all_of(found.begin(), found.begin() + nodeCount, [](int n) {return n == 1;});
+}
+
+
+unsigned caseFailures = 0;
+
+void expect(bool ok, const std::string &what) {
+  if (ok) return;
+  printf("FAILED: %s\n", what.c_str());
+  caseFailures++;
+}
+
+void expectAck(const std::string &got, const std::string &want, const std::string &what) {
+  expect(got == want, what + ": got \"" + got + "\", expected \"" + want + "\"");
+}
+
+
+//------------------------------------------------------------------------------
+/* Scripted cases for a single drone: duplicates are acknowledged but not
+   uploaded again, readings too far ahead are not acknowledged, a new
+   session starts the drone's record afresh from its reading 0, and
+   readings of other sessions are answered with a renumber request. */
+void singleDroneCases() {
+  Simulation &s = simulation;
+  const uint64_t drone = 0x0013A20040A00001ull;
+  uint64_t posts = s.counters.posts;
+
+  expectAck(deliver(drone, 0x1234, 0), ackPacket(0x1234, 1, 0), "first reading");
+  expectAck(deliver(drone, 0x1234, 0), ackPacket(0x1234, 1, 0), "duplicate of next-1");
+  expectAck(deliver(drone, 0x1234, 2), ackPacket(0x1234, 1, 0x1), "reading ahead of a gap");
+  expectAck(deliver(drone, 0x1234, 2), ackPacket(0x1234, 1, 0x1), "duplicate ahead of a gap");
+  expectAck(deliver(drone, 0x1234, 1), ackPacket(0x1234, 3, 0), "gap filled");
+  expect(s.counters.posts - posts == 3, "duplicates uploaded");
+  expect(nodeCounter("duplicates") == 2, "duplicates counted");
+
+  // Window: reading next+1+31 is the last tracked in the bitmap
+  posts = s.counters.posts;
+  expectAck(deliver(drone, 0x1234, 3 + XBEE_NODE_WINDOW),
+            ackPacket(0x1234, 3, 1UL << (XBEE_NODE_WINDOW - 1)), "last reading in window");
+  expectAck(deliver(drone, 0x1234, 3 + XBEE_NODE_WINDOW + 1), "", "reading beyond window");
+  expectAck(deliver(drone, 0x1234, 2),
+            ackPacket(0x1234, 3, 1UL << (XBEE_NODE_WINDOW - 1)), "reading behind window");
+  expect(s.counters.posts - posts == 1, "readings outside window uploaded");
+
+  // New session: next, ahead and highest (one past reading 35 so far)
+  // start again.  Reading 0 then counts as neither reordered nor missing.
+  long reordered = nodeCounter("reordered");
+  long missing = nodeCounter("missing");
+  expectAck(deliver(drone, 0x5678, 0), ackPacket(0x5678, 1, 0), "first reading of new session");
+  expect(nodeCounter("reordered") == reordered, "highest reset by new session (reordered)");
+  expect(nodeCounter("missing") == missing, "highest reset by new session (missing)");
+  expectAck(deliver(drone, 0x5678, 3), ackPacket(0x5678, 1, 0x2), "reading ahead in new session");
+  expect(nodeCounter("missing") == missing + 2, "readings skipped in new session");
+
+  // Late readings of the replaced session, and a session not started
+  // from reading 0, leave the record alone
+  posts = s.counters.posts;
+  expectAck(deliver(drone, 0x1234, 0), renumberPacket(0x1234), "reading 0 of replaced session");
+  expectAck(deliver(drone, 0x1234, 4), renumberPacket(0x1234), "reading of replaced session");
+  expectAck(deliver(drone, 0x9ABC, 2), renumberPacket(0x9ABC), "session not started from 0");
+  expectAck(deliver(drone, 0x0000, 0), renumberPacket(0x0000), "session 0");
+  expectAck(deliver(drone, 0x5678, 1), ackPacket(0x5678, 2, 0x1), "record kept");
+  expect(s.counters.posts - posts == 1, "readings of other sessions uploaded");
+}
+
+
+//------------------------------------------------------------------------------
+/* More drones than the coordinator has records for.  Drones send
+   readings in order (at random, some far more often than others) and
+   renumber when the coordinator, having forgotten them, asks.  A model of the records (the XBEE_MAX_NODES most recently heard
+   drones) gives the acknowledgement expected for each reading, so a
+   drone lost from the node index after an eviction shows up as a wrong
+   acknowledgement. */
+void evictionCases(unsigned drones, unsigned steps) {
+  Simulation &s = simulation;
+  struct CaseDrone {
+    uint64_t source;
+    uint16_t session;
+    uint16_t seq = 0;
+  };
+  std::vector<CaseDrone> fleet;
+  for (unsigned k = 0; k < drones; k++) {
+    CaseDrone d;
+    d.source = 0x0013A20000000000ull | (uint32_t)s.rng();
+    d.session = 1 + (uint16_t)(s.rng() % 0xFFFE);
+    fleet.push_back(d);
+  }
+  // Model: drones with records, least recently heard first, and the
+  // session and next reading of each
+  std::vector<size_t> heard;
+  std::unordered_map<size_t,std::pair<uint16_t,uint16_t>> records;
+  uint64_t evictions = 0;
+
+  for (unsigned step = 0; step < steps; step++) {
+    double u = s.uniform(1.0);
+    size_t k = std::min<size_t>(drones - 1, (size_t)(drones * u * u));
+    CaseDrone &d = fleet[k];
+
+    std::string want;
+    auto it = records.find(k);
+    if ((it != records.end()) && (it->second.first == d.session)) {
+      want = ackPacket(d.session, d.seq + 1, 0);
+      it->second.second = d.seq + 1;
+    } else if (d.seq == 0) {
+      want = ackPacket(d.session, 1, 0);
+      records[k] = std::make_pair(d.session, (uint16_t)1);
+    } else {
+      want = renumberPacket(d.session);
+      if (it == records.end()) records[k] = std::make_pair((uint16_t)0, (uint16_t)0);
+    }
+    auto h = std::find(heard.begin(), heard.end(), k);
+    if (h != heard.end()) heard.erase(h);
+    heard.push_back(k);
+    if (heard.size() > XBEE_MAX_NODES) {
+      records.erase(heard.front());
+      heard.erase(heard.begin());
+      evictions++;
+    }
+
+    std::string got = deliver(d.source, d.session, d.seq);
+    expectAck(got, want, "drone " + std::to_string(k) + " step " + std::to_string(step));
+    expect(nodeIndexValid(), "node index after step " + std::to_string(step));
+    if (caseFailures > 10) return;
+    if (got == ackPacket(d.session, d.seq + 1, 0)) {
+      d.seq++;
+    } else {
+      // Asked to renumber
+      d.session = (d.session % 0xFFFE) + 1;
+      d.seq = 0;
+    }
+  }
+  printf("eviction: %u drones, %u readings, %llu records replaced\n",
+         drones, steps, (unsigned long long)evictions);
+  expect(evictions > 0, "no records replaced");
+}
+
+
+//------------------------------------------------------------------------------
+/* Runs the coordinator cases.  Returns true if they all passed. */
+bool runCases() {
+  singleDroneCases();
+  restartCoordinator();
+  evictionCases(60, 4000);
+  printf(caseFailures == 0 ? "All cases passed.\n" : "Cases FAILED.\n");
+  return caseFailures == 0;
+}
+
+
+
+// Main ========================================================================
+
+int main(int argc, char **argv) {
+  Simulation &s = simulation;
+  if (!parseArgs(argc, argv, s.opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  const Options &opts = s.opts;
+  s.rng.seed(opts.seed);
+
+  // Coordinator start-up, as in setup()
+  hostfw::settings().coordinator = true;
+  Serial.setOutput(opts.verbose ? stderr : nullptr);
+  static SeqNetwork network;
+  sim::setNetwork(&network);
+  static sim::XBeeLink xbee(Serial1, 1024, opts.baud);
+  s.xbee = &xbee;
+  Serial1.setWriteHook(coordinatorWrite);
+  // Start away from time zero: the firmware treats a zero millis()
+  // timestamp as "never"
+  sim::advance(us(1.0));
+  startXBee();
+  ethernetSetup();
+  if (opts.cases) return runCases() ? 0 : 1;
+
+  uint64_t start = sim::now();
+  s.endReadings = start + us(opts.duration);
+  for (unsigned k = 0; k < opts.pods; k++) {
+    Drone d;
+    d.name = "drone" + std::to_string(k + 1);
+    d.address = 0x0013A20040000000ull + k;
+    s.byAddress[d.address] = k;
+    s.drones.push_back(d);
+    startSession(s.drones.back());
+    sim::schedule(start + us(s.uniform(opts.interval)), [k]() {takeReading(k);});
+    sim::schedule(start + us(s.uniform(1e-3 * DRONE_LOOP_INTERVAL)), [k]() {droneLoop(k);});
+  }
+  for (double t : opts.restarts) {
+    sim::schedule(start + us(t), []() {simulation.restartPending = true;});
+  }
+
+  // Coordinator main loop, until every reading has been acknowledged
+  // and uploaded (or two minutes after the last reading)
+  const uint64_t loopTime = us(opts.loop);
+  while (true) {
+    if (s.restartPending) {
+      s.restartPending = false;
+      restartCoordinator();
+    }
+    ethernetMaintain();
+    processXBee();
+    serviceUploadQueue();
+    sim::advance(loopTime);
+    if (sim::now() < s.endReadings) continue;
+    bool done = (getUploadQueueCount() == 0)
+                && std::all_of(s.drones.begin(), s.drones.end(),
+                               [](const Drone &d) {return d.delivered == d.readings.size();});
+    if (done || (sim::now() > s.endReadings + us(120.0))) break;
+  }
+
+  return report() ? 0 : 1;
+}
+
+
+//==============================================================================
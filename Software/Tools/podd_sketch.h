@@ -0,0 +1,282 @@
+/*==============================================================================
+  Mergeable streaming summary statistics for the host-side PODD data
+  tools: count/min/mean/max along with a quantile sketch.
+
+  The quantile sketch follows the DDSketch approach (Masson, Rim & Lee,
+  "DDSketch: A fast and fully-mergeable quantile sketch with
+  relative-error guarantees", VLDB 2019): values are counted in
+  logarithmically spaced buckets, so any quantile is returned to within
+  a fixed relative error, and sketches built from separate files or
+  threads merge exactly by adding bucket counts.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+#pragma once
+
+// Standard libraries
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+namespace podd {
+
+
+// Relative accuracy of quantile estimates (1%).  Sensor readings are
+// only reported to a couple of decimal places, so there is little point
+// in anything finer.
+constexpr double SKETCH_ACCURACY = 0.01;
+
+// Magnitudes below this are counted as zero (e.g. "0.00" PM readings).
+constexpr double SKETCH_MIN_VALUE = 1e-6;
+
+
+// Serialization ===============================================================
+// Summaries are saved in a compact binary form (used for cached
+// aggregates), with integers stored as LEB128-style variable-length
+// values: most counts fit in a single byte.
+
+inline void putVarint(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((char)v);
+}
+
+inline void putSignedVarint(std::string &out, int64_t v) {
+  putVarint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+inline void putDouble(std::string &out, double v) {
+  char buf[sizeof(double)];
+  memcpy(buf, &v, sizeof(double));
+  out.append(buf, sizeof(double));
+}
+
+// Readers return false if the data is truncated or malformed
+inline bool getVarint(const char *&p, const char *end, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; (p < end) && (shift < 64); shift += 7) {
+    uint8_t b = (uint8_t)*p++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if ((b & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+inline bool getSignedVarint(const char *&p, const char *end, int64_t &v) {
+  uint64_t u;
+  if (!getVarint(p, end, u)) return false;
+  v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+  return true;
+}
+
+inline bool getDouble(const char *&p, const char *end, double &v) {
+  if (end - p < (ptrdiff_t)sizeof(double)) return false;
+  memcpy(&v, p, sizeof(double));
+  p += sizeof(double);
+  return true;
+}
+
+
+
+// Sketch ======================================================================
+
+/* Counts in a contiguous range of bucket indices, grown as needed. */
+class BucketStore {
+public:
+  inline void add(int32_t index, uint32_t n = 1) {
+    if (_counts.empty()) {
+      _offset = index;
+      _counts.assign(1, 0);
+    } else if (index < _offset) {
+      _counts.insert(_counts.begin(), (size_t)(_offset - index), 0);
+      _offset = index;
+    } else if (index >= _offset + (int32_t)_counts.size()) {
+      _counts.resize((size_t)(index - _offset) + 1, 0);
+    }
+    _counts[(size_t)(index - _offset)] += n;
+  }
+
+  void merge(const BucketStore &o) {
+    for (size_t k = 0; k < o._counts.size(); k++) {
+      if (o._counts[k] > 0) add(o._offset + (int32_t)k, o._counts[k]);
+    }
+  }
+
+  void serialize(std::string &out) const {
+    putSignedVarint(out, _offset);
+    putVarint(out, _counts.size());
+    for (uint32_t c : _counts) putVarint(out, c);
+  }
+
+  bool deserialize(const char *&p, const char *end) {
+    int64_t offset;
+    uint64_t n, c;
+    if (!getSignedVarint(p, end, offset) || !getVarint(p, end, n)) return false;
+    if (n > (uint64_t)(end - p)) return false;
+    _offset = (int32_t)offset;
+    _counts.resize((size_t)n);
+    for (size_t k = 0; k < n; k++) {
+      if (!getVarint(p, end, c)) return false;
+      _counts[k] = (uint32_t)c;
+    }
+    return true;
+  }
+
+  bool empty() const {return _counts.empty();}
+  int32_t offset() const {return _offset;}
+  const std::vector<uint32_t> &counts() const {return _counts;}
+
+private:
+  int32_t _offset = 0;
+  std::vector<uint32_t> _counts;
+};
+
+
+/* Streaming summary of a set of values: count, sum, extremes, and a
+   relative-error quantile sketch.  All operations are mergeable. */
+class Summary {
+public:
+  inline void add(double v) {
+    _count++;
+    _sum += v;
+    if (v < _min) _min = v;
+    if (v > _max) _max = v;
+    if (v > SKETCH_MIN_VALUE) {
+      _pos.add(index(v));
+    } else if (v < -SKETCH_MIN_VALUE) {
+      _neg.add(index(-v));
+    } else {
+      _zeros++;
+    }
+  }
+
+  void merge(const Summary &o) {
+    if (o._count == 0) return;
+    _count += o._count;
+    _sum += o._sum;
+    _min = std::min(_min, o._min);
+    _max = std::max(_max, o._max);
+    _zeros += o._zeros;
+    _pos.merge(o._pos);
+    _neg.merge(o._neg);
+  }
+
+  void serialize(std::string &out) const {
+    putVarint(out, _count);
+    putDouble(out, _sum);
+    putDouble(out, _min);
+    putDouble(out, _max);
+    putVarint(out, _zeros);
+    _pos.serialize(out);
+    _neg.serialize(out);
+  }
+
+  bool deserialize(const char *&p, const char *end) {
+    return getVarint(p, end, _count) && getDouble(p, end, _sum)
+           && getDouble(p, end, _min) && getDouble(p, end, _max)
+           && getVarint(p, end, _zeros)
+           && _pos.deserialize(p, end) && _neg.deserialize(p, end);
+  }
+
+  uint64_t count() const {return _count;}
+  double min() const {return _min;}
+  double max() const {return _max;}
+  double mean() const {return (_count > 0) ? _sum / _count : NAN;}
+
+  // Estimate of the q-quantile (0 <= q <= 1), to within the sketch's
+  // relative accuracy.  Returns NAN if there are no values.
+  double quantile(double q) const {
+    if (_count == 0) return NAN;
+    uint64_t rank = (uint64_t)(std::min(std::max(q, 0.0), 1.0) * (_count - 1));
+    uint64_t seen = 0;
+    double v = NAN;
+    // Negative values, most negative (largest index) first
+    const std::vector<uint32_t> &nc = _neg.counts();
+    for (size_t k = nc.size(); k-- > 0; ) {
+      seen += nc[k];
+      if (seen > rank) {
+        v = -value(_neg.offset() + (int32_t)k);
+        break;
+      }
+    }
+    if (std::isnan(v)) {
+      seen += _zeros;
+      if (seen > rank) v = 0.0;
+    }
+    if (std::isnan(v)) {
+      const std::vector<uint32_t> &pc = _pos.counts();
+      for (size_t k = 0; k < pc.size(); k++) {
+        seen += pc[k];
+        if (seen > rank) {
+          v = value(_pos.offset() + (int32_t)k);
+          break;
+        }
+      }
+    }
+    if (std::isnan(v)) v = _max;
+    return std::min(std::max(v, _min), _max);
+  }
+
+protected:
+  uint64_t _count = 0;
+  double _sum = 0.0;
+  double _min = INFINITY;
+  double _max = -INFINITY;
+  uint64_t _zeros = 0;
+  BucketStore _pos;
+  BucketStore _neg;
+
+  // Bucket index k holds values in (gamma^(k-1), gamma^k]
+  static inline int32_t index(double v) {
+    return (int32_t)std::ceil(std::log(v) * invLogGamma());
+  }
+
+  // Representative value for bucket k, within the relative accuracy of
+  // every value in the bucket
+  static inline double value(int32_t k) {
+    return 2.0 * std::exp(k * logGamma()) / (gamma() + 1.0);
+  }
+
+  static constexpr double gamma() {
+    return (1.0 + SKETCH_ACCURACY) / (1.0 - SKETCH_ACCURACY);
+  }
+  static inline double logGamma() {
+    static const double lg = std::log(gamma());
+    return lg;
+  }
+  static inline double invLogGamma() {
+    static const double ilg = 1.0 / std::log(gamma());
+    return ilg;
+  }
+};
+
+
+}  // namespace podd
+
+
+//==============================================================================
@@ -0,0 +1,724 @@
+/*==============================================================================
+  Host-side summary statistics for PODD data logs.  Computes the daily
+  count/min/mean/max and quantiles of each sensor for each pod, reading
+  log files in parallel.
+
+  Usage:
+    podd_stats [options] [POD=]PATH...
+
+  Each PATH is either a single data log or a directory, such as the
+  data/YYYY/MM/ tree written to a pod's SD card, which is searched
+  recursively for data logs.  See README.md in this directory for the
+  options and output format.
+
+  With --index, per-hour aggregates for each log are cached in an index
+  file, so that later runs only parse logs that are new or have changed.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Standard libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+// Local headers
+#include "podd_csv.h"
+#include "podd_sketch.h"
+
+namespace fs = std::filesystem;
+
+
+// Options =====================================================================
+
+struct Options {
+  std::vector<std::pair<std::string,std::string>> inputs;  // (pod, path)
+  std::string output = "-";
+  std::string index;
+  std::vector<double> quantiles = {0.05, 0.50, 0.95};
+  unsigned threads = 0;
+  int replicate = 1;
+  bool bench = false;
+  int repeat = 3;
+  podd::TimeSource source = podd::LOCAL_TIME;
+};
+
+
+//------------------------------------------------------------------------------
+/* Prints usage information. */
+void usage(const char *prog) {
+  fprintf(stderr,
+    "Usage: %s [options] [POD=]PATH...\n"
+    "Options:\n"
+    "  -o FILE          output file (default: stdout)\n"
+    "  --index FILE     cache per-file aggregates in (and reuse from) FILE\n"
+    "  --quantiles LIST comma-separated quantiles (default: 0.05,0.5,0.95)\n"
+    "  --utc            group readings by UTC day rather than local day\n"
+    "  --threads N      number of worker threads (default: all cores)\n"
+    "  --bench          report throughput for 1, 2, 4, ... threads\n"
+    "  --repeat N       benchmark passes per thread count (default: 3)\n"
+    "  --replicate N    process each input N times, as N separate pods\n",
+    prog);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses a comma-separated list of quantiles.  Returns false if any is
+   invalid. */
+bool parseQuantiles(const char *s, std::vector<double> &qs) {
+  qs.clear();
+  while (*s != '\0') {
+    char *e;
+    double q = strtod(s, &e);
+    if ((e == s) || (q < 0) || (q > 1)) return false;
+    qs.push_back(q);
+    s = (*e == ',') ? e + 1 : e;
+  }
+  return !qs.empty();
+}
+
+
+//------------------------------------------------------------------------------
+/* Pod name for an input path: the file name for single logs, or the
+   directory name for a log tree.  A trailing "data" directory (the SD
+   card layout) is skipped in favor of its parent. */
+std::string podNameForPath(const std::string &path) {
+  fs::path p = fs::path(path).lexically_normal();
+  if (p.filename().empty()) p = p.parent_path();
+  if (!fs::is_directory(p)) return podd::podNameFromPath(p.string());
+  fs::path name = p.filename();
+  if ((name == "data") || (name == "DATA")) {
+    fs::path parent = fs::absolute(p).parent_path().filename();
+    if (!parent.empty()) name = parent;
+  }
+  return name.string();
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses the command line into opts.  Returns false on invalid usage. */
+bool parseArgs(int argc, char **argv, Options &opts) {
+  for (int k = 1; k < argc; k++) {
+    std::string a = argv[k];
+    bool more = (k + 1 < argc);
+    if ((a == "-o") && more) {
+      opts.output = argv[++k];
+    } else if ((a == "--index") && more) {
+      opts.index = argv[++k];
+    } else if ((a == "--quantiles") && more) {
+      if (!parseQuantiles(argv[++k], opts.quantiles)) return false;
+    } else if (a == "--utc") {
+      opts.source = podd::UTC_TIME;
+    } else if ((a == "--threads") && more) {
+      opts.threads = (unsigned)atoi(argv[++k]);
+    } else if (a == "--bench") {
+      opts.bench = true;
+    } else if ((a == "--repeat") && more) {
+      opts.repeat = std::max(1, atoi(argv[++k]));
+    } else if ((a == "--replicate") && more) {
+      opts.replicate = std::max(1, atoi(argv[++k]));
+    } else if ((a.size() > 1) && (a[0] == '-')) {
+      return false;
+    } else {
+      // POD=PATH or PATH
+      size_t eq = a.find('=');
+      if ((eq != std::string::npos) && (eq > 0) && (a.find('/') > eq)) {
+        opts.inputs.emplace_back(a.substr(0, eq), a.substr(eq + 1));
+      } else {
+        opts.inputs.emplace_back(podNameForPath(a), a);
+      }
+    }
+  }
+  if (opts.threads == 0) opts.threads = std::max(1u, std::thread::hardware_concurrency());
+  return !opts.inputs.empty();
+}
+
+
+
+// Inputs ======================================================================
+
+/* One data log to be processed. */
+struct Source {
+  int pod;
+  std::string path;
+  uint64_t size;
+  int64_t mtime;   // modification time (ns, file system clock)
+};
+
+
+//------------------------------------------------------------------------------
+/* Modification time of the file in nanoseconds.  Only compared against
+   earlier values on the same system, so the clock's epoch is
+   irrelevant. */
+int64_t modTime(const fs::path &p) {
+  std::error_code ec;
+  auto t = fs::last_write_time(p, ec);
+  if (ec) return 0;
+  return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+           t.time_since_epoch()).count();
+}
+
+
+//------------------------------------------------------------------------------
+/* True if the path has a .CSV extension (any case). */
+bool isLogFile(const fs::path &p) {
+  std::string ext = p.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::toupper);
+  return ext == ".CSV";
+}
+
+
+//------------------------------------------------------------------------------
+/* Collects the data logs for all inputs.  Directories are searched
+   recursively.  Returns false if an input does not exist. */
+bool collectSources(const Options &opts, std::vector<std::string> &pods,
+                    std::vector<Source> &sources) {
+  std::map<std::string,int> podIndex;
+  for (int rep = 0; rep < opts.replicate; rep++) {
+    for (const auto &input : opts.inputs) {
+      std::string pod = input.first;
+      if (rep > 0) pod += "#" + std::to_string(rep);
+      auto it = podIndex.find(pod);
+      int id;
+      if (it == podIndex.end()) {
+        id = (int)pods.size();
+        podIndex[pod] = id;
+        pods.push_back(pod);
+      } else {
+        id = it->second;
+      }
+      // Absolute paths, so index entries do not depend on the current
+      // directory
+      std::error_code ec;
+      fs::path p = fs::absolute(input.second).lexically_normal();
+      if (fs::is_directory(p, ec)) {
+        for (const auto &e : fs::recursive_directory_iterator(p, ec)) {
+          if (e.is_regular_file() && isLogFile(e.path())) {
+            sources.push_back({id, e.path().string(), (uint64_t)e.file_size(),
+                               modTime(e.path())});
+          }
+        }
+      } else if (fs::is_regular_file(p, ec)) {
+        sources.push_back({id, p.string(), (uint64_t)fs::file_size(p), modTime(p)});
+      } else {
+        fprintf(stderr, "Unable to find %s.\n", input.second.c_str());
+        return false;
+      }
+    }
+  }
+  // Largest files first, so the threads finish at about the same time
+  std::stable_sort(sources.begin(), sources.end(),
+                   [](const Source &a, const Source &b) {return a.size > b.size;});
+  return true;
+}
+
+
+
+// Statistics ==================================================================
+
+/* Statistics are accumulated per (pod, sensor, day), packed into a
+   single integer key. */
+inline uint64_t makeKey(int pod, int sensor, int64_t day) {
+  return ((uint64_t)(uint16_t)pod << 48) | ((uint64_t)(uint16_t)sensor << 32)
+         | (uint32_t)(int32_t)day;
+}
+inline int keyPod(uint64_t key) {return (int)(key >> 48);}
+inline int keySensor(uint64_t key) {return (int)((key >> 32) & 0xFFFF);}
+inline int64_t keyDay(uint64_t key) {return (int32_t)(uint32_t)key;}
+
+typedef std::unordered_map<uint64_t,podd::Summary> SummaryMap;
+
+
+/* Sensor (column) names seen across all logs, shared between threads.
+   Sensors are later listed in the order they first appear in the
+   (sorted) logs, regardless of which thread saw them first. */
+class SensorTable {
+public:
+  // Returns the ids of the given column names, adding any new names
+  std::vector<int> lookup(const std::vector<std::string> &cols, size_t source) {
+    std::lock_guard<std::mutex> guard(_lock);
+    std::vector<int> ids;
+    for (size_t c = 0; c < cols.size(); c++) {
+      auto it = _index.find(cols[c]);
+      int id;
+      if (it == _index.end()) {
+        id = (int)_names.size();
+        _index[cols[c]] = id;
+        _names.push_back(cols[c]);
+        _firstSeen.push_back(std::make_pair(source, c));
+      } else {
+        id = it->second;
+        _firstSeen[id] = std::min(_firstSeen[id], std::make_pair(source, c));
+      }
+      ids.push_back(id);
+    }
+    return ids;
+  }
+
+  const std::string &name(int id) const {return _names[id];}
+
+  // Rank of each sensor id in output order
+  std::vector<int> order() const {
+    std::vector<int> ids(_names.size());
+    for (size_t k = 0; k < ids.size(); k++) ids[k] = (int)k;
+    std::sort(ids.begin(), ids.end(),
+              [&](int a, int b) {return _firstSeen[a] < _firstSeen[b];});
+    std::vector<int> rank(ids.size());
+    for (size_t k = 0; k < ids.size(); k++) rank[ids[k]] = (int)k;
+    return rank;
+  }
+
+private:
+  std::mutex _lock;
+  std::map<std::string,int> _index;
+  std::vector<std::string> _names;
+  std::vector<std::pair<size_t,size_t>> _firstSeen;
+};
+
+
+// Index =======================================================================
+
+/* Per-hour aggregates of one data log, along with what is needed to
+   tell whether the log has changed since they were computed. */
+struct FileEntry {
+  struct Hour {
+    uint32_t col;    // column in the log
+    int64_t hour;    // hours since 1970-01-01
+    podd::Summary summary;
+  };
+
+  uint64_t size = 0;
+  int64_t mtime = 0;
+  uint64_t hash = 0;
+  std::vector<std::string> columns;
+  std::vector<Hour> hours;   // ordered by column and hour
+
+  void serialize(std::string &out) const {
+    podd::putVarint(out, size);
+    podd::putSignedVarint(out, mtime);
+    podd::putVarint(out, hash);
+    podd::putVarint(out, columns.size());
+    for (const std::string &c : columns) {
+      podd::putVarint(out, c.size());
+      out += c;
+    }
+    podd::putVarint(out, hours.size());
+    for (const Hour &h : hours) {
+      podd::putVarint(out, h.col);
+      podd::putSignedVarint(out, h.hour);
+      h.summary.serialize(out);
+    }
+  }
+
+  bool deserialize(const char *&p, const char *end) {
+    uint64_t n, len, col;
+    if (!podd::getVarint(p, end, size) || !podd::getSignedVarint(p, end, mtime)
+        || !podd::getVarint(p, end, hash) || !podd::getVarint(p, end, n)
+        || (n > (uint64_t)(end - p))) return false;
+    columns.resize((size_t)n);
+    for (std::string &c : columns) {
+      if (!podd::getVarint(p, end, len) || (len > (uint64_t)(end - p))) return false;
+      c.assign(p, (size_t)len);
+      p += len;
+    }
+    if (!podd::getVarint(p, end, n) || (n > (uint64_t)(end - p))) return false;
+    hours.resize((size_t)n);
+    for (Hour &h : hours) {
+      if (!podd::getVarint(p, end, col) || (col >= columns.size())
+          || !podd::getSignedVarint(p, end, h.hour)
+          || !h.summary.deserialize(p, end)) return false;
+      h.col = (uint32_t)col;
+    }
+    return true;
+  }
+};
+
+typedef std::shared_ptr<const FileEntry> EntryPtr;
+
+
+//------------------------------------------------------------------------------
+/* 64-bit FNV-1a hash of the given data. */
+uint64_t hashData(const char *p, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t k = 0; k < n; k++) {
+    h ^= (uint8_t)p[k];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+
+/* Sidecar index of per-file aggregates, keyed by (absolute) path.  The
+   index is only read while files are being processed; new entries are
+   added afterwards. */
+class LogIndex {
+public:
+  // Loads the index from the given file.  A missing file is an empty
+  // index; an index built with different settings (or a corrupt one) is
+  // discarded with a warning.  Returns false only on read errors.
+  bool load(const std::string &path, podd::TimeSource tsrc) {
+    _entries.clear();
+    podd::MappedFile file;
+    if (!fs::exists(path)) return true;
+    if (!file.open(path)) return false;
+    const char *p = file.data();
+    const char *end = file.end();
+    uint64_t version, source, n, len;
+    double accuracy;
+    if ((file.size() < MAGIC_LEN) || (memcmp(p, MAGIC, MAGIC_LEN) != 0)) {
+      fprintf(stderr, "Ignoring %s: not an index file.\n", path.c_str());
+      return true;
+    }
+    p += MAGIC_LEN;
+    if (!podd::getVarint(p, end, version) || (version != VERSION)
+        || !podd::getVarint(p, end, source) || (source != (uint64_t)tsrc)
+        || !podd::getDouble(p, end, accuracy) || (accuracy != podd::SKETCH_ACCURACY)
+        || !podd::getVarint(p, end, n)) {
+      fprintf(stderr, "Ignoring %s: built with different settings.\n", path.c_str());
+      return true;
+    }
+    for (uint64_t k = 0; k < n; k++) {
+      std::shared_ptr<FileEntry> e = std::make_shared<FileEntry>();
+      if (!podd::getVarint(p, end, len) || (len > (uint64_t)(end - p))) break;
+      std::string key(p, (size_t)len);
+      p += len;
+      if (!e->deserialize(p, end)) break;
+      _entries[key] = e;
+    }
+    if (_entries.size() != n) {
+      fprintf(stderr, "Ignoring %s: file is corrupt.\n", path.c_str());
+      _entries.clear();
+    }
+    return true;
+  }
+
+  // Saves the index to the given file, dropping entries for logs that
+  // no longer exist.  The index is written to a temporary file first, so
+  // an interrupted save leaves the previous index intact.
+  bool save(const std::string &path, podd::TimeSource tsrc) const {
+    std::string out(MAGIC, MAGIC_LEN);
+    podd::putVarint(out, VERSION);
+    podd::putVarint(out, (uint64_t)tsrc);
+    podd::putDouble(out, podd::SKETCH_ACCURACY);
+    std::vector<const std::pair<const std::string,EntryPtr> *> keep;
+    for (const auto &e : _entries) {
+      std::error_code ec;
+      if (fs::exists(e.first, ec)) keep.push_back(&e);
+    }
+    podd::putVarint(out, keep.size());
+    for (const auto *e : keep) {
+      podd::putVarint(out, e->first.size());
+      out += e->first;
+      e->second->serialize(out);
+    }
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr) return false;
+    bool ok = (fwrite(out.data(), 1, out.size(), f) == out.size());
+    ok = (fclose(f) == 0) && ok;
+    if (ok) ok = (rename(tmp.c_str(), path.c_str()) == 0);
+    if (!ok) remove(tmp.c_str());
+    return ok;
+  }
+
+  EntryPtr find(const std::string &path) const {
+    auto it = _entries.find(path);
+    return (it == _entries.end()) ? nullptr : it->second;
+  }
+
+  void update(const std::string &path, EntryPtr entry) {_entries[path] = entry;}
+  size_t size() const {return _entries.size();}
+
+private:
+  static constexpr const char *MAGIC = "PODDIDX1";
+  static const size_t MAGIC_LEN = 8;
+  static const uint64_t VERSION = 1;
+  std::unordered_map<std::string,EntryPtr> _entries;
+};
+
+
+
+// Processing ==================================================================
+
+//------------------------------------------------------------------------------
+/* Parses a mapped data log into per-hour aggregates. */
+std::shared_ptr<FileEntry> parseFile(const podd::MappedFile &file,
+                                     podd::TimeSource tsrc) {
+  std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+  const char *body;
+  entry->columns = podd::parseHeader(file.data(), file.end(), body);
+  // Consecutive readings almost always fall in the same hour, so the
+  // summary for each column is looked up only when the hour changes
+  const size_t ncols = entry->columns.size();
+  std::unordered_map<uint64_t,podd::Summary> hours;
+  std::vector<int64_t> lastHour(ncols, INT64_MIN);
+  std::vector<podd::Summary *> last(ncols, nullptr);
+  podd::forEachValue(body, file.end(), tsrc,
+    [&](int64_t t, int col, double v) {
+      if ((size_t)col >= ncols) return;
+      int64_t hour = (t >= 0) ? t / 3600 : -((-t + 3599) / 3600);
+      if (hour != lastHour[col]) {
+        lastHour[col] = hour;
+        last[col] = &hours[((uint64_t)col << 40) | ((uint64_t)hour & 0xFFFFFFFFFFULL)];
+      }
+      last[col]->add(v);
+    });
+  entry->hours.reserve(hours.size());
+  for (auto &h : hours) {
+    // Sign-extend the 40-bit hour
+    int64_t hour = (int64_t)(h.first << 24) >> 24;
+    entry->hours.push_back({(uint32_t)(h.first >> 40), hour, std::move(h.second)});
+  }
+  std::sort(entry->hours.begin(), entry->hours.end(),
+            [](const FileEntry::Hour &a, const FileEntry::Hour &b) {
+              return (a.col != b.col) ? (a.col < b.col) : (a.hour < b.hour);
+            });
+  return entry;
+}
+
+
+//------------------------------------------------------------------------------
+/* Adds the per-hour aggregates of a data log to the daily statistics. */
+void addEntry(const FileEntry &entry, int pod, const std::vector<int> &ids,
+              SummaryMap &stats) {
+  uint64_t lastKey = UINT64_MAX;
+  podd::Summary *last = nullptr;
+  for (const FileEntry::Hour &h : entry.hours) {
+    int64_t day = (h.hour >= 0) ? h.hour / 24 : -((-h.hour + 23) / 24);
+    uint64_t key = makeKey(pod, ids[h.col], day);
+    if (key != lastKey) {
+      lastKey = key;
+      last = &stats[key];
+    }
+    last->merge(h.summary);
+  }
+}
+
+
+/* Totals for one run over all sources. */
+struct RunTotals {
+  uint64_t bytes = 0;    // total size of all logs
+  size_t parsed = 0;     // logs parsed
+  size_t cached = 0;     // logs taken from the index
+};
+
+
+//------------------------------------------------------------------------------
+/* Processes all sources with a pool of worker threads, each pulling the
+   next unprocessed file.  Workers accumulate separate statistics, which
+   are merged at the end.
+
+   If an index is given, logs whose size and modification time match
+   their index entry are not read at all; logs whose contents hash the
+   same as their entry (e.g. copied again from the SD card) are not
+   parsed.  Entries for other logs are computed and added to the index. */
+RunTotals processAll(const std::vector<Source> &sources, unsigned nthreads,
+                     podd::TimeSource tsrc, LogIndex *index,
+                     SensorTable &sensors, SummaryMap &stats) {
+  nthreads = std::max(1u, std::min<unsigned>(nthreads, (unsigned)sources.size()));
+  std::atomic<size_t> next(0);
+  std::vector<SummaryMap> partial(nthreads);
+  std::vector<RunTotals> totals(nthreads);
+  std::vector<EntryPtr> updated(sources.size());
+  auto worker = [&](unsigned id) {
+    for (size_t k; (k = next++) < sources.size(); ) {
+      const Source &src = sources[k];
+      RunTotals &tot = totals[id];
+      EntryPtr entry = (index != nullptr) ? index->find(src.path) : nullptr;
+      if ((entry == nullptr) || (entry->size != src.size) || (entry->mtime != src.mtime)) {
+        podd::MappedFile file;
+        if (!file.open(src.path)) {
+          fprintf(stderr, "Unable to open %s.\n", src.path.c_str());
+          continue;
+        }
+        uint64_t hash = (index != nullptr) ? hashData(file.data(), file.size()) : 0;
+        std::shared_ptr<FileEntry> fresh;
+        if ((entry != nullptr) && (entry->size == file.size()) && (entry->hash == hash)) {
+          fresh = std::make_shared<FileEntry>(*entry);
+          tot.cached++;
+        } else {
+          fresh = parseFile(file, tsrc);
+          tot.parsed++;
+        }
+        fresh->size = file.size();
+        fresh->mtime = src.mtime;
+        fresh->hash = hash;
+        updated[k] = fresh;
+        entry = fresh;
+      } else {
+        tot.cached++;
+      }
+      tot.bytes += src.size;
+      addEntry(*entry, src.pod, sensors.lookup(entry->columns, k), partial[id]);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned k = 1; k < nthreads; k++) pool.emplace_back(worker, k);
+  worker(0);
+  for (std::thread &t : pool) t.join();
+  RunTotals total;
+  stats.swap(partial[0]);
+  for (unsigned k = 0; k < nthreads; k++) {
+    total.bytes += totals[k].bytes;
+    total.parsed += totals[k].parsed;
+    total.cached += totals[k].cached;
+    if (k == 0) continue;
+    for (const auto &e : partial[k]) stats[e.first].merge(e.second);
+  }
+  if (index != nullptr) {
+    for (size_t k = 0; k < sources.size(); k++) {
+      if (updated[k] != nullptr) index->update(sources[k].path, updated[k]);
+    }
+  }
+  return total;
+}
+
+
+//------------------------------------------------------------------------------
+/* Column label for a quantile (0.05 -> "P05"). */
+std::string quantileLabel(double q) {
+  char buf[32];
+  double pct = 100*q;
+  if (pct == std::floor(pct)) snprintf(buf, sizeof(buf), "P%02d", (int)pct);
+  else snprintf(buf, sizeof(buf), "P%g", pct);
+  return buf;
+}
+
+
+//------------------------------------------------------------------------------
+/* Writes the summary table as CSV, one row per (pod, sensor, day),
+   ordered by pod name, sensor and date. */
+bool writeSummary(FILE *f, const SummaryMap &stats, const std::vector<std::string> &pods,
+                  const SensorTable &sensors, const std::vector<double> &quantiles) {
+  std::vector<int> rank = sensors.order();
+  std::vector<uint64_t> keys;
+  keys.reserve(stats.size());
+  for (const auto &e : stats) keys.push_back(e.first);
+  std::sort(keys.begin(), keys.end(), [&](uint64_t a, uint64_t b) {
+    if (keyPod(a) != keyPod(b)) return pods[keyPod(a)] < pods[keyPod(b)];
+    if (keySensor(a) != keySensor(b)) return rank[keySensor(a)] < rank[keySensor(b)];
+    return keyDay(a) < keyDay(b);
+  });
+  fprintf(f, "Pod, Sensor, Date, Count, Min, Mean, Max");
+  for (double q : quantiles) fprintf(f, ", %s", quantileLabel(q).c_str());
+  fprintf(f, "\r\n");
+  char date[20];
+  for (uint64_t key : keys) {
+    const podd::Summary &s = stats.at(key);
+    podd::formatDateTime(86400*keyDay(key), date);
+    date[10] = '\0';
+    fprintf(f, "%s, %s, %s, %llu, %.2f, %.2f, %.2f", pods[keyPod(key)].c_str(),
+            sensors.name(keySensor(key)).c_str(), date,
+            (unsigned long long)s.count(), s.min(), s.mean(), s.max());
+    for (double q : quantiles) fprintf(f, ", %.2f", s.quantile(q));
+    fprintf(f, "\r\n");
+  }
+  return !ferror(f);
+}
+
+
+
+// Main ========================================================================
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseArgs(argc, argv, opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  std::vector<std::string> pods;
+  std::vector<Source> sources;
+  if (!collectSources(opts, pods, sources)) return 1;
+  if (pods.size() > 0xFFFF) {
+    fprintf(stderr, "Too many pods (%zu).\n", pods.size());
+    return 1;
+  }
+
+  LogIndex index;
+  if (!opts.index.empty() && !index.load(opts.index, opts.source)) {
+    fprintf(stderr, "Unable to read %s.\n", opts.index.c_str());
+    return 1;
+  }
+  LogIndex *indexp = opts.index.empty() ? nullptr : &index;
+
+  if (opts.bench) {
+    // Throughput for increasing numbers of threads, best of several
+    // passes each (the first pass also warms the page cache).  Each
+    // pass starts from the index as loaded, and the index is not saved.
+    printf("files: %zu  pods: %zu\n", sources.size(), pods.size());
+    printf("threads       time      MB/s   speedup\n");
+    double base = 0;
+    for (unsigned n = 1; ; n = std::min(2*n, opts.threads)) {
+      double best = 1e30;
+      uint64_t bytes = 0;
+      for (int k = 0; k < opts.repeat; k++) {
+        SensorTable sensors;
+        SummaryMap stats;
+        LogIndex pass(index);
+        auto t0 = std::chrono::steady_clock::now();
+        bytes = processAll(sources, n, opts.source, indexp ? &pass : nullptr,
+                           sensors, stats).bytes;
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+      }
+      if (n == 1) base = best;
+      printf("%7u %8.3f s %9.1f %9.2f\n", n, best, bytes / best / 1e6, base / best);
+      if (n >= opts.threads) break;
+    }
+    return 0;
+  }
+
+  SensorTable sensors;
+  SummaryMap stats;
+  RunTotals totals = processAll(sources, opts.threads, opts.source, indexp,
+                                sensors, stats);
+  if (indexp != nullptr) {
+    fprintf(stderr, "%zu files parsed, %zu from index.\n", totals.parsed, totals.cached);
+    if (!index.save(opts.index, opts.source)) {
+      fprintf(stderr, "Unable to write %s.\n", opts.index.c_str());
+      return 1;
+    }
+  }
+
+  FILE *f = (opts.output == "-") ? stdout : fopen(opts.output.c_str(), "wb");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to open %s for writing.\n", opts.output.c_str());
+    return 1;
+  }
+  bool ok = writeSummary(f, stats, pods, sensors, opts.quantiles);
+  if (f != stdout) ok = (fclose(f) == 0) && ok;
+  if (!ok) {
+    fprintf(stderr, "Error writing %s.\n", opts.output.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+
+//==============================================================================
@@ -0,0 +1,515 @@
+/*==============================================================================
+  Equivalence test and benchmark for the date conversions of the Time and
+  Timezone libraries used by the firmware (breakTime(), makeTime() and the
+  Timezone UTC/local conversions), compiled for the host.  The libraries'
+  constant-time conversions are checked against copies of the original
+  year-by-year and month-by-month versions kept here, and both are timed
+  over a multi-year sweep of times.
+
+  Usage:
+    podd_timecheck [options]
+
+  Exits with status 1 if any conversion differs from the original.  See
+  README.md in this directory.
+
+  This file is part of the LMN PODD distribution:
+    https://github.com/lmnts/PODD
+
+  COPYRIGHT/LICENSE:
+  Copyright (c) 2019 LMN Architects
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+==============================================================================*/
+
+// Standard libraries
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+// Local headers
+#include "host/Arduino.h"
+// Libraries
+#include <TimeLib.h>
+#include <Timezone.h>
+
+
+// Options =====================================================================
+
+struct Options {
+  bool bench = true;             // run the benchmark after the checks
+  unsigned repeat = 3;           // benchmark passes (best is reported)
+  unsigned years = 10;           // length of the benchmark sweep
+  uint64_t seed = 1;
+};
+
+
+//------------------------------------------------------------------------------
+/* Prints usage information. */
+void usage(const char *prog) {
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "Options:\n"
+    "  --check       run the equivalence checks only\n"
+    "  --years N     length of the benchmark sweep from 2019 (default: 10)\n"
+    "  --repeat N    benchmark passes, best is reported (default: 3)\n"
+    "  --seed N      random seed (default: 1)\n",
+    prog);
+}
+
+
+//------------------------------------------------------------------------------
+/* Parses the command line into opts.  Returns false on invalid usage. */
+bool parseArgs(int argc, char **argv, Options &opts) {
+  for (int k = 1; k < argc; k++) {
+    std::string a = argv[k];
+    bool more = (k + 1 < argc);
+    if (a == "--check") {
+      opts.bench = false;
+    } else if ((a == "--years") && more) {
+      opts.years = (unsigned)atoi(argv[++k]);
+      if ((opts.years == 0) || (opts.years > 80)) return false;
+    } else if ((a == "--repeat") && more) {
+      opts.repeat = std::max(1, atoi(argv[++k]));
+    } else if ((a == "--seed") && more) {
+      opts.seed = (uint64_t)atoll(argv[++k]);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+
+// Original conversions ========================================================
+
+/* The Time and Timezone library conversions as they were before the
+   constant-time versions, for reference. */
+namespace orig {
+
+#define LEAP_YEAR(Y)     ( ((1970+Y)>0) && !((1970+Y)%4) && ( ((1970+Y)%100) || !((1970+Y)%400) ) )
+
+static  const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31};
+
+void breakTime(time_t timeInput, tmElements_t &tm){
+  uint8_t year;
+  uint8_t month, monthLength;
+  uint32_t time;
+  unsigned long days;
+
+  time = (uint32_t)timeInput;
+  tm.Second = time % 60;
+  time /= 60; // now it is minutes
+  tm.Minute = time % 60;
+  time /= 60; // now it is hours
+  tm.Hour = time % 24;
+  time /= 24; // now it is days
+  tm.Wday = ((time + 4) % 7) + 1;  // Sunday is day 1
+
+  year = 0;
+  days = 0;
+  while((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time) {
+    year++;
+  }
+  tm.Year = year; // year is offset from 1970
+
+  days -= LEAP_YEAR(year) ? 366 : 365;
+  time  -= days; // now it is days in this year, starting at 0
+
+  days=0;
+  month=0;
+  monthLength=0;
+  for (month=0; month<12; month++) {
+    if (month==1) { // february
+      if (LEAP_YEAR(year)) {
+        monthLength=29;
+      } else {
+        monthLength=28;
+      }
+    } else {
+      monthLength = monthDays[month];
+    }
+
+    if (time >= monthLength) {
+      time -= monthLength;
+    } else {
+        break;
+    }
+  }
+  tm.Month = month + 1;  // jan is month 1
+  tm.Day = time + 1;     // day of month
+}
+
+time_t makeTime(const tmElements_t &tm){
+  int i;
+  uint32_t seconds;
+
+  // seconds from 1970 till 1 jan 00:00:00 of the given year
+  seconds= tm.Year*(SECS_PER_DAY * 365);
+  for (i = 0; i < tm.Year; i++) {
+    if (LEAP_YEAR(i)) {
+      seconds +=  SECS_PER_DAY;   // add extra days for leap years
+    }
+  }
+
+  // add days for this year, months start from 1
+  for (i = 1; i < tm.Month; i++) {
+    if ( (i == 2) && LEAP_YEAR(tm.Year)) {
+      seconds += SECS_PER_DAY * 29;
+    } else {
+      seconds += SECS_PER_DAY * monthDays[i-1];  //monthDay array starts from 0
+    }
+  }
+  seconds+= (tm.Day-1) * SECS_PER_DAY;
+  seconds+= tm.Hour * SECS_PER_HOUR;
+  seconds+= tm.Minute * SECS_PER_MIN;
+  seconds+= tm.Second;
+  return (time_t)seconds;
+}
+
+#undef LEAP_YEAR
+
+// The library's year() and weekday() share one cached breakTime() result,
+// which the alternating arguments in Timezone always miss
+int year(time_t t) {tmElements_t tm; orig::breakTime(t, tm); return tmYearToCalendar(tm.Year);}
+int weekday(time_t t) {tmElements_t tm; orig::breakTime(t, tm); return tm.Wday;}
+
+class Timezone {
+public:
+  Timezone(TimeChangeRule dstStart, TimeChangeRule stdStart)
+    : m_dst(dstStart), m_std(stdStart) {}
+
+  time_t toLocal(time_t utc) {
+    if (year(utc) != year(m_dstUTC)) calcTimeChanges(year(utc));
+    if (utcIsDST(utc))
+      return utc + m_dst.offset * SECS_PER_MIN;
+    else
+      return utc + m_std.offset * SECS_PER_MIN;
+  }
+  time_t toUTC(time_t local) {
+    if (year(local) != year(m_dstLoc)) calcTimeChanges(year(local));
+    if (locIsDST(local))
+      return local - m_dst.offset * SECS_PER_MIN;
+    else
+      return local - m_std.offset * SECS_PER_MIN;
+  }
+  bool utcIsDST(time_t utc) {
+    if (year(utc) != year(m_dstUTC)) calcTimeChanges(year(utc));
+    if (m_stdUTC == m_dstUTC)
+      return false;
+    else if (m_stdUTC > m_dstUTC)
+      return (utc >= m_dstUTC && utc < m_stdUTC);
+    else
+      return !(utc >= m_stdUTC && utc < m_dstUTC);
+  }
+  bool locIsDST(time_t local) {
+    if (year(local) != year(m_dstLoc)) calcTimeChanges(year(local));
+    if (m_stdUTC == m_dstUTC)
+      return false;
+    else if (m_stdLoc > m_dstLoc)
+      return (local >= m_dstLoc && local < m_stdLoc);
+    else
+      return !(local >= m_stdLoc && local < m_dstLoc);
+  }
+
+private:
+  void calcTimeChanges(int yr) {
+    m_dstLoc = toTime_t(m_dst, yr);
+    m_stdLoc = toTime_t(m_std, yr);
+    m_dstUTC = m_dstLoc - m_std.offset * SECS_PER_MIN;
+    m_stdUTC = m_stdLoc - m_dst.offset * SECS_PER_MIN;
+  }
+  time_t toTime_t(TimeChangeRule r, int yr) {
+    uint8_t m = r.month;
+    uint8_t w = r.week;
+    if (w == 0) {
+      if (++m > 12) {
+        m = 1;
+        ++yr;
+      }
+      w = 1;
+    }
+    tmElements_t tm;
+    tm.Hour = r.hour;
+    tm.Minute = 0;
+    tm.Second = 0;
+    tm.Day = 1;
+    tm.Month = m;
+    tm.Year = yr - 1970;
+    time_t t = orig::makeTime(tm);
+    t += ( (r.dow - orig::weekday(t) + 7) % 7 + (w - 1) * 7 ) * SECS_PER_DAY;
+    if (r.week == 0) t -= 7 * SECS_PER_DAY;
+    return t;
+  }
+
+  TimeChangeRule m_dst;
+  TimeChangeRule m_std;
+  time_t m_dstUTC = 0;
+  time_t m_stdUTC = 0;
+  time_t m_dstLoc = 0;
+  time_t m_stdLoc = 0;
+};
+
+}  // namespace orig
+
+
+
+// Time zones ==================================================================
+
+struct Zone {
+  const char *name;
+  TimeChangeRule dst;
+  TimeChangeRule std;
+};
+
+// Northern and southern hemisphere zones, "Last" rules (including one in
+// December, which falls in the following month's calculation) and a zone
+// without daylight time
+const Zone zones[] = {
+  {"US Pacific", {"PDT", Second, Sun, Mar, 2, -420}, {"PST", First, Sun, Nov, 2, -480}},
+  {"Central European", {"CEST", Last, Sun, Mar, 2, 120}, {"CET", Last, Sun, Oct, 3, 60}},
+  {"Australia Eastern", {"AEDT", First, Sun, Oct, 2, 660}, {"AEST", First, Sun, Apr, 3, 600}},
+  {"December rule", {"DDT", Last, Sat, Dec, 23, -180}, {"DST", Second, Mon, Jun, 1, -240}},
+  {"Arizona", {"MST", First, Sun, Nov, 2, -420}, {"MST", First, Sun, Nov, 2, -420}},
+};
+
+
+
+// Checks ======================================================================
+
+// Range of time_t on the firmware (32-bit unsigned)
+const uint32_t LAST_DAY = 0xFFFFFFFFUL / SECS_PER_DAY;
+
+// Times checked for the time zones: 1971 through 2105.  The original
+// Timezone treats the change points of a new object as belonging to 1970,
+// so gives standard time throughout 1970 until another year is converted;
+// the rules for the last year in range fall partly outside of it.
+const time_t TZ_FIRST = 31536000;     // 1971-01-01
+const time_t TZ_LAST = 4291747200UL;  // 2106-01-01
+
+unsigned long failures = 0;
+
+//------------------------------------------------------------------------------
+/* Reports a mismatch (the first few only). */
+void fail(const char *what, unsigned long long t, long long got, long long want) {
+  if (++failures <= 20)
+    printf("  MISMATCH %s(%llu): %lld, original %lld\n", what, t, got, want);
+}
+
+//------------------------------------------------------------------------------
+/* Compares breakTime() with the original for the given time. */
+void checkBreak(uint32_t t) {
+  tmElements_t a, b;
+  breakTime(t, a);
+  orig::breakTime(t, b);
+  if (memcmp(&a, &b, sizeof(a)) != 0)
+    fail("breakTime", t, makeTime(a), orig::makeTime(b));
+}
+
+//------------------------------------------------------------------------------
+/* Compares makeTime() with the original for the given elements. */
+void checkMake(tmElements_t tm) {
+  time_t a = makeTime(tm);
+  time_t b = orig::makeTime(tm);
+  if (a != b) fail("makeTime", ((unsigned long long)tm.Year << 24) | (tm.Month << 16) | (tm.Day << 8) | tm.Hour, a, b);
+}
+
+//------------------------------------------------------------------------------
+/* Checks breakTime() for every day in the 32-bit time_t range, at a few
+   times of day, and every time of day on a few days.  The date and time
+   of day are found independently, so this covers every input. */
+unsigned long checkBreakTime(std::mt19937_64 &rng) {
+  unsigned long n = 0;
+  for (uint32_t d = 0; d <= LAST_DAY; d++) {
+    uint32_t t0 = d * SECS_PER_DAY;
+    const uint32_t tod[] = {0, 1, 43200, 86399, (uint32_t)(rng() % SECS_PER_DAY)};
+    for (uint32_t s : tod) {
+      if (t0 + (uint64_t)s > 0xFFFFFFFFULL) continue;
+      checkBreak(t0 + s);
+      n++;
+    }
+  }
+  const uint32_t days[] = {0, 11016, 18149, 47540, 47541, LAST_DAY - 1};
+  for (uint32_t d : days) {
+    for (uint32_t s = 0; s < SECS_PER_DAY; s++) {
+      checkBreak(d * SECS_PER_DAY + s);
+      n++;
+    }
+  }
+  for (uint32_t t = 0xFFFFFFFFUL - SECS_PER_DAY; t != 0; t++) {
+    checkBreak(t);
+    n++;
+  }
+  return n;
+}
+
+//------------------------------------------------------------------------------
+/* Checks makeTime() for every year, month and day of month (including
+   days past the end of the month), with round trips through breakTime(). */
+unsigned long checkMakeTime() {
+  unsigned long n = 0;
+  for (unsigned y = 0; y <= 255; y++) {
+    for (unsigned m = 0; m <= 12; m++) {
+      for (unsigned d = 0; d <= 31; d++) {
+        tmElements_t tm = {};
+        tm.Year = y;
+        tm.Month = m;
+        tm.Day = d;
+        tm.Hour = (y + d) % 24;
+        tm.Minute = (y * 7 + m) % 60;
+        tm.Second = (d * 13 + m) % 60;
+        checkMake(tm);
+        n++;
+        if ((y <= 135) && (m >= 1) && (d >= 1)) {
+          // valid dates round trip
+          tmElements_t back;
+          breakTime(makeTime(tm), back);
+          if ((back.Day == d) && ((back.Month != m) || (back.Year != y) || (back.Hour != tm.Hour)
+                                  || (back.Minute != tm.Minute) || (back.Second != tm.Second)))
+            fail("round trip", (y << 16) | (m << 8) | d, makeTime(back), makeTime(tm));
+        }
+      }
+    }
+  }
+  return n;
+}
+
+//------------------------------------------------------------------------------
+/* Checks the Timezone conversions for one zone: every hour of 1971-2105
+   in order, every second around each time change, and random times (which
+   change year on nearly every call). */
+unsigned long checkZone(const Zone &z, std::mt19937_64 &rng) {
+  Timezone tz(z.dst, z.std);
+  orig::Timezone ref(z.dst, z.std);
+  unsigned long n = 0;
+  auto check = [&](time_t t) {
+    time_t a = tz.toLocal(t), b = ref.toLocal(t);
+    if (a != b) fail("toLocal", t, a, b);
+    a = tz.toUTC(t); b = ref.toUTC(t);
+    if (a != b) fail("toUTC", t, a, b);
+    a = tz.utcIsDST(t); b = ref.utcIsDST(t);
+    if (a != b) fail("utcIsDST", t, a, b);
+    a = tz.locIsDST(t); b = ref.locIsDST(t);
+    if (a != b) fail("locIsDST", t, a, b);
+    n++;
+  };
+  for (time_t t = TZ_FIRST; t < TZ_LAST; t += SECS_PER_HOUR) {
+    check(t);
+    // around a change in either UTC or local time
+    bool dst = ref.utcIsDST(t);
+    if ((ref.utcIsDST(t + SECS_PER_HOUR) != dst) || (ref.locIsDST(t + SECS_PER_HOUR) != ref.locIsDST(t))) {
+      for (time_t u = t - SECS_PER_HOUR; u < t + 3 * SECS_PER_HOUR; u++) check(u);
+    }
+  }
+  for (int k = 0; k < 200000; k++) check(TZ_FIRST + (time_t)(rng() % (TZ_LAST - TZ_FIRST)));
+  return n;
+}
+
+
+
+// Benchmark ===================================================================
+
+volatile uint32_t sink;
+
+//------------------------------------------------------------------------------
+/* Runs f over the sweep the given number of times, returning the best time
+   per call [ns]. */
+template <class F>
+double timeSweep(const std::vector<uint32_t> &times, unsigned repeat, F f) {
+  double best = 1e30;
+  for (unsigned r = 0; r < repeat; r++) {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t acc = 0;
+    for (uint32_t t : times) acc += f(t);
+    sink = acc;
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+    best = std::min(best, 1e9 * dt.count() / times.size());
+  }
+  return best;
+}
+
+//------------------------------------------------------------------------------
+/* Times the library and original conversions over a sweep of the given
+   number of years from 2019, in steps of just over a minute (as for
+   successive readings). */
+void bench(const Options &opts) {
+  std::vector<uint32_t> times;
+  const uint32_t start = 1546300800UL;  // 2019-01-01
+  for (uint64_t t = start; t < start + opts.years * 365.2425 * SECS_PER_DAY; t += 61) times.push_back((uint32_t)t);
+  std::vector<tmElements_t> elems(times.size());
+  for (size_t k = 0; k < times.size(); k++) breakTime(times[k], elems[k]);
+
+  printf("\nBenchmark: %zu times over %u years from 2019, ns per call (best of %u)\n",
+         times.size(), opts.years, opts.repeat);
+  printf("%-18s %10s %10s %8s\n", "", "original", "library", "speedup");
+  auto row = [](const char *name, double a, double b) {
+    printf("%-18s %10.1f %10.1f %7.1fx\n", name, a, b, a / b);
+  };
+
+  double a = timeSweep(times, opts.repeat, [](uint32_t t) {
+    tmElements_t tm; orig::breakTime(t, tm); return (uint32_t)(tm.Day + tm.Year);});
+  double b = timeSweep(times, opts.repeat, [](uint32_t t) {
+    tmElements_t tm; breakTime(t, tm); return (uint32_t)(tm.Day + tm.Year);});
+  row("breakTime", a, b);
+
+  size_t k = 0;
+  a = timeSweep(times, opts.repeat, [&](uint32_t) {
+    return (uint32_t)orig::makeTime(elems[k++ % elems.size()]);});
+  k = 0;
+  b = timeSweep(times, opts.repeat, [&](uint32_t) {
+    return (uint32_t)makeTime(elems[k++ % elems.size()]);});
+  row("makeTime", a, b);
+
+  orig::Timezone ref(zones[0].dst, zones[0].std);
+  Timezone tz(zones[0].dst, zones[0].std);
+  a = timeSweep(times, opts.repeat, [&](uint32_t t) {return (uint32_t)ref.toLocal(t);});
+  b = timeSweep(times, opts.repeat, [&](uint32_t t) {return (uint32_t)tz.toLocal(t);});
+  row("toLocal", a, b);
+
+  // As formatted for each reading: local time broken into its elements
+  a = timeSweep(times, opts.repeat, [&](uint32_t t) {
+    tmElements_t tm; orig::breakTime(ref.toLocal(t), tm); return (uint32_t)(tm.Day + tm.Hour);});
+  b = timeSweep(times, opts.repeat, [&](uint32_t t) {
+    tmElements_t tm; breakTime(tz.toLocal(t), tm); return (uint32_t)(tm.Day + tm.Hour);});
+  row("toLocal+breakTime", a, b);
+}
+
+
+
+// Main ========================================================================
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseArgs(argc, argv, opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  std::mt19937_64 rng(opts.seed);
+
+  printf("breakTime: %lu times checked\n", checkBreakTime(rng));
+  printf("makeTime: %lu dates checked\n", checkMakeTime());
+  for (const Zone &z : zones) {
+    printf("%s: %lu times checked\n", z.name, checkZone(z, rng));
+  }
+  printf(failures == 0 ? "All conversions match the originals.\n"
+                       : "%lu conversions DIFFER from the originals.\n", failures);
+
+  if (opts.bench && (failures == 0)) bench(opts);
+  return (failures == 0) ? 0 : 1;
+}
+
+
+//==============================================================================